@@ -0,0 +1,168 @@
+#version 330 core
+out vec4 FragColor;
+
+// DenoisePass: edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) with the variance driven
+// luminance weight of SVGF (Schied et al. 2017), guided by the first hits written by main.frag.
+// The lighting is filtered apart from the texture: the radiance is divided by the albedo first and
+// multiplied back at the end. Every stage covers the lower left size corner of its inputs.
+uniform int stage;
+uniform vec2 size;
+
+// Accumulation (rgb = radiance sum, a = sample count) and its guides, see main.frag
+uniform sampler2D accum;
+uniform sampler2D normalDepth;
+uniform sampler2D albedo;
+uniform sampler2D lumaSums;
+// Output of the previous stage: rgb = radiance over albedo, a = variance of its luminance
+uniform sampler2D filtered;
+// Distance between the taps of this iteration, doubled every iteration
+uniform int stepSize;
+// Sample count from which the accumulation is shown as is
+uniform float maxSpp;
+
+const int DEMODULATE = 0;
+const int FILTER = 1;
+const int REMODULATE = 2;
+
+// Edge stopping, the larger the sharper for the normals, the smaller for the others
+const float SIGMA_NORMAL = 128.0;
+const float SIGMA_DEPTH = 1.0;
+const float SIGMA_LUMINANCE = 4.0;
+// Keeps dark materials from amplifying their noise
+const float MIN_ALBEDO = 0.01;
+// Under this many samples the variance is estimated over the neighbours instead
+const float MIN_TEMPORAL_SAMPLES = 4.0;
+const int SPATIAL_RADIUS = 2;
+
+// B3 spline, 5 taps per axis
+const float KERNEL[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Inverse of encodeNormal in main.frag
+vec3 decodeNormal(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+bool inside(ivec2 p) {
+    return all(greaterThanEqual(p, ivec2(0))) && all(lessThan(p, ivec2(size)));
+}
+
+vec3 pixelAlbedo(ivec2 p) {
+    return max(texelFetch(albedo, p, 0).rgb, vec3(MIN_ALBEDO));
+}
+
+vec3 mean(ivec2 p) {
+    vec4 a = texelFetch(accum, p, 0);
+    return a.a > 0.0 ? a.rgb / a.a : vec3(0.0);
+}
+
+vec3 demodulated(ivec2 p) {
+    return mean(p) / pixelAlbedo(p);
+}
+
+// Variance of the luminance of demodulated(p), the error left in the pixel
+float variance(ivec2 p, vec4 guide) {
+    float count = texelFetch(accum, p, 0).a;
+    vec4 sums = texelFetch(lumaSums, p, 0);
+    if (sums.z >= MIN_TEMPORAL_SAMPLES) {
+        // Spread of the samples of this accumulation, the reprojected ones count in the mean
+        float m = sums.x / sums.z;
+        float l = luminance(pixelAlbedo(p));
+        return max(sums.y / sums.z - m * m, 0.0) / (count * l * l);
+    }
+
+    // Spread of the neighbours on the same surface, each is already a mean
+    vec3 n = decodeNormal(guide.xy);
+    float sum = 0.0;
+    float sumSq = 0.0;
+    float weight = 0.0;
+    for (int y = -SPATIAL_RADIUS; y <= SPATIAL_RADIUS; y++) {
+        for (int x = -SPATIAL_RADIUS; x <= SPATIAL_RADIUS; x++) {
+            ivec2 q = p + ivec2(x, y);
+            if (!inside(q))
+                continue;
+            vec4 g = texelFetch(normalDepth, q, 0);
+            if (g.z == 0.0)
+                continue;
+            float w = pow(max(dot(n, decodeNormal(g.xy)), 0.0), SIGMA_NORMAL);
+            float l = luminance(demodulated(q));
+            sum += w * l;
+            sumSq += w * l * l;
+            weight += w;
+        }
+    }
+    float m = sum / weight;
+    return max(sumSq / weight - m * m, 0.0);
+}
+
+vec4 filterStep(ivec2 p, vec4 guide) {
+    vec4 center = texelFetch(filtered, p, 0);
+
+    // The luminance weight uses the variance blurred over 3x3, a single pixel is too noisy
+    float blurred = 0.0;
+    float blurWeight = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 q = p + ivec2(x, y);
+            if (!inside(q))
+                continue;
+            float w = (x == 0 ? 0.5 : 0.25) * (y == 0 ? 0.5 : 0.25);
+            blurred += w * texelFetch(filtered, q, 0).a;
+            blurWeight += w;
+        }
+    }
+    float sigmaL = SIGMA_LUMINANCE * sqrt(blurred / blurWeight) + 1e-6;
+
+    vec3 n = decodeNormal(guide.xy);
+    float l = luminance(center.rgb);
+    vec3 sum = vec3(0.0);
+    float sumVariance = 0.0;
+    float weight = 0.0;
+    for (int y = -2; y <= 2; y++) {
+        for (int x = -2; x <= 2; x++) {
+            ivec2 q = p + ivec2(x, y) * stepSize;
+            if (!inside(q))
+                continue;
+            vec4 g = texelFetch(normalDepth, q, 0);
+            if (g.z == 0.0)
+                continue;
+            vec4 c = texelFetch(filtered, q, 0);
+            // The depth may change by the gradient times the distance in pixels on the same surface
+            float reach = guide.w * length(vec2(x, y)) * float(stepSize) + 1e-3 * guide.z;
+            float wn = pow(max(dot(n, decodeNormal(g.xy)), 0.0), SIGMA_NORMAL);
+            float wz = exp(-abs(guide.z - g.z) / (SIGMA_DEPTH * reach));
+            float wl = exp(-abs(l - luminance(c.rgb)) / sigmaL);
+            float w = KERNEL[abs(x)] * KERNEL[abs(y)] * wn * wz * wl;
+            sum += w * c.rgb;
+            sumVariance += w * w * c.a;
+            weight += w;
+        }
+    }
+    // The center always has a weight of KERNEL[0]^2
+    return vec4(sum / weight, sumVariance / (weight * weight));
+}
+
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec4 guide = texelFetch(normalDepth, p, 0);
+    // Nothing hit: the accumulation is exact (black background), and neighbours never blend it in
+    bool hit = guide.z > 0.0;
+
+    if (stage == DEMODULATE) {
+        FragColor = hit ? vec4(demodulated(p), variance(p, guide)) : vec4(0.0);
+    } else if (stage == FILTER) {
+        FragColor = hit ? filterStep(p, guide) : vec4(0.0);
+    } else {
+        // Back to the raw accumulation while the sample count reaches maxSpp, no jump when it stops
+        vec3 raw = mean(p);
+        vec3 denoised = texelFetch(filtered, p, 0).rgb * pixelAlbedo(p);
+        float t = hit ? smoothstep(0.5 * maxSpp, maxSpp, texelFetch(accum, p, 0).a) : 1.0;
+        FragColor = vec4(mix(denoised, raw, t), 1.0);
+    }
+}
@@ -1,6 +1,11 @@
 #version 330 core
+#ifdef SCENE_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
 
-out vec4 FragColor;
+// Added to the accumulation by blending: rgb = radiance sum, a = sample count.
+// The display pass divides, see screenShader.frag.
+layout(location = 0) out vec4 FragColor;
 
 #include "const.glsl"
 
@@ -9,256 +14,264 @@ uniform vec2 resolution;
 uniform vec3 camDir;
 uniform vec3 camUp;
 uniform vec3 camPos;
-uniform int time;
-uniform int maxBounces;
+uniform uint time;
 uniform int lastMove;
-uniform int rayPerPixel;
-uniform sampler2D oldFrame;
-
-struct Material {
-    vec4 color;
-    vec4 emissionColor;
-    float emissionStrength;
-};
-
-Material getDefaultMaterial() {
-    Material m;
-    m.color = vec4(1,0,1,1);
-    m.emissionColor = vec4(1,0,1,1);
-    m.emissionStrength = 0.0;
-    return m;
-}
-
-struct Sphere {
-    vec3 center;
-    float radius;
-    Material material;
-};
 
-const int sphereCount = 4;
-Sphere spheres[sphereCount];
-
-Sphere getDefaultSphere() {
-    return Sphere(vec3(0),0,getDefaultMaterial());
-}
+// Specialization, see ShaderVariant: constant loop bounds when MAX_BOUNCES / RAY_PER_PIXEL
+// are defined, uniforms otherwise
+#ifdef MAX_BOUNCES
+#define BOUNCE_COUNT MAX_BOUNCES
+#else
+uniform int maxBounces;
+#define BOUNCE_COUNT maxBounces
+#endif
+#ifdef RAY_PER_PIXEL
+#define SAMPLE_COUNT RAY_PER_PIXEL
+#else
+uniform int rayPerPixel;
+#define SAMPLE_COUNT rayPerPixel
+#endif
+#ifndef USE_EMISSION
+#define USE_EMISSION 1
+#endif
+#ifndef USE_RUSSIAN_ROULETTE
+#define USE_RUSSIAN_ROULETTE 1
+#endif
+#ifndef USE_LIGHT_SAMPLING
+#define USE_LIGHT_SAMPLING 1
+#endif
+#ifndef USE_ADAPTIVE_SAMPLING
+#define USE_ADAPTIVE_SAMPLING 0
+#endif
+#if USE_ADAPTIVE_SAMPLING
+// Per pixel statistics: x = mean luminance, y = mean squared luminance, z = sample count,
+// w = relative standard error of the mean.
+layout(location = 1) out vec4 Moments;
+uniform sampler2D oldMoments;
+// Sum of oldMoments over the image (single texel), times momentsScale the image average
+uniform sampler2D momentsSum;
+uniform float momentsScale;
+uniform float adaptiveThreshold;
+#endif
+#ifndef USE_REPROJECTION
+#define USE_REPROJECTION 0
+#endif
+#if USE_REPROJECTION
+// First hit of the pixel center: world position, w = 1 on a hit, 0 when the ray leaves the scene
+layout(location = 2) out vec4 FirstHit;
+// Accumulation and first hits of the previous view, added to the first pass of a new accumulation
+uniform sampler2D historyAccum;
+uniform sampler2D historyFirstHit;
+uniform bool reproject;
+uniform vec3 historyCamPos;
+uniform vec3 historyCamDir;
+uniform vec3 historyCamUp;
+uniform float historyFocalLength;
+#endif
+#ifndef USE_DENOISE_AOVS
+#define USE_DENOISE_AOVS 0
+#endif
+#if USE_DENOISE_AOVS
+// Guides of DenoisePass, replaced every pass: xy = octahedral normal of the first hit, z = its distance
+// (0 when the ray leaves the scene), w = change of that distance per pixel across the surface
+layout(location = 3) out vec4 NormalDepth;
+// Color of the first hit material, the filter works on the radiance divided by it
+layout(location = 4) out vec4 Albedo;
+// Added by blending like FragColor: x = luminance sum, y = squared luminance sum, z = sample count
+layout(location = 5) out vec4 LumaSums;
+#endif
+
+#include "scene.glsl"
+#include "trace.glsl"
 
 const vec4 RED = vec4(1,0,0,1);
 const vec4 BLACK = vec4(0,0,0,1);
 
-struct Ray {
-    vec3 origin;
-    vec3 direction;
-};
-
-struct HitInfo {
-    bool didHit;
-    float dst;
-    vec3 hitPoint;
-    vec3 normal;
-    Sphere sphere;
-};
-
-HitInfo getDefaultHitInfo() {
-    return HitInfo(false,1e9,vec3(0),vec3(0),getDefaultSphere());
-}
-
-//////////////////////////////
-//          Random          //
-//////////////////////////////
-uint wang_hash(uint x) {
-    x = (x ^ 61u) ^ (x >> 16);
-    x *= 9u;
-    x = x ^ (x >> 4);
-    x *= 0x27d4eb2du;
-    x = x ^ (x >> 15);
-    return x;
-}
-
-
-uint generateSeed(int i) {
-    uint seed = uint(gl_FragCoord.x) * 1973u + uint(gl_FragCoord.y) * 9277u + uint(time + 1) * 26699u + uint(i) * 911247u + uint(lastMove) * 54782u;
-    seed = wang_hash(seed);
-    return seed;
-}
-float randf(inout uint state) {
-    // xorshift32 variant
-    state ^= state << 13;
-    state ^= state >> 17;
-    state ^= state << 5;
-    // normalize to [0,1)
-    return float(state) / 4294967295.0;
-}
-
-// --- Cosine-weighted hemisphere sampling ---
-vec3 cosineSampleHemisphere(float u1, float u2) {
-    float r = sqrt(u1);
-    float theta = 2.0 * 3.14159265359 * u2;
-    float x = r * cos(theta);
-    float y = r * sin(theta);
-    float z = sqrt(max(0.0, 1.0 - u1));
-    return vec3(x, y, z); // local-space (z = up)
-}
-
-vec3 makeTangentBasis(vec3 n) {
-    // return tangent vectorX; compute Y via cross in caller
-    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
-    vec3 tangentX = normalize(cross(up, n));
-    return tangentX;
-}
-
-vec3 sampleHemisphereCosine(vec3 normal, inout uint rngState) {
-    float u1 = randf(rngState);
-    float u2 = randf(rngState);
-    vec3 samplecos = cosineSampleHemisphere(u1, u2); // local coords
-    vec3 tangentX = makeTangentBasis(normal);
-    vec3 tangentY = cross(normal, tangentX);
-    // transform to world
-    return normalize(samplecos.x * tangentX + samplecos.y * tangentY + samplecos.z * normal);
-}
-
-HitInfo RaySphere(Ray ray)
-{
-    HitInfo closestHit = getDefaultHitInfo();
-    const float MIN_DIST = 0.001; // Avoid self-intersection
-    const float MAX_DIST = 1000.0; // Prevent infinite rays
-
-    for(int i = 0; i < sphereCount; ++i) {
-        Sphere s = spheres[i];
-        HitInfo hit = getDefaultHitInfo();
-
-        vec3 offsetRayOrigin = ray.origin - s.center;
-        float a = dot(ray.direction, ray.direction);
-        float b = 2.0 * dot(offsetRayOrigin, ray.direction);
-        float c = dot(offsetRayOrigin, offsetRayOrigin) - s.radius * s.radius;
-
-        float discriminant = b * b - 4.0 * a * c;
-
-        if (discriminant >= 0.0) {
-            float sqrtDisc = sqrt(discriminant);
-            float dst1 = (-b - sqrtDisc) / (2.0 * a);
-            float dst2 = (-b + sqrtDisc) / (2.0 * a);
-
-            // Choose the closest valid intersection
-            float dst = min(dst1, dst2);
-            if (dst < MIN_DIST) {
-                dst = max(dst1, dst2); // Try the other solution
-            }
-
-            if (dst >= MIN_DIST && dst <= MAX_DIST && dst < closestHit.dst) {
-                hit.didHit = true;
-                hit.dst = dst;
-                hit.hitPoint = ray.origin + ray.direction * dst;
-                hit.normal = normalize(hit.hitPoint - s.center);
-                hit.sphere = s;
-                closestHit = hit;
-            }
-        }
-    }
-    return closestHit;
-}
-
-vec3 getRayDir(vec3 camDir, vec3 camUp, vec2 texCoord) {
-    vec3 camSide = normalize(cross(camDir, camUp));
-    vec2 p = 2.0 * texCoord - 1.0;
-    p.x *= resolution.x / resolution.y;
-    return normalize(p.x * camSide + p.y * camUp + focalLength * camDir);
-}
-
-vec3 Trace(Ray ray,int i) {
+// sampleNumber counts the samples of the pixel since the accumulation started
+vec3 Trace(Ray ray, uint sampleNumber) {
     vec3 radiance = vec3(0.0);
     vec3 throughput = vec3(1.0);
+    float bsdfPdf = 0.0;
 
-    uint seed = generateSeed(i);
+    SamplerState rng = makeSampler(uvec2(gl_FragCoord.xy), sampleNumber);
 
-    for (int bounce = 0; bounce < maxBounces; ++bounce) {
+    for (int bounce = 0; bounce < BOUNCE_COUNT; ++bounce) {
         HitInfo hit = RaySphere(ray);// should return closest hit with sphere in HitInfo
         if (!hit.didHit) {
             // environment: return black or env color
             break;
         }
+        if (!scatter(hit, bounce, ray, radiance, throughput, bsdfPdf, rng))
+            break;
+    }
 
-        // offset to avoid self-intersection
-        ray.origin = hit.hitPoint + hit.normal * 1e-4;
-
-        // if emitter -> accumulate emission * throughput
-        float emit = hit.sphere.material.emissionStrength;
-        if (emit > 0.0) {
-            radiance += throughput * hit.sphere.material.emissionColor.rgb * emit;
-            // If you want direct-only from emitters, you could 'break' here,
-            // but for path tracing, we usually continue (or break depending)
-        }
-
-        // sample new direction cosine-weighted around normal
-        vec3 newDir = sampleHemisphereCosine(hit.normal, seed);
-
-        // update throughput: for lambertian BRDF = albedo/pi and pdf = cos(theta)/pi
-        // BRDF/pdf => albedo (cancels pi), so we can simply multiply by albedo
-        throughput *= hit.sphere.material.color.rgb;
+    return radiance;
+}
 
-        // move ray direction
-        ray.direction = newDir;
+#if USE_ADAPTIVE_SAMPLING
+// Same constants in CpuRenderer
+const float ADAPTIVE_MIN_SAMPLES = 16.0; // uniform sampling until then, the estimate is too noisy
+const float ADAPTIVE_MAX_SHARE = 4.0; // at most 4x the budget in one pass
+const float ADAPTIVE_DARK = 0.01; // keeps the relative error of black pixels finite
+// Variance of a pseudo-sample, fading as 1/n. Without it a pixel whose first samples all missed
+// the lights looks converged and stays black.
+const float ADAPTIVE_PRIOR = 1.0;
+
+// Samples for this pass. The budget is SAMPLE_COUNT per pixel on average: each pixel gets its
+// error relative to the image mean, converged pixels get none.
+int adaptiveSampleCount(vec4 moments, float meanError) {
+    if (moments.z < max(ADAPTIVE_MIN_SAMPLES, 2.0 * float(SAMPLE_COUNT)))
+        return SAMPLE_COUNT;
+    if (moments.w < adaptiveThreshold)
+        return 0;
+    float share = moments.w / max(meanError, 1e-6);
+    return int(clamp(floor(float(SAMPLE_COUNT) * share + 0.5), 1.0, ADAPTIVE_MAX_SHARE * float(SAMPLE_COUNT)));
+}
 
-        // Russian roulette after few bounces
-        if (bounce > maxBounces/4) {
-            float p = max(max(throughput.r, throughput.g), throughput.b);
-            float r = randf(seed);
-            if (r > p) break;
-            throughput /= max(p, 1e-6);
-        }
-    }
+// Camera rays are not jittered: when the primary ray misses, every sample is black for sure
+vec4 updateMoments(vec4 moments, float sumL, float sumL2, float count, bool primaryHit) {
+    float total = moments.z + count;
+    float mean = (moments.x * moments.z + sumL) / total;
+    float meanSq = (moments.y * moments.z + sumL2) / total;
+    float variance = max(meanSq - mean * mean, 0.0) + ADAPTIVE_PRIOR / total;
+    float error = primaryHit ? sqrt(variance / total) / (mean + ADAPTIVE_DARK) : 0.0;
+    return vec4(mean, meanSq, total, error);
+}
+#endif
+
+#if USE_REPROJECTION
+// Same constants in CpuRenderer
+// Largest distance between the first hits of a pixel and of its history, in pixel footprints on
+// the surface. The nearest texel is up to one away, more would let occluders leak.
+const float REPROJECT_TOLERANCE = 2.0;
+const float REPROJECT_MIN_COSINE = 0.1; // bounds the footprint at grazing angles
+// Samples kept from the history, new samples always weigh something
+const float REPROJECT_MAX_SAMPLES = 1024.0;
+
+// Radiance sum and sample count taken over from the history for a pixel whose first hit is primary.
+// Every material is diffuse, the radiance leaving a point doesn't depend on the view: the history
+// is valid wherever the same surface point is visible (no disocclusion). The confidence scales the
+// sample count down with the position error and when a history pixel covers more than one pixel.
+vec4 reprojectHistory(HitInfo primary) {
+    if (!primary.didHit)
+        return vec4(0.0);
+
+    // Pixel of the point in the history view, inverse of getRayDir
+    vec3 v = primary.hitPoint - historyCamPos;
+    float z = dot(v, historyCamDir);
+    if (z <= 0.0)
+        return vec4(0.0);
+    vec3 historySide = normalize(cross(historyCamDir, historyCamUp));
+    vec2 p = historyFocalLength * vec2(dot(v, historySide), dot(v, historyCamUp)) / z;
+    p.x /= resolution.x / resolution.y;
+    vec2 pixel = (p * 0.5 + 0.5) * resolution;
+    if (any(lessThan(pixel, vec2(0.0))) || any(greaterThanEqual(pixel, resolution)))
+        return vec4(0.0);
+
+    ivec2 texel = ivec2(pixel);
+    vec4 hit = texelFetch(historyFirstHit, texel, 0);
+    vec4 accum = texelFetch(historyAccum, texel, 0);
+    if (hit.w == 0.0 || accum.a == 0.0)
+        return vec4(0.0);
+
+    // Disocclusion: the history pixel sees another surface
+    float dist = length(primary.hitPoint - camPos);
+    float cosine = max(abs(dot(primary.normal, primary.hitPoint - camPos)) / dist, REPROJECT_MIN_COSINE);
+    float footprint = 2.0 * dist / (resolution.y * focalLength * cosine);
+    float error = length(hit.xyz - primary.hitPoint) / (REPROJECT_TOLERANCE * footprint);
+    if (error >= 1.0)
+        return vec4(0.0);
+
+    float magnification = min(1.0, dist / length(v));
+    float confidence = (1.0 - error * error) * magnification * magnification;
+    float kept = min(accum.a, REPROJECT_MAX_SAMPLES) * confidence;
+    return vec4(accum.rgb * (kept / accum.a), kept);
+}
+#endif
 
-    return radiance;
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
 }
 
-vec4 combine_with_old_frame(vec4 newPixel, vec2 texCoord) {
-    vec4 oldPixel = texture(oldFrame, texCoord);
+#if USE_DENOISE_AOVS
+// Unit vector to the octahedron unfolded in [-1, 1]^2, decoded by denoise.frag
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e;
+}
 
-    float weight = 1.0 / float(lastMove + 1);
-    return mix(oldPixel, newPixel, weight);
+void writeGuides(HitInfo primary) {
+    LumaSums = vec4(0.0);
+    if (!primary.didHit) {
+        NormalDepth = vec4(0.0);
+        Albedo = vec4(0.0);
+        return;
+    }
+    // A pixel spans 2 d / (resolution.y f) on a surface facing the camera, the distance changes
+    // by that times the tangent of the incidence angle
+    vec3 view = normalize(primary.hitPoint - camPos);
+    float cosine = max(abs(dot(primary.normal, view)), 0.05);
+    float footprint = 2.0 * primary.dst / (resolution.y * focalLength);
+    NormalDepth = vec4(encodeNormal(primary.normal), primary.dst, footprint * sqrt(1.0 - cosine * cosine) / cosine);
+    Albedo = vec4(getMaterial(primary.material).color.rgb, 1.0);
 }
+#endif
 
 void main()
 {
     vec2 texCoord = gl_FragCoord.xy / resolution;
     Ray r = Ray(camPos, getRayDir(camDir, camUp, texCoord));
-
-    Material m0;
-    m0.color = vec4(1,0,0,1);
-    m0.emissionColor = vec4(1,0,0,1);
-    m0.emissionStrength = 0.0;
-    Material m1;
-    m1.color = vec4(0,0,0,1);
-    m1.emissionColor = vec4(1,1,1,1);
-    m1.emissionStrength = 1.0;
-    Material m2;
-    m2.color = vec4(0,0,1,1);
-    m2.emissionColor = vec4(0,0,1,1);
-    m2.emissionStrength = 0.0;
-
-    Material floorM;
-    floorM.color = vec4(1,1,1,1);
-    floorM.emissionColor = vec4(1,1,1,1);
-    floorM.emissionStrength = 0.1;
-
-    spheres[0] = Sphere(vec3(-3.5,-1.5,10), 1.0, m0);
-    spheres[1] = Sphere(vec3(0,0,10), 2.0, m1);
-    spheres[2] = Sphere(vec3(3.5,-1.5,10), 1.0, m2);
-    spheres[3] = Sphere(vec3(0,-102,10), 100.0, floorM);
-
-    vec3 allColor[100];
-    float xAvg = 0;
-    float yAvg = 0;
-    float zAvg = 0;
-    for (int i=0;i<rayPerPixel;i++) {
-        vec3 t = Trace(r,i);
-        xAvg += t.x;
-        yAvg += t.y;
-        zAvg += t.z;
+#if USE_ADAPTIVE_SAMPLING || USE_REPROJECTION || USE_DENOISE_AOVS
+    HitInfo primary = RaySphere(r);
+#endif
+#if USE_DENOISE_AOVS
+    writeGuides(primary);
+#endif
+#if USE_REPROJECTION
+    FirstHit = primary.didHit ? vec4(primary.hitPoint, 1.0) : vec4(0.0);
+    vec4 history = reproject ? reprojectHistory(primary) : vec4(0.0);
+#else
+    vec4 history = vec4(0.0);
+#endif
+
+#if USE_ADAPTIVE_SAMPLING
+    vec4 moments = lastMove <= 1 ? vec4(0.0) : texelFetch(oldMoments, ivec2(gl_FragCoord.xy), 0);
+    float meanError = texelFetch(momentsSum, ivec2(0), 0).w * momentsScale;
+    int sampleCount = adaptiveSampleCount(moments, meanError);
+    if (sampleCount == 0) {
+        // Converged: nothing added, the moments are carried over to the other buffer
+        // (never the first pass, no history to add)
+        FragColor = vec4(0.0);
+        Moments = moments;
+        return;
+    }
+    uint firstSample = uint(moments.z);
+#else
+    int sampleCount = SAMPLE_COUNT;
+    uint firstSample = uint(max(lastMove, 1) - 1) * uint(SAMPLE_COUNT);
+#endif
+
+    vec3 sum = vec3(0.0);
+    float sumL = 0.0;
+    float sumL2 = 0.0;
+    for (int i=0;i<sampleCount;i++) {
+        vec3 t = Trace(r, firstSample + uint(i));
+        sum += t;
+#if USE_ADAPTIVE_SAMPLING || USE_DENOISE_AOVS
+        float l = luminance(t);
+        sumL += l;
+        sumL2 += l * l;
+#endif
     }
-    vec4 newColor = vec4(xAvg/rayPerPixel,yAvg/rayPerPixel,zAvg/rayPerPixel, 1.0);
 
-    if (lastMove<=1)
-        FragColor = newColor;
-    else
-        FragColor = combine_with_old_frame(newColor,texCoord);
+    FragColor = vec4(sum, float(sampleCount)) + history;
+#if USE_ADAPTIVE_SAMPLING
+    Moments = updateMoments(moments, sumL, sumL2, float(sampleCount), primary.didHit);
+#endif
+#if USE_DENOISE_AOVS
+    LumaSums = vec4(sumL, sumL2, float(sampleCount), 0.0);
+#endif
 }
\ No newline at end of file
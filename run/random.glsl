@@ -1,25 +1,148 @@
-float random(int seed) {
-    seed = seed * 747796405 + 2891336453;
-    int result = ((seed >> ((seed >> 28) + 4)) ^ seed) * 277803737;
-    result = (result >> 22) ^ result;
-    return result / 4294967295.0;
+// Sample sequences of the paths, included by trace.glsl. Mirrored by CpuRenderer.
+// SAMPLER selects one (same values as RenderParams::Sampler):
+//   SAMPLER_RANDOM      xorshift32 stream seeded per sample, pure random
+//   SAMPLER_SOBOL       Sobol (0, 2) sequence, Owen scrambled and index shuffled per pixel and per
+//                       dimension (Burley 2020, "Practical Hash-based Owen Scrambling")
+//   SAMPLER_BLUE_NOISE  the same scrambled Sobol points for every pixel, rotated per pixel by a
+//                       blue noise mask: stratified in time, the error is blue noise on the screen
+// A sample is indexed by its number in the pixel accumulation, so the samples of the following
+// passes fill the gaps of the previous ones. Its dimensions are drawn in order.
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+#ifndef SAMPLER
+#define SAMPLER SAMPLER_SOBOL
+#endif
+
+#if SAMPLER == SAMPLER_BLUE_NOISE
+// BLUE_NOISE_SIZE x BLUE_NOISE_SIZE tile, one value of [0, 1) per texel (see blueNoise.hpp)
+uniform sampler2D blueNoise;
+const uint BLUE_NOISE_MASK = 63u;
+#endif
+
+struct SamplerState {
+    uint index; // sample number in the pixel accumulation
+    // xorshift state (random), scramble seed of the pixel (Sobol) or packed pixel x | y << 16 (blue noise)
+    uint seed;
+    uint dimension; // next dimension drawn
+};
+
+uint wang_hash(uint x) {
+    x = (x ^ 61u) ^ (x >> 16);
+    x *= 9u;
+    x = x ^ (x >> 4);
+    x *= 0x27d4eb2du;
+    x = x ^ (x >> 15);
+    return x;
+}
+
+uint hashCombine(uint seed, uint v) {
+    return wang_hash(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+float randf(inout uint state) {
+    // xorshift32 variant
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    // normalize to [0,1)
+    return float(state) / 4294967295.0;
+}
+
+// bitfieldReverse is GLSL 4.00
+uint reverseBits(uint x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Random permutation where each bit only depends on the lower ones (Laine and Karras 2011,
+// constants of Vegdahl 2021). On reversed bits: a nested uniform (Owen) scramble, which keeps
+// the stratification of the Sobol points.
+uint laineKarrasPermutation(uint x, uint seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed) {
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Second dimension of the Sobol sequence, the first one is reverseBits(index)
+uint sobol1(uint index) {
+    uint result = 0u;
+    for (uint v = 0x80000000u; index != 0u; index >>= 1, v ^= v >> 1) {
+        if ((index & 1u) != 0u)
+            result ^= v;
+    }
+    return result;
+}
+
+// 24 bits, exact in a float and below 1
+float toUnitFloat(uint x) {
+    return float(x >> 8) / 16777216.0;
+}
+
+// Every dimension (or pair) gets its own shuffle of the indices and its own scramble:
+// padded this way the first two Sobol dimensions are enough
+float sobol1D(uint index, uint seed) {
+    index = nestedUniformScramble(index, seed);
+    return toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(seed, 0u)));
+}
+
+vec2 sobol2D(uint index, uint seed) {
+    index = nestedUniformScramble(index, seed);
+    return vec2(toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(seed, 0u))),
+                toUnitFloat(nestedUniformScramble(sobol1(index), hashCombine(seed, 1u))));
 }
 
-float randomValueNormalDistribution(int seed) {
-    float theta = 2 * 3.1415926535897 * random(seed);
-    float rho = sqrt(-2 * log(random(seed)));
-    return rho * cos(theta);
+#if SAMPLER == SAMPLER_BLUE_NOISE
+// Cranley-Patterson rotation by the mask, moved by a different offset in every dimension
+float blueNoiseRotate(float u, uint pixel, uint dimension) {
+    uint offset = wang_hash(dimension + 1u);
+    uvec2 texel = (uvec2(pixel & 0xffffu, pixel >> 16) + uvec2(offset, offset >> 16)) & BLUE_NOISE_MASK;
+    return fract(u + texelFetch(blueNoise, ivec2(texel), 0).r);
 }
+#endif
 
-vec3 randomDirection(int seed) {
-    float x = randomValueNormalDistribution(seed);
-    float y = randomValueNormalDistribution(seed);
-    float z = randomValueNormalDistribution(seed);
-    return normalize(vec3(x,y,z));
+SamplerState makeSampler(uvec2 pixel, uint sampleNumber) {
+#if SAMPLER == SAMPLER_RANDOM
+    uint seed = wang_hash(pixel.x * 1973u + pixel.y * 9277u + (time + 1u) * 26699u + sampleNumber * 911247u);
+#elif SAMPLER == SAMPLER_SOBOL
+    uint seed = hashCombine(wang_hash(pixel.x), pixel.y);
+#else
+    uint seed = (pixel.x & 0xffffu) | (pixel.y << 16);
+#endif
+    return SamplerState(sampleNumber, seed, 0u);
 }
 
-// Random direction in the hemisphere oriented around the given normal vector
-vec3 randomHemisphereDirection(vec3 normal,int seed) {
-    vec3 dir = randomDirection(seed);
-    return dir * sign(dot(normal,dir));
-}
\ No newline at end of file
+float sample1D(inout SamplerState s) {
+    uint dimension = s.dimension++;
+#if SAMPLER == SAMPLER_RANDOM
+    return randf(s.seed);
+#elif SAMPLER == SAMPLER_SOBOL
+    return sobol1D(s.index, hashCombine(s.seed, dimension));
+#else
+    return blueNoiseRotate(sobol1D(s.index, wang_hash(dimension)), s.seed, 2u * dimension);
+#endif
+}
+
+vec2 sample2D(inout SamplerState s) {
+    uint dimension = s.dimension++;
+#if SAMPLER == SAMPLER_RANDOM
+    float u1 = randf(s.seed);
+    float u2 = randf(s.seed);
+    return vec2(u1, u2);
+#elif SAMPLER == SAMPLER_SOBOL
+    return sobol2D(s.index, hashCombine(s.seed, dimension));
+#else
+    vec2 u = sobol2D(s.index, wang_hash(dimension));
+    return vec2(blueNoiseRotate(u.x, s.seed, 2u * dimension), blueNoiseRotate(u.y, s.seed, 2u * dimension + 1u));
+#endif
+}
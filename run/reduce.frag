@@ -0,0 +1,21 @@
+#version 330 core
+out vec4 FragColor;
+
+// Reduction of the adaptive sampling moments (see traceRows): every texel is the sum of a
+// BLOCK x BLOCK block of source, texels past sourceSize count as zeros. Repeated down to a
+// single texel, the sum over the image.
+uniform sampler2D source;
+uniform vec2 sourceSize;
+
+// Same constant in gladManager (MOMENT_REDUCTION_BLOCK)
+const int BLOCK = 8;
+
+void main() {
+    ivec2 first = ivec2(gl_FragCoord.xy) * BLOCK;
+    ivec2 last = min(first + BLOCK, ivec2(sourceSize));
+    vec4 sum = vec4(0.0);
+    for (int y = first.y; y < last.y; y++)
+        for (int x = first.x; x < last.x; x++)
+            sum += texelFetch(source, ivec2(x, y), 0);
+    FragColor = sum;
+}
@@ -0,0 +1,384 @@
+// Scene and its traversal, shared by main.frag and wavefront.comp.
+// SCENE_SSBO selects the storage buffers (GL 4.3), uniform blocks of MAX_SPHERES / MAX_MATERIALS /
+// MAX_EMITTERS otherwise.
+
+struct Material {
+    vec4 color;
+    vec4 emissionColor;
+    float emissionStrength;
+};
+
+//////////////////////////////
+//          Scene           //
+//////////////////////////////
+// Uploaded by SceneBuffer, same layout in std140 and std430
+struct GpuSphere {
+    vec4 centerRadius;
+    ivec4 data; // x = material index
+};
+
+struct GpuMaterial {
+    vec4 color;
+    vec4 emission; // rgb = emission color, a = emission strength
+};
+
+// Emissive spheres (Scene::emitters), the lights of next event estimation
+struct GpuEmitter {
+    ivec4 data; // x = sphere index
+};
+
+#ifdef SCENE_SSBO
+layout(std430) readonly buffer SphereBuffer {
+    GpuSphere sphereData[];
+};
+layout(std430) readonly buffer MaterialBuffer {
+    GpuMaterial materialData[];
+};
+layout(std430) readonly buffer EmitterBuffer {
+    GpuEmitter emitterData[];
+};
+#else
+layout(std140) uniform SphereBlock {
+    GpuSphere sphereData[MAX_SPHERES];
+};
+layout(std140) uniform MaterialBlock {
+    GpuMaterial materialData[MAX_MATERIALS];
+};
+layout(std140) uniform EmitterBlock {
+    GpuEmitter emitterData[MAX_EMITTERS];
+};
+#endif
+
+uniform int sphereCount;
+uniform int emitterCount;
+
+// Built by Bvh, uploaded by BvhBuffer. Node = 2 texels:
+// (boundsMin, leftFirst bits) and (boundsMax, primitive count bits), count == 0 for inner nodes
+uniform samplerBuffer bvhNodes;
+uniform isamplerBuffer bvhPrimitives;
+
+// Meshes, uploaded by BvhBuffer::uploadMeshes. Primitive sphereCount + i of the scene BVH is instance i.
+// Their BVHs follow each other in one node buffer (same layout, indices relative to the mesh), their
+// leaves reference the triangles of the mesh directly: 3 texels (v0, edge1, edge2).
+// Instance = 4 texels: the rows of its world to object transform, then the bits of
+// x = first node, y = material, z = first triangle of its mesh.
+uniform int instanceCount;
+uniform samplerBuffer meshNodes;
+uniform samplerBuffer meshTriangles;
+uniform samplerBuffer instances;
+
+// Bvh::MAX_DEPTH, a front to back traversal never holds more entries
+const int BVH_STACK_SIZE = 32;
+
+Material getMaterial(int index) {
+    GpuMaterial gm = materialData[index];
+    Material m;
+    m.color = gm.color;
+    m.emissionColor = vec4(gm.emission.rgb, 1.0);
+    m.emissionStrength = gm.emission.a;
+    return m;
+}
+
+
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+};
+
+struct HitInfo {
+    bool didHit;
+    float dst;
+    vec3 hitPoint;
+    vec3 normal;
+    int material;
+    int sphere;
+};
+
+HitInfo getDefaultHitInfo() {
+    return HitInfo(false,1e9,vec3(0),vec3(0),0,-1);
+}
+
+const float MIN_DIST = 0.001; // Avoid self-intersection
+const float MAX_DIST = 1000.0; // Prevent infinite rays
+const float NO_HIT = 1e30;
+
+// Distance to the first intersection of a sphere (xyz = center, w = radius) in [MIN_DIST, MAX_DIST], or NO_HIT
+float sphereDistance(Ray ray, vec4 s)
+{
+    vec3 offsetRayOrigin = ray.origin - s.xyz;
+    float a = dot(ray.direction, ray.direction);
+    float b = 2.0 * dot(offsetRayOrigin, ray.direction);
+    float c = dot(offsetRayOrigin, offsetRayOrigin) - s.w * s.w;
+
+    float discriminant = b * b - 4.0 * a * c;
+
+    if (discriminant >= 0.0) {
+        float sqrtDisc = sqrt(discriminant);
+        float dst1 = (-b - sqrtDisc) / (2.0 * a);
+        float dst2 = (-b + sqrtDisc) / (2.0 * a);
+
+        // Choose the closest valid intersection
+        float dst = min(dst1, dst2);
+        if (dst < MIN_DIST) {
+            dst = max(dst1, dst2); // Try the other solution
+        }
+
+        if (dst >= MIN_DIST && dst <= MAX_DIST)
+            return dst;
+    }
+    return NO_HIT;
+}
+
+void intersectSphere(Ray ray, int i, inout HitInfo closestHit)
+{
+    vec4 s = sphereData[i].centerRadius;
+    float dst = sphereDistance(ray, s);
+    if (dst < closestHit.dst) {
+        closestHit.didHit = true;
+        closestHit.dst = dst;
+        closestHit.hitPoint = ray.origin + ray.direction * dst;
+        closestHit.normal = normalize(closestHit.hitPoint - s.xyz);
+        closestHit.material = sphereData[i].data.x;
+        closestHit.sphere = i;
+    }
+}
+
+// Slab test, entry distance or NO_HIT
+float intersectAABB(vec3 origin, vec3 invDir, vec3 bmin, vec3 bmax, float tMax)
+{
+    vec3 t0 = (bmin - origin) * invDir;
+    vec3 t1 = (bmax - origin) * invDir;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    float tNear = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tFar = min(min(tmax.x, tmax.y), min(tmax.z, tMax));
+    return tNear <= tFar ? tNear : NO_HIT;
+}
+
+// Moller-Trumbore, distance in [MIN_DIST, tMax] or NO_HIT. Same arithmetic as intersectTriangle in mesh.hpp.
+float triangleDistance(Ray ray, int triangle, float tMax)
+{
+    vec3 v0 = texelFetch(meshTriangles, triangle * 3).xyz;
+    vec3 edge1 = texelFetch(meshTriangles, triangle * 3 + 1).xyz;
+    vec3 edge2 = texelFetch(meshTriangles, triangle * 3 + 2).xyz;
+    vec3 p = cross(ray.direction, edge2);
+    float det = dot(edge1, p);
+    if (det == 0.0)
+        return NO_HIT;
+    float invDet = 1.0 / det;
+    vec3 s = ray.origin - v0;
+    float u = dot(s, p) * invDet;
+    if (u < 0.0 || u > 1.0)
+        return NO_HIT;
+    vec3 q = cross(s, edge1);
+    float v = dot(ray.direction, q) * invDet;
+    if (v < 0.0 || u + v > 1.0)
+        return NO_HIT;
+    float t = dot(edge2, q) * invDet;
+    return t >= MIN_DIST && t <= tMax ? t : NO_HIT;
+}
+
+// The ray in the object space of an instance. Not normalized, the distances along it are the same.
+Ray objectRay(Ray ray, int instance)
+{
+    vec4 row0 = texelFetch(instances, instance * 4);
+    vec4 row1 = texelFetch(instances, instance * 4 + 1);
+    vec4 row2 = texelFetch(instances, instance * 4 + 2);
+    vec4 origin = vec4(ray.origin, 1.0);
+    return Ray(vec3(dot(row0, origin), dot(row1, origin), dot(row2, origin)),
+               vec3(dot(row0.xyz, ray.direction), dot(row1.xyz, ray.direction), dot(row2.xyz, ray.direction)));
+}
+
+// Closest triangle of a mesh instance through the BVH of the mesh, front to back like RaySphere.
+// Flat shaded: the geometric normal, turned towards the ray.
+void intersectMesh(Ray worldRay, int instance, inout HitInfo closestHit)
+{
+    Ray ray = objectRay(worldRay, instance);
+    vec3 invDir = 1.0 / ray.direction;
+    ivec4 data = floatBitsToInt(texelFetch(instances, instance * 4 + 3));
+    int hitTriangle = -1;
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = data.x;
+
+    while (true) {
+        vec4 lo = texelFetch(meshNodes, node * 2);
+        vec4 hi = texelFetch(meshNodes, node * 2 + 1);
+        float tMax = min(closestHit.dst, MAX_DIST);
+
+        if (intersectAABB(ray.origin, invDir, lo.xyz, hi.xyz, tMax) < NO_HIT) {
+            int leftFirst = floatBitsToInt(lo.w);
+            int count = floatBitsToInt(hi.w);
+            if (count > 0) {
+                for (int i = data.z + leftFirst; i < data.z + leftFirst + count; ++i) {
+                    float dst = triangleDistance(ray, i, tMax);
+                    if (dst < closestHit.dst) {
+                        closestHit.dst = dst;
+                        hitTriangle = i;
+                        tMax = dst;
+                    }
+                }
+            } else {
+                int nearChild = data.x + leftFirst;
+                int farChild = nearChild + 1;
+                float nearDist = intersectAABB(ray.origin, invDir, texelFetch(meshNodes, nearChild * 2).xyz, texelFetch(meshNodes, nearChild * 2 + 1).xyz, tMax);
+                float farDist = intersectAABB(ray.origin, invDir, texelFetch(meshNodes, farChild * 2).xyz, texelFetch(meshNodes, farChild * 2 + 1).xyz, tMax);
+                if (farDist < nearDist) {
+                    int t = nearChild; nearChild = farChild; farChild = t;
+                    float d = nearDist; nearDist = farDist; farDist = d;
+                }
+                if (nearDist < NO_HIT) {
+                    if (farDist < NO_HIT)
+                        stack[stackSize++] = farChild;
+                    node = nearChild;
+                    continue;
+                }
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        node = stack[--stackSize];
+    }
+
+    if (hitTriangle >= 0) {
+        // To world space by the transpose of the world to object transform
+        vec3 objectNormal = cross(texelFetch(meshTriangles, hitTriangle * 3 + 1).xyz, texelFetch(meshTriangles, hitTriangle * 3 + 2).xyz);
+        vec3 normal = normalize(texelFetch(instances, instance * 4).xyz * objectNormal.x
+                                + texelFetch(instances, instance * 4 + 1).xyz * objectNormal.y
+                                + texelFetch(instances, instance * 4 + 2).xyz * objectNormal.z);
+        closestHit.didHit = true;
+        closestHit.hitPoint = worldRay.origin + worldRay.direction * closestHit.dst;
+        closestHit.normal = dot(normal, worldRay.direction) < 0.0 ? normal : -normal;
+        closestHit.material = data.y;
+        closestHit.sphere = -1;
+    }
+}
+
+// Any triangle of a mesh instance closer than maxDist
+bool meshOccluded(Ray worldRay, int instance, float maxDist)
+{
+    Ray ray = objectRay(worldRay, instance);
+    vec3 invDir = 1.0 / ray.direction;
+    ivec4 data = floatBitsToInt(texelFetch(instances, instance * 4 + 3));
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = data.x;
+
+    while (true) {
+        vec4 lo = texelFetch(meshNodes, node * 2);
+        vec4 hi = texelFetch(meshNodes, node * 2 + 1);
+        if (intersectAABB(ray.origin, invDir, lo.xyz, hi.xyz, maxDist) < NO_HIT) {
+            int leftFirst = floatBitsToInt(lo.w);
+            int count = floatBitsToInt(hi.w);
+            if (count > 0) {
+                for (int i = data.z + leftFirst; i < data.z + leftFirst + count; ++i) {
+                    if (triangleDistance(ray, i, maxDist) < maxDist)
+                        return true;
+                }
+            } else {
+                stack[stackSize++] = data.x + leftFirst + 1;
+                node = data.x + leftFirst;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        node = stack[--stackSize];
+    }
+    return false;
+}
+
+HitInfo RaySphere(Ray ray)
+{
+    HitInfo closestHit = getDefaultHitInfo();
+    if (sphereCount + instanceCount == 0)
+        return closestHit;
+
+    vec3 invDir = 1.0 / ray.direction;
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = 0;
+
+    while (true) {
+        vec4 lo = texelFetch(bvhNodes, node * 2);
+        vec4 hi = texelFetch(bvhNodes, node * 2 + 1);
+        float tMax = min(closestHit.dst, MAX_DIST);
+
+        // Nodes coming from the stack may be farther than a hit found since they were pushed
+        if (intersectAABB(ray.origin, invDir, lo.xyz, hi.xyz, tMax) < NO_HIT) {
+            int leftFirst = floatBitsToInt(lo.w);
+            int count = floatBitsToInt(hi.w);
+            if (count > 0) {
+                for (int i = 0; i < count; ++i) {
+                    int primitive = texelFetch(bvhPrimitives, leftFirst + i).x;
+                    // Instances refused by BvhBuffer::uploadMeshes are past instanceCount, not traced
+                    if (primitive < sphereCount)
+                        intersectSphere(ray, primitive, closestHit);
+                    else if (primitive - sphereCount < instanceCount)
+                        intersectMesh(ray, primitive - sphereCount, closestHit);
+                }
+            } else {
+                int nearChild = leftFirst;
+                int farChild = leftFirst + 1;
+                float nearDist = intersectAABB(ray.origin, invDir, texelFetch(bvhNodes, nearChild * 2).xyz, texelFetch(bvhNodes, nearChild * 2 + 1).xyz, tMax);
+                float farDist = intersectAABB(ray.origin, invDir, texelFetch(bvhNodes, farChild * 2).xyz, texelFetch(bvhNodes, farChild * 2 + 1).xyz, tMax);
+                if (farDist < nearDist) {
+                    int t = nearChild; nearChild = farChild; farChild = t;
+                    float d = nearDist; nearDist = farDist; farDist = d;
+                }
+                if (nearDist < NO_HIT) {
+                    if (farDist < NO_HIT)
+                        stack[stackSize++] = farChild;
+                    node = nearChild;
+                    continue;
+                }
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        node = stack[--stackSize];
+    }
+    return closestHit;
+}
+
+// Shadow rays: true as soon as anything is hit closer than maxDist, in no particular order
+bool occluded(Ray ray, float maxDist)
+{
+    if (sphereCount + instanceCount == 0)
+        return false;
+
+    vec3 invDir = 1.0 / ray.direction;
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = 0;
+
+    while (true) {
+        vec4 lo = texelFetch(bvhNodes, node * 2);
+        vec4 hi = texelFetch(bvhNodes, node * 2 + 1);
+        if (intersectAABB(ray.origin, invDir, lo.xyz, hi.xyz, maxDist) < NO_HIT) {
+            int leftFirst = floatBitsToInt(lo.w);
+            int count = floatBitsToInt(hi.w);
+            if (count > 0) {
+                for (int i = 0; i < count; ++i) {
+                    int primitive = texelFetch(bvhPrimitives, leftFirst + i).x;
+                    if (primitive < sphereCount ? sphereDistance(ray, sphereData[primitive].centerRadius) < maxDist
+                                                : primitive - sphereCount < instanceCount && meshOccluded(ray, primitive - sphereCount, maxDist))
+                        return true;
+                }
+            } else {
+                // Both children, the second one from the stack
+                stack[stackSize++] = leftFirst + 1;
+                node = leftFirst;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        node = stack[--stackSize];
+    }
+    return false;
+}
@@ -2,8 +2,15 @@
 out vec4 FragColor;
 in vec2 TexCoord;
 
+// Accumulation: rgb = radiance sum, a = sample count
 uniform sampler2D screenTex;
+// Part of the texture holding the image: 1 for the native accumulation, the traced corner of the
+// reduced resolution target otherwise (upscaled by its bilinear filtering)
+uniform vec2 uvScale;
 
 void main() {
-    FragColor = texture(screenTex, TexCoord);
+    // Half a texel inside the corner, the filtering would blend in what is around it
+    vec2 limit = uvScale - 0.5 / vec2(textureSize(screenTex, 0));
+    vec4 accum = texture(screenTex, min(TexCoord * uvScale, limit));
+    FragColor = vec4(accum.a > 0.0 ? accum.rgb / accum.a : vec3(0.0), 1.0);
 }
@@ -0,0 +1,161 @@
+// Paths of the tracing programs, shared by main.frag and wavefront.comp.
+// Expects the uniforms time, resolution and focalLength, BOUNCE_COUNT, USE_EMISSION, USE_RUSSIAN_ROULETTE,
+// USE_LIGHT_SAMPLING and SAMPLER, and const.glsl and scene.glsl included first.
+
+#include "random.glsl"
+
+// --- Cosine-weighted hemisphere sampling ---
+vec3 cosineSampleHemisphere(float u1, float u2) {
+    float r = sqrt(u1);
+    float theta = 2.0 * 3.14159265359 * u2;
+    float x = r * cos(theta);
+    float y = r * sin(theta);
+    float z = sqrt(max(0.0, 1.0 - u1));
+    return vec3(x, y, z); // local-space (z = up)
+}
+
+vec3 makeTangentBasis(vec3 n) {
+    // return tangent vectorX; compute Y via cross in caller
+    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangentX = normalize(cross(up, n));
+    return tangentX;
+}
+
+vec3 sampleHemisphereCosine(vec3 normal, inout SamplerState rng) {
+    vec2 u = sample2D(rng);
+    vec3 samplecos = cosineSampleHemisphere(u.x, u.y); // local coords
+    vec3 tangentX = makeTangentBasis(normal);
+    vec3 tangentY = cross(normal, tangentX);
+    // transform to world
+    return normalize(samplecos.x * tangentX + samplecos.y * tangentY + samplecos.z * normal);
+}
+
+//////////////////////////////
+//     Light sampling       //
+//////////////////////////////
+// Next event estimation: at every hit one emitter is picked uniformly and a direction is drawn
+// uniformly in the cone of its sphere, a shadow ray tells if it is visible. The emission found by
+// the cosine sampled bounces is still added: both estimators are combined with multiple importance
+// sampling (power heuristic), so neither the small nor the large lights get noisier.
+float powerHeuristic(float pdf, float otherPdf) {
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// 1 - cos of the half angle of the cone of sphere s seen from p, 0 from inside.
+// Written with sin^2 / (1 + cos): no cancellation for small or far spheres.
+float coneOneMinusCos(vec3 p, vec4 s) {
+    vec3 d = s.xyz - p;
+    float sin2 = s.w * s.w / dot(d, d);
+    if (sin2 >= 1.0)
+        return 0.0;
+    return sin2 / (1.0 + sqrt(1.0 - sin2));
+}
+
+// Solid angle pdf of a light sample from p in the direction of emissive sphere s.
+// 0 for the meshes (s = -1), they are never light sampled.
+float lightPdf(vec3 p, int s) {
+    if (s < 0)
+        return 0.0;
+    float oneMinusCos = coneOneMinusCos(p, sphereData[s].centerRadius);
+    if (oneMinusCos == 0.0 || emitterCount == 0)
+        return 0.0;
+    return 1.0 / (TWO_PI * oneMinusCos * float(emitterCount));
+}
+
+vec3 sampleCone(vec3 axis, float oneMinusCos, float u1, float u2) {
+    float cosTheta = 1.0 - u1 * oneMinusCos;
+    float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+    float phi = TWO_PI * u2;
+    vec3 tangentX = makeTangentBasis(axis);
+    vec3 tangentY = cross(axis, tangentX);
+    return normalize(sinTheta * cos(phi) * tangentX + sinTheta * sin(phi) * tangentY + cosTheta * axis);
+}
+
+// Light sample at a hit, origin is its offset point. Returns the reflected radiance over the
+// albedo, MIS weighted: Le * cos / pi / pdf * weight. Always draws the same dimensions.
+vec3 sampleLight(HitInfo hit, vec3 origin, inout SamplerState rng) {
+    if (emitterCount == 0)
+        return vec3(0.0);
+    int e = min(int(sample1D(rng) * float(emitterCount)), emitterCount - 1);
+    vec2 u = sample2D(rng);
+
+    // A sphere never lights itself, the directions of its cone are below the surface
+    int s = emitterData[e].data.x;
+    if (s == hit.sphere)
+        return vec3(0.0);
+    vec4 light = sphereData[s].centerRadius;
+    float oneMinusCos = coneOneMinusCos(origin, light);
+    if (oneMinusCos == 0.0)
+        return vec3(0.0);
+    vec3 direction = sampleCone(normalize(light.xyz - origin), oneMinusCos, u.x, u.y);
+    float cosine = dot(hit.normal, direction);
+    if (cosine <= 0.0)
+        return vec3(0.0);
+
+    // The shadow ray stops just before the light, which may be missed at the rim of the cone
+    Ray shadow = Ray(origin, direction);
+    float lightDist = sphereDistance(shadow, light);
+    if (lightDist == NO_HIT || occluded(shadow, lightDist * (1.0 - 1e-4)))
+        return vec3(0.0);
+
+    Material emitter = getMaterial(sphereData[s].data.x);
+    float pdf = 1.0 / (TWO_PI * oneMinusCos * float(emitterCount));
+    float bsdfPdf = cosine / PI;
+    return emitter.emissionColor.rgb * emitter.emissionStrength * (bsdfPdf / pdf) * powerHeuristic(pdf, bsdfPdf);
+}
+
+vec3 getRayDir(vec3 camDir, vec3 camUp, vec2 texCoord) {
+    vec3 camSide = normalize(cross(camDir, camUp));
+    vec2 p = 2.0 * texCoord - 1.0;
+    p.x *= resolution.x / resolution.y;
+    return normalize(p.x * camSide + p.y * camUp + focalLength * camDir);
+}
+
+// One bounce of a path at its hit: adds the emission, moves the ray to the next direction.
+// bsdfPdf is the pdf of the direction of ray, updated for the next one. False when Russian roulette ends the path.
+bool scatter(HitInfo hit, int bounce, inout Ray ray, inout vec3 radiance, inout vec3 throughput, inout float bsdfPdf, inout SamplerState rng) {
+    Material material = getMaterial(hit.material);
+
+#if USE_EMISSION
+    // if emitter -> accumulate emission * throughput
+    float emit = material.emissionStrength;
+    if (emit > 0.0) {
+        float weight = 1.0;
+#if USE_LIGHT_SAMPLING
+        // Camera rays aside, the light sample of the previous hit could have found it as well
+        if (bounce > 0)
+            weight = powerHeuristic(bsdfPdf, lightPdf(ray.origin, hit.sphere));
+#endif
+        radiance += throughput * material.emissionColor.rgb * emit * weight;
+    }
+#endif
+
+    // offset to avoid self-intersection
+    ray.origin = hit.hitPoint + hit.normal * 1e-4;
+
+#if USE_EMISSION && USE_LIGHT_SAMPLING
+    radiance += throughput * material.color.rgb * sampleLight(hit, ray.origin, rng);
+#endif
+
+    // sample new direction cosine-weighted around normal
+    vec3 newDir = sampleHemisphereCosine(hit.normal, rng);
+    bsdfPdf = dot(hit.normal, newDir) / PI;
+
+    // update throughput: for lambertian BRDF = albedo/pi and pdf = cos(theta)/pi
+    // BRDF/pdf => albedo (cancels pi), so we can simply multiply by albedo
+    throughput *= material.color.rgb;
+
+    // move ray direction
+    ray.direction = newDir;
+
+#if USE_RUSSIAN_ROULETTE
+    // Russian roulette after few bounces
+    if (bounce > BOUNCE_COUNT/4) {
+        float p = max(max(throughput.r, throughput.g), throughput.b);
+        float r = sample1D(rng);
+        if (r > p) return false;
+        throughput /= max(p, 1e-6);
+    }
+#endif
+    return true;
+}
@@ -0,0 +1,801 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "scene/scene.hpp"
+#include "utils/arena.hpp"
+#include "utils/threadPool.hpp"
+
+std::vector<Aabb> sphereBounds(const std::vector<Sphere>& spheres) {
+   std::vector<Aabb> bounds(spheres.size());
+   for (size_t i = 0; i < spheres.size(); i++) {
+      glm::vec3 r(spheres[i].radius);
+      bounds[i].min = spheres[i].center - r;
+      bounds[i].max = spheres[i].center + r;
+   }
+   return bounds;
+}
+
+namespace {
+   // Nodes of more primitives than the subtree size are split one after the other, each with
+   // parallel binning and partitioning. The subtrees below them are then built in parallel, one
+   // thread each. There are about SUBTREES_PER_THREAD of them per thread for load balancing.
+   constexpr size_t MIN_SUBTREE_SIZE = 1 << 12;
+   constexpr size_t SUBTREES_PER_THREAD = 8;
+   // Primitives per job of the parallel loops
+   constexpr size_t BATCH_SIZE = 1 << 14;
+   // Nodes per job of a refit level
+   constexpr size_t REFIT_BATCH_SIZE = 1 << 12;
+   // Dirty ranges closer than this many elements are uploaded as one
+   constexpr size_t RANGE_MERGE_GAP = 8;
+
+   constexpr int BIN_COUNT = Bvh::BIN_COUNT;
+
+   struct Bin {
+      Aabb bounds;
+      int count = 0;
+   };
+
+   // Bins of the three axes, filled in the same pass
+   struct BinSet {
+      Bin bins[3][BIN_COUNT];
+
+      void merge(const BinSet& other) {
+         for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < BIN_COUNT; b++) {
+               bins[axis][b].bounds.grow(other.bins[axis][b].bounds);
+               bins[axis][b].count += other.bins[axis][b].count;
+            }
+         }
+      }
+   };
+
+   struct Split {
+      int axis = -1;
+      int bin = 0;
+      float cost = 1e30f;
+   };
+
+   struct NodeBounds {
+      Aabb bounds;
+      Aabb centroids;
+
+      void merge(const NodeBounds& other) {
+         bounds.grow(other.bounds);
+         centroids.grow(other.centroids);
+      }
+   };
+
+   struct BuildTask {
+      int node;
+      int depth;
+      // Of the primitives of the node, its own bounds are already set
+      Aabb centroids;
+   };
+
+   struct Subtree {
+      BuildTask root;
+      // Built nodes, the root first, in the arena of the thread that built them
+      const BvhNode* nodes = nullptr;
+      int nodeCount = 0;
+   };
+
+   // What the builder reads, shared by every thread
+   struct BuildInput {
+      const Aabb* bounds;
+      const glm::vec3* centers;
+      uint32_t* indices;
+   };
+
+   // Bins per unit of distance on every axis, 0 on flat ones
+   glm::vec3 binScale(const Aabb& centroids) {
+      const glm::vec3 extent = centroids.max - centroids.min;
+      glm::vec3 scale(0.0f);
+      for (int axis = 0; axis < 3; axis++) {
+         if (extent[axis] > 0.0f)
+            scale[axis] = BIN_COUNT / extent[axis];
+      }
+      return scale;
+   }
+
+   int binOf(const glm::vec3& center, int axis, const Aabb& centroids, const glm::vec3& scale) {
+      return std::min(BIN_COUNT - 1, static_cast<int>((center[axis] - centroids.min[axis]) * scale[axis]));
+   }
+
+   void binPrimitives(const BuildInput& in, size_t begin, size_t end, const Aabb& centroids, const glm::vec3& scale, BinSet& out) {
+      // Copies, the compiler can't tell that the bins don't overlap them
+      const glm::vec3 minCenter = centroids.min;
+      const glm::vec3 binsPerUnit = scale;
+      const uint32_t* indices = in.indices;
+      for (size_t i = begin; i < end; i++) {
+         const uint32_t prim = indices[i];
+         // binOf() on the three axes at once
+         const glm::ivec3 b = glm::min(glm::ivec3((in.centers[prim] - minCenter) * binsPerUnit), glm::ivec3(BIN_COUNT - 1));
+         const Aabb bounds = in.bounds[prim];
+         for (int axis = 0; axis < 3; axis++) {
+            Bin& bin = out.bins[axis][b[axis]];
+            bin.bounds.grow(bounds);
+            bin.count++;
+         }
+      }
+   }
+
+   void growBounds(const BuildInput& in, size_t begin, size_t end, NodeBounds& out) {
+      for (size_t i = begin; i < end; i++) {
+         out.bounds.grow(in.bounds[in.indices[i]]);
+         out.centroids.grow(in.centers[in.indices[i]]);
+      }
+   }
+
+   // Cheapest binned SAH split over the axes where the centroids are spread. Empty bins are
+   // skipped: a split next to one costs as much as the split at the last filled bin before it.
+   Split findSplit(const BinSet& set, const glm::vec3& scale) {
+      Split best;
+      for (int axis = 0; axis < 3; axis++) {
+         if (scale[axis] <= 0.0f)
+            continue;
+         const Bin* bins = set.bins[axis];
+         int filled[BIN_COUNT];
+         int filledCount = 0;
+         for (int b = 0; b < BIN_COUNT; b++) {
+            if (bins[b].count > 0)
+               filled[filledCount++] = b;
+         }
+
+         // Sweep from the right to get the cost of every right side, then from the left
+         float rightArea[BIN_COUNT];
+         Aabb rightBox;
+         for (int f = filledCount - 1; f > 0; f--) {
+            rightBox.grow(bins[filled[f]].bounds);
+            rightArea[f - 1] = rightBox.area();
+         }
+
+         Aabb leftBox;
+         int leftSum = 0;
+         int total = 0;
+         for (int f = 0; f < filledCount; f++) {
+            total += bins[filled[f]].count;
+         }
+         for (int f = 0; f < filledCount - 1; f++) {
+            const Bin& bin = bins[filled[f]];
+            leftBox.grow(bin.bounds);
+            leftSum += bin.count;
+            float cost = leftSum * leftBox.area() + (total - leftSum) * rightArea[f];
+            if (cost < best.cost) {
+               best = Split{axis, filled[f], cost};
+            }
+         }
+      }
+      return best;
+   }
+
+   // A split without axis means every centroid is at the same place
+   bool makeLeaf(const Split& split, const Aabb& bounds, int count, int depth) {
+      if (count == 1 || depth + 1 >= Bvh::MAX_DEPTH)
+         return true;
+      if (split.axis < 0)
+         return count <= Bvh::MAX_LEAF_SIZE;
+
+      const float nodeArea = bounds.area();
+      const float leafCost = Bvh::INTERSECTION_COST * count;
+      const float splitCost = nodeArea > 0.0f
+         ? Bvh::TRAVERSAL_COST + Bvh::INTERSECTION_COST * split.cost / nodeArea
+         : Bvh::TRAVERSAL_COST + leafCost;
+      return splitCost >= leafCost && count <= Bvh::MAX_LEAF_SIZE;
+   }
+
+   // Bounds of both sides of a split, merged from its bins. The centroid bounds are grown while
+   // partitioning.
+   void splitBounds(const BinSet& set, const Split& split, NodeBounds& left, NodeBounds& right) {
+      for (int b = 0; b < BIN_COUNT; b++) {
+         (b <= split.bin ? left : right).bounds.grow(set.bins[split.axis][b].bounds);
+      }
+   }
+
+   // Moves the primitives on the left of the split to the front of [begin, end), returns the first
+   // one on the right
+   uint32_t* partition(const BuildInput& in, uint32_t* begin, uint32_t* end, const Aabb& centroids, const glm::vec3& scale,
+                       const Split& split, NodeBounds& left, NodeBounds& right) {
+      const Aabb binned = centroids;
+      const glm::vec3 binsPerUnit = scale;
+      Aabb leftCentroids;
+      Aabb rightCentroids;
+      while (true) {
+         while (begin < end && binOf(in.centers[*begin], split.axis, binned, binsPerUnit) <= split.bin) {
+            leftCentroids.grow(in.centers[*begin]);
+            begin++;
+         }
+         while (begin < end && binOf(in.centers[end[-1]], split.axis, binned, binsPerUnit) > split.bin) {
+            rightCentroids.grow(in.centers[end[-1]]);
+            end--;
+         }
+         if (begin == end)
+            break;
+         std::swap(*begin, end[-1]);
+      }
+      left.centroids.grow(leftCentroids);
+      right.centroids.grow(rightCentroids);
+      return begin;
+   }
+
+   BvhNode makeNode(const Aabb& bounds, int first, int count) {
+      return BvhNode{bounds.min, first, bounds.max, count};
+   }
+
+   // Build the subtree of nodes[0], whose bounds, first primitive and count are set, on the
+   // calling thread. nodes has room for the 2 * count - 1 nodes of a complete split.
+   // Children are numbered within the subtree. Returns the node count.
+   int buildSubtree(const BuildInput& in, const BuildTask& root, BvhNode* nodes, Arena& arena) {
+      // A task is pending for at most one sibling per level
+      BuildTask* stack = arena.allocate<BuildTask>(Bvh::MAX_DEPTH + 1);
+      int stackSize = 0;
+      int nodeCount = 1;
+      stack[stackSize++] = BuildTask{0, root.depth, root.centroids};
+
+      while (stackSize > 0) {
+         const BuildTask task = stack[--stackSize];
+         BvhNode& node = nodes[task.node];
+         const int first = node.leftFirst;
+         const int count = node.count;
+         const Aabb bounds{node.boundsMin, node.boundsMax};
+         if (count == 1 || task.depth + 1 >= Bvh::MAX_DEPTH)
+            continue;
+
+         const glm::vec3 scale = binScale(task.centroids);
+         BinSet set;
+         binPrimitives(in, first, first + count, task.centroids, scale, set);
+         const Split split = findSplit(set, scale);
+         if (makeLeaf(split, bounds, count, task.depth))
+            continue;
+
+         int middle;
+         NodeBounds left;
+         NodeBounds right;
+         if (split.axis >= 0) {
+            uint32_t* firstRight = partition(in, in.indices + first, in.indices + first + count, task.centroids, scale, split, left, right);
+            middle = static_cast<int>(firstRight - in.indices);
+            splitBounds(set, split, left, right);
+         } else {
+            middle = first + count / 2;
+            growBounds(in, first, middle, left);
+            growBounds(in, middle, first + count, right);
+         }
+
+         const int leftNode = nodeCount;
+         nodes[leftNode] = makeNode(left.bounds, first, middle - first);
+         nodes[leftNode + 1] = makeNode(right.bounds, middle, first + count - middle);
+         nodeCount += 2;
+         node.leftFirst = leftNode;
+         node.count = 0;
+
+         stack[stackSize++] = BuildTask{leftNode + 1, task.depth + 1, right.centroids};
+         stack[stackSize++] = BuildTask{leftNode, task.depth + 1, left.centroids};
+      }
+      return nodeCount;
+   }
+
+   // partition() of a node of the top of the tree, with every thread. The primitives keep their
+   // order on each side, they go through scratch.
+   int partitionParallel(ThreadPool& pool, const BuildInput& in, size_t first, size_t count, const BuildTask& task,
+                         const glm::vec3& scale, const Split& split, uint32_t* scratch, NodeBounds& left,
+                         NodeBounds& right, Arena& arena) {
+      const size_t batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+      size_t* leftCounts = arena.allocate<size_t>(batchCount);
+      NodeBounds* leftBounds = arena.allocate<NodeBounds>(batchCount);
+      NodeBounds* rightBounds = arena.allocate<NodeBounds>(batchCount);
+      auto goesLeft = [&](uint32_t prim) {
+         return binOf(in.centers[prim], split.axis, task.centroids, scale) <= split.bin;
+      };
+
+      pool.parallelFor(batchCount, [&](size_t batch) {
+         const size_t begin = first + batch * BATCH_SIZE;
+         const size_t end = std::min(first + count, begin + BATCH_SIZE);
+         leftBounds[batch] = NodeBounds{};
+         rightBounds[batch] = NodeBounds{};
+         size_t leftCount = 0;
+         for (size_t i = begin; i < end; i++) {
+            const uint32_t prim = in.indices[i];
+            if (goesLeft(prim)) {
+               leftBounds[batch].centroids.grow(in.centers[prim]);
+               leftCount++;
+            } else {
+               rightBounds[batch].centroids.grow(in.centers[prim]);
+            }
+         }
+         leftCounts[batch] = leftCount;
+      });
+
+      // Exclusive prefix sums, the right side starts after every left primitive
+      size_t leftTotal = 0;
+      for (size_t batch = 0; batch < batchCount; batch++) {
+         leftTotal += leftCounts[batch];
+         left.merge(leftBounds[batch]);
+         right.merge(rightBounds[batch]);
+      }
+      size_t* rightStarts = arena.allocate<size_t>(batchCount);
+      size_t leftSum = 0;
+      for (size_t batch = 0; batch < batchCount; batch++) {
+         // Every batch before this one is full
+         rightStarts[batch] = leftTotal + batch * BATCH_SIZE - leftSum;
+         const size_t left = leftCounts[batch];
+         leftCounts[batch] = leftSum;
+         leftSum += left;
+      }
+
+      pool.parallelFor(batchCount, [&](size_t batch) {
+         const size_t begin = first + batch * BATCH_SIZE;
+         const size_t end = std::min(first + count, begin + BATCH_SIZE);
+         size_t left = leftCounts[batch];
+         size_t right = rightStarts[batch];
+         for (size_t i = begin; i < end; i++) {
+            const uint32_t prim = in.indices[i];
+            scratch[goesLeft(prim) ? left++ : right++] = prim;
+         }
+      });
+      pool.parallelFor(batchCount, [&](size_t batch) {
+         const size_t begin = batch * BATCH_SIZE;
+         const size_t end = std::min(count, begin + BATCH_SIZE);
+         std::copy(scratch + begin, scratch + end, in.indices + first + begin);
+      });
+      return static_cast<int>(first + leftTotal);
+   }
+
+   NodeBounds boundsParallel(ThreadPool& pool, const BuildInput& in, size_t first, size_t count, Arena& arena) {
+      const size_t batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+      NodeBounds* partial = arena.allocate<NodeBounds>(batchCount);
+      pool.parallelFor(batchCount, [&](size_t batch) {
+         const size_t begin = first + batch * BATCH_SIZE;
+         partial[batch] = NodeBounds{};
+         growBounds(in, begin, std::min(first + count, begin + BATCH_SIZE), partial[batch]);
+      });
+      NodeBounds result;
+      for (size_t batch = 0; batch < batchCount; batch++) {
+         result.merge(partial[batch]);
+      }
+      return result;
+   }
+
+   BinSet binParallel(ThreadPool& pool, const BuildInput& in, size_t first, size_t count, const Aabb& centroids,
+                      const glm::vec3& scale, Arena& arena) {
+      const size_t batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+      BinSet* partial = arena.allocate<BinSet>(batchCount);
+      pool.parallelFor(batchCount, [&](size_t batch) {
+         const size_t begin = first + batch * BATCH_SIZE;
+         partial[batch] = BinSet{};
+         binPrimitives(in, begin, std::min(first + count, begin + BATCH_SIZE), centroids, scale, partial[batch]);
+      });
+      BinSet result;
+      for (size_t batch = 0; batch < batchCount; batch++) {
+         result.merge(partial[batch]);
+      }
+      return result;
+   }
+}
+
+void Bvh::build(const std::vector<Aabb>& primitiveBounds, int rootDepth) {
+   auto start = std::chrono::steady_clock::now();
+
+   resetRefit();
+   nodes.clear();
+   stats = BvhStats{};
+   const size_t count = primitiveBounds.size();
+   primitiveIndices.resize(count);
+   if (count == 0)
+      return;
+
+   ThreadPool& pool = ThreadPool::global();
+   // Every temporary comes from the arena of the thread using it, all freed at the end. A tree has
+   // at most 2 * count - 1 nodes, reserved once for the top levels and the merged subtrees.
+   std::vector<Arena> arenas(pool.concurrency());
+   auto threadArena = [&]() -> Arena& {
+      // A nested build runs serially on a single thread, whatever its index
+      const unsigned int index = ThreadPool::threadIndex();
+      return arenas[index < arenas.size() ? index : 0];
+   };
+   Arena& mainArena = threadArena();
+
+   glm::vec3* centers = mainArena.allocate<glm::vec3>(count);
+   const size_t batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+   pool.parallelFor(batchCount, [&](size_t batch) {
+      const size_t end = std::min(count, (batch + 1) * BATCH_SIZE);
+      for (size_t i = batch * BATCH_SIZE; i < end; i++) {
+         primitiveIndices[i] = static_cast<uint32_t>(i);
+         centers[i] = primitiveBounds[i].center();
+      }
+   });
+   const BuildInput in{primitiveBounds.data(), centers, primitiveIndices.data()};
+
+   // Top of the tree, split with every thread down to the subtree size
+   const size_t subtreeSize = std::max(MIN_SUBTREE_SIZE, count / (pool.concurrency() * SUBTREES_PER_THREAD));
+   const NodeBounds rootBounds = boundsParallel(pool, in, 0, count, mainArena);
+   nodes.reserve(2 * count - 1);
+   nodes.push_back(makeNode(rootBounds.bounds, 0, static_cast<int>(count)));
+
+   // Subtree roots hold disjoint primitives, a task is pending for at most one sibling per level
+   Subtree* subtrees = mainArena.allocate<Subtree>(count);
+   size_t subtreeCount = 0;
+   BuildTask* tasks = mainArena.allocate<BuildTask>(MAX_DEPTH + 1);
+   int taskCount = 0;
+   tasks[taskCount++] = BuildTask{0, rootDepth, rootBounds.centroids};
+   uint32_t* scratch = nullptr;
+   while (taskCount > 0) {
+      const BuildTask task = tasks[--taskCount];
+
+      const int first = nodes[task.node].leftFirst;
+      const int nodeCount = nodes[task.node].count;
+      if (static_cast<size_t>(nodeCount) <= subtreeSize) {
+         subtrees[subtreeCount++] = Subtree{task};
+         continue;
+      }
+
+      const Aabb bounds{nodes[task.node].boundsMin, nodes[task.node].boundsMax};
+      const glm::vec3 scale = binScale(task.centroids);
+      const BinSet set = binParallel(pool, in, first, nodeCount, task.centroids, scale, mainArena);
+      const Split split = findSplit(set, scale);
+      if (makeLeaf(split, bounds, nodeCount, task.depth))
+         continue;
+
+      int middle;
+      NodeBounds left;
+      NodeBounds right;
+      if (split.axis >= 0) {
+         if (!scratch)
+            scratch = mainArena.allocate<uint32_t>(count);
+         middle = partitionParallel(pool, in, first, nodeCount, task, scale, split, scratch, left, right, mainArena);
+         splitBounds(set, split, left, right);
+      } else {
+         middle = first + nodeCount / 2;
+         left = boundsParallel(pool, in, first, middle - first, mainArena);
+         right = boundsParallel(pool, in, middle, first + nodeCount - middle, mainArena);
+      }
+
+      const int leftNode = static_cast<int>(nodes.size());
+      nodes.push_back(makeNode(left.bounds, first, middle - first));
+      nodes.push_back(makeNode(right.bounds, middle, first + nodeCount - middle));
+      nodes[task.node].leftFirst = leftNode;
+      nodes[task.node].count = 0;
+
+      tasks[taskCount++] = BuildTask{leftNode + 1, task.depth + 1, right.centroids};
+      tasks[taskCount++] = BuildTask{leftNode, task.depth + 1, left.centroids};
+   }
+
+   // Largest subtrees first, the small ones fill the gaps at the end. Ties keep their order, like a
+   // stable sort without its buffer.
+   size_t* order = mainArena.allocate<size_t>(subtreeCount);
+   for (size_t i = 0; i < subtreeCount; i++) {
+      order[i] = i;
+   }
+   std::sort(order, order + subtreeCount, [&](size_t a, size_t b) {
+      const int countA = nodes[subtrees[a].root.node].count;
+      const int countB = nodes[subtrees[b].root.node].count;
+      return countA != countB ? countA > countB : a < b;
+   });
+   pool.parallelFor(subtreeCount, [&](size_t i) {
+      Subtree& subtree = subtrees[order[i]];
+      const BvhNode& root = nodes[subtree.root.node];
+      Arena& arena = threadArena();
+      BvhNode* built = arena.allocate<BvhNode>(2 * static_cast<size_t>(root.count) - 1);
+      built[0] = root;
+      subtree.nodeCount = buildSubtree(in, subtree.root, built, arena);
+      subtree.nodes = built;
+   });
+
+   // Each subtree replaces its root and appends the rest of its nodes, children still come after
+   // their parent and next to their sibling
+   size_t* bases = mainArena.allocate<size_t>(subtreeCount);
+   size_t total = nodes.size();
+   for (size_t i = 0; i < subtreeCount; i++) {
+      bases[i] = total;
+      total += subtrees[i].nodeCount - 1;
+   }
+   nodes.resize(total);
+   pool.parallelFor(subtreeCount, [&](size_t i) {
+      const Subtree& subtree = subtrees[i];
+      const int offset = static_cast<int>(bases[i]) - 1;
+      for (int k = 0; k < subtree.nodeCount; k++) {
+         BvhNode node = subtree.nodes[k];
+         if (!node.isLeaf())
+            node.leftFirst += offset;
+         nodes[k == 0 ? subtree.root.node : offset + k] = node;
+      }
+   });
+
+   computeStats();
+   stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Bvh::assign(std::vector<BvhNode> builtNodes, std::vector<uint32_t> builtPrimitiveIndices) {
+   nodes = std::move(builtNodes);
+   primitiveIndices = std::move(builtPrimitiveIndices);
+   resetRefit();
+   computeStats();
+}
+
+std::vector<uint32_t> Bvh::leafOrder() {
+   std::vector<uint32_t> order = std::move(primitiveIndices);
+   primitiveIndices.resize(order.size());
+   for (size_t i = 0; i < primitiveIndices.size(); i++) {
+      primitiveIndices[i] = static_cast<uint32_t>(i);
+   }
+   allDirty = true;
+   return order;
+}
+
+void Bvh::computeStats() {
+   stats = BvhStats{};
+   if (nodes.empty())
+      return;
+
+   // Children always come after their parent: one pass in order gives every depth
+   const float rootArea = std::max(Aabb{nodes[0].boundsMin, nodes[0].boundsMax}.area(), 1e-30f);
+   std::vector<int> depths(nodes.size(), 1);
+   for (size_t i = 0; i < nodes.size(); i++) {
+      const BvhNode& node = nodes[i];
+      if (node.isUnused())
+         continue;
+      float relativeArea = Aabb{node.boundsMin, node.boundsMax}.area() / rootArea;
+      stats.nodeCount++;
+      stats.depth = std::max(stats.depth, depths[i]);
+      if (node.isLeaf()) {
+         stats.leafCount++;
+         stats.sahCost += INTERSECTION_COST * relativeArea * node.count;
+      } else {
+         stats.sahCost += TRAVERSAL_COST * relativeArea;
+         depths[node.leftFirst] = depths[i] + 1;
+         depths[node.leftFirst + 1] = depths[i] + 1;
+      }
+   }
+}
+
+void Bvh::resetRefit() {
+   levelNodes.clear();
+   levelStarts.clear();
+   costs.clear();
+   builtCosts.clear();
+   ranges.clear();
+   freePairs.clear();
+   dirtyNodes.clear();
+   dirtyPrimitives.clear();
+   allDirty = true;
+}
+
+void Bvh::prepareRefit() {
+   if (levelNodes.empty()) {
+      levelStarts.assign(1, 0);
+      levelNodes.assign(1, 0);
+      while (levelStarts.back() < levelNodes.size()) {
+         const size_t begin = levelStarts.back();
+         const size_t end = levelNodes.size();
+         levelStarts.push_back(end);
+         for (size_t i = begin; i < end; i++) {
+            const BvhNode& node = nodes[levelNodes[i]];
+            if (!node.isLeaf()) {
+               levelNodes.push_back(node.leftFirst);
+               levelNodes.push_back(node.leftFirst + 1);
+            }
+         }
+      }
+   }
+
+   if (builtCosts.empty()) {
+      costs.resize(nodes.size());
+      ranges.resize(nodes.size());
+      dirtyNodes.assign(nodes.size(), 0);
+      dirtyPrimitives.assign(primitiveIndices.size(), 0);
+      // The tree is still the one built, its costs are the reference
+      refitLevels(nullptr);
+      builtCosts.resize(nodes.size());
+      for (size_t i = 0; i < nodes.size(); i++) {
+         builtCosts[i] = costs[i] / std::max(Aabb{nodes[i].boundsMin, nodes[i].boundsMax}.area(), 1e-30f);
+      }
+   }
+}
+
+void Bvh::refitLevels(const Aabb* primitiveBounds) {
+   for (size_t level = levelStarts.size() - 1; level-- > 0;) {
+      const size_t begin = levelStarts[level];
+      const size_t end = levelStarts[level + 1];
+      ThreadPool::global().parallelFor((end - begin + REFIT_BATCH_SIZE - 1) / REFIT_BATCH_SIZE, [&](size_t batch) {
+         const size_t batchEnd = std::min(end, begin + (batch + 1) * REFIT_BATCH_SIZE);
+         for (size_t i = begin + batch * REFIT_BATCH_SIZE; i < batchEnd; i++) {
+            const int index = levelNodes[i];
+            BvhNode& node = nodes[index];
+            Aabb bounds{node.boundsMin, node.boundsMax};
+            if (node.isLeaf()) {
+               if (primitiveBounds) {
+                  bounds = Aabb{};
+                  for (int p = node.leftFirst; p < node.leftFirst + node.count; p++) {
+                     bounds.grow(primitiveBounds[primitiveIndices[p]]);
+                  }
+               }
+               costs[index] = INTERSECTION_COST * node.count * bounds.area();
+               ranges[index] = glm::ivec2(node.leftFirst, node.count);
+            } else {
+               const int left = node.leftFirst;
+               if (primitiveBounds) {
+                  bounds = Aabb{nodes[left].boundsMin, nodes[left].boundsMax};
+                  bounds.grow(Aabb{nodes[left + 1].boundsMin, nodes[left + 1].boundsMax});
+               }
+               costs[index] = TRAVERSAL_COST * bounds.area() + costs[left] + costs[left + 1];
+               ranges[index] = glm::ivec2(ranges[left].x, ranges[left].y + ranges[left + 1].y);
+            }
+            if (bounds.min != node.boundsMin || bounds.max != node.boundsMax) {
+               node.boundsMin = bounds.min;
+               node.boundsMax = bounds.max;
+               dirtyNodes[index] = 1;
+            }
+         }
+      });
+   }
+}
+
+void Bvh::refit(const std::vector<Aabb>& primitiveBounds) {
+   if (nodes.empty())
+      return;
+   prepareRefit();
+   refitLevels(primitiveBounds.data());
+}
+
+void Bvh::update(const std::vector<Aabb>& primitiveBounds) {
+   auto start = std::chrono::steady_clock::now();
+
+   if (nodes.empty() || primitiveBounds.size() != primitiveIndices.size()) {
+      build(primitiveBounds);
+      stats.rebuiltSubtrees = 1;
+      stats.rebuiltPrimitives = primitiveBounds.size();
+      stats.updateMs = stats.buildMs;
+      return;
+   }
+   refit(primitiveBounds);
+
+   // Topmost degraded subtrees, their parents are still fine
+   struct Degraded {
+      int node;
+      int depth;
+   };
+   std::vector<Degraded> degraded;
+   std::vector<Degraded> stack{{0, 0}};
+   while (!stack.empty()) {
+      const Degraded entry = stack.back();
+      stack.pop_back();
+      const BvhNode& node = nodes[entry.node];
+      if (node.isLeaf())
+         continue;
+      const float area = Aabb{node.boundsMin, node.boundsMax}.area();
+      if (area > 0.0f && costs[entry.node] / area > REBUILD_THRESHOLD * builtCosts[entry.node]) {
+         degraded.push_back(entry);
+      } else {
+         stack.push_back({node.leftFirst + 1, entry.depth + 1});
+         stack.push_back({node.leftFirst, entry.depth + 1});
+      }
+   }
+
+   if (!degraded.empty() && degraded[0].node == 0) {
+      build(primitiveBounds);
+      stats.rebuiltSubtrees = 1;
+      stats.rebuiltPrimitives = primitiveBounds.size();
+      stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      return;
+   }
+
+   size_t rebuiltPrimitives = 0;
+   for (const Degraded& entry : degraded) {
+      rebuiltPrimitives += ranges[entry.node].y;
+      rebuildSubtree(entry.node, entry.depth, primitiveBounds);
+   }
+   if (!degraded.empty()) {
+      // The levels changed, the costs of the ancestors are refreshed by the next refit
+      levelNodes.clear();
+      levelStarts.clear();
+   }
+
+   const double buildMs = stats.buildMs;
+   computeStats();
+   stats.buildMs = buildMs;
+   stats.rebuiltSubtrees = static_cast<int>(degraded.size());
+   stats.rebuiltPrimitives = rebuiltPrimitives;
+   stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Bvh::rebuildSubtree(int root, int depth, const std::vector<Aabb>& primitiveBounds) {
+   const int first = ranges[root].x;
+   const int count = ranges[root].y;
+   const std::vector<uint32_t> primitives(primitiveIndices.begin() + first, primitiveIndices.begin() + first + count);
+   std::vector<Aabb> bounds(count);
+   for (int i = 0; i < count; i++) {
+      bounds[i] = primitiveBounds[primitives[i]];
+   }
+   Bvh subtree;
+   subtree.build(bounds, depth);
+   const std::vector<BvhNode>& built = subtree.nodes;
+
+   // Sibling pairs of the old subtree and the free ones after its root, in order: the parents of
+   // the new pairs still come first
+   std::vector<int> pairs;
+   std::vector<int> stack{root};
+   while (!stack.empty()) {
+      const BvhNode& node = nodes[stack.back()];
+      stack.pop_back();
+      if (!node.isLeaf()) {
+         pairs.push_back(node.leftFirst);
+         stack.push_back(node.leftFirst);
+         stack.push_back(node.leftFirst + 1);
+      }
+   }
+   auto laterFree = std::partition(freePairs.begin(), freePairs.end(), [&](int pair) { return pair < root; });
+   pairs.insert(pairs.end(), laterFree, freePairs.end());
+   freePairs.erase(laterFree, freePairs.end());
+   std::sort(pairs.begin(), pairs.end());
+
+   const size_t pairCount = (built.size() - 1) / 2;
+   while (pairs.size() < pairCount) {
+      pairs.push_back(static_cast<int>(nodes.size()));
+      nodes.resize(nodes.size() + 2);
+      allDirty = true;
+   }
+   const BvhNode unused{glm::vec3(0), -1, glm::vec3(0), 0};
+   for (size_t i = pairCount; i < pairs.size(); i++) {
+      nodes[pairs[i]] = unused;
+      nodes[pairs[i] + 1] = unused;
+      freePairs.push_back(pairs[i]);
+   }
+   costs.resize(nodes.size());
+   builtCosts.resize(nodes.size());
+   ranges.resize(nodes.size());
+   dirtyNodes.resize(nodes.size());
+
+   // Built node k goes to the root for 0, else to the pair (k - 1) / 2
+   auto slot = [&](int k) { return k == 0 ? root : pairs[(k - 1) / 2] + (k - 1) % 2; };
+   std::vector<float> builtCost(built.size());
+   for (size_t k = built.size(); k-- > 0;) {
+      BvhNode node = built[k];
+      const float area = Aabb{node.boundsMin, node.boundsMax}.area();
+      if (node.isLeaf()) {
+         builtCost[k] = INTERSECTION_COST * node.count * area;
+         node.leftFirst += first;
+      } else {
+         builtCost[k] = TRAVERSAL_COST * area + builtCost[node.leftFirst] + builtCost[node.leftFirst + 1];
+         node.leftFirst = slot(node.leftFirst);
+      }
+      const int index = slot(static_cast<int>(k));
+      nodes[index] = node;
+      builtCosts[index] = builtCost[k] / std::max(area, 1e-30f);
+      dirtyNodes[index] = 1;
+   }
+
+   for (int i = 0; i < count; i++) {
+      primitiveIndices[first + i] = primitives[subtree.primitiveIndices[i]];
+   }
+   std::fill(dirtyPrimitives.begin() + first, dirtyPrimitives.begin() + first + count, 1);
+}
+
+BvhChanges Bvh::takeChanges() {
+   BvhChanges changes;
+   changes.all = allDirty;
+   allDirty = false;
+   // Runs of dirty elements, close ones merged to save upload calls
+   auto collect = [&](std::vector<uint8_t>& dirty, std::vector<BvhRange>& out) {
+      for (size_t i = 0; i < dirty.size(); i++) {
+         if (!dirty[i])
+            continue;
+         if (!out.empty() && i - out.back().end <= RANGE_MERGE_GAP) {
+            out.back().end = i + 1;
+         } else {
+            out.push_back(BvhRange{i, i + 1});
+         }
+         dirty[i] = 0;
+      }
+      if (changes.all)
+         out.clear();
+   };
+   collect(dirtyNodes, changes.nodes);
+   collect(dirtyPrimitives, changes.primitives);
+   return changes;
+}
+
+void Bvh::printStats(const char* name) const {
+   printf("%s BVH: %zu primitives, %zu nodes, %zu leaves, depth %d, SAH cost %.2f, built in %.2f ms\n",
+          name, primitiveIndices.size(), stats.nodeCount, stats.leafCount, stats.depth, stats.sahCost, stats.buildMs);
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+struct Sphere;
+
+struct Aabb {
+   glm::vec3 min = glm::vec3(1e30f);
+   glm::vec3 max = glm::vec3(-1e30f);
+
+   void grow(const glm::vec3& p) {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+   }
+
+   void grow(const Aabb& other) {
+      min = glm::min(min, other.min);
+      max = glm::max(max, other.max);
+   }
+
+   [[nodiscard]] glm::vec3 center() const { return (min + max) * 0.5f; }
+
+   [[nodiscard]] float area() const {
+      glm::vec3 e = max - min;
+      if (e.x < 0.0f) return 0.0f;
+      return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+   }
+};
+
+// 32 bytes, uploaded as two RGBA32F texels (see BvhBuffer and main.frag)
+struct BvhNode {
+   glm::vec3 boundsMin;
+   // First child for inner nodes (the second one follows), first primitive for leaves
+   int leftFirst;
+   glm::vec3 boundsMax;
+   // Number of primitives, 0 for inner nodes
+   int count;
+
+   [[nodiscard]] bool isLeaf() const { return count > 0; }
+   // Slot left over by a partial rebuild (Bvh::update), not reachable from the root
+   [[nodiscard]] bool isUnused() const { return count == 0 && leftFirst < 0; }
+};
+
+struct BvhStats {
+   double buildMs = 0;
+   // Expected cost of a random ray, in node traversals + primitive tests
+   float sahCost = 0;
+   size_t nodeCount = 0;
+   size_t leafCount = 0;
+   int depth = 0;
+   // Last Bvh::update: refit and partial rebuilds
+   double updateMs = 0;
+   int rebuiltSubtrees = 0;
+   size_t rebuiltPrimitives = 0;
+};
+
+// [begin, end) of the node or primitive index array
+struct BvhRange {
+   size_t begin;
+   size_t end;
+};
+
+// What changed in a Bvh since the last Bvh::takeChanges, for partial uploads
+struct BvhChanges {
+   // Everything, after a build or when the arrays grew
+   bool all = false;
+   std::vector<BvhRange> nodes;
+   std::vector<BvhRange> primitives;
+};
+
+// Bounding volume hierarchy built with the binned surface area heuristic
+class Bvh {
+public:
+   // The shader traversal stack has this many entries, leaves are forced below it
+   static constexpr int MAX_DEPTH = 32;
+   static constexpr int BIN_COUNT = 16;
+   static constexpr int MAX_LEAF_SIZE = 8;
+   static constexpr float TRAVERSAL_COST = 1.0f;
+   static constexpr float INTERSECTION_COST = 1.0f;
+   // update() rebuilds a subtree once its SAH cost grew past this factor of its cost when built
+   static constexpr float REBUILD_THRESHOLD = 1.3f;
+
+   // Top levels split with parallel binning and partitioning, the subtrees below built in parallel
+   // on ThreadPool::global(). Temporaries come from per-thread arenas, the nodes are reserved once.
+   // Deterministic for a given pool size, also when nested in a job (serial).
+   void build(const std::vector<Aabb>& primitiveBounds) { build(primitiveBounds, 0); }
+
+   // New bounds for the same primitives, bottom-up in parallel, the tree is kept
+   void refit(const std::vector<Aabb>& primitiveBounds);
+
+   // refit(), then build again the topmost subtrees whose SAH cost degraded past REBUILD_THRESHOLD,
+   // in place. A full build when the primitive count changed or the root degraded.
+   void update(const std::vector<Aabb>& primitiveBounds);
+
+   // Node and primitive index ranges modified since the last call (all of them after a build)
+   BvhChanges takeChanges();
+
+   // Nodes and primitive indices of an earlier build (SceneCache), only the stats are computed
+   void assign(std::vector<BvhNode> builtNodes, std::vector<uint32_t> builtPrimitiveIndices);
+
+   // Number the primitives in leaf order, the primitive indices become 0, 1, 2...
+   // Returns the former ones: the caller reorders its primitives with it, the leaves then
+   // reference contiguous ranges of them.
+   std::vector<uint32_t> leafOrder();
+
+   [[nodiscard]] const std::vector<BvhNode>& getNodes() const { return nodes; }
+   // Leaves reference ranges of this array, which holds indices of the original primitives
+   [[nodiscard]] const std::vector<uint32_t>& getPrimitiveIndices() const { return primitiveIndices; }
+   [[nodiscard]] const BvhStats& getStats() const { return stats; }
+   [[nodiscard]] bool empty() const { return nodes.empty(); }
+
+   void printStats(const char* name) const;
+
+   // Closest hit traversal, front to back.
+   // intersect(primitiveIndex, tMax) tests a primitive and lowers tMax on a closer hit.
+   template<typename Intersect>
+   void traverse(const glm::vec3& origin, const glm::vec3& direction, float tMax, Intersect&& intersect) const;
+
+   // Any hit traversal for shadow rays, in no particular order.
+   // hit(primitiveIndex) tests a primitive, the traversal stops at the first one returning true.
+   template<typename Hit>
+   bool anyHit(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit&& hit) const;
+
+private:
+   // rootDepth: depth of the root in a larger tree, for the MAX_DEPTH limit
+   void build(const std::vector<Aabb>& primitiveBounds, int rootDepth);
+   void computeStats();
+
+   // Refit state, made by the first refit after a build
+   void prepareRefit();
+   void resetRefit();
+   // Bounds (unless primitiveBounds is null), costs and primitive ranges of every reachable node
+   void refitLevels(const Aabb* primitiveBounds);
+   void rebuildSubtree(int root, int depth, const std::vector<Aabb>& primitiveBounds);
+
+   std::vector<BvhNode> nodes;
+   std::vector<uint32_t> primitiveIndices;
+   BvhStats stats;
+
+   // Reachable nodes by depth, level i is [levelStarts[i], levelStarts[i + 1])
+   std::vector<int> levelNodes;
+   std::vector<size_t> levelStarts;
+   // SAH cost of the subtree of every node as of the last refit, not divided by its area, and
+   // the same divided by its area when the subtree was built
+   std::vector<float> costs;
+   std::vector<float> builtCosts;
+   // First primitive and primitive count of the subtree of every node
+   std::vector<glm::ivec2> ranges;
+   // First node of the sibling pairs left unused by partial rebuilds
+   std::vector<int> freePairs;
+   std::vector<uint8_t> dirtyNodes;
+   std::vector<uint8_t> dirtyPrimitives;
+   bool allDirty = true;
+};
+
+// Bounds of the primitives of a BVH. Scene::primitiveBounds for the scene BVH.
+std::vector<Aabb> sphereBounds(const std::vector<Sphere>& spheres);
+
+// Slab test, returns the entry distance or 1e30 on a miss
+inline float intersectAabb(const glm::vec3& origin, const glm::vec3& invDir, const glm::vec3& bmin, const glm::vec3& bmax, float tMax) {
+   glm::vec3 t0 = (bmin - origin) * invDir;
+   glm::vec3 t1 = (bmax - origin) * invDir;
+   glm::vec3 tmin = glm::min(t0, t1);
+   glm::vec3 tmax = glm::max(t0, t1);
+   float tNear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+   float tFar = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, tMax));
+   return tNear <= tFar ? tNear : 1e30f;
+}
+
+template<typename Intersect>
+void Bvh::traverse(const glm::vec3& origin, const glm::vec3& direction, float tMax, Intersect&& intersect) const {
+   if (nodes.empty())
+      return;
+
+   const glm::vec3 invDir = 1.0f / direction;
+   int stack[MAX_DEPTH];
+   int stackSize = 0;
+   int index = 0;
+
+   while (true) {
+      const BvhNode& node = nodes[index];
+      // Nodes coming from the stack may be farther than a hit found since they were pushed
+      if (intersectAabb(origin, invDir, node.boundsMin, node.boundsMax, tMax) < 1e30f) {
+         if (node.isLeaf()) {
+            for (int i = 0; i < node.count; i++) {
+               intersect(primitiveIndices[node.leftFirst + i], tMax);
+            }
+         } else {
+            int nearChild = node.leftFirst;
+            int farChild = node.leftFirst + 1;
+            float nearDist = intersectAabb(origin, invDir, nodes[nearChild].boundsMin, nodes[nearChild].boundsMax, tMax);
+            float farDist = intersectAabb(origin, invDir, nodes[farChild].boundsMin, nodes[farChild].boundsMax, tMax);
+            if (farDist < nearDist) {
+               std::swap(nearChild, farChild);
+               std::swap(nearDist, farDist);
+            }
+            if (nearDist < 1e30f) {
+               if (farDist < 1e30f)
+                  stack[stackSize++] = farChild;
+               index = nearChild;
+               continue;
+            }
+         }
+      }
+
+      if (stackSize == 0)
+         break;
+      index = stack[--stackSize];
+   }
+}
+
+template<typename Hit>
+bool Bvh::anyHit(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit&& hit) const {
+   if (nodes.empty())
+      return false;
+
+   const glm::vec3 invDir = 1.0f / direction;
+   int stack[MAX_DEPTH];
+   int stackSize = 0;
+   int index = 0;
+
+   while (true) {
+      const BvhNode& node = nodes[index];
+      if (intersectAabb(origin, invDir, node.boundsMin, node.boundsMax, tMax) < 1e30f) {
+         if (node.isLeaf()) {
+            for (int i = 0; i < node.count; i++) {
+               if (hit(primitiveIndices[node.leftFirst + i]))
+                  return true;
+            }
+         } else {
+            // Both children, the second one from the stack
+            stack[stackSize++] = node.leftFirst + 1;
+            index = node.leftFirst;
+            continue;
+         }
+      }
+
+      if (stackSize == 0)
+         break;
+      index = stack[--stackSize];
+   }
+   return false;
+}
+
+#endif //BVH_HPP
@@ -0,0 +1,483 @@
+// raytracer_bench: plays a scripted camera path offscreen at a fixed resolution and seed,
+// then writes the timings to JSON so runs can be compared across commits and machines.
+// With --convergence it measures the error against a converged reference over time instead.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+#include "window.hpp"
+#include "bench/benchRenderer.hpp"
+#include "bench/cameraPath.hpp"
+#include "bench/imageMetrics.hpp"
+#include "rendering/image.hpp"
+#include "rendering/programCache.hpp"
+#include "scene/scene.hpp"
+#include "scene/sceneCache.hpp"
+
+static double now() {
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchOptions {
+   std::string pathFile;
+   // 0: play the whole path once
+   int frames = 0;
+   // Run for this wall-clock time instead of a number of frames
+   double seconds = 0.0;
+   std::string json = "bench.json";
+   std::string image;
+   // Free text stored in the results, e.g. a commit hash
+   std::string label;
+
+   // Error against a reference after each frame instead of frame times
+   bool convergence = false;
+   Backend referenceBackend = Backend::CPU;
+   int referenceFrames = 256;
+   std::string referenceDirectory = "reference_cache";
+};
+
+static void printBenchUsage(const char* program) {
+   printf("Usage: %s [bench options] [Raytracer options]\n", program);
+   printf("  --path FILE           Camera path script (default: built-in path)\n");
+   printf("  --frames N            Frames to render, the path loops (default: path length)\n");
+   printf("  --time S              Render for S seconds instead of a number of frames\n");
+   printf("  --json FILE           Results file (default bench.json)\n");
+   printf("  --image FILE          Also write the last frame, .ppm or .pfm\n");
+   printf("  --label TEXT          Stored as is in the results\n");
+   printf("  --convergence         Record the error against a converged reference after each frame\n");
+   printf("                        (first pose of the path, 64 frames by default)\n");
+   printf("  --reference-backend gpu|cpu  Backend rendering the reference (default cpu)\n");
+   printf("  --reference-frames N  Accumulation frames of the reference (default 256)\n");
+   printf("  --reference-dir DIR   Where references are cached (default reference_cache)\n");
+   printf("Scene, resolution, backend and shader options are the ones of Raytracer --help.\n");
+}
+
+// Bench flags are taken out of argv, the remaining ones go through parseOptions
+static BenchOptions parseBenchOptions(int& argc, char** argv) {
+   BenchOptions bench;
+   int kept = 1;
+   for (int i = 1; i < argc; i++) {
+      const char* arg = argv[i];
+      if (strcmp(arg, "--path") == 0) {
+         bench.pathFile = nextArg(argc, argv, i);
+      } else if (strcmp(arg, "--frames") == 0) {
+         bench.frames = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--time") == 0) {
+         bench.seconds = atof(nextArg(argc, argv, i));
+         if (bench.seconds <= 0.0) {
+            fprintf(stderr, "Invalid value for --time: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--json") == 0) {
+         bench.json = nextArg(argc, argv, i);
+      } else if (strcmp(arg, "--image") == 0) {
+         bench.image = nextArg(argc, argv, i);
+      } else if (strcmp(arg, "--label") == 0) {
+         bench.label = nextArg(argc, argv, i);
+      } else if (strcmp(arg, "--convergence") == 0) {
+         bench.convergence = true;
+      } else if (strcmp(arg, "--reference-backend") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         if (strcmp(value, "gpu") == 0) {
+            bench.referenceBackend = Backend::GPU;
+         } else if (strcmp(value, "cpu") == 0) {
+            bench.referenceBackend = Backend::CPU;
+         } else {
+            fprintf(stderr, "Unknown backend: %s (expected gpu or cpu)\n", value);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--reference-frames") == 0) {
+         bench.referenceFrames = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--reference-dir") == 0) {
+         bench.referenceDirectory = nextArg(argc, argv, i);
+      } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+         printBenchUsage(argv[0]);
+         exit(EXIT_SUCCESS);
+      } else {
+         argv[kept++] = argv[i];
+      }
+   }
+   argc = kept;
+   return bench;
+}
+
+struct Summary {
+   size_t count = 0;
+   double mean = 0, min = 0, p50 = 0, p90 = 0, p95 = 0, p99 = 0, max = 0;
+};
+
+static Summary summarize(std::vector<double> values) {
+   Summary summary;
+   summary.count = values.size();
+   if (values.empty())
+      return summary;
+
+   std::sort(values.begin(), values.end());
+   // Nearest rank
+   auto percentile = [&](double p) {
+      size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(values.size())));
+      return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+   };
+   summary.mean = std::accumulate(values.begin(), values.end(), 0.0) / static_cast<double>(values.size());
+   summary.min = values.front();
+   summary.p50 = percentile(0.50);
+   summary.p90 = percentile(0.90);
+   summary.p95 = percentile(0.95);
+   summary.p99 = percentile(0.99);
+   summary.max = values.back();
+   return summary;
+}
+
+static std::string jsonString(const std::string& text) {
+   std::string result = "\"";
+   for (char c : text) {
+      if (c == '"' || c == '\\') {
+         result += '\\';
+         result += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+         char escaped[8];
+         snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+         result += escaped;
+      } else {
+         result += c;
+      }
+   }
+   return result + "\"";
+}
+
+static void writeSummary(FILE* file, const char* name, const Summary& s, bool last) {
+   fprintf(file, "    %s: {\"count\": %zu, \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+           jsonString(name).c_str(), s.count, s.mean, s.min, s.p50, s.p90, s.p95, s.p99, s.max, last ? "" : ",");
+}
+
+// Everything measured during a run
+struct BenchResult {
+   std::string renderer;
+   double timeToFirstFrameMs = 0.0;
+   double shaderBuildMs = 0.0;
+   bool shaderFromCache = false;
+   double elapsed = 0.0;
+   std::vector<double> frameMs;
+   std::vector<bool> frameMoving;
+   // GPU backend only
+   std::vector<double> gpuTraceMs;
+   Image image;
+};
+
+static bool sameCamera(const CameraState& a, const CameraState& b) {
+   return a.position == b.position && a.direction == b.direction && a.up == b.up;
+}
+
+static double samplesPerFrame(const Options& options) {
+   return static_cast<double>(options.width) * options.height * options.rayPerPixel;
+}
+
+static void playPath(BenchRenderer& renderer, const Options& options, const BenchOptions& bench, const CameraPath& path, double start, BenchResult& result) {
+   const int frames = bench.frames > 0 ? bench.frames : path.frameCount();
+   RenderParams params = options.renderParams();
+   const double loopStart = now();
+   CameraState previous{};
+   int lastMove = 0;
+
+   for (int frame = 0; ; frame++) {
+      if (bench.seconds > 0.0 ? (frame > 0 && now() - loopStart >= bench.seconds) : frame >= frames)
+         break;
+
+      bool moving = false;
+      CameraState camera = path.at(frame, moving);
+      // Like the interactive loop: any camera change restarts the accumulation
+      lastMove = (frame == 0 || !sameCamera(camera, previous)) ? 0 : lastMove + 1;
+      // Only the camera changes along a path, the accumulation can always be reprojected
+      if (lastMove == 0 && frame > 0 && params.reprojection)
+         renderer.saveHistory(previous, params.focalLength);
+      previous = camera;
+      // Fixed seeds: the frame index drives the random numbers
+      params.time = static_cast<unsigned int>(frame);
+
+      double frameStart = now();
+      renderer.render(camera, params, lastMove);
+      double frameEnd = now();
+
+      if (frame == 0)
+         result.timeToFirstFrameMs = (frameEnd - start) * 1000.0;
+      result.frameMs.push_back((frameEnd - frameStart) * 1000.0);
+      result.frameMoving.push_back(moving);
+      if (renderer.gpuMs() > 0.0)
+         result.gpuTraceMs.push_back(renderer.gpuMs());
+   }
+   result.elapsed = now() - loopStart;
+   result.image = renderer.image();
+}
+
+static const char* backendName(Backend backend) {
+   switch (backend) {
+      case Backend::CPU: return "cpu";
+      case Backend::WAVEFRONT: return "wavefront";
+      default: return "gpu";
+   }
+}
+
+// Fields common to every result file, up to the opening brace included
+static void writeHeader(FILE* out, const Options& options, const BenchOptions& bench, const Scene& scene, const Bvh& bvh, const std::string& renderer) {
+   fprintf(out, "{\n");
+   fprintf(out, "  \"label\": %s,\n", jsonString(bench.label).c_str());
+   fprintf(out, "  \"mode\": \"%s\",\n", bench.convergence ? "convergence" : "path");
+   fprintf(out, "  \"backend\": \"%s\",\n", backendName(options.backend));
+   fprintf(out, "  \"renderer\": %s,\n", jsonString(renderer).c_str());
+   fprintf(out, "  \"path\": %s,\n", jsonString(bench.pathFile.empty() ? "default" : bench.pathFile).c_str());
+   fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n", options.width, options.height);
+   fprintf(out, "  \"ray_per_pixel\": %d,\n  \"max_bounces\": %d,\n", options.rayPerPixel, options.maxBounces);
+   fprintf(out, "  \"adaptive_sampling\": %s,\n  \"adaptive_threshold\": %g,\n", options.adaptiveSampling ? "true" : "false", options.adaptiveThreshold);
+   fprintf(out, "  \"reprojection\": %s,\n", options.reprojection ? "true" : "false");
+   fprintf(out, "  \"scene\": {\"spheres\": %zu, \"meshes\": %zu, \"triangles\": %zu, \"instances\": %zu, \"materials\": %zu, \"bvh_nodes\": %zu, \"bvh_build_ms\": %.3f},\n",
+           scene.spheres.size(), scene.meshes.size(), scene.triangleCount(), scene.instances.size(), scene.materials.size(), bvh.getStats().nodeCount, bvh.getStats().buildMs);
+}
+
+static bool closeJson(FILE* out, const std::string& file) {
+   bool ok = fclose(out) == 0;
+   if (ok)
+      printf("Results written to %s\n", file.c_str());
+   return ok;
+}
+
+static bool writePathJson(const Options& options, const BenchOptions& bench, const Scene& scene, const Bvh& bvh, const BenchResult& result) {
+   FILE* out = fopen(bench.json.c_str(), "w");
+   if (!out) {
+      fprintf(stderr, "Unable to write %s\n", bench.json.c_str());
+      return false;
+   }
+
+   std::vector<double> still;
+   std::vector<double> moving;
+   for (size_t i = 0; i < result.frameMs.size(); i++) {
+      (result.frameMoving[i] ? moving : still).push_back(result.frameMs[i]);
+   }
+   const double samples = samplesPerFrame(options) * static_cast<double>(result.frameMs.size());
+
+   writeHeader(out, options, bench, scene, bvh, result.renderer);
+   fprintf(out, "  \"frames\": %zu,\n", result.frameMs.size());
+   fprintf(out, "  \"elapsed_s\": %.4f,\n", result.elapsed);
+   fprintf(out, "  \"samples_per_second\": %.1f,\n", samples / result.elapsed);
+   fprintf(out, "  \"time_to_first_frame_ms\": %.3f,\n", result.timeToFirstFrameMs);
+   fprintf(out, "  \"shader\": {\"build_ms\": %.3f, \"from_cache\": %s},\n", result.shaderBuildMs, result.shaderFromCache ? "true" : "false");
+   fprintf(out, "  \"frame_ms\": {\n");
+   writeSummary(out, "all", summarize(result.frameMs), false);
+   writeSummary(out, "still", summarize(still), false);
+   writeSummary(out, "moving", summarize(moving), true);
+   fprintf(out, "  }%s\n", result.gpuTraceMs.empty() ? "" : ",");
+   if (!result.gpuTraceMs.empty()) {
+      fprintf(out, "  \"gpu_trace_ms\": {\n");
+      writeSummary(out, "all", summarize(result.gpuTraceMs), true);
+      fprintf(out, "  }\n");
+   }
+   fprintf(out, "}\n");
+
+   return closeJson(out, bench.json);
+}
+
+static int runPath(const Options& options, const BenchOptions& bench, const CameraPath& path, Scene& scene, Bvh& bvh, double start) {
+   BenchResult result;
+   {
+      std::unique_ptr<BenchRenderer> renderer = BenchRenderer::create(options.backend, options, scene, bvh);
+      result.renderer = renderer->getName();
+      result.shaderBuildMs = renderer->getShaderBuildMs();
+      result.shaderFromCache = renderer->isShaderFromCache();
+      playPath(*renderer, options, bench, path, start, result);
+   }
+
+   Summary frames = summarize(result.frameMs);
+   const double samples = samplesPerFrame(options) * static_cast<double>(frames.count);
+   printf("%s: %zu frames at %dx%d, %.2f Msamples/s\n", result.renderer.c_str(), frames.count, options.width, options.height, samples / result.elapsed * 1e-6);
+   printf("ms/frame p50 %.2f / p95 %.2f / p99 %.2f, first frame after %.1f ms\n", frames.p50, frames.p95, frames.p99, result.timeToFirstFrameMs);
+
+   if (!bench.image.empty() && writeImage(bench.image, result.image))
+      printf("Image written to %s\n", bench.image.c_str());
+
+   return writePathJson(options, bench, scene, bvh, result) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Seeds of the reference frames, far from the ones of the measured run so both noises are independent
+static constexpr unsigned int REFERENCE_SEED = 1u << 24;
+
+static uint64_t hashValue(uint64_t hash, const void* data, size_t size) {
+   const auto* bytes = static_cast<const unsigned char*>(data);
+   for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+   }
+   return hash;
+}
+
+template <typename T>
+static uint64_t hashValue(uint64_t hash, const T& value) {
+   return hashValue(hash, &value, sizeof(T));
+}
+
+// Everything the converged image depends on. main.frag is left out on purpose: the reference
+// must stay put while the shader changes, delete the cache when the expected image changes.
+static std::string referenceFile(const Options& options, const BenchOptions& bench, const Scene& scene, const CameraState& camera) {
+   uint64_t hash = 14695981039346656037ull;
+   for (const Sphere& sphere : scene.spheres) {
+      hash = hashValue(hash, sphere.center.x);
+      hash = hashValue(hash, sphere.center.y);
+      hash = hashValue(hash, sphere.center.z);
+      hash = hashValue(hash, sphere.radius);
+      hash = hashValue(hash, sphere.material);
+   }
+   for (const Mesh& mesh : scene.meshes)
+      hash = hashValue(hash, mesh.triangles.data(), mesh.triangles.size() * sizeof(MeshTriangle));
+   hash = hashValue(hash, scene.instances.data(), scene.instances.size() * sizeof(MeshInstance));
+   for (const Material& material : scene.materials) {
+      for (int c = 0; c < 4; c++) {
+         hash = hashValue(hash, material.color[c]);
+         hash = hashValue(hash, material.emissionColor[c]);
+      }
+      hash = hashValue(hash, material.emissionStrength);
+   }
+   for (const glm::vec3& v : {camera.position, camera.direction, camera.up}) {
+      hash = hashValue(hash, v.x);
+      hash = hashValue(hash, v.y);
+      hash = hashValue(hash, v.z);
+   }
+   hash = hashValue(hash, options.width);
+   hash = hashValue(hash, options.height);
+   hash = hashValue(hash, options.focalLength);
+   hash = hashValue(hash, options.maxBounces);
+   hash = hashValue(hash, options.rayPerPixel);
+   hash = hashValue(hash, options.emission);
+   hash = hashValue(hash, options.russianRoulette);
+   hash = hashValue(hash, bench.referenceFrames);
+   hash = hashValue(hash, bench.referenceBackend);
+
+   char name[32];
+   snprintf(name, sizeof(name), "%016llx.pfm", static_cast<unsigned long long>(hash));
+   return (std::filesystem::path(bench.referenceDirectory) / name).string();
+}
+
+static Image loadOrRenderReference(const Options& options, const BenchOptions& bench, Scene& scene, Bvh& bvh, const CameraState& camera,
+                                   bool& cached, double& renderSeconds) {
+   const std::string file = referenceFile(options, bench, scene, camera);
+   Image reference;
+   cached = readImage(file, reference) && reference.width == options.width && reference.height == options.height;
+   renderSeconds = 0.0;
+   if (cached) {
+      printf("Reference loaded from %s\n", file.c_str());
+      return reference;
+   }
+
+   printf("Rendering the reference: %d frames on the %s\n", bench.referenceFrames, bench.referenceBackend == Backend::CPU ? "CPU" : "GPU");
+   const double start = now();
+   {
+      std::unique_ptr<BenchRenderer> renderer = BenchRenderer::create(bench.referenceBackend, options, scene, bvh);
+      RenderParams params = options.renderParams();
+      // Uniform sampling, pixels stopped by the adaptive threshold would keep their noise
+      params.adaptiveSampling = false;
+      for (int frame = 0; frame < bench.referenceFrames; frame++) {
+         params.time = REFERENCE_SEED + static_cast<unsigned int>(frame);
+         // Like headless runs, the first frame is 1
+         renderer->render(camera, params, frame + 1);
+      }
+      reference = renderer->image();
+   }
+   renderSeconds = now() - start;
+   printf("Reference rendered in %.1f s\n", renderSeconds);
+
+   std::error_code error;
+   std::filesystem::create_directories(bench.referenceDirectory, error);
+   if (writeImage(file, reference))
+      printf("Reference cached in %s\n", file.c_str());
+   return reference;
+}
+
+struct ConvergencePoint {
+   int frame;
+   // Mean samples per pixel
+   double spp;
+   // Render time only, read back and error computation excluded
+   double seconds;
+   ImageError error;
+};
+
+static int runConvergence(const Options& options, const BenchOptions& bench, const CameraPath& path, Scene& scene, Bvh& bvh, double start) {
+   bool moving = false;
+   const CameraState camera = path.at(0, moving);
+
+   bool referenceCached = false;
+   double referenceSeconds = 0.0;
+   Image reference = loadOrRenderReference(options, bench, scene, bvh, camera, referenceCached, referenceSeconds);
+
+   std::vector<ConvergencePoint> curve;
+   std::unique_ptr<BenchRenderer> renderer = BenchRenderer::create(options.backend, options, scene, bvh);
+   const int frames = bench.frames > 0 ? bench.frames : 64;
+   RenderParams params = options.renderParams();
+   double renderSeconds = 0.0;
+   double timeToFirstFrameMs = 0.0;
+   for (int frame = 0; bench.seconds > 0.0 ? (frame == 0 || renderSeconds < bench.seconds) : frame < frames; frame++) {
+      params.time = static_cast<unsigned int>(frame);
+      double frameStart = now();
+      renderer->render(camera, params, frame + 1);
+      double frameEnd = now();
+      renderSeconds += frameEnd - frameStart;
+      if (frame == 0)
+         timeToFirstFrameMs = (frameEnd - start) * 1000.0;
+
+      double spp = options.adaptiveSampling ? renderer->averageSampleCount() : static_cast<double>(frame + 1) * options.rayPerPixel;
+      curve.push_back(ConvergencePoint{frame + 1, spp, renderSeconds, compareImages(renderer->image(), reference)});
+   }
+
+   const ConvergencePoint& last = curve.back();
+   printf("%s: %d frames (%.1f spp) in %.2f s, RMSE %.5f, relMSE %.5f, FLIP-like %.4f\n", renderer->getName().c_str(), last.frame,
+          last.spp, last.seconds, last.error.rmse, last.error.relMse, last.error.flip);
+   if (!bench.image.empty() && writeImage(bench.image, renderer->image()))
+      printf("Image written to %s\n", bench.image.c_str());
+
+   FILE* out = fopen(bench.json.c_str(), "w");
+   if (!out) {
+      fprintf(stderr, "Unable to write %s\n", bench.json.c_str());
+      return EXIT_FAILURE;
+   }
+   writeHeader(out, options, bench, scene, bvh, renderer->getName());
+   fprintf(out, "  \"time_to_first_frame_ms\": %.3f,\n", timeToFirstFrameMs);
+   fprintf(out, "  \"shader\": {\"build_ms\": %.3f, \"from_cache\": %s},\n", renderer->getShaderBuildMs(), renderer->isShaderFromCache() ? "true" : "false");
+   fprintf(out, "  \"reference\": {\"backend\": \"%s\", \"frames\": %d, \"cached\": %s, \"render_s\": %.3f},\n",
+           bench.referenceBackend == Backend::CPU ? "cpu" : "gpu", bench.referenceFrames, referenceCached ? "true" : "false", referenceSeconds);
+   fprintf(out, "  \"curve\": [\n");
+   for (size_t i = 0; i < curve.size(); i++) {
+      const ConvergencePoint& p = curve[i];
+      fprintf(out, "    {\"frame\": %d, \"spp\": %.2f, \"time_s\": %.5f, \"rmse\": %.6g, \"relmse\": %.6g, \"flip\": %.6g}%s\n",
+              p.frame, p.spp, p.seconds, p.error.rmse, p.error.relMse, p.error.flip, i + 1 < curve.size() ? "," : "");
+   }
+   fprintf(out, "  ]\n}\n");
+
+   return closeJson(out, bench.json) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+   const double start = now();
+
+   BenchOptions bench = parseBenchOptions(argc, argv);
+   Options options = parseOptions(argc, argv);
+   ProgramCache::setEnabled(options.shaderCache);
+   SceneCache::setEnabled(options.sceneCache);
+   CameraPath path = bench.pathFile.empty() ? CameraPath::defaultPath() : CameraPath::load(bench.pathFile);
+
+   // randomScene is seeded, the scene is the same on every run
+   Scene scene = options.randomSpheres > 0 ? randomScene(options.randomSpheres) : defaultScene();
+   Bvh bvh;
+   if (!SceneCache::loadOrBuild(scene, bvh, options.meshes, options.randomInstances))
+      return EXIT_FAILURE;
+
+   if (bench.convergence)
+      return runConvergence(options, bench, path, scene, bvh, start);
+   return runPath(options, bench, path, scene, bvh, start);
+}
@@ -0,0 +1,138 @@
+#include "benchRenderer.hpp"
+
+#include <cstdio>
+
+#include "window.hpp"
+#include "cpu/cpuRenderer.hpp"
+#include "rendering/bvhBuffer.hpp"
+#include "rendering/gladManager.hpp"
+#include "rendering/gpuTimer.hpp"
+#include "rendering/sceneBuffer.hpp"
+#include "rendering/shaderVariants.hpp"
+#include "rendering/tracePass.hpp"
+#include "rendering/wavefrontTracer.hpp"
+
+namespace {
+
+class CpuBenchRenderer : public BenchRenderer {
+public:
+   CpuBenchRenderer(const Options& options, const Scene& scene, const Bvh& bvh) : cpuRenderer(scene, bvh) {
+      cpuRenderer.resize(options.width, options.height);
+      name = "CPU (" + std::to_string(cpuRenderer.threadCount()) + " threads)";
+   }
+
+   void render(const CameraState& camera, const RenderParams& params, int lastMove) override {
+      cpuRenderer.renderFrame(camera, params, lastMove);
+   }
+
+   void saveHistory(const CameraState& camera, float focalLength) override {
+      cpuRenderer.saveHistory(camera, focalLength);
+   }
+
+   [[nodiscard]] Image image() const override { return cpuRenderer.getImage(); }
+
+   [[nodiscard]] double averageSampleCount() const override { return cpuRenderer.averageSampleCount(); }
+
+private:
+   CpuRenderer cpuRenderer;
+};
+
+// Created first and destroyed last, around every GL object of the renderer
+struct HeadlessContext {
+   HeadlessContext(int width, int height) { windowInitHeadless("raytracer_bench", width, height); }
+   ~HeadlessContext() { windowClose(); }
+};
+
+class GpuBenchRenderer : public BenchRenderer {
+public:
+   // The wavefront backend falls back to the fragment one when it can't be built, like Raytracer
+   GpuBenchRenderer(Backend backend, const Options& options, Scene& scene, Bvh& bvh)
+      : context(options.width, options.height), sceneBuffer(!options.forceUniformBuffer),
+        traceShaders("main.vert", "main.frag", sceneBuffer.shaderDefines(), [this](Shader& built) {
+           sceneBuffer.bindBlocks(built.getProgram());
+        }),
+        timer(1), width(options.width), height(options.height) {
+      name = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+
+      fitSceneToBuffer(scene, bvh, sceneBuffer);
+      sceneBuffer.sync(scene);
+
+      traceShaders.setSpecialization(options.specialize);
+      RenderParams params = options.renderParams();
+      const Shader& shader = traceShaders.get(params, true);
+      shaderBuildMs = shader.getBuildMs();
+      shaderFromCache = shader.isFromCache();
+
+      bvhBuffer.upload(bvh);
+      bvhBuffer.uploadMeshes(scene.meshes, scene.instances);
+
+      gladManager::bindVAO(&VAO);
+      gladManager::generateFrameBuffer(width, height);
+      glViewport(0, 0, width, height);
+
+      if (backend == Backend::WAVEFRONT) {
+         wavefront = WavefrontTracer::create(sceneBuffer);
+         if (wavefront)
+            name += " (wavefront)";
+         else
+            printf("Falling back to the fragment shader backend\n");
+      }
+   }
+
+   ~GpuBenchRenderer() override {
+      gladManager::unbindVAO(&VAO);
+   }
+
+   void render(const CameraState& camera, const RenderParams& params, int lastMove) override {
+      timer.begin(0);
+      if (wavefront) {
+         wavefront->trace(bvhBuffer, camera, params, lastMove, width, height);
+         wavefrontSamples = (lastMove <= 1 ? 0 : wavefrontSamples) + params.rayPerPixel;
+      } else {
+         const Shader& shader = traceShaders.get(params, true);
+         writeIndex = traceFrame(shader, sceneBuffer, bvhBuffer, camera, params, lastMove, width, height);
+      }
+      timer.end(0);
+      // Per-frame numbers need the frame to be done, the cost is one pipeline drain per frame
+      glFinish();
+      timer.endFrame();
+   }
+
+   // The wavefront accumulation restarts instead
+   void saveHistory(const CameraState& camera, float focalLength) override {
+      if (!wavefront)
+         ::saveHistory(camera, focalLength, width, height);
+   }
+
+   [[nodiscard]] Image image() const override {
+      return readAccumulation(width, height);
+   }
+
+   [[nodiscard]] double averageSampleCount() const override {
+      return wavefront ? wavefrontSamples : ::averageSampleCount(width, height);
+   }
+
+   [[nodiscard]] double gpuMs() const override { return timer.getMs(0); }
+
+private:
+   HeadlessContext context;
+   SceneBuffer sceneBuffer;
+   ShaderVariants traceShaders;
+   BvhBuffer bvhBuffer;
+   GpuTimer timer;
+   unsigned int VAO = 0;
+   int width;
+   int height;
+   int writeIndex = 0;
+   // Uniform sampling, every pixel of the accumulation has the same count
+   std::unique_ptr<WavefrontTracer> wavefront;
+   double wavefrontSamples = 0.0;
+};
+
+}
+
+std::unique_ptr<BenchRenderer> BenchRenderer::create(Backend backend, const Options& options, Scene& scene, Bvh& bvh) {
+   if (backend == Backend::CPU)
+      return std::make_unique<CpuBenchRenderer>(options, scene, bvh);
+   return std::make_unique<GpuBenchRenderer>(backend, options, scene, bvh);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef BENCHRENDERER_HPP
+#define BENCHRENDERER_HPP
+
+#include <memory>
+#include <string>
+
+#include "options.hpp"
+#include "accel/bvh.hpp"
+#include "rendering/image.hpp"
+#include "rendering/renderParams.hpp"
+#include "scene/scene.hpp"
+
+// One backend driven by the bench loops. The GPU one owns a headless context,
+// only one of them may exist at a time.
+class BenchRenderer {
+public:
+   static std::unique_ptr<BenchRenderer> create(Backend backend, const Options& options, Scene& scene, Bvh& bvh);
+
+   virtual ~BenchRenderer() = default;
+
+   // Render one accumulation frame and wait until it is done
+   virtual void render(const CameraState& camera, const RenderParams& params, int lastMove) = 0;
+
+   // The next frame with lastMove 0 reprojects the current accumulation, traced from camera
+   virtual void saveHistory(const CameraState& camera, float focalLength) = 0;
+
+   // Current accumulation
+   [[nodiscard]] virtual Image image() const = 0;
+
+   // Mean samples per pixel in the accumulation, only tracked with adaptive sampling
+   [[nodiscard]] virtual double averageSampleCount() const = 0;
+
+   // GPU time of the last frame, 0 when not measured
+   [[nodiscard]] virtual double gpuMs() const { return 0.0; }
+
+   [[nodiscard]] const std::string& getName() const { return name; }
+   [[nodiscard]] double getShaderBuildMs() const { return shaderBuildMs; }
+   [[nodiscard]] bool isShaderFromCache() const { return shaderFromCache; }
+
+protected:
+   std::string name;
+   double shaderBuildMs = 0.0;
+   bool shaderFromCache = false;
+};
+
+#endif //BENCHRENDERER_HPP
@@ -0,0 +1,107 @@
+#include "cameraPath.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "rendering/camera.hpp"
+
+static const char* DEFAULT_PATH = R"(
+# Default camera, looking at the spheres
+still 48
+move 24   0 1 3      90 -15   # dolly in
+still 48
+move 24   -2 1.5 3   75 -20   # strafe and turn
+still 48
+)";
+
+CameraPath CameraPath::parse(const std::string& script, const std::string& name) {
+   CameraPath path;
+   CameraPose pose{Camera().Position, YAW, PITCH};
+
+   std::istringstream lines(script);
+   std::string line;
+   int lineNumber = 0;
+   while (std::getline(lines, line)) {
+      lineNumber++;
+      line = line.substr(0, line.find('#'));
+      std::istringstream words(line);
+      std::string kind;
+      if (!(words >> kind))
+         continue; // Empty line
+
+      Segment segment{0, pose, pose, kind == "move"};
+      bool valid = (kind == "still" || kind == "move") && (words >> segment.frames) && segment.frames > 0;
+      if (valid) {
+         CameraPose target{};
+         if (words >> target.position.x >> target.position.y >> target.position.z >> target.yaw >> target.pitch) {
+            segment.to = target;
+            // A still segment with a pose jumps there
+            if (!segment.moving)
+               segment.from = target;
+         } else {
+            valid = !segment.moving && words.eof();
+         }
+      }
+      if (!valid) {
+         fprintf(stderr, "%s:%d: expected 'still <frames> [x y z yaw pitch]' or 'move <frames> x y z yaw pitch'\n", name.c_str(), lineNumber);
+         exit(EXIT_FAILURE);
+      }
+
+      pose = segment.to;
+      path.segments.push_back(segment);
+   }
+
+   if (path.segments.empty()) {
+      fprintf(stderr, "%s: empty camera path\n", name.c_str());
+      exit(EXIT_FAILURE);
+   }
+   return path;
+}
+
+CameraPath CameraPath::load(const std::string& path) {
+   std::ifstream file(path);
+   if (!file) {
+      fprintf(stderr, "Unable to open camera path %s\n", path.c_str());
+      exit(EXIT_FAILURE);
+   }
+   std::stringstream content;
+   content << file.rdbuf();
+   return parse(content.str(), path);
+}
+
+CameraPath CameraPath::defaultPath() {
+   return parse(DEFAULT_PATH, "default path");
+}
+
+int CameraPath::frameCount() const {
+   int count = 0;
+   for (const Segment& segment : segments) {
+      count += segment.frames;
+   }
+   return count;
+}
+
+CameraState CameraPath::at(int frame, bool& moving) const {
+   frame %= frameCount();
+
+   const Segment* segment = &segments.back();
+   for (const Segment& s : segments) {
+      if (frame < s.frames) {
+         segment = &s;
+         break;
+      }
+      frame -= s.frames;
+   }
+
+   moving = segment->moving;
+   // The last frame of a move lands on the target
+   float t = moving ? static_cast<float>(frame + 1) / static_cast<float>(segment->frames) : 1.0f;
+   glm::vec3 position = glm::mix(segment->from.position, segment->to.position, t);
+   float yaw = glm::mix(segment->from.yaw, segment->to.yaw, t);
+   float pitch = glm::mix(segment->from.pitch, segment->to.pitch, t);
+
+   Camera camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+   return CameraState{camera.Position, camera.Front, camera.Up};
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef CAMERAPATH_HPP
+#define CAMERAPATH_HPP
+
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "rendering/renderParams.hpp"
+
+// Camera pose as the interactive Camera stores it
+struct CameraPose {
+   glm::vec3 position;
+   float yaw;
+   float pitch;
+};
+
+// Scripted camera for benchmarks, one segment per line:
+//    still <frames> [x y z yaw pitch]   stay on a pose, accumulation goes on
+//    move <frames> x y z yaw pitch      reach the pose linearly, accumulation restarts every frame
+// '#' starts a comment. The path starts on the default camera pose.
+class CameraPath {
+public:
+   // Exits with a message on a malformed script
+   static CameraPath parse(const std::string& script, const std::string& name);
+   static CameraPath load(const std::string& path);
+   static CameraPath defaultPath();
+
+   [[nodiscard]] int frameCount() const;
+
+   // Frames past the end wrap around. moving tells which kind of segment the frame belongs to.
+   [[nodiscard]] CameraState at(int frame, bool& moving) const;
+
+private:
+   struct Segment {
+      int frames;
+      CameraPose from;
+      CameraPose to;
+      bool moving;
+   };
+
+   std::vector<Segment> segments;
+};
+
+#endif //CAMERAPATH_HPP
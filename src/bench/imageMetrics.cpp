@@ -0,0 +1,60 @@
+#include "imageMetrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glm/glm.hpp"
+
+// Display-linear RGB to CIELAB, D65 white
+static glm::vec3 linearToLab(glm::vec3 rgb) {
+   glm::vec3 xyz(0.4124f * rgb.x + 0.3576f * rgb.y + 0.1805f * rgb.z,
+                 0.2126f * rgb.x + 0.7152f * rgb.y + 0.0722f * rgb.z,
+                 0.0193f * rgb.x + 0.1192f * rgb.y + 0.9505f * rgb.z);
+   xyz /= glm::vec3(0.95047f, 1.0f, 1.08883f);
+
+   auto f = [](float t) {
+      return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.0f / 116.0f;
+   };
+   glm::vec3 v(f(xyz.x), f(xyz.y), f(xyz.z));
+   return glm::vec3(116.0f * v.y - 16.0f, 500.0f * (v.x - v.y), 200.0f * (v.y - v.z));
+}
+
+static float hyab(glm::vec3 a, glm::vec3 b) {
+   glm::vec3 d = a - b;
+   return std::abs(d.x) + std::sqrt(d.y * d.y + d.z * d.z);
+}
+
+static glm::vec3 toneMap(const float* pixel) {
+   glm::vec3 c(std::max(pixel[0], 0.0f), std::max(pixel[1], 0.0f), std::max(pixel[2], 0.0f));
+   return c / (glm::vec3(1.0f) + c);
+}
+
+ImageError compareImages(const Image& test, const Image& reference) {
+   ImageError error;
+   const size_t pixelCount = static_cast<size_t>(reference.width) * reference.height;
+   if (pixelCount == 0 || test.pixels.size() != reference.pixels.size())
+      return error;
+
+   // Largest color distance FLIP considers, between pure green and pure blue
+   static const float maxDistance = hyab(linearToLab(glm::vec3(0.0f, 1.0f, 0.0f)), linearToLab(glm::vec3(0.0f, 0.0f, 1.0f)));
+
+   double squared = 0.0;
+   double relative = 0.0;
+   double flip = 0.0;
+   for (size_t i = 0; i < pixelCount; i++) {
+      const float* t = &test.pixels[i * 4];
+      const float* r = &reference.pixels[i * 4];
+      for (int c = 0; c < 3; c++) {
+         double d = static_cast<double>(t[c]) - r[c];
+         squared += d * d;
+         relative += d * d / (static_cast<double>(r[c]) * r[c] + 0.01);
+      }
+      float distance = hyab(linearToLab(toneMap(t)), linearToLab(toneMap(r)));
+      flip += std::pow(std::min(distance / maxDistance, 1.0f), 0.7f);
+   }
+
+   error.rmse = std::sqrt(squared / static_cast<double>(pixelCount * 3));
+   error.relMse = relative / static_cast<double>(pixelCount * 3);
+   error.flip = flip / static_cast<double>(pixelCount);
+   return error;
+}
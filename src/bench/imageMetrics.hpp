@@ -0,0 +1,21 @@
+#pragma once
+
+#ifndef IMAGEMETRICS_HPP
+#define IMAGEMETRICS_HPP
+
+#include "rendering/image.hpp"
+
+// Error of an image against a reference, RGB channels only
+struct ImageError {
+   double rmse = 0.0;
+   // Squared error relative to the reference value, (t - r)^2 / (r^2 + 0.01)
+   double relMse = 0.0;
+   // Color part of FLIP without its spatial filters: Reinhard tone mapping, CIELAB,
+   // HyAB distance normalized by the green-blue distance and raised to 0.7. 0 = identical, 1 = worst.
+   double flip = 0.0;
+};
+
+// Both images must have the same size
+ImageError compareImages(const Image& test, const Image& reference);
+
+#endif //IMAGEMETRICS_HPP
@@ -0,0 +1,565 @@
+#include "cpuRenderer.hpp"
+
+#include "utils/blueNoise.hpp"
+
+//////////////////////////////
+//          Random          //
+//////////////////////////////
+// Same functions as random.glsl, on 32 bit unsigned integers
+static uint32_t wang_hash(uint32_t x) {
+   x = (x ^ 61u) ^ (x >> 16);
+   x *= 9u;
+   x = x ^ (x >> 4);
+   x *= 0x27d4eb2du;
+   x = x ^ (x >> 15);
+   return x;
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t v) {
+   return wang_hash(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+static float randf(uint32_t& state) {
+   // xorshift32 variant
+   state ^= state << 13;
+   state ^= state >> 17;
+   state ^= state << 5;
+   // normalize to [0,1)
+   return static_cast<float>(state) / 4294967295.0f;
+}
+
+static uint32_t reverseBits(uint32_t x) {
+   x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+   x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+   x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+   x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+   return (x >> 16) | (x << 16);
+}
+
+static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+   x ^= x * 0x3d20adeau;
+   x += seed;
+   x *= (seed >> 16) | 1u;
+   x ^= x * 0x05526c56u;
+   x ^= x * 0x53a22864u;
+   return x;
+}
+
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+   return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+static uint32_t sobol1(uint32_t index) {
+   uint32_t result = 0u;
+   for (uint32_t v = 0x80000000u; index != 0u; index >>= 1, v ^= v >> 1) {
+      if (index & 1u)
+         result ^= v;
+   }
+   return result;
+}
+
+static float toUnitFloat(uint32_t x) {
+   return static_cast<float>(x >> 8) / 16777216.0f;
+}
+
+static float sobol1D(uint32_t index, uint32_t seed) {
+   index = nestedUniformScramble(index, seed);
+   return toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(seed, 0u)));
+}
+
+static glm::vec2 sobol2D(uint32_t index, uint32_t seed) {
+   index = nestedUniformScramble(index, seed);
+   return {toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(seed, 0u))),
+           toUnitFloat(nestedUniformScramble(sobol1(index), hashCombine(seed, 1u)))};
+}
+
+static float blueNoiseRotate(float u, uint32_t pixel, uint32_t dimension) {
+   constexpr uint32_t mask = BLUE_NOISE_SIZE - 1;
+   const uint32_t offset = wang_hash(dimension + 1u);
+   const uint32_t x = ((pixel & 0xffffu) + offset) & mask;
+   const uint32_t y = ((pixel >> 16) + (offset >> 16)) & mask;
+   const float v = u + blueNoiseMask()[y * BLUE_NOISE_SIZE + x];
+   return v - std::floor(v);
+}
+
+static SamplerState makeSampler(Sampler sampler, int x, int y, unsigned int time, uint32_t sampleNumber) {
+   const auto px = static_cast<uint32_t>(x);
+   const auto py = static_cast<uint32_t>(y);
+   uint32_t seed;
+   if (sampler == Sampler::RANDOM)
+      seed = wang_hash(px * 1973u + py * 9277u + (time + 1u) * 26699u + sampleNumber * 911247u);
+   else if (sampler == Sampler::SOBOL)
+      seed = hashCombine(wang_hash(px), py);
+   else
+      seed = (px & 0xffffu) | (py << 16);
+   return {sampler, sampleNumber, seed, 0u};
+}
+
+static float sample1D(SamplerState& s) {
+   const uint32_t dimension = s.dimension++;
+   switch (s.sampler) {
+      case Sampler::RANDOM:
+         return randf(s.seed);
+      case Sampler::SOBOL:
+         return sobol1D(s.index, hashCombine(s.seed, dimension));
+      default:
+         return blueNoiseRotate(sobol1D(s.index, wang_hash(dimension)), s.seed, 2u * dimension);
+   }
+}
+
+static glm::vec2 sample2D(SamplerState& s) {
+   const uint32_t dimension = s.dimension++;
+   switch (s.sampler) {
+      case Sampler::RANDOM: {
+         float u1 = randf(s.seed);
+         float u2 = randf(s.seed);
+         return {u1, u2};
+      }
+      case Sampler::SOBOL:
+         return sobol2D(s.index, hashCombine(s.seed, dimension));
+      default: {
+         glm::vec2 u = sobol2D(s.index, wang_hash(dimension));
+         return {blueNoiseRotate(u.x, s.seed, 2u * dimension), blueNoiseRotate(u.y, s.seed, 2u * dimension + 1u)};
+      }
+   }
+}
+
+// --- Cosine-weighted hemisphere sampling ---
+static glm::vec3 cosineSampleHemisphere(float u1, float u2) {
+   float r = std::sqrt(u1);
+   float theta = 2.0f * 3.14159265359f * u2;
+   float x = r * std::cos(theta);
+   float y = r * std::sin(theta);
+   float z = std::sqrt(std::max(0.0f, 1.0f - u1));
+   return {x, y, z}; // local-space (z = up)
+}
+
+static glm::vec3 makeTangentBasis(const glm::vec3& n) {
+   glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+   return glm::normalize(glm::cross(up, n));
+}
+
+static glm::vec3 sampleHemisphereCosine(const glm::vec3& normal, SamplerState& rng) {
+   glm::vec2 u = sample2D(rng);
+   glm::vec3 samplecos = cosineSampleHemisphere(u.x, u.y); // local coords
+   glm::vec3 tangentX = makeTangentBasis(normal);
+   glm::vec3 tangentY = glm::cross(normal, tangentX);
+   // transform to world
+   return glm::normalize(samplecos.x * tangentX + samplecos.y * tangentY + samplecos.z * normal);
+}
+
+static glm::vec3 getRayDir(const CameraState& camera, float focalLength, glm::vec2 resolution, glm::vec2 texCoord) {
+   glm::vec3 camSide = glm::normalize(glm::cross(camera.direction, camera.up));
+   glm::vec2 p = 2.0f * texCoord - 1.0f;
+   p.x *= resolution.x / resolution.y;
+   return glm::normalize(p.x * camSide + p.y * camera.up + focalLength * camera.direction);
+}
+
+//////////////////////////////
+//     Light sampling       //
+//////////////////////////////
+// Same functions as trace.glsl, PI and TWO_PI as in const.glsl
+static constexpr float PI = 3.14159265359f;
+static constexpr float TWO_PI = 6.28318530718f;
+
+static float powerHeuristic(float pdf, float otherPdf) {
+   return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+static float coneOneMinusCos(const glm::vec3& p, const Sphere& s) {
+   glm::vec3 d = s.center - p;
+   float sin2 = s.radius * s.radius / glm::dot(d, d);
+   if (sin2 >= 1.0f)
+      return 0.0f;
+   return sin2 / (1.0f + std::sqrt(1.0f - sin2));
+}
+
+static glm::vec3 sampleCone(const glm::vec3& axis, float oneMinusCos, float u1, float u2) {
+   float cosTheta = 1.0f - u1 * oneMinusCos;
+   float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+   float phi = TWO_PI * u2;
+   glm::vec3 tangentX = makeTangentBasis(axis);
+   glm::vec3 tangentY = glm::cross(axis, tangentX);
+   return glm::normalize(sinTheta * std::cos(phi) * tangentX + sinTheta * std::sin(phi) * tangentY + cosTheta * axis);
+}
+
+static constexpr float MIN_DIST = 0.001f; // Avoid self-intersection
+static constexpr float MAX_DIST = 1000.0f; // Prevent infinite rays
+static constexpr float NO_HIT = 1e30f;
+
+// Distance to the first intersection in [MIN_DIST, MAX_DIST], or NO_HIT
+static float sphereDistance(const glm::vec3& origin, const glm::vec3& direction, const Sphere& s) {
+   glm::vec3 offsetRayOrigin = origin - s.center;
+   float a = glm::dot(direction, direction);
+   float b = 2.0f * glm::dot(offsetRayOrigin, direction);
+   float c = glm::dot(offsetRayOrigin, offsetRayOrigin) - s.radius * s.radius;
+
+   float discriminant = b * b - 4.0f * a * c;
+
+   if (discriminant >= 0.0f) {
+      float sqrtDisc = std::sqrt(discriminant);
+      float dst1 = (-b - sqrtDisc) / (2.0f * a);
+      float dst2 = (-b + sqrtDisc) / (2.0f * a);
+
+      // Choose the closest valid intersection
+      float dst = std::min(dst1, dst2);
+      if (dst < MIN_DIST) {
+         dst = std::max(dst1, dst2); // Try the other solution
+      }
+
+      if (dst >= MIN_DIST && dst <= MAX_DIST)
+         return dst;
+   }
+   return NO_HIT;
+}
+
+static float luminance(const glm::vec3& c) {
+   return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Adaptive sampling, same constants and formulas as main.frag
+static constexpr float ADAPTIVE_MIN_SAMPLES = 16.0f;
+static constexpr float ADAPTIVE_MAX_SHARE = 4.0f;
+static constexpr float ADAPTIVE_DARK = 0.01f;
+static constexpr float ADAPTIVE_PRIOR = 1.0f;
+
+static int adaptiveSampleCount(const glm::vec4& moments, float meanError, int rayPerPixel, float threshold) {
+   if (moments.z < std::max(ADAPTIVE_MIN_SAMPLES, 2.0f * static_cast<float>(rayPerPixel)))
+      return rayPerPixel;
+   if (moments.w < threshold)
+      return 0;
+   float share = moments.w / std::max(meanError, 1e-6f);
+   return static_cast<int>(glm::clamp(std::floor(static_cast<float>(rayPerPixel) * share + 0.5f), 1.0f, ADAPTIVE_MAX_SHARE * static_cast<float>(rayPerPixel)));
+}
+
+// Reprojection, same constants as main.frag
+static constexpr float REPROJECT_TOLERANCE = 2.0f;
+static constexpr float REPROJECT_MIN_COSINE = 0.1f;
+static constexpr float REPROJECT_MAX_SAMPLES = 1024.0f;
+
+static glm::vec4 updateMoments(const glm::vec4& moments, float sumL, float sumL2, float count, bool primaryHit) {
+   float total = moments.z + count;
+   float mean = (moments.x * moments.z + sumL) / total;
+   float meanSq = (moments.y * moments.z + sumL2) / total;
+   float variance = std::max(meanSq - mean * mean, 0.0f) + ADAPTIVE_PRIOR / total;
+   float error = primaryHit ? std::sqrt(variance / total) / (mean + ADAPTIVE_DARK) : 0.0f;
+   return {mean, meanSq, total, error};
+}
+
+CpuRenderer::CpuRenderer(const Scene& scene, const Bvh& bvh, ThreadPool& pool) : scene(scene), bvh(bvh), pool(pool) {}
+
+void CpuRenderer::resize(int width, int height) {
+   image.width = width;
+   image.height = height;
+   image.pixels.assign(static_cast<size_t>(width) * height * 4, 0.0f);
+   accumulation.assign(static_cast<size_t>(width) * height, glm::vec4(0.0f));
+   moments.assign(static_cast<size_t>(width) * height, glm::vec4(0.0f));
+   firstHits.assign(static_cast<size_t>(width) * height, glm::vec4(0.0f));
+   historyAccumulation.clear();
+   historyFirstHits.clear();
+   historyValid = false;
+}
+
+void CpuRenderer::saveHistory(const CameraState& camera, float focalLength) {
+   historyAccumulation = accumulation;
+   historyFirstHits = firstHits;
+   historyValid = true;
+   historyCamera = camera;
+   historyFocalLength = focalLength;
+}
+
+void CpuRenderer::dropHistory() {
+   historyValid = false;
+}
+
+float CpuRenderer::averageSampleCount() const {
+   double sum = 0.0;
+   for (const glm::vec4& m : moments)
+      sum += m.z;
+   return moments.empty() ? 0.0f : static_cast<float>(sum / static_cast<double>(moments.size()));
+}
+
+CpuRenderer::HitInfo CpuRenderer::RaySphere(const Ray& ray) const {
+   HitInfo closestHit{false, 1e9f, glm::vec3(0), glm::vec3(0), 0, nullptr};
+
+   bvh.traverse(ray.origin, ray.direction, MAX_DIST, [&](uint32_t index, float& tMax) {
+      if (index >= scene.spheres.size()) {
+         // Mesh instance: the BVH of the mesh in object space, flat shaded like intersectMesh in scene.glsl
+         const MeshInstance& instance = scene.instances[index - scene.spheres.size()];
+         const Mesh& mesh = scene.meshes[instance.mesh];
+         const glm::vec3 origin = instance.objectPoint(ray.origin);
+         const glm::vec3 direction = instance.objectVector(ray.direction);
+         const MeshTriangle* hitTriangle = nullptr;
+         mesh.bvh.traverse(origin, direction, tMax, [&](uint32_t triangle, float& meshMax) {
+            float dst = intersectTriangle(origin, direction, mesh.triangles[triangle], MIN_DIST, meshMax);
+            if (dst < closestHit.dst) {
+               closestHit.dst = dst;
+               hitTriangle = &mesh.triangles[triangle];
+               meshMax = dst;
+            }
+         });
+         if (hitTriangle) {
+            glm::vec3 normal = glm::normalize(instance.worldNormal(glm::cross(hitTriangle->edge1, hitTriangle->edge2)));
+            closestHit.didHit = true;
+            closestHit.hitPoint = ray.origin + ray.direction * closestHit.dst;
+            closestHit.normal = glm::dot(normal, ray.direction) < 0.0f ? normal : -normal;
+            closestHit.material = instance.material;
+            closestHit.sphere = nullptr;
+            tMax = closestHit.dst;
+         }
+         return;
+      }
+      const Sphere& s = scene.spheres[index];
+      float dst = sphereDistance(ray.origin, ray.direction, s);
+      if (dst < closestHit.dst) {
+         closestHit.didHit = true;
+         closestHit.dst = dst;
+         closestHit.hitPoint = ray.origin + ray.direction * dst;
+         closestHit.normal = glm::normalize(closestHit.hitPoint - s.center);
+         closestHit.material = s.material;
+         closestHit.sphere = &s;
+         tMax = dst;
+      }
+   });
+   return closestHit;
+}
+
+bool CpuRenderer::occluded(const Ray& ray, float maxDist) const {
+   return bvh.anyHit(ray.origin, ray.direction, maxDist, [&](uint32_t index) {
+      if (index < scene.spheres.size())
+         return sphereDistance(ray.origin, ray.direction, scene.spheres[index]) < maxDist;
+      const MeshInstance& instance = scene.instances[index - scene.spheres.size()];
+      const Mesh& mesh = scene.meshes[instance.mesh];
+      const glm::vec3 origin = instance.objectPoint(ray.origin);
+      const glm::vec3 direction = instance.objectVector(ray.direction);
+      return mesh.bvh.anyHit(origin, direction, maxDist, [&](uint32_t triangle) {
+         return intersectTriangle(origin, direction, mesh.triangles[triangle], MIN_DIST, maxDist) < maxDist;
+      });
+   });
+}
+
+float CpuRenderer::lightPdf(const glm::vec3& p, int sphere) const {
+   if (sphere < 0)
+      return 0.0f;
+   float oneMinusCos = coneOneMinusCos(p, scene.spheres[sphere]);
+   if (oneMinusCos == 0.0f || emitters.empty())
+      return 0.0f;
+   return 1.0f / (TWO_PI * oneMinusCos * static_cast<float>(emitters.size()));
+}
+
+glm::vec3 CpuRenderer::sampleLight(const HitInfo& hit, const glm::vec3& origin, SamplerState& rng) const {
+   if (emitters.empty())
+      return glm::vec3(0.0f);
+   const int emitterCount = static_cast<int>(emitters.size());
+   int e = std::min(static_cast<int>(sample1D(rng) * static_cast<float>(emitterCount)), emitterCount - 1);
+   glm::vec2 u = sample2D(rng);
+
+   // A sphere never lights itself, the directions of its cone are below the surface
+   const Sphere& light = scene.spheres[emitters[e]];
+   if (&light == hit.sphere)
+      return glm::vec3(0.0f);
+   float oneMinusCos = coneOneMinusCos(origin, light);
+   if (oneMinusCos == 0.0f)
+      return glm::vec3(0.0f);
+   glm::vec3 direction = sampleCone(glm::normalize(light.center - origin), oneMinusCos, u.x, u.y);
+   float cosine = glm::dot(hit.normal, direction);
+   if (cosine <= 0.0f)
+      return glm::vec3(0.0f);
+
+   // The shadow ray stops just before the light, which may be missed at the rim of the cone
+   float lightDist = sphereDistance(origin, direction, light);
+   if (lightDist == NO_HIT || occluded(Ray{origin, direction}, lightDist * (1.0f - 1e-4f)))
+      return glm::vec3(0.0f);
+
+   const Material& emitter = scene.materialOf(light);
+   float pdf = 1.0f / (TWO_PI * oneMinusCos * static_cast<float>(emitterCount));
+   float bsdfPdf = cosine / PI;
+   return glm::vec3(emitter.emissionColor) * emitter.emissionStrength * (bsdfPdf / pdf) * powerHeuristic(pdf, bsdfPdf);
+}
+
+glm::vec3 CpuRenderer::Trace(Ray ray, SamplerState rng, const RenderParams& params) const {
+   const int maxBounces = params.maxBounces;
+   glm::vec3 radiance(0.0f);
+   glm::vec3 throughput(1.0f);
+   float bsdfPdf = 0.0f;
+   const bool lightSampling = params.emission && params.lightSampling;
+
+   for (int bounce = 0; bounce < maxBounces; ++bounce) {
+      HitInfo hit = RaySphere(ray);
+      if (!hit.didHit) {
+         break;
+      }
+
+      const Material& material = scene.materials[hit.material];
+      float emit = material.emissionStrength;
+      if (params.emission && emit > 0.0f) {
+         // MIS with the light sample of the previous hit, see scatter in trace.glsl
+         float weight = 1.0f;
+         if (lightSampling && bounce > 0)
+            weight = powerHeuristic(bsdfPdf, lightPdf(ray.origin, hit.sphere ? static_cast<int>(hit.sphere - scene.spheres.data()) : -1));
+         radiance += throughput * glm::vec3(material.emissionColor) * emit * weight;
+      }
+
+      // offset to avoid self-intersection
+      ray.origin = hit.hitPoint + hit.normal * 1e-4f;
+
+      if (lightSampling)
+         radiance += throughput * glm::vec3(material.color) * sampleLight(hit, ray.origin, rng);
+
+      glm::vec3 newDir = sampleHemisphereCosine(hit.normal, rng);
+      bsdfPdf = glm::dot(hit.normal, newDir) / PI;
+
+      // lambertian BRDF/pdf => albedo
+      throughput *= glm::vec3(material.color);
+
+      ray.direction = newDir;
+
+      // Russian roulette after few bounces
+      if (params.russianRoulette && bounce > maxBounces / 4) {
+         float p = std::max(std::max(throughput.x, throughput.y), throughput.z);
+         float r = sample1D(rng);
+         if (r > p) break;
+         throughput /= std::max(p, 1e-6f);
+      }
+   }
+
+   return radiance;
+}
+
+void CpuRenderer::renderTile(const FrameContext& ctx, int tileX, int tileY) {
+   const int x0 = tileX * TILE_SIZE;
+   const int y0 = tileY * TILE_SIZE;
+   const int x1 = std::min(x0 + TILE_SIZE, image.width);
+   const int y1 = std::min(y0 + TILE_SIZE, image.height);
+   const int rayPerPixel = ctx.params.rayPerPixel;
+
+   for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+         // gl_FragCoord is the pixel center
+         glm::vec2 texCoord = (glm::vec2(static_cast<float>(x), static_cast<float>(y)) + 0.5f) / ctx.resolution;
+         Ray r{ctx.camera.position, getRayDir(ctx.camera, ctx.params.focalLength, ctx.resolution, texCoord)};
+         const size_t index = static_cast<size_t>(y) * image.width + x;
+
+         HitInfo primary{false, 1e9f, glm::vec3(0), glm::vec3(0), 0, nullptr};
+         if (ctx.params.adaptiveSampling || ctx.params.reprojection)
+            primary = RaySphere(r);
+         glm::vec4 history(0.0f);
+         if (ctx.params.reprojection) {
+            firstHits[index] = primary.didHit ? glm::vec4(primary.hitPoint, 1.0f) : glm::vec4(0.0f);
+            if (ctx.reproject)
+               history = reprojectHistory(ctx, primary);
+         }
+
+         // Radiance sum and sample count, like the output of main.frag
+         glm::vec4 frame(0.0f);
+         if (ctx.params.adaptiveSampling) {
+            frame = traceAdaptivePixel(ctx, r, primary.didHit, x, y);
+         } else {
+            // Samples are numbered from the start of the accumulation, see main.frag
+            const uint32_t firstSample = static_cast<uint32_t>(std::max(ctx.lastMove, 1) - 1) * static_cast<uint32_t>(rayPerPixel);
+            glm::vec3 sum(0.0f);
+            for (int i = 0; i < rayPerPixel; i++)
+               sum += Trace(r, makeSampler(ctx.params.sampler, x, y, ctx.params.time, firstSample + static_cast<uint32_t>(i)), ctx.params);
+            frame = glm::vec4(sum, static_cast<float>(rayPerPixel));
+         }
+         // A converged adaptive pixel adds nothing, never on the first frame
+         if (frame.w > 0.0f)
+            frame += history;
+
+         // Same as the cleared then blended accumulation texture
+         glm::vec4& accum = accumulation[index];
+         if (ctx.lastMove <= 1)
+            accum = glm::vec4(0.0f);
+         accum += frame;
+
+         float* pixel = &image.pixels[index * 4];
+         for (int c = 0; c < 3; c++)
+            pixel[c] = accum.w > 0.0f ? accum[c] / accum.w : 0.0f;
+         pixel[3] = 1.0f;
+      }
+   }
+}
+
+glm::vec4 CpuRenderer::traceAdaptivePixel(const FrameContext& ctx, const Ray& r, bool primaryHit, int x, int y) {
+   const size_t index = static_cast<size_t>(y) * image.width + x;
+   glm::vec4 m = ctx.lastMove <= 1 ? glm::vec4(0.0f) : moments[index];
+   int sampleCount = adaptiveSampleCount(m, ctx.meanError, ctx.params.rayPerPixel, ctx.params.adaptiveThreshold);
+   if (sampleCount == 0) {
+      // Converged: nothing added, the moments stay
+      return glm::vec4(0.0f);
+   }
+
+   const auto firstSample = static_cast<uint32_t>(m.z);
+   glm::vec3 sum(0.0f);
+   float sumL = 0.0f;
+   float sumL2 = 0.0f;
+   for (int i = 0; i < sampleCount; i++) {
+      glm::vec3 t = Trace(r, makeSampler(ctx.params.sampler, x, y, ctx.params.time, firstSample + static_cast<uint32_t>(i)), ctx.params);
+      sum += t;
+      float l = luminance(t);
+      sumL += l;
+      sumL2 += l * l;
+   }
+
+   moments[index] = updateMoments(m, sumL, sumL2, static_cast<float>(sampleCount), primaryHit);
+   return {sum, static_cast<float>(sampleCount)};
+}
+
+void CpuRenderer::renderFrame(const CameraState& camera, const RenderParams& params, int lastMove) {
+   if (image.width <= 0 || image.height <= 0)
+      return;
+   emitters = scene.emitters();
+
+   float meanError = 0.0f;
+   if (params.adaptiveSampling && lastMove > 1) {
+      double sum = 0.0;
+      for (const glm::vec4& m : moments)
+         sum += m.w;
+      meanError = static_cast<float>(sum / static_cast<double>(moments.size()));
+   }
+
+   const bool reproject = params.reprojection && lastMove <= 1 && historyValid;
+   FrameContext ctx{camera, params, lastMove, glm::vec2(static_cast<float>(image.width), static_cast<float>(image.height)), meanError, reproject};
+   const int tilesX = (image.width + TILE_SIZE - 1) / TILE_SIZE;
+   const int tilesY = (image.height + TILE_SIZE - 1) / TILE_SIZE;
+
+   pool.parallelFor(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile) {
+      renderTile(ctx, static_cast<int>(tile % tilesX), static_cast<int>(tile / tilesX));
+   });
+}
+
+glm::vec4 CpuRenderer::reprojectHistory(const FrameContext& ctx, const HitInfo& primary) const {
+   if (!primary.didHit)
+      return glm::vec4(0.0f);
+
+   // Pixel of the point in the history view, inverse of getRayDir
+   glm::vec3 v = primary.hitPoint - historyCamera.position;
+   float z = glm::dot(v, historyCamera.direction);
+   if (z <= 0.0f)
+      return glm::vec4(0.0f);
+   glm::vec3 historySide = glm::normalize(glm::cross(historyCamera.direction, historyCamera.up));
+   glm::vec2 p = historyFocalLength * glm::vec2(glm::dot(v, historySide), glm::dot(v, historyCamera.up)) / z;
+   p.x /= ctx.resolution.x / ctx.resolution.y;
+   glm::vec2 pixel = (p * 0.5f + 0.5f) * ctx.resolution;
+   if (pixel.x < 0.0f || pixel.y < 0.0f || pixel.x >= ctx.resolution.x || pixel.y >= ctx.resolution.y)
+      return glm::vec4(0.0f);
+
+   const size_t index = static_cast<size_t>(pixel.y) * image.width + static_cast<size_t>(pixel.x);
+   const glm::vec4& hit = historyFirstHits[index];
+   const glm::vec4& accum = historyAccumulation[index];
+   if (hit.w == 0.0f || accum.w == 0.0f)
+      return glm::vec4(0.0f);
+
+   // Disocclusion: the history pixel sees another surface
+   float dist = glm::length(primary.hitPoint - ctx.camera.position);
+   float cosine = std::max(std::abs(glm::dot(primary.normal, primary.hitPoint - ctx.camera.position)) / dist, REPROJECT_MIN_COSINE);
+   float footprint = 2.0f * dist / (ctx.resolution.y * ctx.params.focalLength * cosine);
+   float error = glm::length(glm::vec3(hit) - primary.hitPoint) / (REPROJECT_TOLERANCE * footprint);
+   if (error >= 1.0f)
+      return glm::vec4(0.0f);
+
+   float magnification = std::min(1.0f, dist / glm::length(v));
+   float confidence = (1.0f - error * error) * magnification * magnification;
+   float kept = std::min(accum.w, REPROJECT_MAX_SAMPLES) * confidence;
+   return {glm::vec3(accum) * (kept / accum.w), kept};
+}
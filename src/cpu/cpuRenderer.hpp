@@ -0,0 +1,110 @@
+#pragma once
+
+#ifndef CPURENDERER_HPP
+#define CPURENDERER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "accel/bvh.hpp"
+#include "rendering/image.hpp"
+#include "rendering/renderParams.hpp"
+#include "scene/scene.hpp"
+#include "utils/threadPool.hpp"
+
+// Sample sequence of a path, see SamplerState in random.glsl
+struct SamplerState {
+   Sampler sampler;
+   uint32_t index;
+   uint32_t seed;
+   uint32_t dimension;
+};
+
+// CPU port of the path tracer in run/main.frag.
+// Same sampling, same random streams and same accumulation, so both backends converge to the same image.
+class CpuRenderer {
+public:
+   // bvh is built over scene.primitiveBounds(), the meshes are built
+   CpuRenderer(const Scene& scene, const Bvh& bvh, ThreadPool& pool = ThreadPool::global());
+
+   void resize(int width, int height);
+
+   // Trace one frame of rayPerPixel samples per pixel and add it to the previous ones,
+   // a new accumulation starts when lastMove <= 1 (it follows gladManager::frameSinceLastMove).
+   void renderFrame(const CameraState& camera, const RenderParams& params, int lastMove);
+
+   // Accumulated image, already divided by the sample counts (alpha = 1), bottom row first like the GPU textures
+   [[nodiscard]] const Image& getImage() const { return image; }
+
+   [[nodiscard]] unsigned int threadCount() const { return pool.concurrency(); }
+
+   // Mean samples per pixel since the last restart, adaptive sampling only
+   [[nodiscard]] float averageSampleCount() const;
+
+   // Same as saveHistory and dropHistory of tracePass: the first frame of the next accumulation
+   // reprojects the current one, traced from camera (RenderParams::reprojection)
+   void saveHistory(const CameraState& camera, float focalLength);
+   void dropHistory();
+
+   static constexpr int TILE_SIZE = 16;
+
+private:
+   struct Ray {
+      glm::vec3 origin;
+      glm::vec3 direction;
+   };
+
+   struct HitInfo {
+      bool didHit;
+      float dst;
+      glm::vec3 hitPoint;
+      glm::vec3 normal;
+      int material;
+      // nullptr for the meshes
+      const Sphere* sphere;
+   };
+
+   struct FrameContext {
+      const CameraState& camera;
+      const RenderParams& params;
+      int lastMove;
+      glm::vec2 resolution;
+      // Image average of the relative error, from the previous frame
+      float meanError;
+      // First frame of an accumulation with a history to start from
+      bool reproject;
+   };
+
+   void renderTile(const FrameContext& ctx, int tileX, int tileY);
+   // Radiance sum and sample count of the pixel for this frame, updates its moments
+   glm::vec4 traceAdaptivePixel(const FrameContext& ctx, const Ray& r, bool primaryHit, int x, int y);
+   // Radiance sum and sample count kept from the history, see main.frag
+   [[nodiscard]] glm::vec4 reprojectHistory(const FrameContext& ctx, const HitInfo& primary) const;
+
+   [[nodiscard]] HitInfo RaySphere(const Ray& ray) const;
+   [[nodiscard]] bool occluded(const Ray& ray, float maxDist) const;
+   // Next event estimation, see sampleLight and lightPdf in trace.glsl
+   [[nodiscard]] glm::vec3 sampleLight(const HitInfo& hit, const glm::vec3& origin, SamplerState& rng) const;
+   [[nodiscard]] float lightPdf(const glm::vec3& p, int sphere) const;
+   [[nodiscard]] glm::vec3 Trace(Ray ray, SamplerState rng, const RenderParams& params) const;
+
+   const Scene& scene;
+   const Bvh& bvh;
+   ThreadPool& pool;
+   // Scene::emitters, taken at every frame: the scene may be edited in between
+   std::vector<int> emitters;
+   Image image;
+   // Same layout as gladManager::accumTexture: radiance sum, sample count
+   std::vector<glm::vec4> accumulation;
+   // Same layout as the moment textures of main.frag
+   std::vector<glm::vec4> moments;
+   // Same layout as gladManager::firstHitTexture and the history textures
+   std::vector<glm::vec4> firstHits;
+   std::vector<glm::vec4> historyAccumulation;
+   std::vector<glm::vec4> historyFirstHits;
+   bool historyValid = false;
+   CameraState historyCamera{};
+   float historyFocalLength = 1.0f;
+};
+
+#endif //CPURENDERER_HPP
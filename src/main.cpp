@@ -1,44 +1,215 @@
 
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+#include "options.hpp"
 #include "window.hpp"
+#include "accel/bvh.hpp"
+#include "cpu/cpuRenderer.hpp"
 #include "imgui/imGuiManager.hpp"
+#include "rendering/bvhBuffer.hpp"
 #include "rendering/camera.hpp"
+#include "rendering/denoisePass.hpp"
+#include "rendering/dynamicResolution.hpp"
 #include "rendering/gladManager.hpp"
+#include "rendering/gpuTimer.hpp"
+#include "rendering/image.hpp"
+#include "rendering/programCache.hpp"
+#include "rendering/renderParams.hpp"
+#include "rendering/sceneBuffer.hpp"
 #include "rendering/shader.hpp"
+#include "rendering/shaderReloader.hpp"
+#include "rendering/shaderVariants.hpp"
+#include "rendering/tracePass.hpp"
+#include "rendering/traceScheduler.hpp"
+#include "rendering/wavefrontTracer.hpp"
+#include "scene/scene.hpp"
+#include "scene/sceneCache.hpp"
+#include "utils/frameStats.hpp"
+
+// Uniforms of screenShader.frag, hashed at compile time
+static constexpr UniformId UV_SCALE("uvScale");
 
 Window* window;
 
-std::vector<Sphere> spheres = {
-   Sphere{
-      .center = glm::vec3(0, 0, 10),
-      .radius = 2
-   },
-   Sphere{
-      .center = glm::vec3(10, 0, 10),
-      .radius = 1
-   },
-   Sphere{
-      .center = glm::vec3(10, 0, 10),
-      .radius = 1
+Scene scene;
+Bvh bvh;
+
+// Wall clock in seconds, usable before GLFW is initialized (headless runs never initialize it)
+static double now() {
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static CameraState cameraState() {
+   const Camera& camera = gladManager::getCamera();
+   return CameraState{camera.Position, camera.Front, camera.Up};
+}
+
+// Copy the CPU accumulation into the accumulation texture so it can be displayed like the GPU one.
+// It is already normalized, the counts (alpha) are 1.
+static void uploadCpuImage(const Image& image, GLuint texture) {
+   glBindTexture(GL_TEXTURE_2D, texture);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, GL_RGBA, GL_FLOAT, image.pixels.data());
+}
+
+// samplesPerPixel: accumulated over every frame
+static void printThroughput(const Options& options, double elapsed, double samplesPerPixel) {
+   double samples = static_cast<double>(options.width) * options.height * samplesPerPixel;
+   printf("Rendered in %.2f s (%.2f ms/frame, %.2f Msamples/s)\n", elapsed, elapsed * 1000.0 / options.frames, samples / elapsed * 1e-6);
+   if (options.adaptiveSampling)
+      printf("Adaptive sampling: %.1f samples per pixel on average, budget %d\n", samplesPerPixel, options.rayPerPixel * options.frames);
+}
+
+// The CPU backend needs no OpenGL context at all
+static int runHeadlessCpu(const Options& options) {
+   CpuRenderer cpuRenderer(scene, bvh);
+   cpuRenderer.resize(options.width, options.height);
+
+   RenderParams params = options.renderParams();
+   CameraState camera = cameraState();
+
+   printf("Rendering %d frames at %dx%d (%d rays per pixel) on %u CPU threads\n", options.frames, options.width, options.height, options.rayPerPixel, cpuRenderer.threadCount());
+   double start = now();
+   for (int frame = 0; frame < options.frames; frame++) {
+      gladManager::frameSinceLastMove++;
+      cpuRenderer.renderFrame(camera, params, gladManager::frameSinceLastMove);
+      params.time++;
    }
-};
+   double elapsed = now() - start;
+   printThroughput(options, elapsed, options.adaptiveSampling ? cpuRenderer.averageSampleCount() : static_cast<double>(options.rayPerPixel) * options.frames);
+
+   bool written = writeImage(options.output, cpuRenderer.getImage());
+   if (written)
+      printf("Image written to %s\n", options.output.c_str());
+   return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Accumulate a fixed number of frames offscreen, write the result to disk and exit
+static int runHeadless(const Options& options) {
+   if (options.backend == Backend::CPU)
+      return runHeadlessCpu(options);
+
+   printf("Initializing headless context\n");
+   window = windowInitHeadless("RayTracer", options.width, options.height);
+
+   SceneBuffer sceneBuffer(!options.forceUniformBuffer);
+   fitSceneToBuffer(scene, bvh, sceneBuffer);
+   sceneBuffer.sync(scene);
+
+   RenderParams params = options.renderParams();
+
+   ShaderVariants traceShaders("main.vert","main.frag",sceneBuffer.shaderDefines(), [&](Shader& built) {
+      sceneBuffer.bindBlocks(built.getProgram());
+   });
+   traceShaders.setSpecialization(options.specialize);
+   const Shader& shader = traceShaders.get(params, true);
+
+   if (ProgramCache::getSavedMs() > 0.0)
+      printf("Shader cache saved %.1f ms of compilation\n", ProgramCache::getSavedMs());
+
+   BvhBuffer bvhBuffer;
+   bvhBuffer.upload(bvh);
+   bvhBuffer.uploadMeshes(scene.meshes, scene.instances);
+
+   unsigned int VAO;
+   gladManager::bindVAO(&VAO);
+
+   gladManager::generateFrameBuffer(options.width, options.height);
+   glViewport(0, 0, options.width, options.height);
+
+   std::unique_ptr<WavefrontTracer> wavefront;
+   if (options.backend == Backend::WAVEFRONT) {
+      wavefront = WavefrontTracer::create(sceneBuffer);
+      if (!wavefront)
+         printf("Falling back to the fragment shader backend\n");
+      else if (options.adaptiveSampling)
+         printf("Adaptive sampling is not supported by the wavefront backend, sampling uniformly\n");
+   }
+
+   printf("Rendering %d frames at %dx%d (%d rays per pixel%s)\n", options.frames, options.width, options.height, options.rayPerPixel, wavefront ? ", wavefront" : "");
+   double start = now();
+   int writeIndex = 0;
+   for (int frame = 0; frame < options.frames; frame++) {
+      gladManager::frameSinceLastMove++;
+      if (wavefront)
+         wavefront->trace(bvhBuffer, cameraState(), params, gladManager::frameSinceLastMove, options.width, options.height);
+      else
+         writeIndex = traceFrame(shader, sceneBuffer, bvhBuffer, cameraState(), params, gladManager::frameSinceLastMove, options.width, options.height);
+      params.time++;
+   }
+   glFinish();
+   double elapsed = now() - start;
+   printThroughput(options, elapsed, options.adaptiveSampling && !wavefront ? averageSampleCount(options.width, options.height) : static_cast<double>(options.rayPerPixel) * options.frames);
+
+   Image image = readAccumulation(options.width, options.height);
+   bool written = writeImage(options.output, image);
+   if (written)
+      printf("Image written to %s\n", options.output.c_str());
+
+   gladManager::unbindVAO(&VAO);
+   windowClose();
+
+   return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+   Options options = parseOptions(argc, argv);
+   ProgramCache::setEnabled(options.shaderCache);
+   SceneCache::setEnabled(options.sceneCache);
+   scene = options.randomSpheres > 0 ? randomScene(options.randomSpheres) : defaultScene();
+   if (!SceneCache::loadOrBuild(scene, bvh, options.meshes, options.randomInstances))
+      return EXIT_FAILURE;
+   printf("Scene: %zu spheres, %zu meshes (%zu triangles), %zu instances (%zu triangles), %zu materials\n", scene.spheres.size(), scene.meshes.size(),
+          scene.triangleCount(), scene.instances.size(), scene.instancedTriangleCount(), scene.materials.size());
+   bvh.printStats("Scene");
+
+   if (options.headless)
+      return runHeadless(options);
 
-int main() {
    printf("Initializing GLFW\n");
-   window = windowInit("RayTracer",800,600);
+   window = windowInit("RayTracer",options.width,options.height);
    glfwPollEvents();
    printf("GLFW initialized\n");
 
-   // Used to render the raytraced image to a texture
-   Shader shader("main.vert","main.frag");
+   SceneBuffer sceneBuffer(!options.forceUniformBuffer);
+   fitSceneToBuffer(scene, bvh, sceneBuffer);
+   sceneBuffer.sync(scene);
+
+   // Edited shader files are rebuilt while running, the old program stays until the new one links
+   ShaderReloader shaderReloader;
+   bool traceShaderReloaded = false;
+   bool restartOnReload = true;
+   const Shader* traceShader = nullptr;
+
+   // Used to render the raytraced image to a texture, one program per specialization
+   ShaderVariants traceShaders("main.vert","main.frag",sceneBuffer.shaderDefines(), [&](Shader& built) {
+      sceneBuffer.bindBlocks(built.getProgram());
+      // A new variant renders the same image, only an edit of the program in use restarts
+      if (&built == traceShader)
+         traceShaderReloaded = true;
+   }, &shaderReloader);
+   traceShaders.setSpecialization(options.specialize);
+   traceShader = &traceShaders.get(options.renderParams(), true);
+   BvhBuffer bvhBuffer;
+   bvhBuffer.update(bvh, bvh.takeChanges());
+   bvhBuffer.uploadMeshes(scene.meshes, scene.instances);
    // Used to display the texture to the screen
    Shader screenShader("screenShader.vert","screenShader.frag");
+   shaderReloader.watch(screenShader);
+   // Filters the display while the accumulation has few samples
+   DenoisePass denoisePass;
+   shaderReloader.watch(denoisePass.getShader());
+   if (ProgramCache::getSavedMs() > 0.0)
+      printf("Shader cache saved %.1f ms of compilation\n", ProgramCache::getSavedMs());
 
    unsigned int VAO;
    gladManager::bindVAO(&VAO);
@@ -48,17 +219,64 @@ int main() {
 
    printf("ImGui Initialized\n");
 
-   float focalLength = 1;
+   float focalLength = options.focalLength;
    gladManager::setDeltaTime(0.0f);
    float lastFrame = 0.0f;
-   int maxBounces = 20;
+   int maxBounces = options.maxBounces;
 
    Camera& camera = gladManager::getCamera();
 
    gladManager::generateFrameBuffer(window->width, window->height);
 
    unsigned int time = 0;
-   int rayPerPixel = 50;
+   int rayPerPixel = options.rayPerPixel;
+   bool emission = options.emission;
+   bool russianRoulette = options.russianRoulette;
+   bool lightSampling = options.lightSampling;
+   int sampler = static_cast<int>(options.sampler);
+   const char* samplerNames[] = {"Random", "Sobol", "Blue noise"};
+   bool adaptiveSampling = options.adaptiveSampling;
+   bool reprojection = options.reprojection;
+   float adaptiveThreshold = options.adaptiveThreshold;
+   bool denoise = options.denoiseSpp > 0;
+   int denoiseSpp = options.denoiseSpp > 0 ? options.denoiseSpp : 64;
+   denoisePass.setMaxSpp(denoiseSpp);
+
+   int backend = static_cast<int>(options.backend);
+   const char* backendNames[] = {"GPU", "CPU", "Wavefront"};
+   // Built when first selected, the fragment backend replaces it when compute shaders are missing
+   std::unique_ptr<WavefrontTracer> wavefront;
+   auto selectWavefront = [&]() {
+      if (!wavefront)
+         wavefront = WavefrontTracer::create(sceneBuffer, &shaderReloader);
+      if (!wavefront) {
+         printf("Falling back to the fragment shader backend\n");
+         backend = static_cast<int>(Backend::GPU);
+      }
+   };
+   if (static_cast<Backend>(backend) == Backend::WAVEFRONT)
+      selectWavefront();
+   CpuRenderer cpuRenderer(scene, bvh);
+   int selectedSphere = 0;
+
+   // Passes timed on the GPU, shown in the Performance window
+   enum Pass { TRACE_PASS, DENOISE_PASS, SCREEN_PASS, IMGUI_PASS, PASS_COUNT };
+   GpuTimer gpuTimer(PASS_COUNT);
+   TraceScheduler traceScheduler;
+   traceScheduler.setBudget(options.traceBudgetMs);
+   float traceBudget = static_cast<float>(options.traceBudgetMs);
+   DynamicResolution dynamicResolution;
+   dynamicResolution.setTargetMs(options.motionTargetMs);
+   bool dynamicResolutionEnabled = options.motionTargetMs > 0.0;
+   float motionTarget = static_cast<float>(options.motionTargetMs > 0.0 ? options.motionTargetMs : 16.7);
+   CameraState lastCamera = cameraState();
+   // What the native accumulation was traced with, it becomes the history when only the camera moves
+   bool accumulationReusable = false;
+   CameraState accumulationCamera = lastCamera;
+   float accumulationFocalLength = focalLength;
+   glm::ivec2 accumulationSize(0);
+   FrameStats frameStats;
+   double cpuTraceMs = 0.0;
 
    // Boucle principale
    while (!windowShouldClose()) {
@@ -111,9 +329,44 @@ int main() {
       ImGui::Separator();
       ImGui::SliderInt("Max bounces",&maxBounces,2,100);
       ImGui::SliderInt("Ray per pixel",&rayPerPixel,1,100);
+      bool featureChanged = ImGui::Checkbox("Emission",&emission);
+      featureChanged |= ImGui::Checkbox("Russian roulette",&russianRoulette);
+      featureChanged |= ImGui::Checkbox("Light sampling",&lightSampling);
+      featureChanged |= ImGui::Combo("Sampler",&sampler,samplerNames,3);
+      featureChanged |= ImGui::Checkbox("Adaptive sampling",&adaptiveSampling);
+      featureChanged |= ImGui::Checkbox("Reprojection",&reprojection);
+      featureChanged |= ImGui::Checkbox("Denoise",&denoise);
+      if (featureChanged) {
+         moved = true;
+         accumulationReusable = false;
+      }
+      if (adaptiveSampling) {
+         // Only decides which pixels stop, the accumulation goes on
+         ImGui::SliderFloat("Error threshold",&adaptiveThreshold,0.001f,0.1f,"%.3f",ImGuiSliderFlags_Logarithmic);
+      }
+      if (denoise && ImGui::SliderInt("Denoise until (spp)",&denoiseSpp,1,1024,"%d",ImGuiSliderFlags_Logarithmic)) {
+         denoisePass.setMaxSpp(denoiseSpp);
+      }
+      const ShaderVariant& variant = traceShaders.current();
+      ImGui::Text("Program: %s (%zu variants)",variant.isGeneric() ? "generic" : "specialized",traceShaders.size());
       ImGui::Separator();
-      ImGui::Text("DeltaTime: %.2f",d);
-      ImGui::Text("FPS: %.2f",1/d);
+      if (ImGui::SliderFloat("Trace budget (ms)",&traceBudget,0.0f,50.0f,"%.1f")) {
+         traceScheduler.setBudget(traceBudget);
+      }
+      bool motionChanged = ImGui::Checkbox("Dynamic resolution",&dynamicResolutionEnabled);
+      if (dynamicResolutionEnabled) {
+         motionChanged |= ImGui::SliderFloat("Motion target (ms)",&motionTarget,4.0f,50.0f,"%.1f");
+      }
+      if (motionChanged) {
+         dynamicResolution.setTargetMs(dynamicResolutionEnabled ? motionTarget : 0.0);
+      }
+      if (ImGui::Combo("Backend",&backend,backendNames,3)) {
+         if (static_cast<Backend>(backend) == Backend::WAVEFRONT)
+            selectWavefront();
+         gladManager::frameSinceLastMove = 0;
+         accumulationReusable = false;
+      }
+      ImGui::Checkbox("Restart accumulation on shader reload",&restartOnReload);
       ImGui::Separator();
       ImGui::Text("Uniforms:");
       ImGui::Text("focalLength = %.2f\n",focalLength);
@@ -127,45 +380,183 @@ int main() {
       ImGui::Text("rayPerPixel = %d",rayPerPixel);
       ImGui::End();
 
-      // Shader things
+      frameStats.push(d * 1000.0f);
+      ImGui::Begin("Performance");
+      ImGui::Text("Frame: %.2f ms (%.1f FPS)",d * 1000.0f,1/d);
+      ImGui::Text("p50 %.2f / p95 %.2f / p99 %.2f ms",frameStats.percentile(0.50f),frameStats.percentile(0.95f),frameStats.percentile(0.99f));
+      ImGui::PlotLines("##frameTimes",frameStats.data(),static_cast<int>(frameStats.size()),frameStats.offset(),nullptr,0.0f,FLT_MAX,ImVec2(0,60));
+      ImGui::Separator();
+      const bool cpuBackend = static_cast<Backend>(backend) == Backend::CPU;
+      const bool fragmentBackend = static_cast<Backend>(backend) == Backend::GPU;
+      if (cpuBackend) {
+         ImGui::Text("Trace (CPU): %.2f ms",cpuTraceMs);
+         ImGui::Text("Upload (GPU): %.2f ms",gpuTimer.getMs(TRACE_PASS));
+      } else {
+         ImGui::Text("Trace (GPU): %.2f ms",gpuTimer.getMs(TRACE_PASS));
+      }
+      ImGui::Text("Denoise (GPU): %.2f ms",gpuTimer.getMs(DENOISE_PASS));
+      ImGui::Text("Screen (GPU): %.2f ms",gpuTimer.getMs(SCREEN_PASS));
+      ImGui::Text("ImGui (GPU): %.2f ms",gpuTimer.getMs(IMGUI_PASS));
+      if (fragmentBackend) {
+         ImGui::Text("Passes: %d, strips: %d (%d rows), planned %.2f ms",traceScheduler.getCompletedPasses(),traceScheduler.getStrips(),traceScheduler.getRows(),traceScheduler.getPlannedMs());
+         ImGui::Text("Cost: %.3f ns/sample",traceScheduler.getNsPerSample());
+         const glm::ivec2 motionSize = dynamicResolution.size(window->width, window->height);
+         ImGui::Text("Motion scale: %.2f (%dx%d)",dynamicResolution.getScale(),motionSize.x,motionSize.y);
+      }
+      const double traceMs = cpuBackend ? cpuTraceMs : gpuTimer.getMs(TRACE_PASS);
+      if (traceMs > 0.0) {
+         // Every path may stop early, the rays are an upper bound.
+         // With adaptive sampling rayPerPixel is the average budget, converged pixels take none.
+         const double samples = fragmentBackend ? traceScheduler.getPixelSamples() : static_cast<double>(window->width) * window->height * rayPerPixel;
+         ImGui::Text("Samples/s: %.2f M",samples / traceMs * 1e-3);
+         ImGui::Text("Rays/s: <= %.2f M (%d bounces)",samples * maxBounces / traceMs * 1e-3,maxBounces);
+      }
+      ImGui::End();
+
+      ImGui::Begin("Scene");
+      ImGui::Text("%zu spheres, %zu materials (%s)",scene.spheres.size(),scene.materials.size(),sceneBuffer.usesStorageBuffer() ? "SSBO" : "UBO");
+      if (!scene.meshes.empty()) {
+         ImGui::Text("%zu meshes, %zu triangles",scene.meshes.size(),scene.triangleCount());
+         ImGui::Text("%zu instances, %zu triangles",scene.instances.size(),scene.instancedTriangleCount());
+      }
+      const BvhStats& bvhStats = bvh.getStats();
+      ImGui::Text("BVH: %zu nodes, SAH cost %.2f",bvhStats.nodeCount,bvhStats.sahCost);
+      ImGui::Text("Last update: %.3f ms, %d subtrees rebuilt (%zu primitives)",bvhStats.updateMs,bvhStats.rebuiltSubtrees,bvhStats.rebuiltPrimitives);
+      if (!scene.spheres.empty()) {
+         const int lastSphere = static_cast<int>(scene.spheres.size()) - 1;
+         ImGui::SliderInt("Sphere",&selectedSphere,0,lastSphere);
+         selectedSphere = std::min(selectedSphere,lastSphere);
+         Sphere& sphere = scene.spheres[selectedSphere];
+         bool edited = ImGui::DragFloat3("Center",&sphere.center.x,0.05f);
+         edited |= ImGui::DragFloat("Radius",&sphere.radius,0.01f,0.01f,1000.0f);
+         const size_t materialCount = std::min(scene.materials.size(),sceneBuffer.maxMaterials());
+         edited |= ImGui::SliderInt("Material",&sphere.material,0,static_cast<int>(materialCount) - 1);
+         if (edited) {
+            sceneBuffer.markSphereDirty(selectedSphere);
+            // Refit, the degraded subtrees only are built again
+            bvh.update(scene.primitiveBounds());
+            bvhBuffer.update(bvh, bvh.takeChanges());
+            moved = true;
+            accumulationReusable = false;
+         }
+
+         Material& material = scene.materials[sphere.material];
+         bool materialEdited = ImGui::ColorEdit3("Color",&material.color.x);
+         materialEdited |= ImGui::ColorEdit3("Emission",&material.emissionColor.x);
+         materialEdited |= ImGui::DragFloat("Emission strength",&material.emissionStrength,0.01f,0.0f,100.0f);
+         if (materialEdited) {
+            sceneBuffer.markMaterialDirty(sphere.material);
+            moved = true;
+            accumulationReusable = false;
+         }
+      }
+      ImGui::End();
+      sceneBuffer.sync(scene);
+
+      traceShaders.update();
+      shaderReloader.update();
+      if (traceShaderReloaded && restartOnReload) {
+         moved = true;
+         accumulationReusable = false;
+      }
+      traceShaderReloaded = false;
+
+      // Shader things. With the fragment backend the scheduler counts the passes, there may be several per frame.
       if (moved) {
          gladManager::frameSinceLastMove = 0;
-      } else {
+      } else if (static_cast<Backend>(backend) != Backend::GPU) {
          gladManager::frameSinceLastMove++;
       }
 
-      int writeIndex = (gladManager::frameSinceLastMove % 2 == 0) ? 0 : 1;
-      int readIndex = 1 - writeIndex; // on lit l’autre texture
-
-      glBindFramebuffer(GL_FRAMEBUFFER, gladManager::framebuffers[writeIndex]);
+      // Moving: reduced resolution until the camera is still, then the native accumulation restarts
+      // (frameSinceLastMove is still 0, those frames don't count)
+      const CameraState traceCamera = cameraState();
+      const bool cameraMoved = traceCamera.position != lastCamera.position || traceCamera.direction != lastCamera.direction || traceCamera.up != lastCamera.up;
+      lastCamera = traceCamera;
+      const double gpuFrameMs = gpuTimer.getMs(TRACE_PASS) + gpuTimer.getMs(DENOISE_PASS) + gpuTimer.getMs(SCREEN_PASS) + gpuTimer.getMs(IMGUI_PASS);
+      const bool reducedResolution = dynamicResolution.update(static_cast<Backend>(backend) == Backend::GPU && (moved || cameraMoved), gpuFrameMs);
+      const glm::ivec2 tracedSize = reducedResolution ? dynamicResolution.size(window->width, window->height) : glm::ivec2(window->width, window->height);
+
+      RenderParams params{focalLength, maxBounces, rayPerPixel, time, emission, russianRoulette, adaptiveSampling, adaptiveThreshold, reprojection, denoise, lightSampling, static_cast<Sampler>(sampler)};
+
+      // New native accumulation: start from the previous one when only the camera moved since
+      // (the CPU and wavefront backends restart on frames 0 and 1, the wavefront one keeps no history)
+      const bool cpuBackendSelected = static_cast<Backend>(backend) == Backend::CPU;
+      const bool fragmentBackendSelected = static_cast<Backend>(backend) == Backend::GPU;
+      const bool restart = fragmentBackendSelected ? !reducedResolution && gladManager::frameSinceLastMove == 0 : gladManager::frameSinceLastMove <= 1;
+      if (restart) {
+         const bool keep = reprojection && accumulationReusable && accumulationSize.x == window->width && accumulationSize.y == window->height;
+         if (cpuBackendSelected) {
+            if (keep)
+               cpuRenderer.saveHistory(accumulationCamera, accumulationFocalLength);
+            else
+               cpuRenderer.dropHistory();
+         } else if (keep && fragmentBackendSelected) {
+            saveHistory(accumulationCamera, accumulationFocalLength, window->width, window->height);
+         } else {
+            dropHistory();
+         }
+      }
+      if (!reducedResolution) {
+         accumulationReusable = reprojection && static_cast<Backend>(backend) != Backend::WAVEFRONT;
+         accumulationCamera = traceCamera;
+         accumulationFocalLength = focalLength;
+         accumulationSize = glm::ivec2(window->width, window->height);
+      }
 
-      shader.useShader();
-      shader.setFloat("focalLength", focalLength);
-      shader.setVec2f("resolution", static_cast<float>(window->width), static_cast<float>(window->height));
-      shader.setVec3f("camDir",dir.x,dir.y,dir.z);
-      shader.setVec3f("camUp",up.x,up.y,up.z);
-      shader.setVec3f("camPos",pos.x,pos.y,pos.z);
-      shader.setUInt("time",time);
-      shader.setInt("maxBounces",maxBounces);
-      shader.setInt("lastMove", gladManager::frameSinceLastMove);
-      shader.setInt("rayPerPixel",rayPerPixel);
-      // Send old frame
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, gladManager::getAccumTexture());
-      glUniform1i(glGetUniformLocation(shader.getProgram(), "oldFrame"), 0);
+      if (static_cast<Backend>(backend) == Backend::CPU) {
+         const Image& image = cpuRenderer.getImage();
+         if (image.width != window->width || image.height != window->height) {
+            cpuRenderer.resize(window->width, window->height);
+         }
+         double traceStart = now();
+         cpuRenderer.renderFrame(traceCamera, params, gladManager::frameSinceLastMove);
+         cpuTraceMs = (now() - traceStart) * 1000.0;
+         gpuTimer.begin(TRACE_PASS);
+         uploadCpuImage(cpuRenderer.getImage(), gladManager::accumTexture);
+         gpuTimer.end(TRACE_PASS);
+      } else if (static_cast<Backend>(backend) == Backend::WAVEFRONT) {
+         gpuTimer.begin(TRACE_PASS);
+         wavefront->trace(bvhBuffer, traceCamera, params, gladManager::frameSinceLastMove, window->width, window->height);
+         gpuTimer.end(TRACE_PASS);
+      } else if (reducedResolution) {
+         // A single pass, adaptive sampling has nothing to work with
+         RenderParams motionParams = params;
+         motionParams.adaptiveSampling = false;
+         traceShader = &traceShaders.get(motionParams);
+         gpuTimer.begin(TRACE_PASS);
+         traceMotionFrame(*traceShader, sceneBuffer, bvhBuffer, traceCamera, motionParams, tracedSize.x, tracedSize.y);
+         gpuTimer.end(TRACE_PASS);
+      } else {
+         traceShader = &traceShaders.get(params);
+         gpuTimer.begin(TRACE_PASS);
+         traceScheduler.run(*traceShader, sceneBuffer, bvhBuffer, traceCamera, params, gladManager::frameSinceLastMove, window->width, window->height);
+         gpuTimer.end(TRACE_PASS);
+      }
 
-      // Render Triangle
-      gladManager::draw();
+      // Few samples since the last move: show the filtered accumulation (only the fragment backend writes guides)
+      GLuint displayed = reducedResolution ? gladManager::motionTexture : gladManager::accumTexture;
+      gpuTimer.begin(DENOISE_PASS);
+      if (fragmentBackendSelected && denoise && (reducedResolution || gladManager::frameSinceLastMove * rayPerPixel < denoiseSpp)) {
+         displayed = denoisePass.run(displayed, reducedResolution ? gladManager::motionGbufferTextures : gladManager::gbufferTextures, tracedSize.x, tracedSize.y);
+      }
+      gpuTimer.end(DENOISE_PASS);
 
       // Show the texture to the screen so the raytraced image
+      gpuTimer.begin(SCREEN_PASS);
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
       screenShader.useShader();
       glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, gladManager::textures[writeIndex]);
+      glBindTexture(GL_TEXTURE_2D, displayed);
+      screenShader.setVec2f(UV_SCALE, static_cast<float>(tracedSize.x) / static_cast<float>(window->width), static_cast<float>(tracedSize.y) / static_cast<float>(window->height));
 
       gladManager::draw(); // affiche la texture sur l'écran
+      gpuTimer.end(SCREEN_PASS);
 
+      gpuTimer.begin(IMGUI_PASS);
       imGuiManager.render();
+      gpuTimer.end(IMGUI_PASS);
+      gpuTimer.endFrame();
 
       glfwSwapBuffers(window->window);
       glfwPollEvents();
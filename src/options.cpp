@@ -0,0 +1,171 @@
+#include "options.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void printUsage(const char* program) {
+   printf("Usage: %s [options]\n", program);
+   printf("  --headless            Render offscreen, write the image and exit\n");
+   printf("  --backend NAME        Path tracing backend: gpu, cpu or wavefront (compute, OpenGL 4.3, else gpu) (default gpu)\n");
+   printf("  --size WxH            Render resolution (default 800x600)\n");
+   printf("  --frames N            Accumulation frames in headless mode (default 64)\n");
+   printf("  --output FILE         Output image, .ppm or .pfm (default render.ppm)\n");
+   printf("  --spp N               Rays per pixel per frame (default 50)\n");
+   printf("  --bounces N           Maximum bounces per ray (default 20)\n");
+   printf("  --focal F             Focal length (default 1.0)\n");
+   printf("  --spheres N           Add N random spheres to the scene\n");
+   printf("  --mesh FILE           Add a triangle mesh to the scene, .obj or binary .ply (repeatable)\n");
+   printf("  --instances N         Scatter N more instances of the meshes on the floor, the geometry is shared\n");
+   printf("  --ubo                 Upload the scene to uniform blocks, even if SSBOs are available\n");
+   printf("  --no-shader-cache     Always compile the shaders, ignore shader_cache/\n");
+   printf("  --no-scene-cache      Always load the meshes and build the BVHs, ignore scene_cache/\n");
+   printf("  --no-specialize       Keep bounces and rays per pixel as uniforms instead of shader constants\n");
+   printf("  --no-emission         Ignore emissive materials\n");
+   printf("  --no-roulette         Disable Russian roulette path termination\n");
+   printf("  --no-light-sampling   Only find the lights by bouncing, no next event estimation\n");
+   printf("  --sampler NAME        Sample sequence: random, sobol or bluenoise (default sobol)\n");
+   printf("  --no-reprojection     Restart from nothing when the camera moves, instead of reprojecting the accumulation\n");
+   printf("  --trace-budget MS     GPU time spent tracing per displayed frame, 0 for one pass per frame (default 12)\n");
+   printf("  --motion-target MS    GPU frame time while the camera moves, reached by lowering the resolution, 0 to disable (default 16.7)\n");
+   printf("  --denoise-spp N       Denoise the displayed image until it has N samples per pixel, 0 to disable (default 64)\n");
+   printf("  --adaptive [F]        Adaptive sampling, pixels stop under a relative error of F (default 0.01)\n");
+   printf("  --help                Show this message\n");
+}
+
+const char* nextArg(int argc, char** argv, int& i) {
+   if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value for %s\n", argv[i]);
+      exit(EXIT_FAILURE);
+   }
+   return argv[++i];
+}
+
+int parsePositiveInt(const char* option, const char* value) {
+   char* end = nullptr;
+   long v = strtol(value, &end, 10);
+   if (end == value || *end != '\0' || v <= 0) {
+      fprintf(stderr, "Invalid value for %s: %s\n", option, value);
+      exit(EXIT_FAILURE);
+   }
+   return static_cast<int>(v);
+}
+
+Options parseOptions(int argc, char** argv) {
+   Options options;
+
+   for (int i = 1; i < argc; i++) {
+      const char* arg = argv[i];
+      if (strcmp(arg, "--headless") == 0) {
+         options.headless = true;
+      } else if (strcmp(arg, "--backend") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         if (strcmp(value, "gpu") == 0) {
+            options.backend = Backend::GPU;
+         } else if (strcmp(value, "cpu") == 0) {
+            options.backend = Backend::CPU;
+         } else if (strcmp(value, "wavefront") == 0) {
+            options.backend = Backend::WAVEFRONT;
+         } else {
+            fprintf(stderr, "Invalid value for --backend: %s\n", value);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--size") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         if (sscanf(value, "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+            fprintf(stderr, "Invalid value for --size: %s\n", value);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--frames") == 0) {
+         options.frames = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--output") == 0) {
+         options.output = nextArg(argc, argv, i);
+      } else if (strcmp(arg, "--spp") == 0) {
+         options.rayPerPixel = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--bounces") == 0) {
+         options.maxBounces = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--focal") == 0) {
+         options.focalLength = static_cast<float>(atof(nextArg(argc, argv, i)));
+      } else if (strcmp(arg, "--spheres") == 0) {
+         options.randomSpheres = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--mesh") == 0) {
+         options.meshes.emplace_back(nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--instances") == 0) {
+         options.randomInstances = parsePositiveInt(arg, nextArg(argc, argv, i));
+      } else if (strcmp(arg, "--ubo") == 0) {
+         options.forceUniformBuffer = true;
+      } else if (strcmp(arg, "--no-shader-cache") == 0) {
+         options.shaderCache = false;
+      } else if (strcmp(arg, "--no-scene-cache") == 0) {
+         options.sceneCache = false;
+      } else if (strcmp(arg, "--no-specialize") == 0) {
+         options.specialize = false;
+      } else if (strcmp(arg, "--no-emission") == 0) {
+         options.emission = false;
+      } else if (strcmp(arg, "--no-roulette") == 0) {
+         options.russianRoulette = false;
+      } else if (strcmp(arg, "--no-light-sampling") == 0) {
+         options.lightSampling = false;
+      } else if (strcmp(arg, "--sampler") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         if (strcmp(value, "random") == 0) {
+            options.sampler = Sampler::RANDOM;
+         } else if (strcmp(value, "sobol") == 0) {
+            options.sampler = Sampler::SOBOL;
+         } else if (strcmp(value, "bluenoise") == 0) {
+            options.sampler = Sampler::BLUE_NOISE;
+         } else {
+            fprintf(stderr, "Invalid value for --sampler: %s\n", value);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--no-reprojection") == 0) {
+         options.reprojection = false;
+      } else if (strcmp(arg, "--trace-budget") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         char* end = nullptr;
+         options.traceBudgetMs = strtod(value, &end);
+         if (end == value || *end != '\0' || options.traceBudgetMs < 0.0) {
+            fprintf(stderr, "Invalid value for --trace-budget: %s\n", value);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--motion-target") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         char* end = nullptr;
+         options.motionTargetMs = strtod(value, &end);
+         if (end == value || *end != '\0' || options.motionTargetMs < 0.0) {
+            fprintf(stderr, "Invalid value for --motion-target: %s\n", value);
+            exit(EXIT_FAILURE);
+         }
+      } else if (strcmp(arg, "--denoise-spp") == 0) {
+         const char* value = nextArg(argc, argv, i);
+         char* end = nullptr;
+         const long spp = strtol(value, &end, 10);
+         if (end == value || *end != '\0' || spp < 0) {
+            fprintf(stderr, "Invalid value for --denoise-spp: %s\n", value);
+            exit(EXIT_FAILURE);
+         }
+         options.denoiseSpp = static_cast<int>(spp);
+      } else if (strcmp(arg, "--adaptive") == 0) {
+         options.adaptiveSampling = true;
+         // The threshold is optional
+         if (i + 1 < argc && argv[i + 1][0] != '-') {
+            const char* value = nextArg(argc, argv, i);
+            char* end = nullptr;
+            options.adaptiveThreshold = strtof(value, &end);
+            if (end == value || *end != '\0' || options.adaptiveThreshold <= 0.0f) {
+               fprintf(stderr, "Invalid value for --adaptive: %s\n", value);
+               exit(EXIT_FAILURE);
+            }
+         }
+      } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+         printUsage(argv[0]);
+         exit(EXIT_SUCCESS);
+      } else {
+         fprintf(stderr, "Unknown option: %s\n", arg);
+         printUsage(argv[0]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   return options;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <string>
+#include <vector>
+
+#include "rendering/renderParams.hpp"
+
+// Where the path tracing runs
+enum class Backend {
+   GPU, // main.frag
+   CPU, // CpuRenderer, multithreaded port of main.frag
+   WAVEFRONT // WavefrontTracer, compute kernels (GL 4.3), GPU when unavailable
+};
+
+// Command line options of the application
+struct Options {
+   // Render without a visible window, write the image to disk and exit
+   bool headless = false;
+   Backend backend = Backend::GPU;
+   int width = 800;
+   int height = 600;
+   // Number of accumulation frames rendered in headless mode
+   int frames = 64;
+   std::string output = "render.ppm";
+
+   // Random spheres added to the default scene
+   int randomSpheres = 0;
+   // Triangle meshes (.obj or binary .ply) added in front of the spheres
+   std::vector<std::string> meshes;
+   // Instances of the meshes scattered on the floor, in addition to the one of each in front
+   int randomInstances = 0;
+   // Keep the scene in uniform blocks even when storage buffers are available
+   bool forceUniformBuffer = false;
+
+   // Reuse linked program binaries from shader_cache/
+   bool shaderCache = true;
+   // Reuse the built scenes and BVHs of scene_cache/ (SceneCache)
+   bool sceneCache = true;
+   // GPU time spent tracing per displayed frame (TraceScheduler), 0: one full pass per frame
+   double traceBudgetMs = 12.0;
+   // GPU frame time targeted while the camera moves (DynamicResolution), 0: native resolution
+   double motionTargetMs = 16.7;
+
+   // Bake common bounce/sample counts into dedicated programs (ShaderVariants)
+   bool specialize = true;
+
+   float focalLength = 1;
+   int maxBounces = 20;
+   int rayPerPixel = 50;
+   bool emission = true;
+   bool russianRoulette = true;
+   bool lightSampling = true;
+   Sampler sampler = Sampler::SOBOL;
+   bool adaptiveSampling = false;
+   float adaptiveThreshold = 0.01f;
+   // Reuse the accumulation when only the camera moved (interactive and camera paths)
+   bool reprojection = true;
+   // Samples per pixel under which the displayed image is denoised (DenoisePass), 0: never.
+   // Interactive only, headless runs write the raw accumulation.
+   int denoiseSpp = 64;
+
+   // Params of the first frame (time = 0). The camera of headless runs never moves, no reprojection.
+   [[nodiscard]] RenderParams renderParams() const {
+      return RenderParams{focalLength, maxBounces, rayPerPixel, 0, emission, russianRoulette, adaptiveSampling, adaptiveThreshold, reprojection && !headless, denoiseSpp > 0 && !headless, lightSampling, sampler};
+   }
+};
+
+Options parseOptions(int argc, char** argv);
+
+// Helpers for tools with their own flags, both exit with a message on bad input
+// Value following argv[i], advances i
+const char* nextArg(int argc, char** argv, int& i);
+int parsePositiveInt(const char* option, const char* value);
+
+#endif //OPTIONS_HPP
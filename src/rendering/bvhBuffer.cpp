@@ -0,0 +1,208 @@
+#include "bvhBuffer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "utils/threadPool.hpp"
+
+// Uniforms of scene.glsl, hashed at compile time
+static constexpr UniformId BVH_NODES("bvhNodes");
+static constexpr UniformId BVH_PRIMITIVES("bvhPrimitives");
+static constexpr UniformId MESH_NODES("meshNodes");
+static constexpr UniformId MESH_TRIANGLES("meshTriangles");
+static constexpr UniformId INSTANCES("instances");
+static constexpr UniformId INSTANCE_COUNT("instanceCount");
+
+// Instances packed per job of uploadMeshes
+static constexpr size_t INSTANCE_BATCH_SIZE = 1 << 16;
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode is read as two RGBA32F texels");
+static_assert(sizeof(MeshTriangle) == 48, "MeshTriangle is read as three RGBA32F texels");
+
+// Instance as read by intersectMesh in scene.glsl: the rows of its world to object transform,
+// then first node, material and first triangle as float bits
+struct GpuInstance {
+   glm::vec4 toObject[3];
+   int firstNode;
+   int material;
+   int firstTriangle;
+   int pad;
+};
+static_assert(sizeof(GpuInstance) == 64, "GpuInstance is read as four RGBA32F texels");
+
+const BvhNode BvhBuffer::EMPTY_NODE{glm::vec3(1e30f), 0, glm::vec3(1e30f), 1};
+
+// Texture buffer holding the arrays one after the other, copied from where they are.
+// Only the element empty when they are all empty, so that the samplers stay valid.
+template<typename T>
+static void fillTextureBuffer(GLuint buffer, GLuint texture, GLenum format, const std::vector<const std::vector<T>*>& parts,
+                              const T& empty) {
+   size_t count = 0;
+   for (const std::vector<T>* part : parts)
+      count += part->size();
+   glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+   glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(std::max<size_t>(count, 1) * sizeof(T)), count == 0 ? &empty : nullptr, GL_STATIC_DRAW);
+   GLintptr offset = 0;
+   for (const std::vector<T>* part : parts) {
+      const auto size = static_cast<GLsizeiptr>(part->size() * sizeof(T));
+      if (size > 0)
+         glBufferSubData(GL_TEXTURE_BUFFER, offset, size, part->data());
+      offset += size;
+   }
+   glBindBuffer(GL_TEXTURE_BUFFER, 0);
+   glBindTexture(GL_TEXTURE_BUFFER, texture);
+   glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+   glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+BvhBuffer::BvhBuffer() {
+   glGenBuffers(1, &nodeBuffer);
+   glGenBuffers(1, &primitiveBuffer);
+   glGenBuffers(1, &meshNodeBuffer);
+   glGenBuffers(1, &meshTriangleBuffer);
+   glGenBuffers(1, &instanceBuffer);
+   glGenTextures(1, &nodeTexture);
+   glGenTextures(1, &primitiveTexture);
+   glGenTextures(1, &meshNodeTexture);
+   glGenTextures(1, &meshTriangleTexture);
+   glGenTextures(1, &instanceTexture);
+   uploadMeshes({}, {});
+}
+
+BvhBuffer::~BvhBuffer() {
+   glDeleteTextures(1, &nodeTexture);
+   glDeleteTextures(1, &primitiveTexture);
+   glDeleteTextures(1, &meshNodeTexture);
+   glDeleteTextures(1, &meshTriangleTexture);
+   glDeleteTextures(1, &instanceTexture);
+   glDeleteBuffers(1, &nodeBuffer);
+   glDeleteBuffers(1, &primitiveBuffer);
+   glDeleteBuffers(1, &meshNodeBuffer);
+   glDeleteBuffers(1, &meshTriangleBuffer);
+   glDeleteBuffers(1, &instanceBuffer);
+}
+
+void BvhBuffer::upload(const Bvh& bvh) {
+   const auto& nodes = bvh.getNodes();
+   const auto& primitives = bvh.getPrimitiveIndices();
+
+   GLint maxTexels = 0;
+   glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+   const bool fits = nodes.size() * 2 <= static_cast<size_t>(maxTexels) && primitives.size() <= static_cast<size_t>(maxTexels);
+   if (!fits) {
+      fprintf(stderr, "BVH too large for texture buffers (%d texels max), not traced\n", maxTexels);
+   }
+
+   // Texture buffers cannot be empty, keep one element so the samplers stay valid
+   const uint32_t emptyPrimitive = 0;
+   const bool uploadNodes = fits && !nodes.empty();
+   const bool uploadPrimitives = fits && !primitives.empty();
+
+   glBindBuffer(GL_TEXTURE_BUFFER, nodeBuffer);
+   glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>((uploadNodes ? nodes.size() : 1) * sizeof(BvhNode)),
+                uploadNodes ? nodes.data() : &EMPTY_NODE, GL_STATIC_DRAW);
+   glBindBuffer(GL_TEXTURE_BUFFER, primitiveBuffer);
+   glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>((uploadPrimitives ? primitives.size() : 1) * sizeof(uint32_t)),
+                uploadPrimitives ? primitives.data() : &emptyPrimitive, GL_STATIC_DRAW);
+   glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+   glBindTexture(GL_TEXTURE_BUFFER, nodeTexture);
+   glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, nodeBuffer);
+   glBindTexture(GL_TEXTURE_BUFFER, primitiveTexture);
+   glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, primitiveBuffer);
+   glBindTexture(GL_TEXTURE_BUFFER, 0);
+   // A refused BVH is never updated in place, update() tries a full upload again
+   nodeCount = fits ? nodes.size() : 0;
+   primitiveCount = fits ? primitives.size() : 0;
+}
+
+void BvhBuffer::update(const Bvh& bvh, const BvhChanges& changes) {
+   const auto& nodes = bvh.getNodes();
+   const auto& primitives = bvh.getPrimitiveIndices();
+   if (changes.all || nodes.size() != nodeCount || primitives.size() != primitiveCount) {
+      upload(bvh);
+      return;
+   }
+
+   glBindBuffer(GL_TEXTURE_BUFFER, nodeBuffer);
+   for (const BvhRange& range : changes.nodes) {
+      glBufferSubData(GL_TEXTURE_BUFFER, static_cast<GLintptr>(range.begin * sizeof(BvhNode)),
+                      static_cast<GLsizeiptr>((range.end - range.begin) * sizeof(BvhNode)), nodes.data() + range.begin);
+   }
+   glBindBuffer(GL_TEXTURE_BUFFER, primitiveBuffer);
+   for (const BvhRange& range : changes.primitives) {
+      glBufferSubData(GL_TEXTURE_BUFFER, static_cast<GLintptr>(range.begin * sizeof(uint32_t)),
+                      static_cast<GLsizeiptr>((range.end - range.begin) * sizeof(uint32_t)), primitives.data() + range.begin);
+   }
+   glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+bool BvhBuffer::meshesFit(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, size_t maxTexels) {
+   size_t nodeCount = 0;
+   size_t triangleCount = 0;
+   for (const Mesh& mesh : meshes) {
+      nodeCount += mesh.bvh.getNodes().size();
+      triangleCount += mesh.triangles.size();
+   }
+   return nodeCount * 2 <= maxTexels && triangleCount * 3 <= maxTexels && instances.size() * 4 <= maxTexels;
+}
+
+void BvhBuffer::uploadMeshes(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances) {
+   GLint maxTexels = 0;
+   glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+   if (!meshesFit(meshes, instances, static_cast<size_t>(maxTexels))) {
+      fprintf(stderr, "Meshes too large for texture buffers (%d texels max), not traced\n", maxTexels);
+      uploadMeshes({}, {});
+      return;
+   }
+
+   // The BVHs keep their own indices, relative to the first node and triangle of their mesh
+   std::vector<glm::ivec2> firsts;
+   std::vector<const std::vector<BvhNode>*> nodes;
+   std::vector<const std::vector<MeshTriangle>*> triangles;
+   int firstNode = 0;
+   int firstTriangle = 0;
+   for (const Mesh& mesh : meshes) {
+      firsts.emplace_back(firstNode, firstTriangle);
+      nodes.push_back(&mesh.bvh.getNodes());
+      triangles.push_back(&mesh.triangles);
+      firstNode += static_cast<int>(mesh.bvh.getNodes().size());
+      firstTriangle += static_cast<int>(mesh.triangles.size());
+   }
+
+   std::vector<GpuInstance> gpuInstances(instances.size());
+   ThreadPool::global().parallelFor((instances.size() + INSTANCE_BATCH_SIZE - 1) / INSTANCE_BATCH_SIZE, [&](size_t batch) {
+      const size_t end = std::min(instances.size(), (batch + 1) * INSTANCE_BATCH_SIZE);
+      for (size_t i = batch * INSTANCE_BATCH_SIZE; i < end; i++) {
+         const MeshInstance& instance = instances[i];
+         const glm::ivec2& first = firsts[instance.mesh];
+         gpuInstances[i] = GpuInstance{{instance.toObject[0], instance.toObject[1], instance.toObject[2]}, first.x, instance.material, first.y, 0};
+      }
+   });
+
+   fillTextureBuffer(meshNodeBuffer, meshNodeTexture, GL_RGBA32F, nodes, EMPTY_NODE);
+   fillTextureBuffer(meshTriangleBuffer, meshTriangleTexture, GL_RGBA32F, triangles, MeshTriangle{});
+   fillTextureBuffer<GpuInstance>(instanceBuffer, instanceTexture, GL_RGBA32F, {&gpuInstances}, GpuInstance{});
+   instanceCount = static_cast<int>(instances.size());
+}
+
+void BvhBuffer::bind(const Shader& shader) const {
+   glActiveTexture(GL_TEXTURE0 + NODE_TEXTURE_UNIT);
+   glBindTexture(GL_TEXTURE_BUFFER, nodeTexture);
+   glActiveTexture(GL_TEXTURE0 + PRIMITIVE_TEXTURE_UNIT);
+   glBindTexture(GL_TEXTURE_BUFFER, primitiveTexture);
+   glActiveTexture(GL_TEXTURE0 + MESH_NODE_TEXTURE_UNIT);
+   glBindTexture(GL_TEXTURE_BUFFER, meshNodeTexture);
+   glActiveTexture(GL_TEXTURE0 + MESH_TRIANGLE_TEXTURE_UNIT);
+   glBindTexture(GL_TEXTURE_BUFFER, meshTriangleTexture);
+   glActiveTexture(GL_TEXTURE0 + INSTANCE_TEXTURE_UNIT);
+   glBindTexture(GL_TEXTURE_BUFFER, instanceTexture);
+   glActiveTexture(GL_TEXTURE0);
+
+   shader.setInt(BVH_NODES, NODE_TEXTURE_UNIT);
+   shader.setInt(BVH_PRIMITIVES, PRIMITIVE_TEXTURE_UNIT);
+   shader.setInt(MESH_NODES, MESH_NODE_TEXTURE_UNIT);
+   shader.setInt(MESH_TRIANGLES, MESH_TRIANGLE_TEXTURE_UNIT);
+   shader.setInt(INSTANCES, INSTANCE_TEXTURE_UNIT);
+   shader.setInt(INSTANCE_COUNT, instanceCount);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef BVHBUFFER_HPP
+#define BVHBUFFER_HPP
+
+#include <vector>
+
+#include "accel/bvh.hpp"
+#include "glad/glad.h"
+#include "rendering/shader.hpp"
+#include "scene/mesh.hpp"
+
+// BVH nodes and primitive indices as texture buffers, available on GL 3.3 core.
+// The meshes have their own: the leaves of the scene BVH past the spheres are instances, each
+// leading to the BVH of its mesh.
+class BvhBuffer {
+public:
+   // Texture units used by main.frag, 0 is the accumulation texture
+   static constexpr GLuint NODE_TEXTURE_UNIT = 1;
+   static constexpr GLuint PRIMITIVE_TEXTURE_UNIT = 2;
+   // After the ones of tracePass (3 to 5) and the blue noise (6)
+   static constexpr GLuint MESH_NODE_TEXTURE_UNIT = 7;
+   static constexpr GLuint MESH_TRIANGLE_TEXTURE_UNIT = 8;
+   static constexpr GLuint INSTANCE_TEXTURE_UNIT = 9;
+
+   // What an empty or refused BVH is uploaded as: a leaf past MAX_DIST, the traversals end on a
+   // miss of its root. A zero node would be an inner node whose children are itself.
+   static const BvhNode EMPTY_NODE;
+
+   BvhBuffer();
+   ~BvhBuffer();
+
+   BvhBuffer(const BvhBuffer&) = delete;
+   BvhBuffer& operator=(const BvhBuffer&) = delete;
+
+   void upload(const Bvh& bvh);
+   // Only the ranges in changes (Bvh::takeChanges), everything when the arrays were resized
+   void update(const Bvh& bvh, const BvhChanges& changes);
+
+   // Nodes of all the mesh BVHs in one buffer and their triangles (leaf order, see Mesh) in
+   // another, one mesh after the other, uploaded without repacking. The instances in a third one,
+   // 64 bytes each: their transform to object space and the ranges of their mesh.
+   // Meshes or instances too large for texture buffers of maxTexels are refused as a whole: an
+   // empty upload, instanceCount 0, and the shaders skip every primitive of the scene BVH past the spheres.
+   void uploadMeshes(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances);
+   static bool meshesFit(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, size_t maxTexels);
+
+   // Bind the textures and point the samplers of the current program at them
+   void bind(const Shader& shader) const;
+
+private:
+   GLuint nodeBuffer = 0;
+   GLuint nodeTexture = 0;
+   GLuint primitiveBuffer = 0;
+   GLuint primitiveTexture = 0;
+   // Sizes of the last upload
+   size_t nodeCount = 0;
+   size_t primitiveCount = 0;
+   GLuint meshNodeBuffer = 0;
+   GLuint meshNodeTexture = 0;
+   GLuint meshTriangleBuffer = 0;
+   GLuint meshTriangleTexture = 0;
+   GLuint instanceBuffer = 0;
+   GLuint instanceTexture = 0;
+   int instanceCount = 0;
+};
+
+#endif //BVHBUFFER_HPP
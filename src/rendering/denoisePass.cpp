@@ -0,0 +1,104 @@
+#include "denoisePass.hpp"
+
+#include <iostream>
+
+#include "rendering/gladManager.hpp"
+
+// Uniforms of denoise.frag, hashed at compile time
+static constexpr UniformId ACCUM("accum");
+static constexpr UniformId NORMAL_DEPTH("normalDepth");
+static constexpr UniformId ALBEDO("albedo");
+static constexpr UniformId LUMA_SUMS("lumaSums");
+static constexpr UniformId FILTERED("filtered");
+static constexpr UniformId MAX_SPP("maxSpp");
+static constexpr UniformId SIZE("size");
+static constexpr UniformId STAGE("stage");
+static constexpr UniformId STEP_SIZE("stepSize");
+
+// Stages of denoise.frag
+enum Stage { DEMODULATE = 0, FILTER = 1, REMODULATE = 2 };
+
+// Inputs of denoise.frag
+static constexpr GLuint ACCUM_TEXTURE_UNIT = 0;
+static constexpr GLuint GUIDE_TEXTURE_UNIT = 1; // to GUIDE_TEXTURE_UNIT + 2
+static constexpr GLuint FILTERED_TEXTURE_UNIT = 4;
+
+DenoisePass::DenoisePass() : shader("screenShader.vert", "denoise.frag") {}
+
+DenoisePass::~DenoisePass() {
+   if (textures[0] != 0) {
+      glDeleteFramebuffers(2, framebuffers);
+      glDeleteTextures(2, textures);
+   }
+}
+
+void DenoisePass::allocate(int width, int height) {
+   if (textures[0] == 0) {
+      glGenFramebuffers(2, framebuffers);
+      glGenTextures(2, textures);
+   }
+
+   for (int i = 0; i < 2; i++) {
+      glBindTexture(GL_TEXTURE_2D, textures[i]);
+      // The variance needs more than half floats
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+      // The display upscales the reduced resolution corner
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+         std::cerr << "Denoise framebuffer not complete!" << std::endl;
+      }
+   }
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   allocated = glm::ivec2(width, height);
+}
+
+GLuint DenoisePass::run(GLuint accum, const GLuint* guides, int width, int height) {
+   // The viewport is the window, the size of the targets
+   GLint viewport[4];
+   glGetIntegerv(GL_VIEWPORT, viewport);
+   if (allocated.x != viewport[2] || allocated.y != viewport[3])
+      allocate(viewport[2], viewport[3]);
+
+   glActiveTexture(GL_TEXTURE0 + ACCUM_TEXTURE_UNIT);
+   glBindTexture(GL_TEXTURE_2D, accum);
+   for (GLuint i = 0; i < 3; i++) {
+      glActiveTexture(GL_TEXTURE0 + GUIDE_TEXTURE_UNIT + i);
+      glBindTexture(GL_TEXTURE_2D, guides[i]);
+   }
+
+   shader.useShader();
+   shader.setInt(ACCUM, ACCUM_TEXTURE_UNIT);
+   shader.setInt(NORMAL_DEPTH, GUIDE_TEXTURE_UNIT);
+   shader.setInt(ALBEDO, GUIDE_TEXTURE_UNIT + 1);
+   shader.setInt(LUMA_SUMS, GUIDE_TEXTURE_UNIT + 2);
+   shader.setInt(FILTERED, FILTERED_TEXTURE_UNIT);
+   shader.setFloat(MAX_SPP, static_cast<float>(maxSpp));
+   shader.setVec2f(SIZE, static_cast<float>(width), static_cast<float>(height));
+   glViewport(0, 0, width, height);
+
+   // Every stage reads the output of the previous one
+   int target = 0;
+   auto stage = [&](Stage s, int stepSize) {
+      glActiveTexture(GL_TEXTURE0 + FILTERED_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, textures[1 - target]);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[target]);
+      shader.setInt(STAGE, s);
+      shader.setInt(STEP_SIZE, stepSize);
+      gladManager::draw();
+      target = 1 - target;
+   };
+   stage(DEMODULATE, 1);
+   for (int i = 0; i < ITERATIONS; i++)
+      stage(FILTER, 1 << i);
+   stage(REMODULATE, 1);
+
+   glActiveTexture(GL_TEXTURE0);
+   glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+   return textures[1 - target];
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#ifndef DENOISEPASS_HPP
+#define DENOISEPASS_HPP
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "rendering/shader.hpp"
+
+// Edge-aware à-trous filter of an accumulation with few samples (denoise.frag). It is guided by the
+// first hits written by the denoising variants of main.frag (RenderParams::denoiseAovs), so edges,
+// silhouettes and texture stay sharp while the lighting is smoothed.
+// The filtered image fades back into the accumulation as the sample count reaches maxSpp: the
+// denoiser covers the first frames after a move, converged images are never touched.
+class DenoisePass {
+public:
+   DenoisePass();
+   ~DenoisePass();
+
+   DenoisePass(const DenoisePass&) = delete;
+   DenoisePass& operator=(const DenoisePass&) = delete;
+
+   // Samples per pixel from which the accumulation is shown as is, 0 disables
+   void setMaxSpp(int spp) { maxSpp = spp; }
+   [[nodiscard]] int getMaxSpp() const { return maxSpp; }
+   [[nodiscard]] bool isEnabled() const { return maxSpp > 0; }
+
+   // Filter the lower left width x height corner of accum with guides, the gladManager G-buffer
+   // traced with it. Returns the texture to display, same corner: rgb = color, a = 1.
+   // The targets are created at the size of the viewport.
+   GLuint run(GLuint accum, const GLuint* guides, int width, int height);
+
+   // For the ShaderReloader
+   Shader& getShader() { return shader; }
+
+   // Wavelet levels: the filter reaches 2^ITERATIONS pixels away
+   static constexpr int ITERATIONS = 5;
+
+private:
+   void allocate(int width, int height);
+
+   Shader shader;
+   int maxSpp = 64;
+
+   // Ping-pong targets: rgb = radiance over albedo, a = variance of its luminance
+   GLuint framebuffers[2] = {0, 0};
+   GLuint textures[2] = {0, 0};
+   glm::ivec2 allocated{0, 0};
+};
+
+#endif //DENOISEPASS_HPP
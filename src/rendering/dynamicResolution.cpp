@@ -0,0 +1,26 @@
+#include "dynamicResolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+bool DynamicResolution::update(bool moving, double gpuMs) {
+   if (!isEnabled() || !moving) {
+      motionFrames = 0;
+      return false;
+   }
+
+   motionFrames++;
+   if (motionFrames > SETTLE_FRAMES && gpuMs > 0.0) {
+      const double ratio = targetMs / gpuMs;
+      if (ratio < 1.0 || ratio > 1.0 / DEADBAND) {
+         // The cost follows the pixel count, the square of the scale
+         const auto step = static_cast<float>(std::pow(ratio, GAIN * 0.5));
+         scale = std::clamp(scale * std::clamp(step, 1.0f / MAX_STEP, MAX_STEP), MIN_SCALE, 1.0f);
+      }
+   }
+   return true;
+}
+
+glm::ivec2 DynamicResolution::size(int width, int height) const {
+   return glm::max(glm::ivec2(glm::vec2(width, height) * scale + 0.5f), glm::ivec2(1));
+}
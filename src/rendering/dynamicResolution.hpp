@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef DYNAMICRESOLUTION_HPP
+#define DYNAMICRESOLUTION_HPP
+
+#include "glm/glm.hpp"
+
+// Resolution of the frames traced while the camera moves. Every movement restarts the accumulation,
+// so those frames are single passes traced in gladManager::motionFramebuffer at a fraction of the
+// window size and upscaled by screenShader.frag. The fraction follows the GPU frame time towards a
+// target; the native resolution comes back, from a new accumulation, once the camera is still.
+class DynamicResolution {
+public:
+   // GPU milliseconds per frame while moving, 0 disables (native resolution, restarted every frame)
+   void setTargetMs(double ms) { targetMs = ms; }
+   [[nodiscard]] double getTargetMs() const { return targetMs; }
+   [[nodiscard]] bool isEnabled() const { return targetMs > 0.0; }
+
+   // Once per frame: moving is true when the accumulation restarted this frame, gpuMs is the latest
+   // GPU time of a whole frame. Returns true when this frame is traced at the reduced resolution.
+   bool update(bool moving, double gpuMs);
+
+   // Width and height over the window size, in [MIN_SCALE, 1]
+   [[nodiscard]] float getScale() const { return scale; }
+   // Traced size for a window, never empty
+   [[nodiscard]] glm::ivec2 size(int width, int height) const;
+
+   static constexpr float MIN_SCALE = 0.25f;
+   static constexpr float INITIAL_SCALE = 0.5f;
+
+private:
+   // GpuTimer results are a few frames late: a measurement is only trusted once the frames in
+   // flight were all traced at the reduced resolution
+   static constexpr int SETTLE_FRAMES = 4;
+   // Fraction of the measured error corrected per frame (on the pixel count). A full correction
+   // oscillates, the measurements are a few frames behind the scale.
+   static constexpr double GAIN = 0.3;
+   // Largest change of the scale per frame
+   static constexpr float MAX_STEP = 1.1f;
+   // No change while the frame time is between DEADBAND and 1 times the target
+   static constexpr double DEADBAND = 0.85;
+
+   double targetMs = 16.7;
+   float scale = INITIAL_SCALE;
+   int motionFrames = 0;
+};
+
+#endif //DYNAMICRESOLUTION_HPP
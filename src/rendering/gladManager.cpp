@@ -2,7 +2,21 @@
 
 std::unique_ptr<Camera> gladManager::camera = std::make_unique<Camera>();
 float gladManager::p_deltaTime = 0.0f;
-bool gladManager::writeToFirstTexture = true;
 GLuint gladManager::framebuffers[2] = {0,1};
-GLuint gladManager::textures[2] = {0,1};
-int gladManager::frameSinceLastMove = 0;
\ No newline at end of file
+GLuint gladManager::accumTexture = 0;
+GLuint gladManager::momentTextures[2] = {0,0};
+std::vector<GLuint> gladManager::momentSumTextures;
+std::vector<GLuint> gladManager::momentSumFramebuffers;
+std::unique_ptr<Shader> gladManager::momentReduction;
+GLuint gladManager::motionFramebuffer = 0;
+GLuint gladManager::motionTexture = 0;
+GLuint gladManager::firstHitTexture = 0;
+GLuint gladManager::gbufferTextures[GBUFFER_SIZE] = {0,0,0};
+GLuint gladManager::motionGbufferTextures[GBUFFER_SIZE] = {0,0,0};
+GLuint gladManager::historyFramebuffer = 0;
+GLuint gladManager::historyTextures[2] = {0,0};
+bool gladManager::historyValid = false;
+CameraState gladManager::historyCamera{};
+float gladManager::historyFocalLength = 1.0f;
+int gladManager::frameSinceLastMove = 0;
+GLuint gladManager::blueNoiseTexture = 0;
\ No newline at end of file
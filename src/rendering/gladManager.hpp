@@ -3,6 +3,7 @@
 #ifndef GLADMANAGER_HPP
 #define GLADMANAGER_HPP
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
@@ -14,32 +15,43 @@
 #include <vector>
 
 #include "camera.hpp"
+#include "renderParams.hpp"
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
-
-struct Sphere {
-   glm::vec3 center;
-   float radius;
-};
-
-constexpr int NBR_SPHERES = 3;
+#include "rendering/shader.hpp"
+#include "scene/scene.hpp"
+#include "utils/blueNoise.hpp"
 
 class gladManager {
 public:
    static void init(GLFWwindow* glfw_window) {
       // Charger OpenGL avec GLAD
-      if (!gladLoadGL()) {
+      if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress))) {
          fprintf(stderr, "Erreur: Impossible d'initialiser GLAD\n");
          glfwDestroyWindow(glfw_window);
          glfwTerminate();
          exit(EXIT_FAILURE);
       }
+      printVersion();
+   }
 
+   // Used by headless contexts that are not owned by GLFW (EGL)
+   static void init(GLADloadproc loader) {
+      if (!gladLoadGLLoader(loader)) {
+         fprintf(stderr, "Erreur: Impossible d'initialiser GLAD\n");
+         exit(EXIT_FAILURE);
+      }
+      printVersion();
+   }
+
+   static void printVersion() {
       const GLubyte* version = glGetString(GL_VERSION);
       const GLubyte* glslVersion = glGetString(GL_SHADING_LANGUAGE_VERSION);
+      const GLubyte* renderer = glGetString(GL_RENDERER);
 
-      printf("OpenGL version: %hhu\n",*version);
-      printf("GLSL version: %hhu\n",*glslVersion);
+      printf("OpenGL version: %s\n",reinterpret_cast<const char*>(version));
+      printf("GLSL version: %s\n",reinterpret_cast<const char*>(glslVersion));
+      printf("Renderer: %s\n",reinterpret_cast<const char*>(renderer));
    }
 
    static void bindVAO(unsigned int* VAO) {
@@ -51,24 +63,6 @@ public:
       glDeleteVertexArrays(1, VAO);
    }
 
-   static void createUBO(unsigned int shaderProgram, const std::vector<Sphere>& spheres) {
-      // Create and bind the UBO
-      GLuint uboSphere;
-      glGenBuffers(1, &uboSphere);
-      glBindBuffer(GL_UNIFORM_BUFFER, uboSphere);
-      glBufferData(GL_UNIFORM_BUFFER, sizeof(Sphere) * NBR_SPHERES, NULL, GL_DYNAMIC_DRAW);
-
-      // Bind the UBO to a specific binding point
-      GLuint uniformBlockIndex = glGetUniformBlockIndex(shaderProgram, "LightBlock");
-      glUniformBlockBinding(shaderProgram, uniformBlockIndex, 0);
-      glBindBufferBase(GL_UNIFORM_BUFFER, 0, uboSphere);
-
-      // Update the data in the UBO
-      glBindBuffer(GL_UNIFORM_BUFFER, uboSphere);
-      glBufferSubData(GL_UNIFORM_BUFFER, 0, spheres.size(), spheres.data());
-      glBindBuffer(GL_UNIFORM_BUFFER, 0);
-   }
-
    static void clear() {
       glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT);
@@ -90,75 +84,298 @@ public:
       return p_deltaTime;
    }
 
+   // One accumulation texture (rgb = radiance sum, a = sample count) shared by both framebuffers,
+   // the passes add to it with blending. The index of the framebuffer only selects the moment texture.
    static void generateFrameBuffer(int width, int height) {
       glGenFramebuffers(2, framebuffers);
-      glGenTextures(2, textures);
+      glGenTextures(1, &accumTexture);
+      // The framebuffers are new (or the context is), moments and the motion target are created on demand
+      momentTextures[0] = momentTextures[1] = 0;
+      momentSumTextures.clear();
+      momentSumFramebuffers.clear();
+      momentReduction.reset();
+      motionFramebuffer = motionTexture = 0;
+      firstHitTexture = historyFramebuffer = historyTextures[0] = historyTextures[1] = 0;
+      historyValid = false;
+      std::fill(std::begin(gbufferTextures), std::end(gbufferTextures), 0);
+      std::fill(std::begin(motionGbufferTextures), std::end(motionGbufferTextures), 0);
+      blueNoiseTexture = 0;
+
+      allocateFrameBuffers(width, height);
 
-      for (int i = 0; i < 2; i++) {
-         glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0); // unbind
+   }
 
-         glBindTexture(GL_TEXTURE_2D, textures[i]);
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+   static void regenerateFrameBuffer(int width, int height) {
+      allocateFrameBuffers(width, height);
+      if (hasMoments())
+         allocateMoments(width, height);
+      if (hasMotionTarget())
+         allocateMotionTarget(width, height);
+      if (hasGbuffer())
+         allocateGbuffer(gbufferTextures, framebuffers, 2, width, height);
+      if (hasMotionGbuffer())
+         allocateGbuffer(motionGbufferTextures, &motionFramebuffer, 1, width, height);
+      if (hasFirstHits())
+         allocateFirstHits(width, height);
+      historyValid = false;
+   }
+
+   // Guides of the denoiser, one set for the accumulation and one for the motion target,
+   // only allocated once denoising is used
+   static bool hasGbuffer() {
+      return gbufferTextures[0] != 0;
+   }
+
+   static void generateGbuffer(int width, int height) {
+      glGenTextures(GBUFFER_SIZE, gbufferTextures);
+      allocateGbuffer(gbufferTextures, framebuffers, 2, width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   }
+
+   static bool hasMotionGbuffer() {
+      return motionGbufferTextures[0] != 0;
+   }
+
+   // After generateMotionTarget
+   static void generateMotionGbuffer(int width, int height) {
+      glGenTextures(GBUFFER_SIZE, motionGbufferTextures);
+      allocateGbuffer(motionGbufferTextures, &motionFramebuffer, 1, width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   }
+
+   // First hit buffer and history, only allocated once reprojection is used
+   static bool hasFirstHits() {
+      return firstHitTexture != 0;
+   }
+
+   static void generateFirstHits(int width, int height) {
+      glGenTextures(1, &firstHitTexture);
+      glGenFramebuffers(1, &historyFramebuffer);
+      glGenTextures(2, historyTextures);
+      allocateFirstHits(width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   }
 
+   // Target of the reduced resolution frames (DynamicResolution), as large as the window: a frame
+   // uses its lower left corner. Half floats, it never holds more than one pass.
+   static bool hasMotionTarget() {
+      return motionFramebuffer != 0;
+   }
+
+   static void generateMotionTarget(int width, int height) {
+      glGenFramebuffers(1, &motionFramebuffer);
+      glGenTextures(1, &motionTexture);
+      allocateMotionTarget(width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   }
+
+   // Mask of the blue noise sampler (see random.glsl), one channel, created on first use
+   static GLuint getBlueNoiseTexture() {
+      if (blueNoiseTexture == 0) {
+         glGenTextures(1, &blueNoiseTexture);
+         glBindTexture(GL_TEXTURE_2D, blueNoiseTexture);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, 0, GL_RED, GL_FLOAT, blueNoiseMask().data());
          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+         glBindTexture(GL_TEXTURE_2D, 0);
+      }
+      return blueNoiseTexture;
+   }
+
+   // Moment textures, only allocated once adaptive sampling is used
+   static bool hasMoments() {
+      return momentTextures[0] != 0;
+   }
+
+   static void generateMoments(int width, int height) {
+      glGenTextures(2, momentTextures);
+      momentReduction = std::make_unique<Shader>("screenShader.vert", "reduce.frag");
+      allocateMoments(width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+   }
+
+   // Size of a texture of sums of MOMENT_REDUCTION_BLOCK x MOMENT_REDUCTION_BLOCK blocks of size
+   static glm::ivec2 reducedSize(glm::ivec2 size) {
+      return (size + MOMENT_REDUCTION_BLOCK - 1) / MOMENT_REDUCTION_BLOCK;
+   }
+
+   static void incrementFrameSinceLastMove() {
+      frameSinceLastMove++;
+   }
+
+   static int getFrameSinceLastMove() {
+      return frameSinceLastMove;
+   }
 
-         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+public:
+   static GLuint framebuffers[2];
+   static GLuint accumTexture;
+   // Second attachment, per pixel statistics used by adaptive sampling (see main.frag)
+   static GLuint momentTextures[2];
+   // Sums of the moments written by the last complete pass (reduce.frag, see traceRows): every
+   // texture sums blocks of the previous one, the last is a single texel, the sum over the image
+   static constexpr int MOMENT_REDUCTION_BLOCK = 8;
+   static std::vector<GLuint> momentSumTextures;
+   static std::vector<GLuint> momentSumFramebuffers;
+   static std::unique_ptr<Shader> momentReduction;
+   static GLuint motionFramebuffer;
+   static GLuint motionTexture;
+   // Third attachment, world position of the first hit of each pixel center (w = 1 on a hit),
+   // written by the reprojection variants
+   static GLuint firstHitTexture;
+   // Attachments 3 to 5 written by the denoising variants (see main.frag): normal and depth,
+   // albedo, luminance sums. The last one is accumulated with blending, the others replaced.
+   static constexpr int GBUFFER_SIZE = 3;
+   static GLuint gbufferTextures[GBUFFER_SIZE];
+   static GLuint motionGbufferTextures[GBUFFER_SIZE];
+   // Accumulation (0) and first hits (1) of the previous view, see saveHistory in tracePass
+   static GLuint historyFramebuffer;
+   static GLuint historyTextures[2];
+   // Camera the history was traced from, valid until a restart that can't reuse it
+   static bool historyValid;
+   static CameraState historyCamera;
+   static float historyFocalLength;
+   static int frameSinceLastMove;
+   static GLuint blueNoiseTexture;
+private:
+   static void allocateFrameBuffers(int width, int height) {
+      glBindTexture(GL_TEXTURE_2D, accumTexture);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+      for (int i = 0; i < 2; i++) {
+         glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
 
          if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
             std::cerr << "Framebuffer " << i << " not complete!" << std::endl;
          }
       }
-
-      glBindFramebuffer(GL_FRAMEBUFFER, 0); // unbind
    }
 
-   static void regenerateFrameBuffer(int width, int height) {
+   static void allocateMoments(int width, int height) {
+      const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
       for (int i = 0; i < 2; i++) {
          glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
 
-         glBindTexture(GL_TEXTURE_2D, textures[i]);
+         glBindTexture(GL_TEXTURE_2D, momentTextures[i]);
          glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
-
          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, momentTextures[i], 0);
 
          if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
             std::cerr << "Framebuffer " << i << " not complete!" << std::endl;
          }
+         const GLenum buffers[] = {GL_NONE, GL_COLOR_ATTACHMENT1};
+         glDrawBuffers(2, buffers);
+         glClearBufferfv(GL_COLOR, 1, zero);
       }
+
+      // One texture per reduction, down to a single texel. Zeros until the first pass is reduced.
+      glDeleteTextures(static_cast<GLsizei>(momentSumTextures.size()), momentSumTextures.data());
+      glDeleteFramebuffers(static_cast<GLsizei>(momentSumFramebuffers.size()), momentSumFramebuffers.data());
+      momentSumTextures.clear();
+      momentSumFramebuffers.clear();
+      glm::ivec2 size(width, height);
+      do {
+         size = reducedSize(size);
+         GLuint texture;
+         GLuint framebuffer;
+         glGenTextures(1, &texture);
+         glGenFramebuffers(1, &framebuffer);
+         glBindTexture(GL_TEXTURE_2D, texture);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+         glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Moment reduction framebuffer not complete!" << std::endl;
+         }
+         glClearBufferfv(GL_COLOR, 0, zero);
+         momentSumTextures.push_back(texture);
+         momentSumFramebuffers.push_back(framebuffer);
+      } while (size.x > 1 || size.y > 1);
    }
 
-   static void renderingToTexture(int width, int height) {
-      int index = writeToFirstTexture ? 0 : 1;
-      glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[index]);
-      glViewport(0, 0, width, height);
+   static void allocateFirstHits(int width, int height) {
+      GLuint textures[3] = {firstHitTexture, historyTextures[0], historyTextures[1]};
+      for (GLuint texture : textures) {
+         glBindTexture(GL_TEXTURE_2D, texture);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      }
 
-      // alterne pour la prochaine frame
-      writeToFirstTexture = !writeToFirstTexture;
-   }
+      for (int i = 0; i < 2; i++) {
+         glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, firstHitTexture, 0);
+         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Framebuffer " << i << " not complete!" << std::endl;
+         }
+      }
 
-   static GLuint getAccumTexture() {
-      // renvoie la texture "ancienne" (celle qu’on ne vient pas de remplir)
-      return textures[writeToFirstTexture ? 1 : 0];
+      glBindFramebuffer(GL_FRAMEBUFFER, historyFramebuffer);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTextures[0], 0);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, historyTextures[1], 0);
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+         std::cerr << "History framebuffer not complete!" << std::endl;
+      }
+
+      // Zeros are misses, never reprojected
+      const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      const GLenum historyBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+      glDrawBuffers(2, historyBuffers);
+      glClearBufferfv(GL_COLOR, 0, zero);
+      glClearBufferfv(GL_COLOR, 1, zero);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+      const GLenum firstHitBuffers[] = {GL_NONE, GL_NONE, GL_COLOR_ATTACHMENT2};
+      glDrawBuffers(3, firstHitBuffers);
+      glClearBufferfv(GL_COLOR, 2, zero);
    }
 
-   static void incrementFrameSinceLastMove() {
-      frameSinceLastMove++;
+   static void allocateGbuffer(const GLuint* textures, const GLuint* targets, int targetCount, int width, int height) {
+      const GLenum formats[GBUFFER_SIZE] = {GL_RGBA32F, GL_RGBA8, GL_RGBA32F};
+      for (int i = 0; i < GBUFFER_SIZE; i++) {
+         glBindTexture(GL_TEXTURE_2D, textures[i]);
+         glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(formats[i]), width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      }
+
+      for (int t = 0; t < targetCount; t++) {
+         glBindFramebuffer(GL_FRAMEBUFFER, targets[t]);
+         for (int i = 0; i < GBUFFER_SIZE; i++)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3 + i, GL_TEXTURE_2D, textures[i], 0);
+         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "G-buffer of framebuffer " << targets[t] << " not complete!" << std::endl;
+         }
+      }
    }
 
-   static int getFrameSinceLastMove() {
-      return frameSinceLastMove;
+   static void allocateMotionTarget(int width, int height) {
+      glBindTexture(GL_TEXTURE_2D, motionTexture);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+      // Bilinear upscale in the screen shader
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+      glBindFramebuffer(GL_FRAMEBUFFER, motionFramebuffer);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, motionTexture, 0);
+
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+         std::cerr << "Motion framebuffer not complete!" << std::endl;
+      }
    }
 
-public:
-   static GLuint framebuffers[2];
-   static GLuint textures[2];
-   static bool writeToFirstTexture;
-   static int frameSinceLastMove;
-private:
    static std::unique_ptr<Camera> camera;
    static float p_deltaTime;
 };
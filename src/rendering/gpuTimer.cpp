@@ -0,0 +1,61 @@
+#include "gpuTimer.hpp"
+
+#include <chrono>
+
+static double wallClock() {
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+GpuTimer::GpuTimer(int passCount) : passCount(passCount), slots(LATENCY * passCount), results(passCount, 0.0) {
+   for (Slot& s : slots) {
+      glGenQueries(1, &s.query);
+   }
+}
+
+GpuTimer::~GpuTimer() {
+   for (Slot& s : slots) {
+      glDeleteQueries(1, &s.query);
+   }
+}
+
+void GpuTimer::begin(int pass) {
+   // A result still pending after LATENCY frames is dropped
+   Slot& s = slot(frame, pass);
+   glBeginQuery(GL_TIME_ELAPSED, s.query);
+   s.pending = true;
+   s.issuedAt = wallClock();
+}
+
+void GpuTimer::end(int pass) {
+   (void)pass;
+   glEndQuery(GL_TIME_ELAPSED);
+}
+
+void GpuTimer::endFrame() {
+   const double time = wallClock();
+   // Oldest first, so the newest available result wins
+   for (int age = LATENCY - 1; age >= 0; age--) {
+      const int frameIndex = frame - age;
+      if (frameIndex < 0)
+         continue;
+      for (int pass = 0; pass < passCount; pass++) {
+         Slot& s = slot(frameIndex, pass);
+         if (!s.pending)
+            continue;
+         GLint available = GL_FALSE;
+         glGetQueryObjectiv(s.query, GL_QUERY_RESULT_AVAILABLE, &available);
+         if (!available)
+            continue;
+         GLuint64 elapsed = 0;
+         glGetQueryObjectui64v(s.query, GL_QUERY_RESULT, &elapsed);
+         s.pending = false;
+         // A pass can't take longer than the time since it began, some drivers (llvmpipe)
+         // return garbage for their very first query
+         const double ms = static_cast<double>(elapsed) * 1e-6;
+         if (ms <= (time - s.issuedAt) * 1000.0)
+            results[pass] = ms;
+      }
+   }
+   frame++;
+}
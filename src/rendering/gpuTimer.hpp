@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef GPUTIMER_HPP
+#define GPUTIMER_HPP
+
+#include <vector>
+
+#include "glad/glad.h"
+
+// GL_TIME_ELAPSED queries around render passes (core since GL 3.3).
+// Each pass owns a ring of queries: a result is read frames later, only once the driver
+// reports it available, so timing never waits on the GPU.
+class GpuTimer {
+public:
+   explicit GpuTimer(int passCount);
+   ~GpuTimer();
+
+   GpuTimer(const GpuTimer&) = delete;
+   GpuTimer& operator=(const GpuTimer&) = delete;
+
+   // Queries of the same target can't nest: passes are timed one after the other
+   void begin(int pass);
+   void end(int pass);
+
+   // Once per frame after the last pass: collect the results that are ready
+   void endFrame();
+
+   // Latest result in milliseconds, 0 until one is available
+   [[nodiscard]] double getMs(int pass) const { return results[pass]; }
+
+private:
+   // Frames a query may stay in flight before its slot is reused
+   static constexpr int LATENCY = 3;
+
+   struct Slot {
+      GLuint query = 0;
+      bool pending = false;
+      // Wall clock at begin(), in seconds
+      double issuedAt = 0.0;
+   };
+
+   Slot& slot(int frameIndex, int pass) { return slots[(frameIndex % LATENCY) * passCount + pass]; }
+
+   int passCount;
+   int frame = 0;
+   std::vector<Slot> slots;
+   std::vector<double> results;
+};
+
+#endif //GPUTIMER_HPP
@@ -0,0 +1,114 @@
+#include "image.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+Image readFramebuffer(GLuint framebuffer, int width, int height) {
+   Image image;
+   image.width = width;
+   image.height = height;
+   image.pixels.resize(static_cast<size_t>(width) * height * 4);
+
+   glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+   glReadBuffer(GL_COLOR_ATTACHMENT0);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, image.pixels.data());
+   glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+   return image;
+}
+
+void normalizeAccumulation(Image& image) {
+   for (size_t i = 0; i + 3 < image.pixels.size(); i += 4) {
+      float* pixel = &image.pixels[i];
+      float count = pixel[3];
+      for (int c = 0; c < 3; c++)
+         pixel[c] = count > 0.0f ? pixel[c] / count : 0.0f;
+      pixel[3] = 1.0f;
+   }
+}
+
+static bool endsWith(const std::string& str, const std::string& suffix) {
+   return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Portable float map, RGB little endian, bottom to top rows
+static bool writePFM(FILE* file, const Image& image) {
+   fprintf(file, "PF\n%d %d\n-1.0\n", image.width, image.height);
+
+   std::vector<float> row(static_cast<size_t>(image.width) * 3);
+   for (int y = 0; y < image.height; y++) {
+      const float* src = &image.pixels[static_cast<size_t>(y) * image.width * 4];
+      for (int x = 0; x < image.width; x++) {
+         row[x * 3 + 0] = src[x * 4 + 0];
+         row[x * 3 + 1] = src[x * 4 + 1];
+         row[x * 3 + 2] = src[x * 4 + 2];
+      }
+      if (fwrite(row.data(), sizeof(float), row.size(), file) != row.size())
+         return false;
+   }
+   return true;
+}
+
+// Binary 8 bit PPM, top to bottom rows, values clamped like on screen
+static bool writePPM(FILE* file, const Image& image) {
+   fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+
+   std::vector<uint8_t> row(static_cast<size_t>(image.width) * 3);
+   for (int y = image.height - 1; y >= 0; y--) {
+      const float* src = &image.pixels[static_cast<size_t>(y) * image.width * 4];
+      for (int x = 0; x < image.width * 3; x++) {
+         float v = std::clamp(src[(x / 3) * 4 + x % 3], 0.0f, 1.0f);
+         row[x] = static_cast<uint8_t>(v * 255.0f + 0.5f);
+      }
+      if (fwrite(row.data(), 1, row.size(), file) != row.size())
+         return false;
+   }
+   return true;
+}
+
+bool writeImage(const std::string& path, const Image& image) {
+   FILE* file = fopen(path.c_str(), "wb");
+   if (!file) {
+      fprintf(stderr, "Unable to open %s for writing\n", path.c_str());
+      return false;
+   }
+
+   bool ok = endsWith(path, ".pfm") ? writePFM(file, image) : writePPM(file, image);
+   ok = (fclose(file) == 0) && ok;
+   if (!ok)
+      fprintf(stderr, "Error writing %s\n", path.c_str());
+   return ok;
+}
+
+bool readImage(const std::string& path, Image& image) {
+   FILE* file = fopen(path.c_str(), "rb");
+   if (!file)
+      return false;
+
+   char magic[3] = {};
+   int width = 0;
+   int height = 0;
+   float scale = 0.0f;
+   // A single whitespace separates the header from the data
+   bool ok = fscanf(file, "%2s %d %d %f", magic, &width, &height, &scale) == 4 && fgetc(file) != EOF &&
+             magic[0] == 'P' && magic[1] == 'F' && width > 0 && height > 0 && scale < 0.0f;
+   if (ok) {
+      image.width = width;
+      image.height = height;
+      image.pixels.assign(static_cast<size_t>(width) * height * 4, 1.0f);
+      std::vector<float> row(static_cast<size_t>(width) * 3);
+      for (int y = 0; y < height && ok; y++) {
+         ok = fread(row.data(), sizeof(float), row.size(), file) == row.size();
+         float* dst = &image.pixels[static_cast<size_t>(y) * width * 4];
+         for (int x = 0; x < width && ok; x++) {
+            dst[x * 4 + 0] = row[x * 3 + 0];
+            dst[x * 4 + 1] = row[x * 3 + 1];
+            dst[x * 4 + 2] = row[x * 3 + 2];
+         }
+      }
+   }
+   fclose(file);
+   return ok;
+}
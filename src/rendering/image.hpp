@@ -0,0 +1,31 @@
+#pragma once
+
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <string>
+#include <vector>
+
+#include "glad/glad.h"
+
+// RGBA float pixels, rows stored bottom to top like OpenGL
+struct Image {
+   int width = 0;
+   int height = 0;
+   std::vector<float> pixels;
+};
+
+// Read back the color attachment of a framebuffer
+Image readFramebuffer(GLuint framebuffer, int width, int height);
+
+// Accumulation buffers hold a radiance sum and a sample count (alpha): divide, alpha becomes 1.
+// Pixels without samples are black.
+void normalizeAccumulation(Image& image);
+
+// Write an image to disk, the format is chosen from the extension (.pfm for float, .ppm otherwise)
+bool writeImage(const std::string& path, const Image& image);
+
+// Read an image written by writeImage as .pfm (little endian RGB). False if missing or malformed.
+bool readImage(const std::string& path, Image& image);
+
+#endif //IMAGE_HPP
@@ -0,0 +1,138 @@
+#include "programCache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+
+bool ProgramCache::p_enabled = true;
+std::string ProgramCache::p_directory = "shader_cache";
+double ProgramCache::p_savedMs = 0.0;
+
+namespace {
+   constexpr uint32_t CACHE_MAGIC = 0x42505452; // "RTPB"
+   constexpr uint32_t CACHE_VERSION = 1;
+
+   struct EntryHeader {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t binaryFormat;
+      uint32_t length;
+      double compileMs;
+   };
+
+   uint64_t fnv1a64(uint64_t h, std::string_view data) {
+      for (unsigned char c : data) {
+         h = (h ^ c) * 1099511628211ull;
+      }
+      // Separator so that ("ab","c") and ("a","bc") differ
+      return (h ^ 0xffu) * 1099511628211ull;
+   }
+
+   std::string_view glString(GLenum name) {
+      const GLubyte* str = glGetString(name);
+      return str ? std::string_view(reinterpret_cast<const char*>(str)) : std::string_view();
+   }
+}
+
+bool ProgramCache::isAvailable() {
+   if (!p_enabled || !GLAD_GL_VERSION_4_1)
+      return false;
+   GLint formats = 0;
+   glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+   return formats > 0;
+}
+
+uint64_t ProgramCache::makeKey(const std::vector<std::string_view>& sources) {
+   uint64_t h = 14695981039346656037ull;
+   for (std::string_view source : sources) {
+      h = fnv1a64(h, source);
+   }
+   h = fnv1a64(h, glString(GL_VENDOR));
+   h = fnv1a64(h, glString(GL_RENDERER));
+   h = fnv1a64(h, glString(GL_VERSION));
+   return h;
+}
+
+std::string ProgramCache::entryPath(uint64_t key) {
+   char name[32];
+   snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+   return (std::filesystem::path(p_directory) / name).string();
+}
+
+bool ProgramCache::load(GLuint program, uint64_t key, double& compileMs) {
+   if (!isAvailable())
+      return false;
+
+   auto start = std::chrono::steady_clock::now();
+   const std::string path = entryPath(key);
+   FILE* file = fopen(path.c_str(), "rb");
+   if (!file)
+      return false;
+
+   EntryHeader header{};
+   std::vector<unsigned char> binary;
+   bool ok = fread(&header, sizeof(header), 1, file) == 1
+             && header.magic == CACHE_MAGIC && header.version == CACHE_VERSION;
+   if (ok) {
+      binary.resize(header.length);
+      ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+   }
+   fclose(file);
+
+   GLint success = 0;
+   if (ok) {
+      glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+      glGetProgramiv(program, GL_LINK_STATUS, &success);
+   }
+   if (!success) {
+      // Corrupted, or the driver changed its mind about the format
+      fprintf(stderr, "Shader cache entry %s rejected, recompiling\n", path.c_str());
+      std::error_code error;
+      std::filesystem::remove(path, error);
+      return false;
+   }
+
+   compileMs = header.compileMs;
+   double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   p_savedMs += std::max(0.0, compileMs - loadMs);
+   return true;
+}
+
+void ProgramCache::store(GLuint program, uint64_t key, double compileMs) {
+   if (!isAvailable())
+      return;
+
+   GLint length = 0;
+   glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+   if (length <= 0)
+      return;
+
+   std::vector<unsigned char> binary(static_cast<size_t>(length));
+   GLenum format = 0;
+   glGetProgramBinary(program, length, &length, &format, binary.data());
+
+   std::error_code error;
+   std::filesystem::create_directories(p_directory, error);
+
+   // Write next to the entry then rename, a concurrent run never reads half a file
+   const std::string path = entryPath(key);
+   const std::string tempPath = path + ".tmp";
+   FILE* file = fopen(tempPath.c_str(), "wb");
+   if (!file) {
+      fprintf(stderr, "Unable to write shader cache entry %s\n", path.c_str());
+      return;
+   }
+   EntryHeader header{CACHE_MAGIC, CACHE_VERSION, format, static_cast<uint32_t>(length), compileMs};
+   bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+             && fwrite(binary.data(), 1, static_cast<size_t>(length), file) == static_cast<size_t>(length);
+   ok = (fclose(file) == 0) && ok;
+
+   if (ok) {
+      std::filesystem::rename(tempPath, path, error);
+   }
+   if (!ok || error) {
+      std::filesystem::remove(tempPath, error);
+   }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#ifndef PROGRAMCACHE_HPP
+#define PROGRAMCACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "glad/glad.h"
+
+// On-disk cache of linked program binaries (glGetProgramBinary / glProgramBinary).
+// Entries are keyed by the preprocessed sources and the driver vendor/renderer/version,
+// so a driver update or any shader change simply misses.
+class ProgramCache {
+public:
+   static void setEnabled(bool enabled) { p_enabled = enabled; }
+   static void setDirectory(const std::string& directory) { p_directory = directory; }
+
+   // Enabled and supported by the context (GL 4.1, at least one binary format)
+   static bool isAvailable();
+
+   static uint64_t makeKey(const std::vector<std::string_view>& sources);
+
+   // Load a binary into program. False when there is no entry or the driver rejects it,
+   // the program must then be compiled. compileMs receives the time the original build took.
+   static bool load(GLuint program, uint64_t key, double& compileMs);
+
+   // Save the binary of a freshly linked program.
+   // GL_PROGRAM_BINARY_RETRIEVABLE_HINT must have been set before linking.
+   static void store(GLuint program, uint64_t key, double compileMs);
+
+   // Compile time avoided by cache hits since startup
+   static double getSavedMs() { return p_savedMs; }
+
+private:
+   static std::string entryPath(uint64_t key);
+
+   static bool p_enabled;
+   static std::string p_directory;
+   static double p_savedMs;
+};
+
+#endif //PROGRAMCACHE_HPP
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef RENDERPARAMS_HPP
+#define RENDERPARAMS_HPP
+
+#include "glm/glm.hpp"
+
+// Sequence of the path samples (see random.glsl), same values as the SAMPLER_ defines
+enum class Sampler {
+   RANDOM, // xorshift, unstratified
+   SOBOL, // Owen scrambled Sobol, per pixel
+   BLUE_NOISE // Owen scrambled Sobol rotated by a blue noise mask
+};
+
+// Uniforms driving the raytracing pass, shared by every backend
+struct RenderParams {
+   float focalLength;
+   int maxBounces;
+   int rayPerPixel;
+   unsigned int time;
+   // Features, baked into the GPU program (see ShaderVariant)
+   bool emission = true;
+   bool russianRoulette = true;
+   // Spend rayPerPixel as an average, per pixel from the variance estimate (see main.frag)
+   bool adaptiveSampling = false;
+   // Relative standard error under which a pixel stops receiving samples
+   float adaptiveThreshold = 0.01f;
+   // Write the first hit buffer, the first pass of an accumulation reprojects the history (see saveHistory)
+   bool reprojection = false;
+   // Write the guides of DenoisePass (first hit normal, depth, albedo and luminance sums)
+   bool denoiseAovs = false;
+   // Next event estimation: sample an emitter at every hit, combined with the bounces by MIS
+   bool lightSampling = true;
+   Sampler sampler = Sampler::SOBOL;
+};
+
+// Camera basis as sent to the shader
+struct CameraState {
+   glm::vec3 position;
+   glm::vec3 direction;
+   glm::vec3 up;
+};
+
+#endif //RENDERPARAMS_HPP
@@ -0,0 +1,160 @@
+#include "sceneBuffer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// Keep some room so that small uniform blocks still hold the default scene
+static constexpr size_t MAX_UNIFORM_MATERIALS = 256;
+
+void SceneBuffer::Range::markDirty(size_t begin, size_t end) {
+   if (dirtyBegin == dirtyEnd) {
+      dirtyBegin = begin;
+      dirtyEnd = end;
+   } else {
+      dirtyBegin = std::min(dirtyBegin, begin);
+      dirtyEnd = std::max(dirtyEnd, end);
+   }
+}
+
+SceneBuffer::SceneBuffer(bool allowStorageBuffer) {
+   GLint fragmentStorageBlocks = 0;
+   if (allowStorageBuffer && GLAD_GL_VERSION_4_3) {
+      glGetIntegerv(GL_MAX_FRAGMENT_SHADER_STORAGE_BLOCKS, &fragmentStorageBlocks);
+   }
+   storage = fragmentStorageBlocks >= 3;
+
+   if (!storage) {
+      GLint maxBlockSize = 0;
+      glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+      maxUniformMaterials = std::min(MAX_UNIFORM_MATERIALS, static_cast<size_t>(maxBlockSize) / sizeof(GpuMaterial));
+      maxUniformSpheres = static_cast<size_t>(maxBlockSize) / sizeof(GpuSphere);
+   }
+   spheres.binding = SPHERE_BINDING;
+   spheres.uniformCapacity = maxUniformSpheres;
+   materials.binding = MATERIAL_BINDING;
+   materials.uniformCapacity = maxUniformMaterials;
+   // Every emitter is a sphere, and GpuEmitter is smaller than GpuSphere: they always fit
+   emitters.binding = EMITTER_BINDING;
+   emitters.uniformCapacity = maxUniformSpheres;
+
+   glGenBuffers(1, &spheres.buffer);
+   glGenBuffers(1, &materials.buffer);
+   glGenBuffers(1, &emitters.buffer);
+
+   printf("Scene buffer: %s\n", storage ? "shader storage buffers" : "uniform buffers");
+}
+
+SceneBuffer::~SceneBuffer() {
+   glDeleteBuffers(1, &spheres.buffer);
+   glDeleteBuffers(1, &materials.buffer);
+   glDeleteBuffers(1, &emitters.buffer);
+}
+
+std::string SceneBuffer::shaderDefines() const {
+   if (storage)
+      return "#define SCENE_SSBO\n";
+   return "#define MAX_SPHERES " + std::to_string(maxUniformSpheres) + "\n"
+        + "#define MAX_MATERIALS " + std::to_string(maxUniformMaterials) + "\n"
+        + "#define MAX_EMITTERS " + std::to_string(maxUniformSpheres) + "\n";
+}
+
+void SceneBuffer::bindBlocks(GLuint program) const {
+   if (storage) {
+      glShaderStorageBlockBinding(program, glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "SphereBuffer"), SPHERE_BINDING);
+      glShaderStorageBlockBinding(program, glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "MaterialBuffer"), MATERIAL_BINDING);
+      glShaderStorageBlockBinding(program, glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "EmitterBuffer"), EMITTER_BINDING);
+   } else {
+      glUniformBlockBinding(program, glGetUniformBlockIndex(program, "SphereBlock"), SPHERE_BINDING);
+      glUniformBlockBinding(program, glGetUniformBlockIndex(program, "MaterialBlock"), MATERIAL_BINDING);
+      glUniformBlockBinding(program, glGetUniformBlockIndex(program, "EmitterBlock"), EMITTER_BINDING);
+   }
+}
+
+void SceneBuffer::markAllDirty() {
+   spheres.reallocate = true;
+   materials.reallocate = true;
+   emitters.reallocate = true;
+}
+
+template<typename T, typename Src, typename Pack>
+void SceneBuffer::upload(Range& range, const std::vector<Src>& source, size_t count, Pack pack) {
+   if (count != range.count) {
+      // Elements added at the end
+      if (count > range.count)
+         range.markDirty(range.count, count);
+      range.count = count;
+   }
+   if (count > range.capacity) {
+      range.reallocate = true;
+   }
+   if (!range.reallocate && range.dirtyBegin == range.dirtyEnd)
+      return;
+
+   const GLenum bufferTarget = target();
+   glBindBuffer(bufferTarget, range.buffer);
+
+   size_t begin = range.dirtyBegin;
+   size_t end = std::min(range.dirtyEnd, count);
+   if (range.reallocate) {
+      if (storage) {
+         // Grow geometrically so that adding spheres one by one stays cheap
+         range.capacity = std::max<size_t>({count, range.capacity + range.capacity / 2, 1});
+      } else {
+         // Uniform blocks are declared with a fixed size in the shader
+         range.capacity = range.uniformCapacity;
+      }
+      glBufferData(bufferTarget, static_cast<GLsizeiptr>(range.capacity * sizeof(T)), nullptr, GL_DYNAMIC_DRAW);
+      glBindBufferBase(bufferTarget, range.binding, range.buffer);
+      begin = 0;
+      end = count;
+   }
+
+   if (begin < end) {
+      staging.resize((end - begin) * sizeof(T));
+      for (size_t i = begin; i < end; i++) {
+         T packed = pack(source[i]);
+         memcpy(&staging[(i - begin) * sizeof(T)], &packed, sizeof(T));
+      }
+      glBufferSubData(bufferTarget, static_cast<GLintptr>(begin * sizeof(T)), static_cast<GLsizeiptr>(staging.size()), staging.data());
+   }
+
+   range.reallocate = false;
+   range.dirtyBegin = range.dirtyEnd = 0;
+   glBindBuffer(bufferTarget, 0);
+}
+
+void SceneBuffer::sync(const Scene& scene) {
+   size_t materialCount = scene.materials.size();
+   size_t count = scene.spheres.size();
+   if (!storage && (materialCount > maxUniformMaterials || count > maxUniformSpheres)) {
+      if (!truncationReported) {
+         fprintf(stderr, "Scene too large for uniform buffers, only the first %zu spheres are rendered\n", maxUniformSpheres);
+         truncationReported = true;
+      }
+      materialCount = std::min(materialCount, maxUniformMaterials);
+      count = std::min(count, maxUniformSpheres);
+   }
+
+   // Any sphere or material edit may light or turn off a sphere
+   if (spheres.isDirty(count) || materials.isDirty(materialCount)) {
+      std::vector<int> visible = scene.emitters();
+      visible.erase(std::find_if(visible.begin(), visible.end(), [&](int i) { return static_cast<size_t>(i) >= count; }), visible.end());
+      if (visible != emitterIndices) {
+         emitterIndices = std::move(visible);
+         emitters.markDirty(0, emitterIndices.size());
+      }
+   }
+
+   upload<GpuMaterial>(materials, scene.materials, materialCount, [](const Material& m) {
+      return GpuMaterial{m.color, glm::vec4(glm::vec3(m.emissionColor), m.emissionStrength)};
+   });
+   // Never index past the materials the shader holds
+   const int lastMaterial = std::max(static_cast<int>(materialCount) - 1, 0);
+   upload<GpuSphere>(spheres, scene.spheres, count, [&](const Sphere& s) {
+      return GpuSphere{glm::vec4(s.center, s.radius), glm::ivec4(std::clamp(s.material, 0, lastMaterial), 0, 0, 0)};
+   });
+   upload<GpuEmitter>(emitters, emitterIndices, emitterIndices.size(), [](int sphere) {
+      return GpuEmitter{glm::ivec4(sphere, 0, 0, 0)};
+   });
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#ifndef SCENEBUFFER_HPP
+#define SCENEBUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glad/glad.h"
+#include "scene/scene.hpp"
+
+// GPU copy of a Scene and of its emitter list, read by main.frag.
+// Uses shader storage buffers when available (GL 4.3),
+// std140 uniform blocks otherwise. Only the ranges marked dirty are uploaded by sync().
+class SceneBuffer {
+public:
+   // Layout shared by std140 and std430, see main.frag
+   struct GpuSphere {
+      glm::vec4 centerRadius;
+      glm::ivec4 data; // x = material index
+   };
+
+   struct GpuMaterial {
+      glm::vec4 color;
+      glm::vec4 emission; // rgb = emission color, a = emission strength
+   };
+
+   struct GpuEmitter {
+      glm::ivec4 data; // x = sphere index
+   };
+
+   static constexpr GLuint SPHERE_BINDING = 0;
+   static constexpr GLuint MATERIAL_BINDING = 1;
+   static constexpr GLuint EMITTER_BINDING = 2;
+
+   explicit SceneBuffer(bool allowStorageBuffer = true);
+   ~SceneBuffer();
+
+   SceneBuffer(const SceneBuffer&) = delete;
+   SceneBuffer& operator=(const SceneBuffer&) = delete;
+
+   // Defines selecting the matching scene declaration, to inject in main.frag
+   [[nodiscard]] std::string shaderDefines() const;
+
+   // Connect the blocks of a program to our binding points
+   void bindBlocks(GLuint program) const;
+
+   void markSphereDirty(size_t index) { spheres.markDirty(index, index + 1); }
+   void markMaterialDirty(size_t index) { materials.markDirty(index, index + 1); }
+   void markAllDirty();
+
+   // Upload what changed since the last call. Grows the buffers when needed.
+   // The emitter list (Scene::emitters) is rebuilt when a sphere or a material changed.
+   void sync(const Scene& scene);
+
+   // Number of spheres visible to the shader (clamped to the uniform block capacity)
+   [[nodiscard]] int getSphereCount() const { return static_cast<int>(spheres.count); }
+   // Emissive spheres among them
+   [[nodiscard]] int getEmitterCount() const { return static_cast<int>(emitters.count); }
+   [[nodiscard]] bool usesStorageBuffer() const { return storage; }
+   // Capacity of the sphere array, only limited for uniform blocks
+   [[nodiscard]] size_t maxSpheres() const { return storage ? SIZE_MAX : maxUniformSpheres; }
+   // Same for the materials, the indices past it are clamped by sync()
+   [[nodiscard]] size_t maxMaterials() const { return storage ? SIZE_MAX : maxUniformMaterials; }
+
+private:
+   struct Range {
+      GLuint buffer = 0;
+      GLuint binding = 0;
+      size_t count = 0; // in elements
+      size_t capacity = 0;
+      // Size of the array declared in the shader when uploaded to a uniform block
+      size_t uniformCapacity = 0;
+      size_t dirtyBegin = 0;
+      size_t dirtyEnd = 0;
+      // Upload all of it at the next sync
+      bool reallocate = true;
+
+      void markDirty(size_t begin, size_t end);
+      // Something to upload for count elements
+      [[nodiscard]] bool isDirty(size_t newCount) const { return reallocate || dirtyBegin != dirtyEnd || count != newCount; }
+   };
+
+   template<typename T, typename Src, typename Pack>
+   void upload(Range& range, const std::vector<Src>& source, size_t count, Pack pack);
+
+   GLenum target() const { return storage ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER; }
+
+   bool storage = false;
+   size_t maxUniformSpheres = 0;
+   size_t maxUniformMaterials = 0;
+   bool truncationReported = false;
+   Range spheres;
+   Range materials;
+   Range emitters;
+   std::vector<int> emitterIndices;
+   std::vector<unsigned char> staging;
+};
+
+#endif //SCENEBUFFER_HPP
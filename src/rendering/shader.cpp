@@ -1,143 +1,318 @@
 #include "shader.hpp"
 
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 #include <glad/glad.h>
 
+#include "programCache.hpp"
 
-std::string read_file(const std::string& filepath) {
-   std::ifstream file(filepath, std::ios::in | std::ios::binary | std::ios::ate);
-   if (!file) {
-      throw std::runtime_error("Unable to open file: " + filepath);
+
+// GL_KHR_parallel_shader_compile, the generated loader has no extensions
+static constexpr GLenum COMPLETION_STATUS = 0x91B1;
+
+static bool hasParallelCompile() {
+   static int supported = -1;
+   if (supported < 0) {
+      supported = 0;
+      GLint count = 0;
+      glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+      for (GLint i = 0; i < count; i++) {
+         const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+         if (extension && (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 ||
+                           strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)) {
+            supported = 1;
+         }
+      }
    }
+   return supported == 1;
+}
+
+static std::string shaderLog(GLuint shader) {
+   GLint length = 0;
+   glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+   std::string log(static_cast<size_t>(std::max(length, 1)), '\0');
+   glGetShaderInfoLog(shader, static_cast<GLsizei>(log.size()), nullptr, log.data());
+   log.resize(strlen(log.c_str()));
+   return log;
+}
+
+static std::string programLog(GLuint program) {
+   GLint length = 0;
+   glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+   std::string log(static_cast<size_t>(std::max(length, 1)), '\0');
+   glGetProgramInfoLog(program, static_cast<GLsizei>(log.size()), nullptr, log.data());
+   log.resize(strlen(log.c_str()));
+   return log;
+}
 
-   std::streamsize size = file.tellg();
-   file.seekg(0, std::ios::beg);
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+   return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-   std::string buffer(size, '\0'); // alloue directement la bonne taille
-   if (!file.read(buffer.data(), size)) {
-      throw std::runtime_error("Error reading file: " + filepath);
+static const char* stageName(GLenum type) {
+   switch (type) {
+      case GL_VERTEX_SHADER: return "VERTEX";
+      case GL_FRAGMENT_SHADER: return "FRAGMENT";
+      case GL_COMPUTE_SHADER: return "COMPUTE";
+      default: return "UNKNOWN";
    }
+}
+
+Shader::Shader(const std::string &vertexShaderPath, const std::string &fragmentShaderPath, const std::string &defines, bool waitForLink)
+   : Shader({{GL_VERTEX_SHADER, vertexShaderPath}, {GL_FRAGMENT_SHADER, fragmentShaderPath}}, defines, waitForLink) {}
 
-   return buffer;
+Shader Shader::compute(const std::string &computeShaderPath, const std::string &defines, bool waitForLink) {
+   return Shader({{GL_COMPUTE_SHADER, computeShaderPath}}, defines, waitForLink);
 }
 
-std::string preprocesseur(const std::string& src) {
-   std::string result = src;
-   //printf("Before: %s\n", result.c_str());
+Shader::Shader(std::vector<Stage> stages, const std::string &defines, bool waitForLink)
+   : stages(std::move(stages)), defines(defines) {
+   for (const Stage& stage : this->stages)
+      name += (name.empty() ? "" : " + ") + stage.path;
 
-   size_t index = result.find("#include");
-   while (index != std::string::npos) {
-      // Find the end of #include directive
-      size_t directive_end = result.find_first_of("\"<", index + 8);
-      if (directive_end == std::string::npos) {
-         break; // Malformed include
+   // Lire les fichiers shaders
+   std::vector<PreprocessedSource> sources = preprocess();
+   for (const PreprocessedSource& source : sources) {
+      if (source.code.empty()) {
+         fprintf(stderr, "Erreur lecture shader files\n");
+         exit(1);
       }
+   }
 
-      // Determine quote type and find matching end quote
-      char quote_char = result[directive_end];
-      char end_quote = (quote_char == '<') ? '>' : quote_char;
-
-      size_t file_start = directive_end + 1;
-      size_t file_end = result.find(end_quote, file_start);
-      if (file_end == std::string::npos) {
-         break; // Malformed include
+   PendingProgram build = startBuild(sources);
+   if (!waitForLink) {
+      program = 0;
+      dependencies = build.files;
+      reload = std::move(build);
+      reloading = true;
+      return;
+   }
+   if (finishBuild(build)) {
+      program = build.program;
+      buildMs = elapsedMs(build.start);
+      fromCache = build.fromCache;
+      if (fromCache) {
+         printf("Shader %s loaded from cache in %.1f ms (compiling took %.1f ms)\n", name.c_str(), buildMs, build.compileMs);
+      } else {
+         printf("Shader %s compiled in %.1f ms\n", name.c_str(), buildMs);
       }
+   } else {
+      program = 0;
+   }
+   dependencies = build.files;
+   uniforms = std::move(build.uniforms);
+}
 
-      // Extract filename
-      std::string filename = result.substr(file_start, file_end - file_start);
+std::vector<PreprocessedSource> Shader::preprocess() const {
+   std::vector<PreprocessedSource> sources;
+   for (const Stage& stage : stages)
+      sources.push_back(ShaderPreprocessor::process(stage.path, defines));
+   return sources;
+}
 
-      // Read the file content
-      std::string file_content = read_file(filename);
+Shader::PendingProgram Shader::startBuild(const std::vector<PreprocessedSource>& sources) {
+   PendingProgram pending;
+   pending.start = std::chrono::steady_clock::now();
+   std::vector<std::string_view> codes;
+   for (const PreprocessedSource& source : sources) {
+      pending.stageFiles.push_back(source.files);
+      for (const std::string& file : source.files) {
+         if (std::find(pending.files.begin(), pending.files.end(), file) == pending.files.end())
+            pending.files.push_back(file);
+      }
+      codes.emplace_back(source.code);
+   }
 
-      // Replace the entire #include directive with file content
-      result.replace(index, file_end + 1 - index, file_content);
+   pending.program = glCreateProgram();
+   pending.cacheKey = ProgramCache::makeKey(codes);
+   if (ProgramCache::load(pending.program, pending.cacheKey, pending.compileMs)) {
+      pending.fromCache = true;
+      return pending;
+   }
 
-      // Continue searching from current position
-      index = result.find("#include", index + file_content.length());
+   // Only submit the work here, statuses are queried in finishBuild so the driver can compile in the background
+   for (size_t i = 0; i < stages.size(); i++) {
+      const char* src = sources[i].code.c_str();
+      GLuint shader = glCreateShader(stages[i].type);
+      glShaderSource(shader, 1, &src, nullptr);
+      glCompileShader(shader);
+      glAttachShader(pending.program, shader);
+      pending.shaders.push_back(shader);
+   }
+   if (ProgramCache::isAvailable()) {
+      glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
    }
+   glLinkProgram(pending.program);
 
-   //printf("After: %s\n", result.c_str());
-   return result;
+   return pending;
 }
 
-Shader::Shader(const std::string &vertexShaderPath, const std::string &fragmentShaderPath) {
+bool Shader::finishBuild(PendingProgram& pending) {
+   if (pending.fromCache) {
+      if (cacheUniformLocations(pending))
+         return true;
+      glDeleteProgram(pending.program);
+      pending.program = 0;
+      return false;
+   }
+
    int success;
-   char infoLog[512];
+   for (size_t i = 0; i < pending.shaders.size(); i++) {
+      glGetShaderiv(pending.shaders[i], GL_COMPILE_STATUS, &success);
+      if(!success) {
+         printf("ERROR::SHADER::%s::COMPILATION_FAILED\n%s\n", stageName(stages[i].type),
+                ShaderPreprocessor::translateLog(shaderLog(pending.shaders[i]), pending.stageFiles[i]).c_str());
+      }
+   }
 
-   program = glCreateProgram();
+   glGetProgramiv(pending.program, GL_LINK_STATUS, &success);
+   if(!success) {
+      printf("ERROR::SHADER::PROGRAM::LINK_FAILED\n%s\n", programLog(pending.program).c_str());
+   }
 
-   // Lire les fichiers shaders
-   std::string contentV = preprocesseur(read_file(vertexShaderPath));
-   const char* srcV = contentV.c_str();
-   std::string contentF = preprocesseur(read_file(fragmentShaderPath));
-   const char* srcF = contentF.c_str();
+   // Nettoyage
+   for (GLuint shader : pending.shaders) {
+      glDetachShader(pending.program, shader);
+      glDeleteShader(shader);
+   }
+   pending.shaders.clear();
 
-   if (contentV.empty() || contentF.empty()) {
-      fprintf(stderr, "Erreur lecture shader files\n");
-      exit(1);
+   if (!success || !cacheUniformLocations(pending)) {
+      glDeleteProgram(pending.program);
+      pending.program = 0;
+      return false;
    }
 
-   // Vertex Shader
-   unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-   glShaderSource(vertexShader, 1, &srcV, nullptr);
-   glCompileShader(vertexShader);
+   pending.compileMs = elapsedMs(pending.start);
+   ProgramCache::store(pending.program, pending.cacheKey, pending.compileMs);
+   return true;
+}
+
+bool Shader::beginReload() {
+   if (reloading) {
+      // The files changed again, the build in flight is outdated
+      for (GLuint shader : reload.shaders)
+         glDeleteShader(shader);
+      glDeleteProgram(reload.program);
+      reloading = false;
+   }
 
-   glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-   if(!success) {
-      glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
-      printf("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s\n", infoLog);
+   std::vector<PreprocessedSource> sources;
+   try {
+      sources = preprocess();
+   } catch (const std::exception& e) {
+      // Typically an editor in the middle of saving, the next change event retries
+      fprintf(stderr, "Shader %s: %s\n", name.c_str(), e.what());
+      return false;
    }
 
-   // Fragment Shader
-   unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-   glShaderSource(fragmentShader, 1, &srcF, nullptr);
-   glCompileShader(fragmentShader);
+   reload = startBuild(sources);
+   reloading = true;
+   return true;
+}
 
-   glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-   if(!success) {
-      glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
-      printf("ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s\n", infoLog);
+Shader::ReloadState Shader::pollReload(bool wait) {
+   if (!reloading)
+      return ReloadState::Idle;
+
+   if (!wait && !reload.fromCache && hasParallelCompile()) {
+      GLint done = GL_TRUE;
+      glGetProgramiv(reload.program, COMPLETION_STATUS, &done);
+      if (!done)
+         return ReloadState::Pending;
    }
 
-   // Link
-   glAttachShader(program, vertexShader);
-   glAttachShader(program, fragmentShader);
-   glLinkProgram(program);
+   reloading = false;
+   // A new #include must be watched even if it does not compile yet
+   dependencies = reload.files;
+   if (!finishBuild(reload)) {
+      fprintf(stderr, "Shader %s: reload failed, keeping the previous program\n", name.c_str());
+      return ReloadState::Failed;
+   }
 
-   glGetProgramiv(program, GL_LINK_STATUS, &success);
-   if(!success) {
-      glGetProgramInfoLog(program, 512, nullptr, infoLog);
-      printf("ERROR::SHADER::PROGRAM::LINK_FAILED\n%s\n", infoLog);
-      program = 0;
+   const bool firstBuild = (program == 0);
+   glDeleteProgram(program);
+   program = reload.program;
+   buildMs = elapsedMs(reload.start);
+   fromCache = reload.fromCache;
+   uniforms = std::move(reload.uniforms);
+   printf("Shader %s %s in %.1f ms%s\n", name.c_str(), firstBuild ? "built" : "reloaded", buildMs, fromCache ? " (from cache)" : "");
+   return ReloadState::Swapped;
+}
+
+bool Shader::cacheUniformLocations(PendingProgram& pending) const {
+   std::vector<UniformSlot>& slots = pending.uniforms;
+   slots.clear();
+
+   GLint count = 0;
+   GLint maxLength = 0;
+   glGetProgramiv(pending.program, GL_ACTIVE_UNIFORMS, &count);
+   glGetProgramiv(pending.program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+   std::string buffer(static_cast<size_t>(maxLength) + 1, '\0');
+   for (GLint i = 0; i < count; i++) {
+      GLsizei length = 0;
+      GLint size = 0;
+      GLenum type = 0;
+      glGetActiveUniform(pending.program, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()), &length, &size, &type, buffer.data());
+
+      std::string uniformName = buffer.substr(0, static_cast<size_t>(length));
+      // Arrays are reported as "name[0]", they are set through their base name
+      size_t bracket = uniformName.find('[');
+      if (bracket != std::string::npos)
+         uniformName.resize(bracket);
+
+      // Members of uniform/storage blocks have no location
+      GLint location = glGetUniformLocation(pending.program, uniformName.c_str());
+      if (location < 0)
+         continue;
+
+      uint32_t hash = UniformId::fnv1a(uniformName.c_str());
+      for (const UniformSlot& slot : slots) {
+         // getLocation could only return one of them, rename a uniform
+         if (slot.hash == hash && slot.location != location) {
+            fprintf(stderr, "Shader %s: uniform hash collision on %s\n", name.c_str(), uniformName.c_str());
+            return false;
+         }
+      }
+      slots.push_back(UniformSlot{hash, location});
    }
 
-   // Nettoyage
-   glDeleteShader(vertexShader);
-   glDeleteShader(fragmentShader);
+   std::sort(slots.begin(), slots.end(), [](const UniformSlot& a, const UniformSlot& b) {
+      return a.hash < b.hash;
+   });
+   return true;
+}
+
+int Shader::getLocation(UniformId name) const {
+   auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash, [](const UniformSlot& slot, uint32_t hash) {
+      return slot.hash < hash;
+   });
+   return (it != uniforms.end() && it->hash == name.hash) ? it->location : -1;
 }
 
 
 void Shader::useShader() const {
    glUseProgram(program);
 }
-void Shader::setBool(const std::string& name, int value) const {
-   glUniform1i(glGetUniformLocation(program, name.c_str()), value);
+void Shader::setBool(UniformId name, int value) const {
+   glUniform1i(getLocation(name), value);
 }
-void Shader::setInt(const std::string& name, int value) const {
-   glUniform1i(glGetUniformLocation(program, name.c_str()), value);
+void Shader::setInt(UniformId name, int value) const {
+   glUniform1i(getLocation(name), value);
 }
-void Shader::setUInt(const std::string& name, unsigned int value) const {
-   glUniform1ui(glGetUniformLocation(program, name.c_str()), value);
+void Shader::setUInt(UniformId name, unsigned int value) const {
+   glUniform1ui(getLocation(name), value);
 }
 
-void Shader::setFloat(const std::string& name, float value) const {
-   glUniform1f(glGetUniformLocation(program, name.c_str()), value);
+void Shader::setFloat(UniformId name, float value) const {
+   glUniform1f(getLocation(name), value);
 }
-void Shader::setVec2f(const std::string& name, float v0, float v1) const {
-   glUniform2f(glGetUniformLocation(program, name.c_str()), v0, v1);
+void Shader::setVec2f(UniformId name, float v0, float v1) const {
+   glUniform2f(getLocation(name), v0, v1);
 }
-void Shader::setVec3f(const std::string& name, float v0, float v1, float v2)  const {
-   glUniform3f(glGetUniformLocation(program, name.c_str()), v0, v1, v2);
+void Shader::setVec3f(UniformId name, float v0, float v1, float v2)  const {
+   glUniform3f(getLocation(name), v0, v1, v2);
 }
\ No newline at end of file
@@ -3,23 +3,120 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
+#include "shaderPreprocessor.hpp"
+
+// Uniform name hashed with FNV-1a. Declared as constexpr constants next to their users, e.g.
+//    static constexpr UniformId MAX_BOUNCES("maxBounces");
+// so that the hash is computed at compile time: setting a uniform then neither hashes a name nor
+// queries its location. Explicit, a name passed as is would be hashed at every call.
+struct UniformId {
+   uint32_t hash;
+
+   explicit constexpr UniformId(const char* name) : hash(fnv1a(name)) {}
+
+   static constexpr uint32_t fnv1a(const char* name) {
+      uint32_t h = 2166136261u;
+      for (; *name; ++name) {
+         h = (h ^ static_cast<unsigned char>(*name)) * 16777619u;
+      }
+      return h;
+   }
+};
 
 class Shader {
 public:
-   Shader(const std::string &vertexShaderPath, const std::string &fragmentShaderPath);
+   enum class ReloadState { Idle, Pending, Swapped, Failed };
+
+   // defines are inserted right after the #version line of both stages.
+   // Without waitForLink the build is left pending like a reload: getProgram() stays 0
+   // until pollReload() reports Swapped.
+   Shader(const std::string &vertexShaderPath, const std::string &fragmentShaderPath, const std::string &defines = "", bool waitForLink = true);
+
+   // Program made of a single compute shader (GL 4.3), built and reloaded the same way
+   static Shader compute(const std::string &computeShaderPath, const std::string &defines = "", bool waitForLink = true);
+
+   // Hot reload: preprocess the files again and start building a new program.
+   // The current program stays in use until pollReload() swaps it. False if a file can't be read.
+   bool beginReload();
+   // Pending while the driver compiles in the background (GL_KHR_parallel_shader_compile),
+   // then Swapped, or Failed and the old program is kept. wait blocks until the build is done.
+   ReloadState pollReload(bool wait = false);
+   // Files read to build the program, includes of every stage
+   [[nodiscard]] const std::vector<std::string>& getDependencies() const {return dependencies;}
+   [[nodiscard]] const std::string& getName() const {return name;}
 
    void useShader() const;
-   void setBool(const std::string& name, int value) const;
-   void setInt(const std::string& name, int value) const;
-   void setUInt(const std::string &name, unsigned int value) const;
-   void setFloat(const std::string& name, float value) const;
-   void setVec2f(const std::string& name, float v0, float v1) const;
-   void setVec3f(const std::string& name, float v0, float v1, float v2) const;
+   void setBool(UniformId name, int value) const;
+   void setInt(UniformId name, int value) const;
+   void setUInt(UniformId name, unsigned int value) const;
+   void setFloat(UniformId name, float value) const;
+   void setVec2f(UniformId name, float v0, float v1) const;
+   void setVec3f(UniformId name, float v0, float v1, float v2) const;
+   // Location resolved at link time, -1 when the uniform is not active
+   [[nodiscard]] int getLocation(UniformId name) const;
    [[nodiscard]] unsigned int getProgram() const {return program;}
+   // Time spent compiling and linking, or loading the cached binary
+   [[nodiscard]] double getBuildMs() const {return buildMs;}
+   [[nodiscard]] bool isFromCache() const {return fromCache;}
 private:
+   struct Stage {
+      unsigned int type; // GL_VERTEX_SHADER, ...
+      std::string path;
+   };
+
+   struct UniformSlot {
+      uint32_t hash;
+      int location;
+   };
+
+   struct PendingProgram {
+      unsigned int program = 0;
+      // One per stage, 0 once deleted
+      std::vector<unsigned int> shaders;
+      uint64_t cacheKey = 0;
+      bool fromCache = false;
+      double compileMs = 0.0;
+      // Source string numbers of each stage, for the logs
+      std::vector<std::vector<std::string>> stageFiles;
+      // Every stage
+      std::vector<std::string> files;
+      std::chrono::steady_clock::time_point start;
+      // Made by finishBuild, sorted by hash
+      std::vector<UniformSlot> uniforms;
+   };
+
+   Shader(std::vector<Stage> stages, const std::string &defines, bool waitForLink);
+
+   // Preprocess every stage, throws when a file can't be read
+   [[nodiscard]] std::vector<PreprocessedSource> preprocess() const;
+   // Load the cached binary or submit compilation and linking without waiting
+   PendingProgram startBuild(const std::vector<PreprocessedSource>& sources);
+   // Query the compile/link status (blocks until the driver is done), print the logs and fill
+   // the location table. A program with two uniform names of the same hash fails too.
+   bool finishBuild(PendingProgram& pending);
+
+   // Location table of the active uniforms of the linked program, false on a hash collision
+   bool cacheUniformLocations(PendingProgram& pending) const;
+
+   std::vector<Stage> stages;
+   std::string defines;
+   std::string name;
+   std::vector<std::string> dependencies;
+
+   bool reloading = false;
+   PendingProgram reload;
+
    unsigned int program;
+   double buildMs = 0.0;
+   bool fromCache = false;
+   // Sorted by hash
+   std::vector<UniformSlot> uniforms;
 };
 
 
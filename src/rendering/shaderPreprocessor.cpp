@@ -0,0 +1,145 @@
+#include "shaderPreprocessor.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+std::unordered_map<std::string, ShaderPreprocessor::CachedFile> ShaderPreprocessor::cache;
+
+static std::string readShaderFile(const std::string& filepath) {
+   std::ifstream file(filepath, std::ios::in | std::ios::binary | std::ios::ate);
+   if (!file) {
+      throw std::runtime_error("Unable to open file: " + filepath);
+   }
+
+   std::streamsize size = file.tellg();
+   file.seekg(0, std::ios::beg);
+
+   std::string buffer(size, '\0'); // alloue directement la bonne taille
+   if (!file.read(buffer.data(), size)) {
+      throw std::runtime_error("Error reading file: " + filepath);
+   }
+
+   return buffer;
+}
+
+// File name of an #include directive line, empty if the line is something else
+static std::string includedFile(const std::string& line) {
+   size_t start = line.find_first_not_of(" \t");
+   if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+      return "";
+
+   size_t open = line.find_first_of("\"<", start + 8);
+   if (open == std::string::npos)
+      return ""; // Malformed include
+   char endQuote = (line[open] == '<') ? '>' : '"';
+   size_t close = line.find(endQuote, open + 1);
+   if (close == std::string::npos)
+      return ""; // Malformed include
+
+   return line.substr(open + 1, close - open - 1);
+}
+
+std::string ShaderPreprocessor::normalize(const std::filesystem::path& path) {
+   std::filesystem::path normal = path.lexically_normal();
+   return normal.empty() ? std::string(".") : normal.generic_string();
+}
+
+const ShaderPreprocessor::CachedFile& ShaderPreprocessor::load(const std::string& path) {
+   std::error_code error;
+   auto writeTime = std::filesystem::last_write_time(path, error);
+
+   auto it = cache.find(path);
+   if (it != cache.end() && !error && it->second.writeTime == writeTime)
+      return it->second;
+
+   CachedFile file;
+   file.writeTime = writeTime;
+
+   const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+   std::istringstream content(readShaderFile(path));
+   std::string line;
+   int lineNumber = 0;
+   while (std::getline(content, line)) {
+      lineNumber++;
+      std::string include = includedFile(line);
+      if (!include.empty()) {
+         // Relative to the including file
+         file.chunks.push_back(Chunk{normalize(directory / include), true, lineNumber});
+         continue;
+      }
+      if (file.chunks.empty() || file.chunks.back().isInclude) {
+         file.chunks.push_back(Chunk{"", false, lineNumber});
+      }
+      file.chunks.back().text += line;
+      file.chunks.back().text += '\n';
+   }
+
+   return cache[path] = std::move(file);
+}
+
+void ShaderPreprocessor::expand(const std::string& path, const std::string& defines, PreprocessedSource& out) {
+   // Included once per stage
+   if (std::find(out.files.begin(), out.files.end(), path) != out.files.end())
+      return;
+
+   const int sourceIndex = static_cast<int>(out.files.size());
+   out.files.push_back(path);
+   const CachedFile& file = load(path);
+
+   for (const Chunk& chunk : file.chunks) {
+      if (chunk.isInclude) {
+         expand(chunk.text, "", out);
+         continue;
+      }
+
+      std::string text = chunk.text;
+      int line = chunk.line;
+      if (sourceIndex == 0 && line == 1 && text.compare(0, 8, "#version") == 0) {
+         // #version must stay the first line, defines come right after it
+         size_t versionEnd = text.find('\n') + 1;
+         out.code += text.substr(0, versionEnd);
+         out.code += defines;
+         text.erase(0, versionEnd);
+         line = 2;
+         if (text.empty())
+            continue;
+      } else if (sourceIndex == 0 && line == 1) {
+         out.code += defines;
+      }
+      out.code += "#line " + std::to_string(line) + " " + std::to_string(sourceIndex) + "\n";
+      out.code += text;
+   }
+}
+
+PreprocessedSource ShaderPreprocessor::process(const std::string& path, const std::string& defines) {
+   PreprocessedSource source;
+   expand(normalize(path), defines, source);
+   return source;
+}
+
+void ShaderPreprocessor::invalidate(const std::string& path) {
+   cache.erase(normalize(path));
+}
+
+std::string ShaderPreprocessor::translateLog(const std::string& log, const std::vector<std::string>& files) {
+   std::istringstream in(log);
+   std::string result;
+   std::string line;
+   while (std::getline(in, line)) {
+      // Mesa: "0:12(3): error", NVIDIA: "0(12) : error"
+      size_t digits = 0;
+      while (digits < line.size() && isdigit(static_cast<unsigned char>(line[digits])))
+         digits++;
+      if (digits > 0 && digits < 6 && digits < line.size() && (line[digits] == ':' || line[digits] == '(')) {
+         size_t index = std::stoul(line.substr(0, digits));
+         if (index < files.size()) {
+            line = files[index] + line.substr(digits);
+         }
+      }
+      result += line;
+      result += '\n';
+   }
+   return result;
+}
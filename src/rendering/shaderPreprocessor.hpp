@@ -0,0 +1,56 @@
+#pragma once
+
+#ifndef SHADERPREPROCESSOR_HPP
+#define SHADERPREPROCESSOR_HPP
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Result of preprocessing one shader stage
+struct PreprocessedSource {
+   std::string code;
+   // Every file read, the root first. The index is the source string number used in #line directives.
+   std::vector<std::string> files;
+};
+
+// #include "file" expansion for GLSL.
+// Files are parsed once and cached until they change on disk, each file is included at most
+// once per stage (like #pragma once), and #line directives keep compiler messages pointing
+// at the right file and line.
+class ShaderPreprocessor {
+public:
+   // defines are inserted right after the #version line of the root file
+   static PreprocessedSource process(const std::string& path, const std::string& defines = "");
+
+   // Forget the cached content of a file, it is read again at the next process()
+   static void invalidate(const std::string& path);
+
+   // Paths as stored in PreprocessedSource::files, so they can be compared with watcher events
+   static std::string normalize(const std::filesystem::path& path);
+
+   // Replace the "N:line" / "N(line)" source references of a driver log by file names
+   static std::string translateLog(const std::string& log, const std::vector<std::string>& files);
+
+private:
+   struct Chunk {
+      // Text, or the file named by an #include when isInclude is set
+      std::string text;
+      bool isInclude;
+      // Line of the chunk start in its file, 1-based
+      int line;
+   };
+
+   struct CachedFile {
+      std::filesystem::file_time_type writeTime;
+      std::vector<Chunk> chunks;
+   };
+
+   static const CachedFile& load(const std::string& path);
+   static void expand(const std::string& path, const std::string& defines, PreprocessedSource& out);
+
+   static std::unordered_map<std::string, CachedFile> cache;
+};
+
+#endif //SHADERPREPROCESSOR_HPP
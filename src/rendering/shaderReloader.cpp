@@ -0,0 +1,146 @@
+#include "shaderReloader.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+ShaderReloader::ShaderReloader() {
+#ifdef __linux__
+   inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (inotifyFd < 0) {
+      perror("inotify_init1, falling back to polling shader files");
+   }
+#endif
+   thread = std::thread(&ShaderReloader::watchLoop, this);
+}
+
+ShaderReloader::~ShaderReloader() {
+   running = false;
+   thread.join();
+#ifdef __linux__
+   if (inotifyFd >= 0)
+      close(inotifyFd);
+#endif
+}
+
+void ShaderReloader::watch(Shader& shader, std::function<void(Shader&)> onReload) {
+   entries.push_back(Entry{&shader, std::move(onReload)});
+   watchFiles(shader.getDependencies());
+}
+
+void ShaderReloader::watchFiles(const std::vector<std::string>& paths) {
+   std::lock_guard<std::mutex> lock(mutex);
+   for (const std::string& path : paths) {
+      if (files.count(path))
+         continue;
+
+      std::error_code error;
+      files[path] = std::filesystem::last_write_time(path, error);
+
+#ifdef __linux__
+      if (inotifyFd >= 0) {
+         // Watch the directory: editors often save by writing a new file and renaming it
+         std::string directory = ShaderPreprocessor::normalize(std::filesystem::path(path).parent_path());
+         bool watched = std::any_of(directories.begin(), directories.end(), [&](const auto& entry) {
+            return entry.second == directory;
+         });
+         if (!watched) {
+            int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd >= 0) {
+               directories[wd] = directory;
+            } else {
+               perror(("inotify_add_watch " + directory).c_str());
+            }
+         }
+      }
+#endif
+   }
+}
+
+void ShaderReloader::watchLoop() {
+   while (running) {
+#ifdef __linux__
+      if (inotifyFd >= 0) {
+         pollfd fd{inotifyFd, POLLIN, 0};
+         // Timeout so the destructor does not wait on a quiet directory
+         if (poll(&fd, 1, 200) <= 0)
+            continue;
+
+         alignas(inotify_event) char buffer[4096];
+         ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+         if (length <= 0)
+            continue;
+
+         std::lock_guard<std::mutex> lock(mutex);
+         for (char* p = buffer; p < buffer + length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(p);
+            auto directory = directories.find(event->wd);
+            if (event->len > 0 && directory != directories.end()) {
+               changed.insert(ShaderPreprocessor::normalize(std::filesystem::path(directory->second) / event->name));
+               lastEvent = std::chrono::steady_clock::now();
+            }
+            p += sizeof(inotify_event) + event->len;
+         }
+         continue;
+      }
+#endif
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto& [path, writeTime] : files) {
+         std::error_code error;
+         auto current = std::filesystem::last_write_time(path, error);
+         if (!error && current != writeTime) {
+            writeTime = current;
+            changed.insert(path);
+            lastEvent = std::chrono::steady_clock::now();
+         }
+      }
+   }
+}
+
+bool ShaderReloader::update() {
+   std::set<std::string> modified;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!changed.empty() && std::chrono::steady_clock::now() - lastEvent > DEBOUNCE)
+         modified.swap(changed);
+   }
+
+   for (const std::string& path : modified) {
+      ShaderPreprocessor::invalidate(path);
+   }
+
+   // Only the programs including one of the modified files
+   if (!modified.empty()) {
+      for (Entry& entry : entries) {
+         const std::vector<std::string>& dependencies = entry.shader->getDependencies();
+         bool affected = std::any_of(dependencies.begin(), dependencies.end(), [&](const std::string& file) {
+            return modified.count(file) > 0;
+         });
+         if (affected) {
+            printf("Reloading shader %s\n", entry.shader->getName().c_str());
+            entry.shader->beginReload();
+         }
+      }
+   }
+
+   bool swapped = false;
+   for (Entry& entry : entries) {
+      Shader::ReloadState state = entry.shader->pollReload();
+      if (state == Shader::ReloadState::Swapped) {
+         if (entry.onReload)
+            entry.onReload(*entry.shader);
+         swapped = true;
+      }
+      if (state == Shader::ReloadState::Swapped || state == Shader::ReloadState::Failed) {
+         watchFiles(entry.shader->getDependencies());
+      }
+   }
+   return swapped;
+}
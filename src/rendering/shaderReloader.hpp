@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef SHADERRELOADER_HPP
+#define SHADERRELOADER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shader.hpp"
+
+// Rebuilds shaders when one of their files changes on disk.
+// A background thread watches the directories of every dependency (inotify on Linux,
+// polling of the write times elsewhere); GL work stays on the thread calling update().
+class ShaderReloader {
+public:
+   ShaderReloader();
+   ~ShaderReloader();
+
+   ShaderReloader(const ShaderReloader&) = delete;
+   ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+   // onReload runs on the GL thread right after the new program replaced the old one,
+   // to restore what lives in the program object (block bindings...)
+   void watch(Shader& shader, std::function<void(Shader&)> onReload = {});
+
+   // Once per frame on the GL thread. True when a program was swapped.
+   bool update();
+
+private:
+   struct Entry {
+      Shader* shader;
+      std::function<void(Shader&)> onReload;
+   };
+
+   // Start watching the files not watched yet
+   void watchFiles(const std::vector<std::string>& files);
+   void watchLoop();
+
+   // Wait for the editor to be done writing before rebuilding
+   static constexpr std::chrono::milliseconds DEBOUNCE{50};
+
+   std::vector<Entry> entries;
+
+   std::mutex mutex;
+   // Files reported by the watcher since the last update()
+   std::set<std::string> changed;
+   std::chrono::steady_clock::time_point lastEvent;
+   // Watched files with their last write time (used when polling)
+   std::map<std::string, std::filesystem::file_time_type> files;
+   // inotify watch descriptor -> directory
+   std::map<int, std::string> directories;
+   int inotifyFd = -1;
+
+   std::atomic<bool> running{true};
+   std::thread thread;
+};
+
+#endif //SHADERRELOADER_HPP
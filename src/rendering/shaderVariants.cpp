@@ -0,0 +1,84 @@
+#include "shaderVariants.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+#include "shaderReloader.hpp"
+
+ShaderVariant ShaderVariant::forParams(const RenderParams& params) {
+   ShaderVariant variant;
+   if (std::find(std::begin(COMMON_BOUNCES), std::end(COMMON_BOUNCES), params.maxBounces) != std::end(COMMON_BOUNCES))
+      variant.maxBounces = params.maxBounces;
+   if (std::find(std::begin(COMMON_RAY_PER_PIXEL), std::end(COMMON_RAY_PER_PIXEL), params.rayPerPixel) != std::end(COMMON_RAY_PER_PIXEL))
+      variant.rayPerPixel = params.rayPerPixel;
+   variant.emission = params.emission;
+   variant.russianRoulette = params.russianRoulette;
+   variant.adaptiveSampling = params.adaptiveSampling;
+   variant.reprojection = params.reprojection;
+   variant.denoiseAovs = params.denoiseAovs;
+   variant.lightSampling = params.lightSampling;
+   variant.sampler = params.sampler;
+   return variant;
+}
+
+std::string ShaderVariant::defines() const {
+   std::string result;
+   if (maxBounces > 0)
+      result += "#define MAX_BOUNCES " + std::to_string(maxBounces) + "\n";
+   if (rayPerPixel > 0)
+      result += "#define RAY_PER_PIXEL " + std::to_string(rayPerPixel) + "\n";
+   result += std::string("#define USE_EMISSION ") + (emission ? "1" : "0") + "\n";
+   result += std::string("#define USE_RUSSIAN_ROULETTE ") + (russianRoulette ? "1" : "0") + "\n";
+   result += std::string("#define USE_ADAPTIVE_SAMPLING ") + (adaptiveSampling ? "1" : "0") + "\n";
+   result += std::string("#define USE_REPROJECTION ") + (reprojection ? "1" : "0") + "\n";
+   result += std::string("#define USE_DENOISE_AOVS ") + (denoiseAovs ? "1" : "0") + "\n";
+   result += std::string("#define USE_LIGHT_SAMPLING ") + (lightSampling ? "1" : "0") + "\n";
+   result += "#define SAMPLER " + std::to_string(static_cast<int>(sampler)) + "\n";
+   return result;
+}
+
+ShaderVariants::ShaderVariants(std::string vertexPath, std::string fragmentPath, std::string baseDefines,
+                               std::function<void(Shader&)> onBuilt, ShaderReloader* reloader)
+   : vertexPath(std::move(vertexPath)), fragmentPath(std::move(fragmentPath)), baseDefines(std::move(baseDefines)),
+     onBuilt(std::move(onBuilt)), reloader(reloader) {}
+
+Shader& ShaderVariants::build(const ShaderVariant& variant, bool wait) {
+   auto it = programs.find(variant);
+   if (it == programs.end()) {
+      printf("Building shader variant bounces=%d rayPerPixel=%d emission=%d russianRoulette=%d lightSampling=%d sampler=%d adaptive=%d reprojection=%d denoise=%d%s\n",
+             variant.maxBounces, variant.rayPerPixel, variant.emission, variant.russianRoulette, variant.lightSampling, static_cast<int>(variant.sampler), variant.adaptiveSampling, variant.reprojection, variant.denoiseAovs,
+             wait ? "" : " in the background");
+      it = programs.emplace(variant, std::make_unique<Shader>(vertexPath, fragmentPath, baseDefines + variant.defines(), false)).first;
+      if (reloader)
+         reloader->watch(*it->second, onBuilt);
+   }
+
+   Shader& shader = *it->second;
+   if (wait && shader.pollReload(true) == Shader::ReloadState::Swapped && onBuilt)
+      onBuilt(shader);
+   return shader;
+}
+
+Shader& ShaderVariants::get(const RenderParams& params, bool wait) {
+   ShaderVariant wanted = ShaderVariant::forParams(params);
+   if (!specialize)
+      wanted = wanted.generic();
+   // The generic program is the fallback, it can't be left compiling
+   Shader& shader = build(wanted, wait || wanted.isGeneric());
+   if (shader.getProgram() != 0 || wanted.isGeneric()) {
+      currentVariant = wanted;
+      return shader;
+   }
+
+   currentVariant = wanted.generic();
+   return build(currentVariant, true);
+}
+
+void ShaderVariants::update() {
+   // Usable variants are polled by the reloader when there is one
+   for (auto& [variant, shader] : programs) {
+      if ((shader->getProgram() == 0 || !reloader) && shader->pollReload() == Shader::ReloadState::Swapped && onBuilt)
+         onBuilt(*shader);
+   }
+}
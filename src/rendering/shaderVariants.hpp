@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef SHADERVARIANTS_HPP
+#define SHADERVARIANTS_HPP
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "renderParams.hpp"
+#include "shader.hpp"
+
+class ShaderReloader;
+
+// Values baked into the tracing program as #defines.
+// A count of 0 stays a uniform, so one generic program covers every slider value.
+struct ShaderVariant {
+   int maxBounces = 0;
+   int rayPerPixel = 0;
+   bool emission = true;
+   bool russianRoulette = true;
+   bool adaptiveSampling = false;
+   bool reprojection = false;
+   bool denoiseAovs = false;
+   bool lightSampling = true;
+   Sampler sampler = Sampler::SOBOL;
+
+   // Variant worth building for params: counts are only baked for common values
+   static ShaderVariant forParams(const RenderParams& params);
+
+   [[nodiscard]] ShaderVariant generic() const { return ShaderVariant{0, 0, emission, russianRoulette, adaptiveSampling, reprojection, denoiseAovs, lightSampling, sampler}; }
+   [[nodiscard]] bool isGeneric() const { return maxBounces == 0 && rayPerPixel == 0; }
+   [[nodiscard]] std::string defines() const;
+
+   // Common values of the sliders, anything else uses the generic program
+   static constexpr int COMMON_BOUNCES[] = {2, 4, 8, 16, 20, 32};
+   static constexpr int COMMON_RAY_PER_PIXEL[] = {1, 2, 4, 8, 16, 32, 50, 64};
+
+   bool operator<(const ShaderVariant& other) const {
+      return std::tie(maxBounces, rayPerPixel, emission, russianRoulette, adaptiveSampling, reprojection, denoiseAovs, lightSampling, sampler) <
+             std::tie(other.maxBounces, other.rayPerPixel, other.emission, other.russianRoulette, other.adaptiveSampling, other.reprojection, other.denoiseAovs, other.lightSampling, other.sampler);
+   }
+};
+
+// Programs of one shader pair, one per variant, built on first use.
+// The on-disk ProgramCache keys on the preprocessed source, so it is per variant as well.
+class ShaderVariants {
+public:
+   // onBuilt runs when a program becomes usable, to set what lives in the program object (block bindings).
+   // With a reloader, variants are also hot-reloaded and onBuilt runs after each reload.
+   ShaderVariants(std::string vertexPath, std::string fragmentPath, std::string baseDefines,
+                  std::function<void(Shader&)> onBuilt = {}, ShaderReloader* reloader = nullptr);
+
+   // Program to render params with. A specialized variant is compiled in the background and the
+   // generic one (same features) is returned until it links. Features always match params:
+   // a missing generic program is built right away, like everything when wait is set.
+   Shader& get(const RenderParams& params, bool wait = false);
+
+   // Once per frame: finish the background builds
+   void update();
+
+   // When disabled only generic programs are used
+   void setSpecialization(bool enabled) { specialize = enabled; }
+
+   // Variant of the program returned by the last get()
+   [[nodiscard]] const ShaderVariant& current() const { return currentVariant; }
+   [[nodiscard]] size_t size() const { return programs.size(); }
+
+private:
+   Shader& build(const ShaderVariant& variant, bool wait);
+
+   std::string vertexPath;
+   std::string fragmentPath;
+   std::string baseDefines;
+   std::function<void(Shader&)> onBuilt;
+   ShaderReloader* reloader;
+   bool specialize = true;
+
+   std::map<ShaderVariant, std::unique_ptr<Shader>> programs;
+   ShaderVariant currentVariant;
+};
+
+#endif //SHADERVARIANTS_HPP
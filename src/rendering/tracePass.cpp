@@ -0,0 +1,289 @@
+#include "tracePass.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "rendering/gladManager.hpp"
+
+// Uniforms of main.frag, hashed at compile time
+static constexpr UniformId FOCAL_LENGTH("focalLength");
+static constexpr UniformId RESOLUTION("resolution");
+static constexpr UniformId CAM_DIR("camDir");
+static constexpr UniformId CAM_UP("camUp");
+static constexpr UniformId CAM_POS("camPos");
+static constexpr UniformId TIME("time");
+static constexpr UniformId MAX_BOUNCES("maxBounces");
+static constexpr UniformId LAST_MOVE("lastMove");
+static constexpr UniformId RAY_PER_PIXEL("rayPerPixel");
+static constexpr UniformId SPHERE_COUNT("sphereCount");
+static constexpr UniformId EMITTER_COUNT("emitterCount");
+static constexpr UniformId BLUE_NOISE("blueNoise");
+static constexpr UniformId OLD_MOMENTS("oldMoments");
+static constexpr UniformId MOMENTS_SUM("momentsSum");
+static constexpr UniformId MOMENTS_SCALE("momentsScale");
+static constexpr UniformId ADAPTIVE_THRESHOLD("adaptiveThreshold");
+static constexpr UniformId HISTORY_ACCUM("historyAccum");
+static constexpr UniformId HISTORY_FIRST_HIT("historyFirstHit");
+static constexpr UniformId REPROJECT("reproject");
+static constexpr UniformId HISTORY_CAM_POS("historyCamPos");
+static constexpr UniformId HISTORY_CAM_DIR("historyCamDir");
+static constexpr UniformId HISTORY_CAM_UP("historyCamUp");
+static constexpr UniformId HISTORY_FOCAL_LENGTH("historyFocalLength");
+
+// Uniforms of reduce.frag
+static constexpr UniformId SOURCE("source");
+static constexpr UniformId SOURCE_SIZE("sourceSize");
+
+// Units 1, 2 and 7 to 9 are taken by BvhBuffer
+static constexpr GLuint MOMENTS_TEXTURE_UNIT = 3;
+static constexpr GLuint HISTORY_ACCUM_TEXTURE_UNIT = 4;
+static constexpr GLuint HISTORY_FIRST_HIT_TEXTURE_UNIT = 5;
+static constexpr GLuint BLUE_NOISE_TEXTURE_UNIT = 6;
+static constexpr GLuint MOMENTS_SUM_TEXTURE_UNIT = 10;
+
+// From the sum over the image to its average
+static float momentsScale(int width, int height) {
+   return 1.0f / static_cast<float>(width * height);
+}
+
+// Sum the moments of a complete pass down to the last gladManager::momentSumTextures
+static void reduceMoments(GLuint moments, int width, int height) {
+   GLint viewport[4];
+   glGetIntegerv(GL_VIEWPORT, viewport);
+   const Shader& shader = *gladManager::momentReduction;
+   shader.useShader();
+   shader.setInt(SOURCE, 0);
+
+   GLuint source = moments;
+   glm::ivec2 size(width, height);
+   for (size_t i = 0; i < gladManager::momentSumTextures.size(); i++) {
+      glBindTexture(GL_TEXTURE_2D, source);
+      shader.setVec2f(SOURCE_SIZE, static_cast<float>(size.x), static_cast<float>(size.y));
+      size = gladManager::reducedSize(size);
+      glBindFramebuffer(GL_FRAMEBUFFER, gladManager::momentSumFramebuffers[i]);
+      glViewport(0, 0, size.x, size.y);
+      gladManager::draw();
+      source = gladManager::momentSumTextures[i];
+   }
+   glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+static void setTraceUniforms(const Shader& shader, const SceneBuffer& sceneBuffer, const CameraState& camera,
+                             const RenderParams& params, int lastMove, int width, int height) {
+   glm::vec3 dir = camera.direction;
+   glm::vec3 up = camera.up;
+   glm::vec3 pos = camera.position;
+
+   shader.useShader();
+   shader.setFloat(FOCAL_LENGTH, params.focalLength);
+   shader.setVec2f(RESOLUTION, static_cast<float>(width), static_cast<float>(height));
+   shader.setVec3f(CAM_DIR,dir.x,dir.y,dir.z);
+   shader.setVec3f(CAM_UP,up.x,up.y,up.z);
+   shader.setVec3f(CAM_POS,pos.x,pos.y,pos.z);
+   shader.setUInt(TIME,params.time);
+   shader.setInt(MAX_BOUNCES,params.maxBounces);
+   shader.setInt(LAST_MOVE, lastMove);
+   shader.setInt(RAY_PER_PIXEL,params.rayPerPixel);
+   shader.setInt(SPHERE_COUNT,sceneBuffer.getSphereCount());
+   shader.setInt(EMITTER_COUNT,sceneBuffer.getEmitterCount());
+   if (params.sampler == Sampler::BLUE_NOISE) {
+      glActiveTexture(GL_TEXTURE0 + BLUE_NOISE_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, gladManager::getBlueNoiseTexture());
+      glActiveTexture(GL_TEXTURE0);
+      shader.setInt(BLUE_NOISE, BLUE_NOISE_TEXTURE_UNIT);
+   }
+}
+
+static void drawAccumulated() {
+   // Radiance and luminance sums are added to the accumulation, the moments, first hits, normals
+   // and albedos are replaced
+   glEnable(GL_BLEND);
+   for (GLuint i = 1; i <= 4; i++)
+      glDisablei(GL_BLEND, i);
+   glBlendEquation(GL_FUNC_ADD);
+   glBlendFunc(GL_ONE, GL_ONE);
+
+   // Render Triangle
+   gladManager::draw();
+
+   glDisable(GL_BLEND);
+}
+
+int traceFrame(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+               const CameraState& camera, const RenderParams& params, int lastMove, int width, int height) {
+   return traceRows(shader, sceneBuffer, bvhBuffer, camera, params, lastMove, width, height, 0, height, true);
+}
+
+int traceRows(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+              const CameraState& camera, const RenderParams& params, int lastMove, int width, int height,
+              int rowBegin, int rowEnd, bool endOfPass) {
+   // Both framebuffers hold the accumulation, only the moments ping-pong
+   int writeIndex = (lastMove % 2 == 0) ? 0 : 1;
+   int readIndex = 1 - writeIndex; // on lit l’autre texture
+
+   if (params.adaptiveSampling && !gladManager::hasMoments())
+      gladManager::generateMoments(width, height);
+   if (params.reprojection && !gladManager::hasFirstHits())
+      gladManager::generateFirstHits(width, height);
+   if (params.denoiseAovs && !gladManager::hasGbuffer())
+      gladManager::generateGbuffer(width, height);
+
+   glBindFramebuffer(GL_FRAMEBUFFER, gladManager::framebuffers[writeIndex]);
+   // The moments are only written by the adaptive variants, the first hits by the reprojection ones,
+   // the guides by the denoising ones
+   const GLenum momentsBuffer = params.adaptiveSampling ? GL_COLOR_ATTACHMENT1 : GL_NONE;
+   const GLenum firstHitBuffer = params.reprojection ? GL_COLOR_ATTACHMENT2 : GL_NONE;
+   const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, momentsBuffer, firstHitBuffer,
+                                 GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5};
+   glDrawBuffers(params.denoiseAovs ? 6 : params.reprojection ? 3 : params.adaptiveSampling ? 2 : 1, drawBuffers);
+
+   // New accumulation, cleared whole by its first strip (always row 0, see TraceScheduler::run):
+   // rows not traced yet must not show the previous accumulation
+   if (lastMove <= 1 && rowBegin == 0) {
+      const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      glClearBufferfv(GL_COLOR, 0, zero);
+      if (params.adaptiveSampling)
+         glClearBufferfv(GL_COLOR, 1, zero);
+      if (params.denoiseAovs)
+         glClearBufferfv(GL_COLOR, 5, zero);
+   }
+
+   // The draw only touches the rows of this call
+   const bool partial = rowBegin > 0 || rowEnd < height;
+   if (partial) {
+      glEnable(GL_SCISSOR_TEST);
+      glScissor(0, rowBegin, width, rowEnd - rowBegin);
+   }
+
+   setTraceUniforms(shader, sceneBuffer, camera, params, lastMove, width, height);
+   if (params.adaptiveSampling) {
+      glActiveTexture(GL_TEXTURE0 + MOMENTS_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, gladManager::momentTextures[readIndex]);
+      glActiveTexture(GL_TEXTURE0 + MOMENTS_SUM_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, gladManager::momentSumTextures.back());
+      glActiveTexture(GL_TEXTURE0);
+      shader.setInt(OLD_MOMENTS, MOMENTS_TEXTURE_UNIT);
+      shader.setInt(MOMENTS_SUM, MOMENTS_SUM_TEXTURE_UNIT);
+      shader.setFloat(MOMENTS_SCALE, momentsScale(width, height));
+      shader.setFloat(ADAPTIVE_THRESHOLD, params.adaptiveThreshold);
+   }
+   if (params.reprojection) {
+      // Only the first pass of an accumulation starts from the history
+      const bool reproject = lastMove <= 1 && gladManager::historyValid;
+      const CameraState& history = gladManager::historyCamera;
+      glActiveTexture(GL_TEXTURE0 + HISTORY_ACCUM_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, gladManager::historyTextures[0]);
+      glActiveTexture(GL_TEXTURE0 + HISTORY_FIRST_HIT_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, gladManager::historyTextures[1]);
+      glActiveTexture(GL_TEXTURE0);
+      shader.setInt(HISTORY_ACCUM, HISTORY_ACCUM_TEXTURE_UNIT);
+      shader.setInt(HISTORY_FIRST_HIT, HISTORY_FIRST_HIT_TEXTURE_UNIT);
+      shader.setBool(REPROJECT, reproject);
+      shader.setVec3f(HISTORY_CAM_POS, history.position.x, history.position.y, history.position.z);
+      shader.setVec3f(HISTORY_CAM_DIR, history.direction.x, history.direction.y, history.direction.z);
+      shader.setVec3f(HISTORY_CAM_UP, history.up.x, history.up.y, history.up.z);
+      shader.setFloat(HISTORY_FOCAL_LENGTH, gladManager::historyFocalLength);
+   }
+   bvhBuffer.bind(shader);
+   drawAccumulated();
+   if (partial)
+      glDisable(GL_SCISSOR_TEST);
+
+   if (params.adaptiveSampling && endOfPass) {
+      // The next pass reads the mean error from the sum
+      reduceMoments(gladManager::momentTextures[writeIndex], width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, gladManager::framebuffers[writeIndex]);
+   }
+
+   return writeIndex;
+}
+
+void traceMotionFrame(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+                      const CameraState& camera, const RenderParams& params, int width, int height) {
+   // The viewport is the window, the size of the target
+   GLint viewport[4];
+   glGetIntegerv(GL_VIEWPORT, viewport);
+   if (!gladManager::hasMotionTarget())
+      gladManager::generateMotionTarget(viewport[2], viewport[3]);
+   if (params.denoiseAovs && !gladManager::hasMotionGbuffer())
+      gladManager::generateMotionGbuffer(viewport[2], viewport[3]);
+
+   glBindFramebuffer(GL_FRAMEBUFFER, gladManager::motionFramebuffer);
+   // Same locations as the accumulation, there are no moments nor first hits here
+   const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_NONE, GL_NONE,
+                                 GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5};
+   glDrawBuffers(params.denoiseAovs ? 6 : 1, drawBuffers);
+   glViewport(0, 0, width, height);
+
+   // A single pass, the first of an accumulation
+   const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+   glClearBufferfv(GL_COLOR, 0, zero);
+   if (params.denoiseAovs)
+      glClearBufferfv(GL_COLOR, 5, zero);
+   setTraceUniforms(shader, sceneBuffer, camera, params, 1, width, height);
+   bvhBuffer.bind(shader);
+   drawAccumulated();
+
+   glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void saveHistory(const CameraState& camera, float focalLength, int width, int height) {
+   if (!gladManager::hasFirstHits()) {
+      dropHistory();
+      return;
+   }
+
+   // Accumulation and first hits, attachments 0 and 2, to the history attachments 0 and 1
+   glBindFramebuffer(GL_READ_FRAMEBUFFER, gladManager::framebuffers[0]);
+   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gladManager::historyFramebuffer);
+   const GLenum accumBuffers[] = {GL_COLOR_ATTACHMENT0};
+   const GLenum firstHitBuffers[] = {GL_NONE, GL_COLOR_ATTACHMENT1};
+   glReadBuffer(GL_COLOR_ATTACHMENT0);
+   glDrawBuffers(1, accumBuffers);
+   glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+   glReadBuffer(GL_COLOR_ATTACHMENT2);
+   glDrawBuffers(2, firstHitBuffers);
+   glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+   glReadBuffer(GL_COLOR_ATTACHMENT0);
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+   gladManager::historyValid = true;
+   gladManager::historyCamera = camera;
+   gladManager::historyFocalLength = focalLength;
+}
+
+void dropHistory() {
+   gladManager::historyValid = false;
+}
+
+Image readAccumulation(int width, int height) {
+   Image image = readFramebuffer(gladManager::framebuffers[0], width, height);
+   normalizeAccumulation(image);
+   return image;
+}
+
+float averageSampleCount(int width, int height) {
+   if (!gladManager::hasMoments())
+      return 0.0f;
+   float sum[4] = {};
+   glBindTexture(GL_TEXTURE_2D, gladManager::momentSumTextures.back());
+   glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, sum);
+   return sum[2] * momentsScale(width, height);
+}
+
+void fitSceneToBuffer(Scene& scene, Bvh& bvh, const SceneBuffer& sceneBuffer) {
+   // The instances are uploaded by BvhBuffer, their materials are clamped here once
+   if (scene.materials.size() > sceneBuffer.maxMaterials()) {
+      fprintf(stderr, "Too many materials for uniform buffers, only the first %zu are used\n", sceneBuffer.maxMaterials());
+      const int lastMaterial = static_cast<int>(sceneBuffer.maxMaterials()) - 1;
+      for (MeshInstance& instance : scene.instances)
+         instance.material = std::min(instance.material, lastMaterial);
+   }
+
+   if (scene.spheres.size() <= sceneBuffer.maxSpheres())
+      return;
+   fprintf(stderr, "Scene too large for uniform buffers, keeping the first %zu spheres\n", sceneBuffer.maxSpheres());
+   scene.spheres.resize(sceneBuffer.maxSpheres());
+   bvh.build(scene.primitiveBounds());
+   bvh.printStats("Scene");
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef TRACEPASS_HPP
+#define TRACEPASS_HPP
+
+#include "accel/bvh.hpp"
+#include "rendering/bvhBuffer.hpp"
+#include "rendering/image.hpp"
+#include "rendering/renderParams.hpp"
+#include "rendering/sceneBuffer.hpp"
+#include "rendering/shader.hpp"
+#include "scene/scene.hpp"
+
+// Add one frame of main.frag to gladManager::accumTexture, cleared first when lastMove <= 1.
+// lastMove is the number of frames since the camera moved, returns the index of the moment texture
+// that was written (adaptive sampling).
+int traceFrame(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+               const CameraState& camera, const RenderParams& params, int lastMove, int width, int height);
+
+// traceFrame restricted to the rows [rowBegin, rowEnd) with the scissor test. A pass (same lastMove)
+// may be split in any number of row ranges, endOfPass is set on the call that completes it. The first
+// pass of an accumulation must start at row 0, whose call clears the whole targets.
+int traceRows(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+              const CameraState& camera, const RenderParams& params, int lastMove, int width, int height,
+              int rowBegin, int rowEnd, bool endOfPass);
+
+// One pass in the lower left width x height corner of gladManager::motionFramebuffer (DynamicResolution),
+// cleared first. The target is created at the size of the viewport. Meant for variants without
+// adaptive sampling, the moments belong to the native accumulation.
+void traceMotionFrame(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+                      const CameraState& camera, const RenderParams& params, int width, int height);
+
+// Keep the accumulation and the first hits, traced from camera, as the history of the next accumulation:
+// its first pass reprojects them (RenderParams::reprojection). Only meaningful when nothing but the
+// camera changed since, the first hits must come from a reprojection variant.
+void saveHistory(const CameraState& camera, float focalLength, int width, int height);
+// The next accumulation starts from nothing
+void dropHistory();
+
+// Read back the accumulation, divided by the sample counts
+Image readAccumulation(int width, int height);
+
+// Mean samples per pixel accumulated by the last complete pass (adaptive sampling only).
+// Reads back the sum of its moments, so it waits for the frame.
+float averageSampleCount(int width, int height);
+
+// Uniform blocks have a fixed capacity, keep the scene and its BVH in line with what the GPU sees
+void fitSceneToBuffer(Scene& scene, Bvh& bvh, const SceneBuffer& sceneBuffer);
+
+#endif //TRACEPASS_HPP
@@ -0,0 +1,164 @@
+#include "traceScheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "rendering/tracePass.hpp"
+
+static double wallClock() {
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Safety net against a cost model gone wrong (tiny predictions)
+static constexpr int MAX_STRIPS_PER_FRAME = 256;
+static constexpr int MAX_PASSES_PER_FRAME = 64;
+// Weight of a new measurement in the moving average
+static constexpr double COST_SMOOTHING = 0.2;
+
+TraceScheduler::TraceScheduler() : queries(QUERY_COUNT) {
+   for (Query& q : queries) {
+      glGenQueries(1, &q.begin);
+      glGenQueries(1, &q.end);
+   }
+}
+
+TraceScheduler::~TraceScheduler() {
+   for (Query& q : queries) {
+      glDeleteQueries(1, &q.begin);
+      glDeleteQueries(1, &q.end);
+   }
+}
+
+void TraceScheduler::collect() {
+   const double time = wallClock();
+   for (Query& q : queries) {
+      if (!q.pending)
+         continue;
+      GLint available = GL_FALSE;
+      glGetQueryObjectiv(q.end, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available)
+         continue;
+      GLuint64 begin = 0;
+      GLuint64 end = 0;
+      glGetQueryObjectui64v(q.begin, GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(q.end, GL_QUERY_RESULT, &end);
+      q.pending = false;
+      if (q.program != program)
+         continue;
+
+      // Same sanity check as GpuTimer: no longer than the wall time since it was issued
+      const double ns = static_cast<double>(end - begin);
+      if (end < begin || ns * 1e-6 > (time - q.issuedAt) * 1000.0 || q.samples <= 0.0)
+         continue;
+      const double cost = ns / q.samples;
+      nsPerSample = nsPerSample > 0.0 ? nsPerSample + (cost - nsPerSample) * COST_SMOOTHING : cost;
+   }
+}
+
+int TraceScheduler::rowsFor(double ms, int width, int rayPerPixel) const {
+   const double rowNs = nsPerSample * width * rayPerPixel;
+   return static_cast<int>(ms * 1e6 / std::max(rowNs, 1e-3));
+}
+
+void TraceScheduler::run(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+                         const CameraState& camera, const RenderParams& params, int& lastMove, int width, int height) {
+   // Another shader variant has another cost
+   if (shader.getProgram() != program) {
+      program = shader.getProgram();
+      nsPerSample = 0.0;
+      warm = false;
+      rowLimit = INITIAL_ROWS;
+   }
+   collect();
+   strips = 0;
+   completedPasses = 0;
+   pixelSamples = 0.0;
+   rows = 0;
+   plannedMs = 0.0;
+   if (width <= 0 || height <= 0)
+      return;
+
+   const double time = wallClock();
+   const bool stalled = lastRunAt > 0.0 && (time - lastRunAt) * 1000.0 > std::max(budgetMs * STALL_BUDGET_FACTOR, STALL_MS);
+   lastRunAt = time;
+   if (stalled)
+      rowLimit = std::max(rowLimit / 2, MIN_ROWS);
+
+   // New accumulation, or a resized one: the first pass starts at row 0, where traceRows clears
+   if (lastMove == 0 || passHeight != height) {
+      rowsLeft = 0;
+      passHeight = height;
+      cursor = 0;
+   }
+
+   const double sliceMs = std::min(budgetMs, MAX_STRIP_MS);
+   while (strips < MAX_STRIPS_PER_FRAME) {
+      if (rowsLeft == 0) {
+         lastMove++;
+         rowsLeft = height;
+      }
+
+      int count;
+      if (budgetMs <= 0.0) {
+         // One full pass per frame, the end of the current one if it was started with a budget
+         count = rowsLeft;
+      } else if (nsPerSample <= 0.0) {
+         // Unknown cost, one small strip until the first measurement comes back
+         if (strips > 0)
+            break;
+         count = INITIAL_ROWS;
+      } else {
+         count = rowsFor(std::min(sliceMs, budgetMs - plannedMs), width, params.rayPerPixel);
+         if (count < MIN_ROWS) {
+            if (strips > 0)
+               break;
+            count = MIN_ROWS;
+         }
+         if (rows + count > rowLimit) {
+            count = rowLimit - rows;
+            if (count < MIN_ROWS && strips > 0)
+               break;
+            count = std::max(count, MIN_ROWS);
+         }
+      }
+      count = std::min({count, rowsLeft, height - cursor});
+
+      const int begin = cursor;
+      const int end = cursor + count;
+      const double samples = static_cast<double>(count) * width * params.rayPerPixel;
+      rowsLeft -= count;
+      cursor = end % height;
+
+      // Not timed when every query is still in flight
+      Query& q = queries[nextQuery];
+      const bool timed = warm && !q.pending;
+      if (timed) {
+         q.samples = samples;
+         q.issuedAt = wallClock();
+         q.program = program;
+         glQueryCounter(q.begin, GL_TIMESTAMP);
+      }
+      traceRows(shader, sceneBuffer, bvhBuffer, camera, params, lastMove, width, height, begin, end, rowsLeft == 0);
+      if (timed) {
+         glQueryCounter(q.end, GL_TIMESTAMP);
+         q.pending = true;
+         nextQuery = (nextQuery + 1) % QUERY_COUNT;
+      }
+      warm = true;
+
+      strips++;
+      rows += count;
+      pixelSamples += samples;
+      plannedMs += samples * nsPerSample * 1e-6;
+      if (rowsLeft == 0) {
+         completedPasses++;
+         if (budgetMs <= 0.0)
+            break;
+      }
+   }
+
+   // The limit held this frame back without a stall: allow twice as much, up to a few passes
+   if (budgetMs > 0.0 && !stalled && rows + MIN_ROWS > rowLimit)
+      rowLimit = std::min(rowLimit * 2, height * MAX_PASSES_PER_FRAME);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#ifndef TRACESCHEDULER_HPP
+#define TRACESCHEDULER_HPP
+
+#include <vector>
+
+#include "glad/glad.h"
+#include "rendering/bvhBuffer.hpp"
+#include "rendering/renderParams.hpp"
+#include "rendering/sceneBuffer.hpp"
+#include "rendering/shader.hpp"
+
+// Splits the tracing of a displayed frame into horizontal strips (scissor) so the GPU time per frame
+// stays close to a budget: as many strips, and passes, as fit are issued before presenting, and no
+// single draw runs long enough to freeze the UI.
+//
+// A pass is rayPerPixel samples on every row, what traceFrame renders. Strips wrap around the image:
+// a pass starts on the row where the previous one stopped. A restart (camera move, lastMove = 0) or
+// a new height starts over from row 0, whose strip clears the whole target (see traceRows), so the
+// rows the first pass has not reached yet are black rather than left from the previous view.
+// The cost of a strip is predicted from GL_TIMESTAMP queries on the previous ones, which don't
+// interfere with GL_TIME_ELAPSED queries around the whole trace. Some drivers (llvmpipe) timestamp
+// the submission rather than the execution, so the rows of a frame are also capped by a limit that
+// doubles while it holds the frame back and halves when the wall time between frames shows a stall.
+class TraceScheduler {
+public:
+   TraceScheduler();
+   ~TraceScheduler();
+
+   TraceScheduler(const TraceScheduler&) = delete;
+   TraceScheduler& operator=(const TraceScheduler&) = delete;
+
+   // GPU milliseconds per displayed frame, 0 renders one full pass per frame
+   void setBudget(double ms) { budgetMs = ms; }
+   [[nodiscard]] double getBudget() const { return budgetMs; }
+
+   // Trace the strips of one displayed frame. lastMove = 0 restarts the accumulation,
+   // it is incremented when a pass begins (the first one is 1, like headless runs).
+   void run(const Shader& shader, const SceneBuffer& sceneBuffer, const BvhBuffer& bvhBuffer,
+            const CameraState& camera, const RenderParams& params, int& lastMove, int width, int height);
+
+   // Work issued by the last run()
+   [[nodiscard]] int getStrips() const { return strips; }
+   [[nodiscard]] int getCompletedPasses() const { return completedPasses; }
+   [[nodiscard]] double getPixelSamples() const { return pixelSamples; }
+   // Rows traced by the last run(), over all its strips
+   [[nodiscard]] int getRows() const { return rows; }
+   // Predicted GPU time of the last run() and cost model, 0 until measured
+   [[nodiscard]] double getPlannedMs() const { return plannedMs; }
+   [[nodiscard]] double getNsPerSample() const { return nsPerSample; }
+
+   // One strip never takes more than this, whatever the budget
+   static constexpr double MAX_STRIP_MS = 20.0;
+   // Strips issued while the cost is unknown, and the smallest strip
+   static constexpr int INITIAL_ROWS = 16;
+   static constexpr int MIN_ROWS = 4;
+   // Wall time between two frames seen as a stall: the larger of the two
+   static constexpr double STALL_BUDGET_FACTOR = 4.0;
+   static constexpr double STALL_MS = 50.0;
+
+private:
+   struct Query {
+      GLuint begin = 0;
+      GLuint end = 0;
+      bool pending = false;
+      double samples = 0.0;
+      // Wall clock when issued, in seconds
+      double issuedAt = 0.0;
+      // Program traced, measurements of another shader variant are dropped
+      GLuint program = 0;
+   };
+
+   // Read the finished queries into the cost model
+   void collect();
+   // Row count whose predicted time is ms
+   [[nodiscard]] int rowsFor(double ms, int width, int rayPerPixel) const;
+
+   // Enough to cover the strips of a few frames in flight
+   static constexpr int QUERY_COUNT = 64;
+
+   std::vector<Query> queries;
+   int nextQuery = 0;
+
+   double budgetMs = 12.0;
+   // Exponential moving average of the GPU time per pixel sample, for this program
+   double nsPerSample = 0.0;
+   GLuint program = 0;
+   // The first draw of a program includes its compilation by the driver
+   bool warm = false;
+
+   // Rows allowed per frame and wall clock of the previous run(), 0 before the first
+   int rowLimit = INITIAL_ROWS;
+   double lastRunAt = 0.0;
+
+   // Next row to trace and rows left in the current pass
+   int cursor = 0;
+   int rowsLeft = 0;
+   int passHeight = 0;
+
+   int strips = 0;
+   int completedPasses = 0;
+   double pixelSamples = 0.0;
+   int rows = 0;
+   double plannedMs = 0.0;
+};
+
+#endif //TRACESCHEDULER_HPP
@@ -0,0 +1,238 @@
+#include "wavefrontTracer.hpp"
+
+#include <cstdio>
+
+#include "rendering/gladManager.hpp"
+#include "rendering/shaderReloader.hpp"
+
+// Uniforms of wavefront.comp, hashed at compile time
+static constexpr UniformId FOCAL_LENGTH("focalLength");
+static constexpr UniformId RESOLUTION("resolution");
+static constexpr UniformId CAM_DIR("camDir");
+static constexpr UniformId CAM_UP("camUp");
+static constexpr UniformId CAM_POS("camPos");
+static constexpr UniformId TIME("time");
+static constexpr UniformId LAST_MOVE("lastMove");
+static constexpr UniformId MAX_BOUNCES("maxBounces");
+static constexpr UniformId RAY_PER_PIXEL("rayPerPixel");
+static constexpr UniformId SPHERE_COUNT("sphereCount");
+static constexpr UniformId EMITTER_COUNT("emitterCount");
+static constexpr UniformId BLUE_NOISE("blueNoise");
+static constexpr UniformId SAMPLE_INDEX("sampleIndex");
+static constexpr UniformId STAGE("stage");
+
+// Kernels of wavefront.comp
+enum Kernel { GENERATE = 0, EXTEND = 1, SHADE = 2, ACCUMULATE = 3, DISPATCH = 4 };
+
+// Storage buffer bindings of wavefront.comp, 0 to 2 are the scene (SceneBuffer)
+static constexpr GLuint RAY_QUEUE_BINDING = 3;
+static constexpr GLuint NEXT_RAY_QUEUE_BINDING = 4;
+static constexpr GLuint HIT_QUEUE_BINDING = 5;
+static constexpr GLuint PIXEL_SUMS_BINDING = 6;
+static constexpr GLuint COUNTERS_BINDING = 7;
+static constexpr GLuint ACCUM_IMAGE_UNIT = 0;
+// Units 1 and 2 are taken by BvhBuffer, same unit as tracePass
+static constexpr GLuint BLUE_NOISE_TEXTURE_UNIT = 6;
+
+// std430 sizes of Path and Hit. The counters are followed by the two indirect commands (uvec3 aligned to 16).
+static constexpr size_t PATH_SIZE = 80;
+static constexpr size_t HIT_SIZE = 48;
+static constexpr GLintptr EXTEND_ARGS_OFFSET = 16;
+static constexpr GLintptr SHADE_ARGS_OFFSET = 32;
+static constexpr GLsizeiptr COUNTERS_SIZE = 48;
+
+static std::string kernelDefines(int kernel) {
+   return "#define KERNEL " + std::to_string(kernel) + "\n";
+}
+
+static std::string samplerDefines(Sampler sampler) {
+   return "#define SAMPLER " + std::to_string(static_cast<int>(sampler)) + "\n";
+}
+
+static GLuint groups(int size, GLuint groupSize) {
+   return (static_cast<GLuint>(size) + groupSize - 1) / groupSize;
+}
+
+std::unique_ptr<WavefrontTracer> WavefrontTracer::create(const SceneBuffer& sceneBuffer, ShaderReloader* reloader) {
+   if (!GLAD_GL_VERSION_4_3) {
+      fprintf(stderr, "Wavefront backend: compute shaders need OpenGL 4.3, the context is %d.%d\n", GLVersion.major, GLVersion.minor);
+      return nullptr;
+   }
+   std::unique_ptr<WavefrontTracer> tracer(new WavefrontTracer(sceneBuffer, reloader));
+   if (!tracer->isComplete()) {
+      fprintf(stderr, "Wavefront backend: kernels failed to build\n");
+      return nullptr;
+   }
+   return tracer;
+}
+
+WavefrontTracer::WavefrontTracer(const SceneBuffer& sceneBuffer, ShaderReloader* reloader)
+   : sceneBuffer(sceneBuffer), reloader(reloader), defines(sceneBuffer.shaderDefines()),
+     extend(Shader::compute("wavefront.comp", defines + kernelDefines(EXTEND))),
+     accumulate(Shader::compute("wavefront.comp", defines + kernelDefines(ACCUMULATE))),
+     dispatch(Shader::compute("wavefront.comp", defines + kernelDefines(DISPATCH))) {
+   watch(extend);
+   watch(accumulate);
+   watch(dispatch);
+   // The default features, built up front so create() can tell if the backend works
+   const RenderParams defaults{};
+   generateKernel(defaults.sampler);
+   shadeKernel(defaults.emission, defaults.russianRoulette, defaults.lightSampling, defaults.sampler);
+
+   glGenBuffers(2, rayQueues);
+   glGenBuffers(1, &hitQueue);
+   glGenBuffers(1, &counters);
+   glGenBuffers(1, &pixelSums);
+
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER, counters);
+   glBufferData(GL_SHADER_STORAGE_BUFFER, COUNTERS_SIZE, nullptr, GL_DYNAMIC_COPY);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+WavefrontTracer::~WavefrontTracer() {
+   glDeleteBuffers(2, rayQueues);
+   glDeleteBuffers(1, &hitQueue);
+   glDeleteBuffers(1, &counters);
+   glDeleteBuffers(1, &pixelSums);
+}
+
+bool WavefrontTracer::isComplete() const {
+   if (extend.getProgram() == 0 || accumulate.getProgram() == 0 || dispatch.getProgram() == 0)
+      return false;
+   for (const auto& [sampler, kernel] : generateKernels) {
+      if (kernel->getProgram() == 0)
+         return false;
+   }
+   for (const auto& [features, kernel] : shadeKernels) {
+      if (kernel->getProgram() == 0)
+         return false;
+   }
+   return true;
+}
+
+Shader& WavefrontTracer::watch(Shader& kernel) {
+   auto bindScene = [this](Shader& built) { sceneBuffer.bindBlocks(built.getProgram()); };
+   if (kernel.getProgram() != 0)
+      bindScene(kernel);
+   if (reloader)
+      reloader->watch(kernel, bindScene);
+   return kernel;
+}
+
+Shader& WavefrontTracer::generateKernel(Sampler sampler) {
+   auto it = generateKernels.find(sampler);
+   if (it == generateKernels.end()) {
+      auto kernel = std::make_unique<Shader>(Shader::compute("wavefront.comp", defines + kernelDefines(GENERATE) + samplerDefines(sampler)));
+      it = generateKernels.emplace(sampler, std::move(kernel)).first;
+      watch(*it->second);
+   }
+   return *it->second;
+}
+
+Shader& WavefrontTracer::shadeKernel(bool emission, bool russianRoulette, bool lightSampling, Sampler sampler) {
+   auto it = shadeKernels.find({emission, russianRoulette, lightSampling, sampler});
+   if (it == shadeKernels.end()) {
+      std::string features = std::string("#define USE_EMISSION ") + (emission ? "1" : "0") + "\n"
+                           + "#define USE_RUSSIAN_ROULETTE " + (russianRoulette ? "1" : "0") + "\n"
+                           + "#define USE_LIGHT_SAMPLING " + (lightSampling ? "1" : "0") + "\n"
+                           + samplerDefines(sampler);
+      auto kernel = std::make_unique<Shader>(Shader::compute("wavefront.comp", defines + kernelDefines(SHADE) + features));
+      it = shadeKernels.emplace(std::make_tuple(emission, russianRoulette, lightSampling, sampler), std::move(kernel)).first;
+      watch(*it->second);
+   }
+   return *it->second;
+}
+
+void WavefrontTracer::allocate(int width, int height) {
+   capacity = static_cast<size_t>(width) * static_cast<size_t>(height);
+   for (GLuint queue : rayQueues) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue);
+      glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(capacity * PATH_SIZE), nullptr, GL_DYNAMIC_COPY);
+   }
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER, hitQueue);
+   glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(capacity * HIT_SIZE), nullptr, GL_DYNAMIC_COPY);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER, pixelSums);
+   glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(capacity * 4 * sizeof(float)), nullptr, GL_DYNAMIC_COPY);
+   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void WavefrontTracer::trace(const BvhBuffer& bvhBuffer, const CameraState& camera, const RenderParams& params,
+                            int lastMove, int width, int height) {
+   if (capacity != static_cast<size_t>(width) * static_cast<size_t>(height))
+      allocate(width, height);
+
+   Shader& generate = generateKernel(params.sampler);
+   Shader& shade = shadeKernel(params.emission, params.russianRoulette, params.lightSampling, params.sampler);
+   Shader* kernels[] = {&generate, &extend, &shade, &accumulate, &dispatch};
+   for (Shader* kernel : kernels) {
+      kernel->useShader();
+      kernel->setFloat(FOCAL_LENGTH, params.focalLength);
+      kernel->setVec2f(RESOLUTION, static_cast<float>(width), static_cast<float>(height));
+      kernel->setVec3f(CAM_DIR, camera.direction.x, camera.direction.y, camera.direction.z);
+      kernel->setVec3f(CAM_UP, camera.up.x, camera.up.y, camera.up.z);
+      kernel->setVec3f(CAM_POS, camera.position.x, camera.position.y, camera.position.z);
+      kernel->setUInt(TIME, params.time);
+      kernel->setInt(LAST_MOVE, lastMove);
+      kernel->setInt(MAX_BOUNCES, params.maxBounces);
+      kernel->setInt(RAY_PER_PIXEL, params.rayPerPixel);
+      kernel->setInt(SPHERE_COUNT, sceneBuffer.getSphereCount());
+      kernel->setInt(EMITTER_COUNT, sceneBuffer.getEmitterCount());
+      bvhBuffer.bind(*kernel);
+   }
+   if (params.sampler == Sampler::BLUE_NOISE) {
+      glActiveTexture(GL_TEXTURE0 + BLUE_NOISE_TEXTURE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, gladManager::getBlueNoiseTexture());
+      glActiveTexture(GL_TEXTURE0);
+      shade.useShader();
+      shade.setInt(BLUE_NOISE, BLUE_NOISE_TEXTURE_UNIT);
+   }
+
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HIT_QUEUE_BINDING, hitQueue);
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COUNTERS_BINDING, counters);
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PIXEL_SUMS_BINDING, pixelSums);
+   glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, counters);
+
+   // The counters and arguments written by one kernel are read by the next one, or by the dispatch
+   const GLbitfield queueBarrier = GL_SHADER_STORAGE_BARRIER_BIT;
+   const GLbitfield argsBarrier = GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT;
+   const GLuint tilesX = groups(width, TILE_SIZE);
+   const GLuint tilesY = groups(height, TILE_SIZE);
+
+   // One wave per sample: the queue of a bounce is the next queue of the previous one
+   for (int sample = 0; sample < params.rayPerPixel; sample++) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NEXT_RAY_QUEUE_BINDING, rayQueues[0]);
+      generate.useShader();
+      generate.setInt(SAMPLE_INDEX, sample);
+      glDispatchCompute(tilesX, tilesY, 1);
+      glMemoryBarrier(queueBarrier);
+
+      for (int bounce = 0; bounce < params.maxBounces; bounce++) {
+         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RAY_QUEUE_BINDING, rayQueues[bounce % 2]);
+         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NEXT_RAY_QUEUE_BINDING, rayQueues[1 - bounce % 2]);
+
+         dispatch.useShader();
+         dispatch.setInt(STAGE, EXTEND);
+         glDispatchCompute(1, 1, 1);
+         glMemoryBarrier(argsBarrier);
+         extend.useShader();
+         glDispatchComputeIndirect(EXTEND_ARGS_OFFSET);
+         glMemoryBarrier(queueBarrier);
+
+         dispatch.useShader();
+         dispatch.setInt(STAGE, SHADE);
+         glDispatchCompute(1, 1, 1);
+         glMemoryBarrier(argsBarrier);
+         shade.useShader();
+         glDispatchComputeIndirect(SHADE_ARGS_OFFSET);
+         glMemoryBarrier(queueBarrier);
+      }
+   }
+
+   glBindImageTexture(ACCUM_IMAGE_UNIT, gladManager::accumTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+   accumulate.useShader();
+   glDispatchCompute(tilesX, tilesY, 1);
+   // Displayed, read back or blended into by the fragment backend next
+   glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+   glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
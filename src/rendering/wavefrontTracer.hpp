@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef WAVEFRONTTRACER_HPP
+#define WAVEFRONTTRACER_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "glad/glad.h"
+#include "rendering/bvhBuffer.hpp"
+#include "rendering/renderParams.hpp"
+#include "rendering/sceneBuffer.hpp"
+#include "rendering/shader.hpp"
+
+class ShaderReloader;
+
+// Compute shader backend (wavefront.comp, GL 4.3): the paths of a pass go through separate
+// generate / extend / shade / accumulate kernels over queues in storage buffers, with atomic
+// counters and indirect dispatches sized on the GPU, instead of one fragment running every bounce.
+// Writes the same accumulation as traceFrame, with the same samples, so the fragment backend is a
+// drop-in fallback. Adaptive sampling, reprojection and the denoiser guides are fragment only.
+class WavefrontTracer {
+public:
+   // Null when the context has no compute shaders or a kernel doesn't build, the caller falls
+   // back to traceFrame. The scene buffer must outlive the tracer. With a reloader the kernels are
+   // hot-reloaded like the other programs.
+   static std::unique_ptr<WavefrontTracer> create(const SceneBuffer& sceneBuffer, ShaderReloader* reloader = nullptr);
+   ~WavefrontTracer();
+
+   WavefrontTracer(const WavefrontTracer&) = delete;
+   WavefrontTracer& operator=(const WavefrontTracer&) = delete;
+
+   // Add one pass (rayPerPixel samples per pixel) to gladManager::accumTexture, cleared first when
+   // lastMove <= 1, like traceFrame. Only params.emission, russianRoulette, lightSampling and sampler are baked in.
+   void trace(const BvhBuffer& bvhBuffer, const CameraState& camera, const RenderParams& params,
+              int lastMove, int width, int height);
+
+   // Local sizes of wavefront.comp: queue kernels and image tiles
+   static constexpr GLuint GROUP_SIZE = 256;
+   static constexpr GLuint TILE_SIZE = 16;
+
+private:
+   WavefrontTracer(const SceneBuffer& sceneBuffer, ShaderReloader* reloader);
+
+   [[nodiscard]] bool isComplete() const;
+   // Kernel built with the scene declarations, the scene blocks bound (also after a reload)
+   Shader& watch(Shader& kernel);
+   // GENERATE bakes the sampler, SHADE the features like ShaderVariants: one program per combination
+   Shader& generateKernel(Sampler sampler);
+   Shader& shadeKernel(bool emission, bool russianRoulette, bool lightSampling, Sampler sampler);
+   void allocate(int width, int height);
+
+   const SceneBuffer& sceneBuffer;
+   ShaderReloader* reloader;
+   std::string defines;
+
+   Shader extend;
+   Shader accumulate;
+   Shader dispatch;
+   std::map<Sampler, std::unique_ptr<Shader>> generateKernels;
+   std::map<std::tuple<bool, bool, bool, Sampler>, std::unique_ptr<Shader>> shadeKernels;
+
+   // Ping-pong ray queues, hit queue, per-pixel sums, counters followed by the indirect arguments
+   GLuint rayQueues[2] = {0, 0};
+   GLuint hitQueue = 0;
+   GLuint pixelSums = 0;
+   GLuint counters = 0;
+   // Pixels the queues hold
+   size_t capacity = 0;
+};
+
+#endif //WAVEFRONTTRACER_HPP
@@ -0,0 +1,86 @@
+#include "mesh.hpp"
+
+#include <cmath>
+
+#include "utils/threadPool.hpp"
+
+// Faces per job of the parallel loops
+static constexpr size_t BATCH_SIZE = 1 << 16;
+
+void Mesh::build() {
+   const size_t count = faces.size();
+   const size_t batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+   std::vector<Aabb> faceBounds(count);
+   ThreadPool::global().parallelFor(batchCount, [&](size_t batch) {
+      const size_t end = std::min(count, (batch + 1) * BATCH_SIZE);
+      for (size_t i = batch * BATCH_SIZE; i < end; i++) {
+         faceBounds[i].grow(positions[faces[i].x]);
+         faceBounds[i].grow(positions[faces[i].y]);
+         faceBounds[i].grow(positions[faces[i].z]);
+      }
+   });
+   bvh.build(faceBounds);
+
+   const std::vector<uint32_t> order = bvh.leafOrder();
+   triangles.resize(count);
+   ThreadPool::global().parallelFor(batchCount, [&](size_t batch) {
+      const size_t end = std::min(count, (batch + 1) * BATCH_SIZE);
+      for (size_t i = batch * BATCH_SIZE; i < end; i++) {
+         const glm::uvec3& face = faces[order[i]];
+         const glm::vec3& a = positions[face.x];
+         triangles[i] = MeshTriangle{a, 0.0f, positions[face.y] - a, 0.0f, positions[face.z] - a, 0.0f};
+      }
+   });
+
+   std::vector<glm::vec3>().swap(positions);
+   std::vector<glm::uvec3>().swap(faces);
+}
+
+Aabb Mesh::bounds() const {
+   Aabb result;
+   for (const glm::vec3& p : positions)
+      result.grow(p);
+   return result;
+}
+
+void Mesh::fit(const glm::vec3& base, float size) {
+   const Aabb box = bounds();
+   const glm::vec3 extent = box.max - box.min;
+   const float largest = std::max(std::max(extent.x, extent.y), extent.z);
+   if (largest <= 0.0f)
+      return;
+   const float scale = size / largest;
+   const glm::vec3 bottom(box.center().x, box.min.y, box.center().z);
+   for (glm::vec3& p : positions)
+      p = base + (p - bottom) * scale;
+}
+
+Aabb MeshInstance::worldBounds(const Aabb& box) const {
+   if (box.min.x > box.max.x)
+      return box;
+   // Center moved, half extent by the absolute values of the linear part
+   const glm::vec3 center = box.center();
+   const glm::vec3 half = (box.max - box.min) * 0.5f;
+   Aabb result;
+   for (int r = 0; r < 3; r++) {
+      const glm::vec4& row = toWorld[r];
+      const float c = row.x * center.x + row.y * center.y + row.z * center.z + row.w;
+      const float e = std::abs(row.x) * half.x + std::abs(row.y) * half.y + std::abs(row.z) * half.z;
+      result.min[r] = c - e;
+      result.max[r] = c + e;
+   }
+   return result;
+}
+
+MeshInstance makeInstance(int mesh, int material, const glm::mat3& linear, const glm::vec3& translation) {
+   const glm::mat3 inverse = glm::inverse(linear);
+   const glm::vec3 inverseTranslation = -(inverse * translation);
+   MeshInstance instance{};
+   for (int r = 0; r < 3; r++) {
+      instance.toWorld[r] = glm::vec4(linear[0][r], linear[1][r], linear[2][r], translation[r]);
+      instance.toObject[r] = glm::vec4(inverse[0][r], inverse[1][r], inverse[2][r], inverseTranslation[r]);
+   }
+   instance.mesh = mesh;
+   instance.material = material;
+   return instance;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <vector>
+
+#include "accel/bvh.hpp"
+#include "glm/glm.hpp"
+
+// Triangle as traced: first vertex and the edges to the two others, precomputed for the
+// Moller-Trumbore test. Uploaded as three RGBA32F texels (see BvhBuffer::uploadMeshes), w unused.
+struct MeshTriangle {
+   glm::vec3 v0;
+   float pad0;
+   glm::vec3 edge1;
+   float pad1;
+   glm::vec3 edge2;
+   float pad2;
+};
+
+// Indexed triangle mesh, traced through its own BVH by its instances (MeshInstance)
+struct Mesh {
+   // Source data, turned into triangles and released by build()
+   std::vector<glm::vec3> positions;
+   // Indices in positions
+   std::vector<glm::uvec3> faces;
+
+   // In the leaf order of bvh, whose primitive indices are 0, 1, 2...: the leaves reference
+   // ranges of triangles directly, on the GPU as well
+   std::vector<MeshTriangle> triangles;
+   Bvh bvh;
+
+   // Once the positions are final
+   void build();
+
+   // Of the positions, before build()
+   [[nodiscard]] Aabb bounds() const;
+
+   // Scale and move the positions so that the largest side of the bounds is size and the
+   // middle of their bottom face (lowest y) is at base
+   void fit(const glm::vec3& base, float size);
+};
+
+// Placement of a shared Mesh, the primitive of the scene BVH: its triangles and BVH are stored
+// once whatever the number of instances. Rows of 3x4 affine matrices, p' = (dot(row, (p, 1))...).
+// The traversals move the rays to object space without normalizing them, so that the distances
+// along them stay the same in both spaces.
+struct MeshInstance {
+   glm::vec4 toWorld[3];
+   // Inverse of toWorld, uploaded with the instance (BvhBuffer::uploadMeshes)
+   glm::vec4 toObject[3];
+   // Index in Scene::meshes
+   int mesh;
+   // Index in Scene::materials
+   int material;
+
+   [[nodiscard]] glm::vec3 objectPoint(const glm::vec3& p) const {
+      return glm::vec3(glm::dot(toObject[0], glm::vec4(p, 1.0f)), glm::dot(toObject[1], glm::vec4(p, 1.0f)), glm::dot(toObject[2], glm::vec4(p, 1.0f)));
+   }
+
+   [[nodiscard]] glm::vec3 objectVector(const glm::vec3& v) const {
+      return glm::vec3(glm::dot(glm::vec3(toObject[0]), v), glm::dot(glm::vec3(toObject[1]), v), glm::dot(glm::vec3(toObject[2]), v));
+   }
+
+   // Normal of the object space in world space, by the transpose of toObject. Not normalized.
+   [[nodiscard]] glm::vec3 worldNormal(const glm::vec3& n) const {
+      return glm::vec3(toObject[0]) * n.x + glm::vec3(toObject[1]) * n.y + glm::vec3(toObject[2]) * n.z;
+   }
+
+   // Bounds of the transformed box
+   [[nodiscard]] Aabb worldBounds(const Aabb& box) const;
+};
+
+// Instance of mesh placed by p' = linear * p + translation, linear invertible
+MeshInstance makeInstance(int mesh, int material, const glm::mat3& linear, const glm::vec3& translation);
+
+// Distance along a ray to a triangle in [minDist, tMax], or 1e30 on a miss. Same arithmetic as
+// triangleDistance in scene.glsl, both sides are hit.
+inline float intersectTriangle(const glm::vec3& origin, const glm::vec3& direction, const MeshTriangle& tri, float minDist, float tMax) {
+   glm::vec3 p = glm::cross(direction, tri.edge2);
+   float det = glm::dot(tri.edge1, p);
+   if (det == 0.0f)
+      return 1e30f;
+   float invDet = 1.0f / det;
+   glm::vec3 s = origin - tri.v0;
+   float u = glm::dot(s, p) * invDet;
+   if (u < 0.0f || u > 1.0f)
+      return 1e30f;
+   glm::vec3 q = glm::cross(s, tri.edge1);
+   float v = glm::dot(direction, q) * invDet;
+   if (v < 0.0f || u + v > 1.0f)
+      return 1e30f;
+   float t = glm::dot(tri.edge2, q) * invDet;
+   return t >= minDist && t <= tMax ? t : 1e30f;
+}
+
+#endif //MESH_HPP
@@ -0,0 +1,605 @@
+#include "meshLoader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "utils/mappedFile.hpp"
+#include "utils/threadPool.hpp"
+
+// Bytes of an OBJ file per parsing job, PLY elements per job
+static constexpr size_t OBJ_CHUNK_SIZE = 1 << 20;
+static constexpr size_t PLY_BATCH_SIZE = 1 << 16;
+
+// Placement of addMeshes: between the camera and the spheres of defaultScene, on the floor sphere
+static constexpr float MESH_SIZE = 2.0f;
+static constexpr float MESH_SPACING = 2.5f;
+static const glm::vec3 MESH_BASE(0.0f, -2.07f, 6.5f);
+
+static bool hasExtension(const std::string& path, const char* extension) {
+   const size_t length = strlen(extension);
+   if (path.size() < length)
+      return false;
+   for (size_t i = 0; i < length; i++) {
+      if (tolower(static_cast<unsigned char>(path[path.size() - length + i])) != extension[i])
+         return false;
+   }
+   return true;
+}
+
+// Job ranges of count items
+template<typename Func>
+static void parallelBatches(size_t count, size_t batchSize, Func&& func) {
+   ThreadPool::global().parallelFor((count + batchSize - 1) / batchSize, [&](size_t batch) {
+      func(batch * batchSize, std::min(count, (batch + 1) * batchSize));
+   });
+}
+
+// OBJ
+
+namespace {
+   // Lines of an OBJ file parsed by one job
+   struct ObjChunk {
+      const char* begin;
+      const char* end;
+      // In the file, for the messages
+      size_t fileOffset = 0;
+      std::vector<glm::vec3> positions;
+      // Fan triangles as written: 1-based indices, or negative ones relative to the last position defined
+      std::vector<glm::ivec3> faces;
+      // Positions of the chunk defined before each face, to resolve the relative indices
+      std::vector<uint32_t> faceBase;
+      // Offsets of the chunk in the mesh arrays
+      size_t firstPosition = 0;
+      size_t firstFace = 0;
+      bool malformed = false;
+   };
+}
+
+static const char* skipBlanks(const char* p, const char* end) {
+   while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+   return p;
+}
+
+static bool isKeyword(const char* p, const char* end, char keyword) {
+   return end - p >= 2 && p[0] == keyword && (p[1] == ' ' || p[1] == '\t');
+}
+
+static void parseObjChunk(ObjChunk& chunk) {
+   const char* line = chunk.begin;
+   while (line < chunk.end && !chunk.malformed) {
+      const char* lineEnd = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(chunk.end - line)));
+      if (!lineEnd)
+         lineEnd = chunk.end;
+      const char* p = skipBlanks(line, lineEnd);
+
+      if (isKeyword(p, lineEnd, 'v')) {
+         glm::vec3 v(0.0f);
+         p += 2;
+         for (int c = 0; c < 3 && !chunk.malformed; c++) {
+            // strtof would go on to the next line
+            p = skipBlanks(p, lineEnd);
+            char* next = nullptr;
+            v[c] = p < lineEnd ? strtof(p, &next) : 0.0f;
+            chunk.malformed = next == nullptr || next == p || next > lineEnd;
+            p = next;
+         }
+         chunk.positions.push_back(v);
+      } else if (isKeyword(p, lineEnd, 'f')) {
+         p += 2;
+         int first = 0;
+         int previous = 0;
+         int corners = 0;
+         while (true) {
+            p = skipBlanks(p, lineEnd);
+            if (p >= lineEnd || *p == '#')
+               break;
+            char* next = nullptr;
+            const long index = strtol(p, &next, 10);
+            if (next == p || index == 0) {
+               chunk.malformed = true;
+               break;
+            }
+            // Texture coordinate and normal indices
+            p = next;
+            while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+               p++;
+
+            if (corners == 0) {
+               first = static_cast<int>(index);
+            } else if (corners >= 2) {
+               chunk.faces.emplace_back(first, previous, static_cast<int>(index));
+               chunk.faceBase.push_back(static_cast<uint32_t>(chunk.positions.size()));
+            }
+            previous = static_cast<int>(index);
+            corners++;
+         }
+         if (corners < 3)
+            chunk.malformed = true;
+      }
+      line = lineEnd + 1;
+   }
+}
+
+static bool loadObj(const std::string& path, const char* text, size_t size, Mesh& mesh) {
+   // strtof and strtol stop after the last digit: only an unterminated last line could make them
+   // read past the mapping, it is parsed from a terminated copy
+   size_t mappedSize = size;
+   while (mappedSize > 0 && text[mappedSize - 1] != '\n')
+      mappedSize--;
+   const std::string lastLine = std::string(text + mappedSize, size - mappedSize) + "\n";
+
+   // Chunks end on line boundaries
+   std::vector<ObjChunk> chunks;
+   size_t begin = 0;
+   while (begin < mappedSize) {
+      size_t end = std::min(mappedSize, begin + OBJ_CHUNK_SIZE);
+      if (end < mappedSize) {
+         const void* newline = memchr(text + end, '\n', mappedSize - end);
+         end = newline ? static_cast<size_t>(static_cast<const char*>(newline) - text) + 1 : mappedSize;
+      }
+      ObjChunk chunk;
+      chunk.begin = text + begin;
+      chunk.end = text + end;
+      chunk.fileOffset = begin;
+      chunks.push_back(std::move(chunk));
+      begin = end;
+   }
+   if (mappedSize < size) {
+      ObjChunk chunk;
+      chunk.begin = lastLine.data();
+      chunk.end = lastLine.data() + lastLine.size();
+      chunk.fileOffset = mappedSize;
+      chunks.push_back(std::move(chunk));
+   }
+
+   ThreadPool::global().parallelFor(chunks.size(), [&](size_t i) { parseObjChunk(chunks[i]); });
+
+   size_t positionCount = 0;
+   size_t faceCount = 0;
+   for (ObjChunk& chunk : chunks) {
+      if (chunk.malformed) {
+         fprintf(stderr, "Malformed vertex or face in %s (near byte %zu)\n", path.c_str(), chunk.fileOffset);
+         return false;
+      }
+      chunk.firstPosition = positionCount;
+      chunk.firstFace = faceCount;
+      positionCount += chunk.positions.size();
+      faceCount += chunk.faces.size();
+   }
+
+   mesh.positions.resize(positionCount);
+   mesh.faces.resize(faceCount);
+   std::atomic<bool> outOfRange{false};
+   ThreadPool::global().parallelFor(chunks.size(), [&](size_t i) {
+      const ObjChunk& chunk = chunks[i];
+      std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + static_cast<std::ptrdiff_t>(chunk.firstPosition));
+      for (size_t f = 0; f < chunk.faces.size(); f++) {
+         const auto defined = static_cast<long long>(chunk.firstPosition + chunk.faceBase[f]);
+         glm::uvec3 face;
+         for (int c = 0; c < 3; c++) {
+            const long long index = chunk.faces[f][c] > 0 ? chunk.faces[f][c] - 1 : defined + chunk.faces[f][c];
+            if (index < 0 || index >= static_cast<long long>(positionCount)) {
+               outOfRange = true;
+               return;
+            }
+            face[c] = static_cast<uint32_t>(index);
+         }
+         mesh.faces[chunk.firstFace + f] = face;
+      }
+   });
+   if (outOfRange) {
+      fprintf(stderr, "Face index out of range in %s\n", path.c_str());
+      return false;
+   }
+   return true;
+}
+
+// Binary PLY
+
+namespace {
+   enum class PlyType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+   struct PlyProperty {
+      std::string name;
+      PlyType type = PlyType::FLOAT32;
+      // Lists: count type, then count values of type
+      bool list = false;
+      PlyType countType = PlyType::UINT8;
+   };
+
+   struct PlyElement {
+      std::string name;
+      size_t count = 0;
+      std::vector<PlyProperty> properties;
+   };
+
+   // Values of a binary PLY body
+   struct PlyReader {
+      const char* data;
+      const char* end;
+      bool swap;
+
+      [[nodiscard]] double read(const char* p, PlyType type) const;
+   };
+}
+
+static size_t plySize(PlyType type) {
+   switch (type) {
+      case PlyType::INT8: case PlyType::UINT8: return 1;
+      case PlyType::INT16: case PlyType::UINT16: return 2;
+      case PlyType::INT32: case PlyType::UINT32: case PlyType::FLOAT32: return 4;
+      default: return 8;
+   }
+}
+
+static bool parsePlyType(const std::string& name, PlyType& type) {
+   static const struct { const char* name; PlyType type; } names[] = {
+      {"char", PlyType::INT8}, {"int8", PlyType::INT8}, {"uchar", PlyType::UINT8}, {"uint8", PlyType::UINT8},
+      {"short", PlyType::INT16}, {"int16", PlyType::INT16}, {"ushort", PlyType::UINT16}, {"uint16", PlyType::UINT16},
+      {"int", PlyType::INT32}, {"int32", PlyType::INT32}, {"uint", PlyType::UINT32}, {"uint32", PlyType::UINT32},
+      {"float", PlyType::FLOAT32}, {"float32", PlyType::FLOAT32}, {"double", PlyType::FLOAT64}, {"float64", PlyType::FLOAT64},
+   };
+   for (const auto& entry : names) {
+      if (name == entry.name) {
+         type = entry.type;
+         return true;
+      }
+   }
+   return false;
+}
+
+double PlyReader::read(const char* p, PlyType type) const {
+   unsigned char bytes[8];
+   const size_t size = plySize(type);
+   memcpy(bytes, p, size);
+   if (swap)
+      std::reverse(bytes, bytes + size);
+   switch (type) {
+      case PlyType::INT8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+      case PlyType::UINT8: return bytes[0];
+      case PlyType::INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+      case PlyType::UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+      case PlyType::INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+      case PlyType::UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+      case PlyType::FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+      default: { double v; memcpy(&v, bytes, 8); return v; }
+   }
+}
+
+// Size of the fixed size properties, SIZE_MAX when the element has lists
+static size_t plyStride(const PlyElement& element) {
+   size_t stride = 0;
+   for (const PlyProperty& property : element.properties) {
+      if (property.list)
+         return SIZE_MAX;
+      stride += plySize(property.type);
+   }
+   return stride;
+}
+
+// Size of the record at p, 0 when it goes past the end
+static size_t plyRecordSize(const PlyReader& reader, const PlyElement& element, const char* p) {
+   size_t size = 0;
+   for (const PlyProperty& property : element.properties) {
+      if (!property.list) {
+         size += plySize(property.type);
+         continue;
+      }
+      const size_t countSize = plySize(property.countType);
+      if (reader.end - p < static_cast<std::ptrdiff_t>(size + countSize))
+         return 0;
+      const auto count = static_cast<size_t>(reader.read(p + size, property.countType));
+      size += countSize + count * plySize(property.type);
+   }
+   return reader.end - p < static_cast<std::ptrdiff_t>(size) ? 0 : size;
+}
+
+static bool parsePlyHeader(const std::string& path, const char* text, size_t size, std::vector<PlyElement>& elements,
+                           bool& littleEndian, size_t& bodyOffset) {
+   const char* headerEnd = nullptr;
+   for (const char* marker : {"end_header\n", "end_header\r\n"}) {
+      const char* found = std::search(text, text + size, marker, marker + strlen(marker));
+      if (found != text + size) {
+         headerEnd = found;
+         bodyOffset = static_cast<size_t>(found - text) + strlen(marker);
+         break;
+      }
+   }
+   if (size < 4 || memcmp(text, "ply", 3) != 0 || !headerEnd) {
+      fprintf(stderr, "%s is not a PLY file\n", path.c_str());
+      return false;
+   }
+
+   std::istringstream header(std::string(text, headerEnd));
+   std::string line;
+   bool formatFound = false;
+   while (std::getline(header, line)) {
+      std::istringstream tokens(line);
+      std::string keyword;
+      tokens >> keyword;
+      if (keyword == "format") {
+         std::string format;
+         tokens >> format;
+         if (format != "binary_little_endian" && format != "binary_big_endian") {
+            fprintf(stderr, "%s: only binary PLY files are supported, not %s\n", path.c_str(), format.c_str());
+            return false;
+         }
+         littleEndian = format == "binary_little_endian";
+         formatFound = true;
+      } else if (keyword == "element") {
+         PlyElement element;
+         tokens >> element.name >> element.count;
+         elements.push_back(element);
+      } else if (keyword == "property") {
+         if (elements.empty()) {
+            fprintf(stderr, "%s: property outside of an element\n", path.c_str());
+            return false;
+         }
+         PlyProperty property;
+         std::string type;
+         tokens >> type;
+         bool valid = true;
+         if (type == "list") {
+            std::string countType;
+            tokens >> countType >> type;
+            property.list = true;
+            valid = parsePlyType(countType, property.countType);
+         }
+         tokens >> property.name;
+         if (!valid || !parsePlyType(type, property.type) || property.name.empty()) {
+            fprintf(stderr, "%s: unsupported property '%s'\n", path.c_str(), line.c_str());
+            return false;
+         }
+         elements.back().properties.push_back(property);
+      }
+   }
+   if (!formatFound) {
+      fprintf(stderr, "%s: PLY format missing\n", path.c_str());
+      return false;
+   }
+   return true;
+}
+
+static bool readPlyVertices(const std::string& path, const PlyReader& reader, const PlyElement& element, const char*& p, Mesh& mesh) {
+   const size_t stride = plyStride(element);
+   int axes[3] = {-1, -1, -1};
+   size_t offsets[3] = {0, 0, 0};
+   size_t offset = 0;
+   for (size_t i = 0; i < element.properties.size() && stride != SIZE_MAX; i++) {
+      const PlyProperty& property = element.properties[i];
+      for (int c = 0; c < 3; c++) {
+         if (property.name == std::string(1, static_cast<char>('x' + c))) {
+            axes[c] = static_cast<int>(i);
+            offsets[c] = offset;
+         }
+      }
+      offset += plySize(property.type);
+   }
+   if (stride == SIZE_MAX || axes[0] < 0 || axes[1] < 0 || axes[2] < 0) {
+      fprintf(stderr, "%s: vertices need fixed size x, y and z properties\n", path.c_str());
+      return false;
+   }
+   if (static_cast<size_t>(reader.end - p) / stride < element.count) {
+      fprintf(stderr, "%s: truncated vertex data\n", path.c_str());
+      return false;
+   }
+
+   mesh.positions.resize(element.count);
+   const char* first = p;
+   parallelBatches(element.count, PLY_BATCH_SIZE, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         const char* record = first + i * stride;
+         for (int c = 0; c < 3; c++)
+            mesh.positions[i][c] = static_cast<float>(reader.read(record + offsets[c], element.properties[axes[c]].type));
+      }
+   });
+   p += element.count * stride;
+   return true;
+}
+
+static bool readPlyFaces(const std::string& path, const PlyReader& reader, const PlyElement& element, const char*& p, Mesh& mesh) {
+   int indexProperty = -1;
+   size_t before = 0; // bytes of the fixed size properties before the indices
+   size_t after = 0;
+   bool otherLists = false;
+   for (size_t i = 0; i < element.properties.size(); i++) {
+      const PlyProperty& property = element.properties[i];
+      if (property.list && indexProperty < 0 && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+         indexProperty = static_cast<int>(i);
+      } else if (property.list) {
+         otherLists = true;
+      } else {
+         (indexProperty < 0 ? before : after) += plySize(property.type);
+      }
+   }
+   if (indexProperty < 0) {
+      fprintf(stderr, "%s: faces without vertex_indices\n", path.c_str());
+      return false;
+   }
+   const PlyProperty& indices = element.properties[indexProperty];
+   const size_t countSize = plySize(indices.countType);
+   const size_t indexSize = plySize(indices.type);
+   const auto vertexCount = static_cast<double>(mesh.positions.size());
+
+   // Triangles only, the usual case: fixed size records read in parallel
+   const size_t stride = before + countSize + 3 * indexSize + after;
+   bool triangles = !otherLists && static_cast<size_t>(reader.end - p) / stride >= element.count;
+   if (triangles) {
+      std::atomic<bool> polygon{false};
+      const char* first = p;
+      parallelBatches(element.count, PLY_BATCH_SIZE, [&](size_t begin, size_t end) {
+         for (size_t i = begin; i < end && !polygon; i++) {
+            if (reader.read(first + i * stride + before, indices.countType) != 3.0)
+               polygon = true;
+         }
+      });
+      triangles = !polygon;
+   }
+   if (triangles) {
+      mesh.faces.resize(element.count);
+      std::atomic<bool> outOfRange{false};
+      const char* first = p;
+      parallelBatches(element.count, PLY_BATCH_SIZE, [&](size_t begin, size_t end) {
+         for (size_t i = begin; i < end; i++) {
+            const char* values = first + i * stride + before + countSize;
+            for (int c = 0; c < 3; c++) {
+               const double index = reader.read(values + c * indexSize, indices.type);
+               if (index < 0.0 || index >= vertexCount) {
+                  outOfRange = true;
+                  return;
+               }
+               mesh.faces[i][c] = static_cast<uint32_t>(index);
+            }
+         }
+      });
+      if (outOfRange) {
+         fprintf(stderr, "%s: face index out of range\n", path.c_str());
+         return false;
+      }
+      p += element.count * stride;
+      return true;
+   }
+
+   // Polygons or extra lists: one record after the other, polygons split in fans
+   mesh.faces.clear();
+   mesh.faces.reserve(element.count);
+   for (size_t i = 0; i < element.count; i++) {
+      const size_t size = plyRecordSize(reader, element, p);
+      if (size == 0) {
+         fprintf(stderr, "%s: truncated face data\n", path.c_str());
+         return false;
+      }
+      const char* field = p;
+      for (size_t k = 0; k < element.properties.size(); k++) {
+         const PlyProperty& property = element.properties[k];
+         if (!property.list) {
+            field += plySize(property.type);
+            continue;
+         }
+         const auto count = static_cast<size_t>(reader.read(field, property.countType));
+         field += plySize(property.countType);
+         if (static_cast<int>(k) == indexProperty) {
+            uint32_t corners[3] = {0, 0, 0};
+            for (size_t c = 0; c < count; c++) {
+               const double index = reader.read(field + c * indexSize, indices.type);
+               if (index < 0.0 || index >= vertexCount) {
+                  fprintf(stderr, "%s: face index out of range\n", path.c_str());
+                  return false;
+               }
+               corners[std::min<size_t>(c, 2)] = static_cast<uint32_t>(index);
+               if (c == 0)
+                  corners[1] = corners[0];
+               if (c >= 2) {
+                  mesh.faces.emplace_back(corners[0], corners[1], corners[2]);
+                  corners[1] = corners[2];
+               }
+            }
+         }
+         field += count * plySize(property.type);
+      }
+      p += size;
+   }
+   return true;
+}
+
+static bool loadPly(const std::string& path, const char* text, size_t size, Mesh& mesh) {
+   std::vector<PlyElement> elements;
+   bool littleEndian = true;
+   size_t bodyOffset = 0;
+   if (!parsePlyHeader(path, text, size, elements, littleEndian, bodyOffset))
+      return false;
+
+   const uint16_t one = 1;
+   unsigned char firstByte = 0;
+   memcpy(&firstByte, &one, 1);
+   const PlyReader reader{text, text + size, littleEndian != (firstByte == 1)};
+
+   // Elements are stored one after the other, the ones after the faces are not needed
+   const char* p = text + bodyOffset;
+   bool verticesRead = false;
+   for (const PlyElement& element : elements) {
+      if (element.name == "vertex") {
+         if (!readPlyVertices(path, reader, element, p, mesh))
+            return false;
+         verticesRead = true;
+      } else if (element.name == "face") {
+         if (!verticesRead) {
+            fprintf(stderr, "%s: faces before the vertices\n", path.c_str());
+            return false;
+         }
+         return readPlyFaces(path, reader, element, p, mesh);
+      } else {
+         for (size_t i = 0; i < element.count; i++) {
+            const size_t size = plyRecordSize(reader, element, p);
+            if (size == 0) {
+               fprintf(stderr, "%s: truncated %s data\n", path.c_str(), element.name.c_str());
+               return false;
+            }
+            p += size;
+         }
+      }
+   }
+   fprintf(stderr, "%s: no faces\n", path.c_str());
+   return false;
+}
+
+bool loadMesh(const std::string& path, Mesh& mesh) {
+   auto start = std::chrono::steady_clock::now();
+   MappedFile file;
+   if (!file.open(path)) {
+      fprintf(stderr, "Cannot open mesh %s\n", path.c_str());
+      return false;
+   }
+
+   Mesh loaded;
+   bool ok;
+   if (hasExtension(path, ".obj")) {
+      ok = loadObj(path, file.data(), file.size(), loaded);
+   } else if (hasExtension(path, ".ply")) {
+      ok = loadPly(path, file.data(), file.size(), loaded);
+   } else {
+      fprintf(stderr, "Unknown mesh format: %s (.obj or .ply)\n", path.c_str());
+      return false;
+   }
+   if (!ok)
+      return false;
+   if (loaded.faces.empty()) {
+      fprintf(stderr, "%s has no faces\n", path.c_str());
+      return false;
+   }
+
+   mesh.positions = std::move(loaded.positions);
+   mesh.faces = std::move(loaded.faces);
+   printf("Mesh %s: %zu vertices, %zu triangles, loaded in %.1f ms\n", path.c_str(), mesh.positions.size(), mesh.faces.size(),
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+   return true;
+}
+
+bool addMeshes(Scene& scene, const std::vector<std::string>& paths) {
+   if (paths.empty())
+      return true;
+
+   const int material = static_cast<int>(scene.materials.size());
+   scene.materials.push_back(Material{glm::vec4(0.8f, 0.8f, 0.8f, 1), glm::vec4(0.8f, 0.8f, 0.8f, 1), 0.0f});
+   for (size_t i = 0; i < paths.size(); i++) {
+      Mesh mesh;
+      if (!loadMesh(paths[i], mesh))
+         return false;
+      // Side by side, centered on the base
+      const float x = (static_cast<float>(i) - 0.5f * static_cast<float>(paths.size() - 1)) * MESH_SPACING;
+      mesh.fit(MESH_BASE + glm::vec3(x, 0.0f, 0.0f), MESH_SIZE);
+      mesh.build();
+      mesh.bvh.printStats("Mesh");
+      scene.instances.push_back(makeInstance(static_cast<int>(scene.meshes.size()), material, glm::mat3(1.0f), glm::vec3(0.0f)));
+      scene.meshes.push_back(std::move(mesh));
+   }
+   return true;
+}
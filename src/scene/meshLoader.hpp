@@ -0,0 +1,22 @@
+#pragma once
+
+#ifndef MESHLOADER_HPP
+#define MESHLOADER_HPP
+
+#include <string>
+#include <vector>
+
+#include "scene/mesh.hpp"
+#include "scene/scene.hpp"
+
+// Positions and faces of a Wavefront OBJ (polygons are split in fans, the rest is ignored) or of
+// a binary PLY (vertex x, y, z and face vertex_indices). Parsed in place from the mapped file,
+// in parallel on ThreadPool::global().
+// The mesh is not built. Prints the error and returns false when the file can't be read.
+bool loadMesh(const std::string& path, Mesh& mesh);
+
+// Load, fit in front of the spheres of defaultScene side by side, and build each file, with one
+// instance each (identity transform) of a new light grey material. False when one of them doesn't load.
+bool addMeshes(Scene& scene, const std::vector<std::string>& paths);
+
+#endif //MESHLOADER_HPP
@@ -0,0 +1,154 @@
+#include "scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "utils/threadPool.hpp"
+
+// Instances per job of primitiveBounds
+static constexpr size_t INSTANCE_BATCH_SIZE = 1 << 16;
+
+std::vector<int> Scene::emitters() const {
+   std::vector<int> result;
+   for (size_t i = 0; i < spheres.size(); i++) {
+      if (materialOf(spheres[i]).emissionStrength > 0.0f)
+         result.push_back(static_cast<int>(i));
+   }
+   return result;
+}
+
+std::vector<Aabb> Scene::primitiveBounds() const {
+   std::vector<Aabb> meshBounds(meshes.size());
+   for (size_t m = 0; m < meshes.size(); m++) {
+      if (!meshes[m].bvh.empty())
+         meshBounds[m] = Aabb{meshes[m].bvh.getNodes()[0].boundsMin, meshes[m].bvh.getNodes()[0].boundsMax};
+   }
+
+   std::vector<Aabb> bounds = sphereBounds(spheres);
+   const size_t first = bounds.size();
+   const size_t count = instances.size();
+   bounds.resize(first + count);
+   ThreadPool::global().parallelFor((count + INSTANCE_BATCH_SIZE - 1) / INSTANCE_BATCH_SIZE, [&](size_t batch) {
+      const size_t end = std::min(count, (batch + 1) * INSTANCE_BATCH_SIZE);
+      for (size_t i = batch * INSTANCE_BATCH_SIZE; i < end; i++)
+         bounds[first + i] = instances[i].worldBounds(meshBounds[instances[i].mesh]);
+   });
+   return bounds;
+}
+
+size_t Scene::triangleCount() const {
+   size_t count = 0;
+   for (const Mesh& mesh : meshes)
+      count += mesh.triangles.size();
+   return count;
+}
+
+size_t Scene::instancedTriangleCount() const {
+   size_t count = 0;
+   for (const MeshInstance& instance : instances)
+      count += meshes[instance.mesh].triangles.size();
+   return count;
+}
+
+Scene defaultScene() {
+   Scene scene;
+
+   scene.materials = {
+      Material{glm::vec4(1,0,0,1), glm::vec4(1,0,0,1), 0.0f}, // m0
+      Material{glm::vec4(0,0,0,1), glm::vec4(1,1,1,1), 1.0f}, // m1
+      Material{glm::vec4(0,0,1,1), glm::vec4(0,0,1,1), 0.0f}, // m2
+      Material{glm::vec4(1,1,1,1), glm::vec4(1,1,1,1), 0.1f}, // floorM
+   };
+
+   scene.spheres = {
+      Sphere{glm::vec3(-3.5f,-1.5f,10), 1.0f, 0},
+      Sphere{glm::vec3(0,0,10), 2.0f, 1},
+      Sphere{glm::vec3(3.5f,-1.5f,10), 1.0f, 2},
+      Sphere{glm::vec3(0,-102,10), 100.0f, 3},
+   };
+
+   return scene;
+}
+
+Scene randomScene(int sphereCount, unsigned int seed) {
+   Scene scene = defaultScene();
+   std::mt19937 rng(seed);
+   std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+   // A few diffuse materials shared by all the small spheres
+   const int firstMaterial = static_cast<int>(scene.materials.size());
+   const int materialCount = 16;
+   for (int i = 0; i < materialCount; i++) {
+      glm::vec4 color(unit(rng), unit(rng), unit(rng), 1);
+      scene.materials.push_back(Material{color, color, 0.0f});
+   }
+
+   // Spread the spheres on a disc around the default scene, their density stays constant
+   const float floorRadius = 100.0f;
+   const glm::vec3 floorCenter(0, -102, 10);
+   const float area = 4.0f + static_cast<float>(sphereCount) * 0.5f;
+   const float discRadius = std::sqrt(area / 3.14159265f);
+   scene.spheres.reserve(scene.spheres.size() + sphereCount);
+   for (int i = 0; i < sphereCount; i++) {
+      float r = discRadius * std::sqrt(unit(rng));
+      float theta = 6.28318531f * unit(rng);
+      float radius = 0.05f + 0.2f * unit(rng);
+      glm::vec3 center(r * std::cos(theta), 0, 10 + r * std::sin(theta));
+      // Sit on the floor sphere
+      glm::vec3 up = glm::normalize(center - floorCenter);
+      center = floorCenter + up * (floorRadius + radius);
+      scene.spheres.push_back(Sphere{center, radius, firstMaterial + static_cast<int>(rng() % materialCount)});
+   }
+
+   return scene;
+}
+
+void scatterInstances(Scene& scene, int instanceCount, unsigned int seed) {
+   if (scene.meshes.empty() || instanceCount <= 0)
+      return;
+   std::mt19937 rng(seed);
+   std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+   const int firstMaterial = static_cast<int>(scene.materials.size());
+   const int materialCount = 8;
+   for (int i = 0; i < materialCount; i++) {
+      glm::vec4 color(unit(rng), unit(rng), unit(rng), 1);
+      scene.materials.push_back(Material{color, color, 0.0f});
+   }
+
+   // Same floor as the spheres of randomScene, a bit more room for each
+   const float floorRadius = 100.0f;
+   const glm::vec3 floorCenter(0, -102, 10);
+   const float area = 4.0f + static_cast<float>(instanceCount) * 1.5f;
+   const float discRadius = std::sqrt(area / 3.14159265f);
+   scene.instances.reserve(scene.instances.size() + instanceCount);
+   for (int i = 0; i < instanceCount; i++) {
+      const int mesh = static_cast<int>(rng() % scene.meshes.size());
+      float r = discRadius * std::sqrt(unit(rng));
+      float theta = 6.28318531f * unit(rng);
+      float angle = 6.28318531f * unit(rng);
+      float scale = 0.1f + 0.2f * unit(rng);
+      glm::vec3 base(r * std::cos(theta), 0, 10 + r * std::sin(theta));
+      glm::vec3 up = glm::normalize(base - floorCenter);
+      base = floorCenter + up * floorRadius;
+
+      // Frame around the floor normal (Duff et al. 2017), turned by angle
+      const float sign = std::copysign(1.0f, up.z);
+      const float a = -1.0f / (sign + up.z);
+      const float b = up.x * up.y * a;
+      const glm::vec3 tangent(1.0f + sign * up.x * up.x * a, sign * b, -sign * up.x);
+      const glm::vec3 bitangent(b, sign + up.y * up.y * a, -up.y);
+      const glm::vec3 x = tangent * std::cos(angle) + bitangent * std::sin(angle);
+      const glm::vec3 z = glm::cross(x, up);
+      const glm::mat3 linear(x * scale, up * scale, z * scale);
+
+      // The middle of the bottom face of the mesh bounds sits on the floor
+      const std::vector<BvhNode>& nodes = scene.meshes[mesh].bvh.getNodes();
+      glm::vec3 bottom(0.0f);
+      if (!nodes.empty())
+         bottom = glm::vec3((nodes[0].boundsMin.x + nodes[0].boundsMax.x) * 0.5f, nodes[0].boundsMin.y, (nodes[0].boundsMin.z + nodes[0].boundsMax.z) * 0.5f);
+      const int material = firstMaterial + static_cast<int>(rng() % materialCount);
+      scene.instances.push_back(makeInstance(mesh, material, linear, base - linear * bottom));
+   }
+}
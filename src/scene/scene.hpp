@@ -0,0 +1,63 @@
+#pragma once
+
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "scene/mesh.hpp"
+
+struct Material {
+   glm::vec4 color;
+   glm::vec4 emissionColor;
+   float emissionStrength;
+};
+
+struct Sphere {
+   glm::vec3 center;
+   float radius;
+   // Index in Scene::materials
+   int material;
+};
+
+struct Scene {
+   std::vector<Sphere> spheres;
+   std::vector<Material> materials;
+   // Built (Mesh::build), only the spheres are edited
+   std::vector<Mesh> meshes;
+   // Placements of the meshes, each mesh may have any number of them
+   std::vector<MeshInstance> instances;
+
+   [[nodiscard]] const Material& materialOf(const Sphere& sphere) const {
+      return materials[sphere.material];
+   }
+
+   [[nodiscard]] const Material& materialOf(const MeshInstance& instance) const {
+      return materials[instance.material];
+   }
+
+   // Primitives of the scene BVH: the spheres, then the instances (primitive spheres.size() + i is instances[i])
+   [[nodiscard]] std::vector<Aabb> primitiveBounds() const;
+
+   // Stored once per mesh
+   [[nodiscard]] size_t triangleCount() const;
+   // Of all the instances
+   [[nodiscard]] size_t instancedTriangleCount() const;
+
+   // Indices of the spheres with an emissive material, in order: the lights of next event estimation.
+   // Emissive meshes are only found by the bounces.
+   [[nodiscard]] std::vector<int> emitters() const;
+};
+
+// Red, emissive and blue spheres above a large floor sphere
+Scene defaultScene();
+
+// The default scene plus sphereCount small random spheres scattered on the floor
+Scene randomScene(int sphereCount, unsigned int seed = 1);
+
+// Add instanceCount small instances of the meshes, picked at random, scattered on the floor like
+// the spheres of randomScene and turned at random around the floor normal
+void scatterInstances(Scene& scene, int instanceCount, unsigned int seed = 1);
+
+#endif //SCENE_HPP
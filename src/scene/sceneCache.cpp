@@ -0,0 +1,330 @@
+#include "sceneCache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "scene/meshLoader.hpp"
+#include "utils/mappedFile.hpp"
+#include "utils/threadPool.hpp"
+
+bool SceneCache::p_enabled = true;
+std::string SceneCache::p_directory = "scene_cache";
+
+namespace {
+   constexpr uint32_t SCENE_MAGIC = 0x43535452; // "RTSC"
+   // Bump when the layout changes, or when addMeshes, scatterInstances or the BVH builder would build something else
+   constexpr uint32_t SCENE_VERSION = 3;
+   // Bytes hashed per job
+   constexpr size_t HASH_CHUNK_SIZE = 1 << 22;
+   // Nodes checked per job
+   constexpr size_t CHECK_BATCH_SIZE = 1 << 16;
+
+   enum Section : uint32_t { SPHERES, MATERIALS, SCENE_NODES, SCENE_PRIMITIVES, MESHES, MESH_NODES, MESH_TRIANGLES, INSTANCES, SECTION_COUNT };
+
+   struct FileHeader {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t key;
+      // In bytes from the start of the file, offsets are multiples of SECTION_ALIGNMENT
+      uint64_t offsets[SECTION_COUNT];
+      uint64_t sizes[SECTION_COUNT];
+   };
+
+   // One per mesh: its ranges of MESH_NODES and MESH_TRIANGLES
+   struct MeshRecord {
+      uint64_t firstNode;
+      uint64_t nodeCount;
+      uint64_t firstTriangle;
+      uint64_t triangleCount;
+   };
+
+   // Bytes of one section, written one part after the other
+   struct SectionData {
+      std::vector<std::pair<const void*, size_t>> parts;
+
+      [[nodiscard]] uint64_t size() const {
+         uint64_t total = 0;
+         for (const auto& part : parts)
+            total += part.second;
+         return total;
+      }
+   };
+
+   uint64_t mix(uint64_t h, uint64_t v) {
+      h = ((h << 27) | (h >> 37)) ^ v;
+      return h * 0x9e3779b97f4a7c15ull;
+   }
+
+   // splitmix64 finalizer
+   uint64_t finish(uint64_t h) {
+      h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+      h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+      return h ^ (h >> 31);
+   }
+
+   // 8 bytes at a time, chunks in parallel
+   uint64_t hashBytes(const void* data, size_t size) {
+      const char* bytes = static_cast<const char*>(data);
+      const size_t chunkCount = (size + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+      std::vector<uint64_t> chunkHashes(chunkCount);
+      ThreadPool::global().parallelFor(chunkCount, [&](size_t c) {
+         const char* chunk = bytes + c * HASH_CHUNK_SIZE;
+         const size_t length = std::min(HASH_CHUNK_SIZE, size - c * HASH_CHUNK_SIZE);
+         uint64_t h = c;
+         size_t i = 0;
+         for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            memcpy(&word, chunk + i, 8);
+            h = mix(h, word);
+         }
+         uint64_t tail = 0;
+         memcpy(&tail, chunk + i, length - i);
+         chunkHashes[c] = finish(mix(h, tail));
+      });
+      uint64_t h = size;
+      for (uint64_t chunkHash : chunkHashes)
+         h = mix(h, chunkHash);
+      return finish(h);
+   }
+
+   uint64_t alignUp(uint64_t offset) {
+      return (offset + SceneCache::SECTION_ALIGNMENT - 1) / SceneCache::SECTION_ALIGNMENT * SceneCache::SECTION_ALIGNMENT;
+   }
+
+   // Every index in range and children after their parent, so the traversals stay in the arrays and end
+   bool validNodes(const BvhNode* nodes, size_t nodeCount, size_t primitiveCount) {
+      if (nodeCount == 0)
+         return primitiveCount == 0;
+      std::atomic<bool> valid{true};
+      ThreadPool::global().parallelFor((nodeCount + CHECK_BATCH_SIZE - 1) / CHECK_BATCH_SIZE, [&](size_t batch) {
+         const size_t end = std::min(nodeCount, (batch + 1) * CHECK_BATCH_SIZE);
+         for (size_t i = batch * CHECK_BATCH_SIZE; i < end && valid; i++) {
+            const BvhNode& node = nodes[i];
+            const auto first = static_cast<int64_t>(node.leftFirst);
+            const bool ok = node.count > 0
+               ? first >= 0 && first + node.count <= static_cast<int64_t>(primitiveCount)
+               : node.count == 0 && first > static_cast<int64_t>(i) && first + 1 < static_cast<int64_t>(nodeCount);
+            if (!ok)
+               valid = false;
+         }
+      });
+      return valid;
+   }
+
+   template<typename T>
+   const T* sectionData(const MappedFile& file, const FileHeader& header, Section section) {
+      return reinterpret_cast<const T*>(file.data() + header.offsets[section]);
+   }
+
+   template<typename T>
+   size_t sectionCount(const FileHeader& header, Section section) {
+      return header.sizes[section] / sizeof(T);
+   }
+}
+
+uint64_t SceneCache::makeKey(const Scene& scene, const std::vector<std::string>& meshPaths, int instanceCount) {
+   uint64_t h = mix(SCENE_VERSION, sizeof(Sphere) | sizeof(Material) << 16 | sizeof(BvhNode) << 32 | sizeof(MeshTriangle) << 48);
+   h = mix(h, sizeof(MeshInstance));
+   h = mix(h, hashBytes(scene.spheres.data(), scene.spheres.size() * sizeof(Sphere)));
+   h = mix(h, hashBytes(scene.materials.data(), scene.materials.size() * sizeof(Material)));
+   h = mix(h, meshPaths.size());
+   for (const std::string& path : meshPaths) {
+      // The extension picks the parser
+      h = mix(h, hashBytes(path.data() + path.rfind('.') + 1, path.size() - path.rfind('.') - 1));
+      // A missing file is reported by addMeshes
+      MappedFile file;
+      h = mix(h, file.open(path) ? hashBytes(file.data(), file.size()) : 0);
+   }
+   h = mix(h, static_cast<uint64_t>(instanceCount));
+   return finish(h);
+}
+
+std::string SceneCache::entryPath(uint64_t key) {
+   char name[32];
+   snprintf(name, sizeof(name), "%016llx.rtscene", static_cast<unsigned long long>(key));
+   return (std::filesystem::path(p_directory) / name).string();
+}
+
+bool SceneCache::loadOrBuild(Scene& scene, Bvh& bvh, const std::vector<std::string>& meshPaths, int instanceCount) {
+   auto start = std::chrono::steady_clock::now();
+   uint64_t key = 0;
+   std::string path;
+   if (p_enabled) {
+      key = makeKey(scene, meshPaths, instanceCount);
+      path = entryPath(key);
+      if (load(path, key, scene, bvh)) {
+         printf("Scene loaded from %s in %.1f ms\n", path.c_str(),
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+         return true;
+      }
+   }
+
+   if (!addMeshes(scene, meshPaths))
+      return false;
+   scatterInstances(scene, instanceCount);
+   bvh.build(scene.primitiveBounds());
+   if (p_enabled)
+      store(path, key, scene, bvh);
+   return true;
+}
+
+bool SceneCache::load(const std::string& path, uint64_t key, Scene& scene, Bvh& bvh) {
+   MappedFile file;
+   if (!file.open(path))
+      return false;
+
+   FileHeader header{};
+   bool ok = file.size() >= sizeof(FileHeader);
+   if (ok) {
+      memcpy(&header, file.data(), sizeof(FileHeader));
+      ok = header.magic == SCENE_MAGIC && header.version == SCENE_VERSION && header.key == key;
+   }
+   const size_t elementSizes[SECTION_COUNT] = {sizeof(Sphere), sizeof(Material), sizeof(BvhNode), sizeof(uint32_t),
+                                               sizeof(MeshRecord), sizeof(BvhNode), sizeof(MeshTriangle), sizeof(MeshInstance)};
+   for (uint32_t s = 0; s < SECTION_COUNT && ok; s++) {
+      ok = header.offsets[s] % SECTION_ALIGNMENT == 0 && header.offsets[s] <= file.size()
+           && header.sizes[s] <= file.size() - header.offsets[s] && header.sizes[s] % elementSizes[s] == 0;
+   }
+
+   Scene loaded;
+   Bvh loadedBvh;
+   if (ok) {
+      const auto* spheres = sectionData<Sphere>(file, header, SPHERES);
+      const auto* materials = sectionData<Material>(file, header, MATERIALS);
+      loaded.spheres.assign(spheres, spheres + sectionCount<Sphere>(header, SPHERES));
+      loaded.materials.assign(materials, materials + sectionCount<Material>(header, MATERIALS));
+      for (const Sphere& sphere : loaded.spheres)
+         ok = ok && sphere.material >= 0 && sphere.material < static_cast<int>(loaded.materials.size());
+   }
+
+   if (ok) {
+      const auto* records = sectionData<MeshRecord>(file, header, MESHES);
+      const auto* nodes = sectionData<BvhNode>(file, header, MESH_NODES);
+      const auto* triangles = sectionData<MeshTriangle>(file, header, MESH_TRIANGLES);
+      const size_t nodeCount = sectionCount<BvhNode>(header, MESH_NODES);
+      const size_t triangleCount = sectionCount<MeshTriangle>(header, MESH_TRIANGLES);
+      const size_t meshCount = sectionCount<MeshRecord>(header, MESHES);
+      loaded.meshes.resize(meshCount);
+      for (size_t m = 0; m < meshCount && ok; m++) {
+         const MeshRecord& record = records[m];
+         ok = record.firstNode <= nodeCount && record.nodeCount <= nodeCount - record.firstNode
+              && record.firstTriangle <= triangleCount && record.triangleCount <= triangleCount - record.firstTriangle
+              && validNodes(nodes + record.firstNode, record.nodeCount, record.triangleCount);
+         if (!ok)
+            break;
+
+         // Leaf ordered: the primitive indices are 0, 1, 2...
+         Mesh& mesh = loaded.meshes[m];
+         std::vector<uint32_t> indices(record.triangleCount);
+         for (size_t i = 0; i < indices.size(); i++)
+            indices[i] = static_cast<uint32_t>(i);
+         mesh.triangles.assign(triangles + record.firstTriangle, triangles + record.firstTriangle + record.triangleCount);
+         mesh.bvh.assign(std::vector<BvhNode>(nodes + record.firstNode, nodes + record.firstNode + record.nodeCount), std::move(indices));
+         ok = mesh.bvh.getStats().depth <= Bvh::MAX_DEPTH;
+      }
+   }
+
+   if (ok) {
+      const auto* instances = sectionData<MeshInstance>(file, header, INSTANCES);
+      loaded.instances.assign(instances, instances + sectionCount<MeshInstance>(header, INSTANCES));
+      for (const MeshInstance& instance : loaded.instances) {
+         ok = ok && instance.mesh >= 0 && instance.mesh < static_cast<int>(loaded.meshes.size())
+              && instance.material >= 0 && instance.material < static_cast<int>(loaded.materials.size());
+      }
+   }
+
+   if (ok) {
+      const auto* nodes = sectionData<BvhNode>(file, header, SCENE_NODES);
+      const auto* primitives = sectionData<uint32_t>(file, header, SCENE_PRIMITIVES);
+      const size_t nodeCount = sectionCount<BvhNode>(header, SCENE_NODES);
+      const size_t primitiveCount = sectionCount<uint32_t>(header, SCENE_PRIMITIVES);
+      ok = validNodes(nodes, nodeCount, primitiveCount);
+      for (size_t i = 0; i < primitiveCount && ok; i++)
+         ok = primitives[i] < loaded.spheres.size() + loaded.instances.size();
+      if (ok) {
+         loadedBvh.assign(std::vector<BvhNode>(nodes, nodes + nodeCount), std::vector<uint32_t>(primitives, primitives + primitiveCount));
+         ok = loadedBvh.getStats().depth <= Bvh::MAX_DEPTH;
+      }
+   }
+
+   if (!ok) {
+      // Corrupted or written by another version, built again and overwritten
+      fprintf(stderr, "Scene cache entry %s rejected, rebuilding\n", path.c_str());
+      file.close();
+      std::error_code error;
+      std::filesystem::remove(path, error);
+      return false;
+   }
+
+   scene = std::move(loaded);
+   bvh = std::move(loadedBvh);
+   return true;
+}
+
+bool SceneCache::store(const std::string& path, uint64_t key, const Scene& scene, const Bvh& bvh) {
+   std::vector<MeshRecord> records;
+   SectionData sections[SECTION_COUNT];
+   sections[SPHERES].parts.emplace_back(scene.spheres.data(), scene.spheres.size() * sizeof(Sphere));
+   sections[MATERIALS].parts.emplace_back(scene.materials.data(), scene.materials.size() * sizeof(Material));
+   sections[SCENE_NODES].parts.emplace_back(bvh.getNodes().data(), bvh.getNodes().size() * sizeof(BvhNode));
+   sections[SCENE_PRIMITIVES].parts.emplace_back(bvh.getPrimitiveIndices().data(), bvh.getPrimitiveIndices().size() * sizeof(uint32_t));
+   uint64_t firstNode = 0;
+   uint64_t firstTriangle = 0;
+   for (const Mesh& mesh : scene.meshes) {
+      const std::vector<BvhNode>& nodes = mesh.bvh.getNodes();
+      records.push_back(MeshRecord{firstNode, nodes.size(), firstTriangle, mesh.triangles.size()});
+      sections[MESH_NODES].parts.emplace_back(nodes.data(), nodes.size() * sizeof(BvhNode));
+      sections[MESH_TRIANGLES].parts.emplace_back(mesh.triangles.data(), mesh.triangles.size() * sizeof(MeshTriangle));
+      firstNode += nodes.size();
+      firstTriangle += mesh.triangles.size();
+   }
+   sections[MESHES].parts.emplace_back(records.data(), records.size() * sizeof(MeshRecord));
+   sections[INSTANCES].parts.emplace_back(scene.instances.data(), scene.instances.size() * sizeof(MeshInstance));
+
+   FileHeader header{SCENE_MAGIC, SCENE_VERSION, key, {}, {}};
+   uint64_t offset = alignUp(sizeof(FileHeader));
+   for (uint32_t s = 0; s < SECTION_COUNT; s++) {
+      header.offsets[s] = offset;
+      header.sizes[s] = sections[s].size();
+      offset = alignUp(offset + header.sizes[s]);
+   }
+
+   std::error_code error;
+   std::filesystem::create_directories(p_directory, error);
+
+   // Write next to the entry then rename, a concurrent run never maps half a file
+   const std::string tempPath = path + ".tmp";
+   FILE* file = fopen(tempPath.c_str(), "wb");
+   if (!file) {
+      fprintf(stderr, "Unable to write scene cache entry %s\n", path.c_str());
+      return false;
+   }
+   const char padding[SECTION_ALIGNMENT] = {};
+   uint64_t written = 0;
+   auto write = [&](const void* data, size_t size) {
+      if (size > 0 && fwrite(data, 1, size, file) != size)
+         return false;
+      written += size;
+      return true;
+   };
+   bool ok = write(&header, sizeof(header));
+   for (uint32_t s = 0; s < SECTION_COUNT && ok; s++) {
+      ok = write(padding, header.offsets[s] - written);
+      for (const auto& part : sections[s].parts)
+         ok = ok && write(part.first, part.second);
+   }
+   ok = (fclose(file) == 0) && ok;
+
+   if (ok)
+      std::filesystem::rename(tempPath, path, error);
+   if (!ok || error) {
+      fprintf(stderr, "Unable to write scene cache entry %s\n", path.c_str());
+      std::filesystem::remove(tempPath, error);
+      return false;
+   }
+   return true;
+}
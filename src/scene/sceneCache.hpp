@@ -0,0 +1,43 @@
+#pragma once
+
+#ifndef SCENECACHE_HPP
+#define SCENECACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "accel/bvh.hpp"
+#include "scene/scene.hpp"
+
+// On-disk cache of built scenes, one versioned binary .rtscene file per entry: flat arrays of
+// spheres, materials, the scene BVH, the meshes (BVH nodes and leaf ordered triangles, laid out
+// like the texture buffers of BvhBuffer) and their instances, each aligned to SECTION_ALIGNMENT. Entries are mapped
+// and copied as is, nothing is parsed or rebuilt.
+// Keyed by the spheres and materials of the scene, by the contents of the mesh files and by the
+// number of scattered instances, so an edited source simply misses.
+class SceneCache {
+public:
+   static constexpr uint64_t SECTION_ALIGNMENT = 256;
+
+   static void setEnabled(bool enabled) { p_enabled = enabled; }
+   static void setDirectory(const std::string& directory) { p_directory = directory; }
+
+   // Add the meshes of meshPaths to scene (addMeshes), scatter instanceCount more instances of them
+   // (scatterInstances) and build bvh over scene.primitiveBounds(), or read both from the cache
+   // entry of the same sources. False when a mesh doesn't load.
+   static bool loadOrBuild(Scene& scene, Bvh& bvh, const std::vector<std::string>& meshPaths, int instanceCount = 0);
+
+   // scene and bvh are left untouched when the file is not a valid entry for key
+   static bool load(const std::string& path, uint64_t key, Scene& scene, Bvh& bvh);
+   static bool store(const std::string& path, uint64_t key, const Scene& scene, const Bvh& bvh);
+
+private:
+   static uint64_t makeKey(const Scene& scene, const std::vector<std::string>& meshPaths, int instanceCount);
+   static std::string entryPath(uint64_t key);
+
+   static bool p_enabled;
+   static std::string p_directory;
+};
+
+#endif //SCENECACHE_HPP
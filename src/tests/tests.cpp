@@ -0,0 +1,331 @@
+// CPU only checks of the scene builders, no OpenGL context needed. Run from anywhere, the files
+// they write go to a temporary directory. Exit code 0 when every check passed.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "accel/bvh.hpp"
+#include "rendering/bvhBuffer.hpp"
+#include "scene/meshLoader.hpp"
+#include "scene/scene.hpp"
+#include "scene/sceneCache.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* expression, const char* file, int line) {
+   if (!ok) {
+      fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+      failures++;
+   }
+}
+
+#define CHECK(expression) check((expression), #expression, __FILE__, __LINE__)
+
+static std::filesystem::path directory;
+
+static std::string writeFile(const char* name, const std::string& contents) {
+   std::filesystem::path path = directory / name;
+   std::ofstream file(path, std::ios::binary | std::ios::trunc);
+   file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+   return path.string();
+}
+
+static std::string readFile(const std::string& path) {
+   std::ifstream file(path, std::ios::binary);
+   return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// --- Bvh ---
+
+static float intersectSphere(const Sphere& sphere, const glm::vec3& origin, const glm::vec3& direction) {
+   glm::vec3 oc = origin - sphere.center;
+   float b = glm::dot(oc, direction);
+   float c = glm::dot(oc, oc) - sphere.radius * sphere.radius;
+   float h = b * b - c;
+   if (h < 0.0f)
+      return 1e30f;
+   h = std::sqrt(h);
+   float t = -b - h;
+   if (t < 1e-4f)
+      t = -b + h;
+   return t < 1e-4f ? 1e30f : t;
+}
+
+struct Hit {
+   float t = 1e30f;
+   int sphere = -1;
+};
+
+static Hit closestHit(const Bvh& bvh, const std::vector<Sphere>& spheres, const glm::vec3& origin, const glm::vec3& direction) {
+   Hit hit;
+   bvh.traverse(origin, direction, hit.t, [&](uint32_t primitive, float& tMax) {
+      float t = intersectSphere(spheres[primitive], origin, direction);
+      if (t < tMax) {
+         tMax = t;
+         hit.t = t;
+         hit.sphere = static_cast<int>(primitive);
+      }
+   });
+   return hit;
+}
+
+// Bounds of the subtree of node, checked against the primitives below it: they must be exactly
+// their union. Counts how many times every primitive is reached.
+static Aabb checkSubtree(const Bvh& bvh, const std::vector<Aabb>& primitiveBounds, int index, int depth,
+                         std::vector<int>& reached) {
+   const BvhNode& node = bvh.getNodes()[index];
+   CHECK(!node.isUnused());
+   CHECK(depth <= Bvh::MAX_DEPTH);
+   Aabb bounds;
+   if (node.isLeaf()) {
+      for (int i = 0; i < node.count; i++) {
+         uint32_t primitive = bvh.getPrimitiveIndices()[node.leftFirst + i];
+         reached[primitive]++;
+         bounds.grow(primitiveBounds[primitive]);
+      }
+   } else {
+      bounds.grow(checkSubtree(bvh, primitiveBounds, node.leftFirst, depth + 1, reached));
+      bounds.grow(checkSubtree(bvh, primitiveBounds, node.leftFirst + 1, depth + 1, reached));
+   }
+   CHECK(node.boundsMin == bounds.min && node.boundsMax == bounds.max);
+   return bounds;
+}
+
+static void checkTree(const Bvh& bvh, const std::vector<Aabb>& primitiveBounds) {
+   std::vector<int> reached(primitiveBounds.size(), 0);
+   checkSubtree(bvh, primitiveBounds, 0, 1, reached);
+   for (int count : reached)
+      CHECK(count == 1);
+}
+
+// Refit and partial rebuilds after some spheres moved far away: same bounds and hits as a new build
+static void testBvhUpdate() {
+   Scene scene = randomScene(4000, 7);
+   Bvh bvh;
+   bvh.build(sphereBounds(scene.spheres));
+
+   std::mt19937 rng(3);
+   std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+   for (size_t i = 4; i < scene.spheres.size(); i++) {
+      Sphere& sphere = scene.spheres[i];
+      if (i % 5 == 0)
+         sphere.center += glm::vec3(30.0f, 5.0f * unit(rng), 0.0f);
+      else
+         sphere.center += 0.05f * glm::vec3(unit(rng) - 0.5f, 0.0f, unit(rng) - 0.5f);
+   }
+   const std::vector<Aabb> bounds = sphereBounds(scene.spheres);
+   bvh.update(bounds);
+   Bvh fresh;
+   fresh.build(bounds);
+
+   CHECK(bvh.getStats().rebuiltSubtrees > 0);
+   checkTree(bvh, bounds);
+   checkTree(fresh, bounds);
+   const BvhNode& root = bvh.getNodes()[0];
+   const BvhNode& freshRoot = fresh.getNodes()[0];
+   CHECK(root.boundsMin == freshRoot.boundsMin && root.boundsMax == freshRoot.boundsMax);
+
+   int mismatches = 0;
+   int hits = 0;
+   for (int i = 0; i < 4000; i++) {
+      glm::vec3 origin(unit(rng) * 60.0f - 20.0f, 1.0f + unit(rng) * 4.0f, unit(rng) * 30.0f - 5.0f);
+      glm::vec3 target(unit(rng) * 60.0f - 20.0f, -2.0f, unit(rng) * 30.0f - 5.0f);
+      glm::vec3 direction = glm::normalize(target - origin);
+      Hit expected;
+      for (size_t s = 0; s < scene.spheres.size(); s++) {
+         float t = intersectSphere(scene.spheres[s], origin, direction);
+         if (t < expected.t)
+            expected = Hit{t, static_cast<int>(s)};
+      }
+      Hit updated = closestHit(bvh, scene.spheres, origin, direction);
+      Hit built = closestHit(fresh, scene.spheres, origin, direction);
+      if (updated.t != expected.t || built.t != expected.t)
+         mismatches++;
+      if (expected.sphere >= 4)
+         hits++;
+   }
+   CHECK(mismatches == 0);
+   CHECK(hits > 100);
+}
+
+// --- Mesh loader ---
+
+static std::string plyHeader(int vertexCount, int faceCount) {
+   return "ply\nformat binary_little_endian 1.0\n"
+          "element vertex " + std::to_string(vertexCount) + "\nproperty float x\nproperty float y\nproperty float z\n"
+          "element face " + std::to_string(faceCount) + "\nproperty list uchar int vertex_indices\nend_header\n";
+}
+
+template<typename T>
+static void append(std::string& bytes, T value) {
+   bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static std::string plyTriangle() {
+   std::string ply = plyHeader(3, 1);
+   const float positions[9] = {0, 0, 0, 1, 0, 0, 0, 1, 0};
+   for (float p : positions)
+      append(ply, p);
+   append<uint8_t>(ply, 3);
+   for (int index = 0; index < 3; index++)
+      append(ply, index);
+   return ply;
+}
+
+static bool loads(const char* name, const std::string& contents) {
+   Mesh mesh;
+   return loadMesh(writeFile(name, contents), mesh);
+}
+
+static void testMeshLoader() {
+   Mesh mesh;
+   CHECK(loadMesh(writeFile("quad.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n"), mesh));
+   CHECK(mesh.faces.size() == 2);
+   CHECK(loads("triangle.ply", plyTriangle()));
+
+   printf("Malformed meshes, errors expected:\n");
+   fflush(stdout);
+   CHECK(!loads("empty.obj", ""));
+   CHECK(!loads("letters.obj", "v 0 0 0\nv 1 x 0\nv 0 1 0\nf 1 2 3\n"));
+   CHECK(!loads("index.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n"));
+   CHECK(!loads("truncated.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2"));
+   CHECK(!loads("text.ply", "ply\nformat ascii 1.0\nelement vertex 0\nend_header\n"));
+   CHECK(!loads("header.ply", "ply\nformat binary_little_endian 1.0\nelement vertex 3\n"));
+   std::string ply = plyTriangle();
+   CHECK(!loads("vertices.ply", ply.substr(0, plyHeader(3, 1).size() + 20)));
+   CHECK(!loads("faces.ply", ply.substr(0, ply.size() - 2)));
+   std::string outOfRange = ply;
+   outOfRange[outOfRange.size() - 4] = 9;
+   CHECK(!loads("range.ply", outOfRange));
+}
+
+// --- Scene cache ---
+
+static void testSceneCache() {
+   const std::string meshPath = writeFile("cached.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n");
+   Scene scene = defaultScene();
+   Bvh bvh;
+   CHECK(addMeshes(scene, {meshPath}));
+   scatterInstances(scene, 50);
+   bvh.build(scene.primitiveBounds());
+
+   const std::string path = (directory / "entry.rtscene").string();
+   const uint64_t key = 42;
+   CHECK(SceneCache::store(path, key, scene, bvh));
+   const std::string entry = readFile(path);
+
+   Scene loaded;
+   Bvh loadedBvh;
+   CHECK(SceneCache::load(path, key, loaded, loadedBvh));
+   CHECK(loaded.spheres.size() == scene.spheres.size() && loaded.instances.size() == scene.instances.size());
+   CHECK(loadedBvh.getNodes().size() == bvh.getNodes().size());
+
+   // Every rejected entry is removed, the scene and its BVH are left untouched
+   auto rejected = [&](const std::string& contents, uint64_t loadKey) {
+      writeFile("entry.rtscene", contents);
+      Scene untouched;
+      Bvh untouchedBvh;
+      bool ok = !SceneCache::load(path, loadKey, untouched, untouchedBvh);
+      return ok && !std::filesystem::exists(path) && untouched.spheres.empty() && untouchedBvh.empty();
+   };
+   printf("Invalid scene cache entries, errors expected:\n");
+   fflush(stdout);
+   CHECK(rejected(entry, key + 1));
+   CHECK(rejected(entry.substr(0, entry.size() / 2), key));
+   CHECK(rejected(entry.substr(0, 8), key));
+   std::string stale = entry;
+   stale[4]++;
+   CHECK(rejected(stale, key));
+   // Garbage over everything past the header and the first sections
+   std::string corrupted = entry;
+   memset(&corrupted[corrupted.size() / 4], 0xff, corrupted.size() - corrupted.size() / 4);
+   CHECK(rejected(corrupted, key));
+}
+
+// --- Instances refused by BvhBuffer ---
+
+// The scene BVH still holds the instances refused by BvhBuffer::uploadMeshes: traced like scene.glsl
+// does, they are skipped and only the spheres are hit. What is left in the mesh node buffer is
+// never entered.
+static void testRefusedInstances() {
+   const std::string meshPath = writeFile("instanced.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n");
+   Scene scene = defaultScene();
+   CHECK(addMeshes(scene, {meshPath}));
+   scatterInstances(scene, 500);
+   Bvh bvh;
+   bvh.build(scene.primitiveBounds());
+
+   // Only the instances are too many
+   const size_t maxTexels = scene.instances.size() * 4 - 1;
+   CHECK(BvhBuffer::meshesFit(scene.meshes, {}, maxTexels));
+   const bool fits = BvhBuffer::meshesFit(scene.meshes, scene.instances, maxTexels);
+   CHECK(!fits);
+   // As uploaded by uploadMeshes
+   const int instanceCount = fits ? static_cast<int>(scene.instances.size()) : 0;
+   const int sphereCount = static_cast<int>(scene.spheres.size());
+
+   std::mt19937 rng(5);
+   std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+   int instancesTraced = 0;
+   int mismatches = 0;
+   for (int i = 0; i < 2000; i++) {
+      glm::vec3 origin(unit(rng) * 10.0f - 5.0f, 0.5f + unit(rng) * 2.0f, unit(rng) * 4.0f);
+      glm::vec3 target(unit(rng) * 10.0f - 5.0f, -2.0f, 4.0f + unit(rng) * 6.0f);
+      glm::vec3 direction = glm::normalize(target - origin);
+      Hit expected;
+      for (int sphere = 0; sphere < sphereCount; sphere++) {
+         float t = intersectSphere(scene.spheres[sphere], origin, direction);
+         if (t < expected.t)
+            expected = Hit{t, sphere};
+      }
+      Hit hit;
+      bvh.traverse(origin, direction, hit.t, [&](uint32_t primitive, float& tMax) {
+         const int p = static_cast<int>(primitive);
+         if (p < sphereCount) {
+            float t = intersectSphere(scene.spheres[p], origin, direction);
+            if (t < tMax) {
+               tMax = t;
+               hit = Hit{t, p};
+            }
+         } else if (p - sphereCount < instanceCount) {
+            instancesTraced++;
+         }
+      });
+      if (hit.t != expected.t)
+         mismatches++;
+   }
+   CHECK(instancesTraced == 0);
+   CHECK(mismatches == 0);
+
+   // A ray through the origin, where a zero node would have looped
+   Bvh filler;
+   filler.assign({BvhBuffer::EMPTY_NODE}, {0});
+   int visited = 0;
+   filler.traverse(glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f), 1e30f, [&](uint32_t, float&) { visited++; });
+   CHECK(visited == 0);
+}
+
+int main() {
+   directory = std::filesystem::temp_directory_path() / "raytracer_tests";
+   std::filesystem::create_directories(directory);
+
+   testBvhUpdate();
+   testMeshLoader();
+   testSceneCache();
+   testRefusedInstances();
+
+   std::error_code error;
+   std::filesystem::remove_all(directory, error);
+   if (failures > 0) {
+      fprintf(stderr, "%d checks failed\n", failures);
+      return 1;
+   }
+   printf("All checks passed\n");
+   return 0;
+}
@@ -0,0 +1,28 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+void Arena::reset() {
+   current = 0;
+   offset = 0;
+}
+
+void* Arena::allocateBytes(size_t size, size_t alignment) {
+   while (current < blocks.size()) {
+      const size_t start = (offset + alignment - 1) & ~(alignment - 1);
+      if (start + size <= blocks[current].size) {
+         offset = start + size;
+         return blocks[current].data.get() + start;
+      }
+      // The rest of the block is lost until the next reset
+      current++;
+      offset = 0;
+   }
+
+   // Allocations larger than a block get one of their own
+   const size_t bytes = std::max(size, blockSize);
+   blocks.push_back(Block{std::unique_ptr<unsigned char[]>(new unsigned char[bytes]), bytes});
+   current = blocks.size() - 1;
+   offset = size;
+   return blocks.back().data.get();
+}
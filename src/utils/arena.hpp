@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for build temporaries: allocate() only moves an offset, nothing is freed before
+// reset() or the end of the arena. The memory is not initialized, pages that are never written
+// are never touched. Not thread safe, one arena per thread.
+class Arena {
+public:
+   explicit Arena(size_t blockSize = 1 << 20) : blockSize(blockSize) {}
+
+   Arena(const Arena&) = delete;
+   Arena& operator=(const Arena&) = delete;
+
+   template<typename T>
+   T* allocate(size_t count) {
+      static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value, "Arena holds plain data only");
+      static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned type");
+      return static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+   }
+
+   // Every allocation becomes invalid, the blocks are kept for the next ones
+   void reset();
+
+private:
+   void* allocateBytes(size_t size, size_t alignment);
+
+   struct Block {
+      std::unique_ptr<unsigned char[]> data;
+      size_t size;
+   };
+
+   std::vector<Block> blocks;
+   // Block being filled and its first free byte
+   size_t current = 0;
+   size_t offset = 0;
+   size_t blockSize;
+};
+
+#endif //ARENA_HPP
@@ -0,0 +1,139 @@
+#include "blueNoise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+
+namespace {
+
+// Standard deviation of the energy filter in pixels, the value of the original paper
+constexpr float SIGMA = 1.5f;
+// Share of pixels in the initial binary pattern
+constexpr float INITIAL_DENSITY = 0.1f;
+
+// Sum over the set pixels of a Gaussian of the toroidal distance, the density around each pixel
+class EnergyField {
+public:
+   explicit EnergyField(int size) : size(size), kernel(static_cast<size_t>(size) * size), energy(kernel.size(), 0.0f) {
+      for (int y = 0; y < size; y++) {
+         for (int x = 0; x < size; x++) {
+            float dx = static_cast<float>(std::min(x, size - x));
+            float dy = static_cast<float>(std::min(y, size - y));
+            kernel[static_cast<size_t>(y) * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * SIGMA * SIGMA));
+         }
+      }
+   }
+
+   // sign = 1 when pixel p is set, -1 when it is cleared
+   void splat(int p, float sign) {
+      const int px = p % size;
+      const int py = p / size;
+      for (int y = 0; y < size; y++) {
+         const float* row = &kernel[static_cast<size_t>((y - py + size) % size) * size];
+         float* out = &energy[static_cast<size_t>(y) * size];
+         for (int x = 0; x < size; x++)
+            out[x] += sign * row[(x - px + size) % size];
+      }
+   }
+
+   // Pixel of highest (tightest cluster) or lowest (largest void) energy among those where pattern == value,
+   // there is always one
+   [[nodiscard]] int find(const std::vector<char>& pattern, char value, bool highest) const {
+      size_t best = 0;
+      bool found = false;
+      for (size_t i = 0; i < pattern.size(); i++) {
+         if (pattern[i] != value)
+            continue;
+         if (!found || (highest ? energy[i] > energy[best] : energy[i] < energy[best]))
+            best = i;
+         found = true;
+      }
+      return static_cast<int>(best);
+   }
+
+private:
+   int size;
+   std::vector<float> kernel;
+   std::vector<float> energy;
+};
+
+}
+
+std::vector<float> generateBlueNoise(int size, unsigned int seed) {
+   const int n = size * size;
+   std::vector<char> pattern(n, 0);
+   std::mt19937 rng(seed);
+   std::uniform_int_distribution<int> pixel(0, n - 1);
+   int ones = 0;
+   while (ones < std::max(1, static_cast<int>(static_cast<float>(n) * INITIAL_DENSITY))) {
+      int p = pixel(rng);
+      if (!pattern[p]) {
+         pattern[p] = 1;
+         ones++;
+      }
+   }
+
+   // Initial pattern: move the tightest cluster to the largest void until it is already there
+   EnergyField field(size);
+   for (int i = 0; i < n; i++) {
+      if (pattern[i])
+         field.splat(i, 1.0f);
+   }
+   while (true) {
+      int cluster = field.find(pattern, 1, true);
+      pattern[cluster] = 0;
+      field.splat(cluster, -1.0f);
+      int gap = field.find(pattern, 0, false);
+      pattern[gap] = 1;
+      field.splat(gap, 1.0f);
+      if (gap == cluster)
+         break;
+   }
+
+   std::vector<int> ranks(n, 0);
+
+   // Phase 1: the initial pixels, tightest clusters last
+   {
+      std::vector<char> remaining = pattern;
+      EnergyField shrinking = field;
+      for (int rank = ones - 1; rank >= 0; rank--) {
+         int cluster = shrinking.find(remaining, 1, true);
+         remaining[cluster] = 0;
+         shrinking.splat(cluster, -1.0f);
+         ranks[cluster] = rank;
+      }
+   }
+
+   // Phase 2: fill the largest voids up to half of the pixels
+   int rank = ones;
+   for (; rank < n / 2; rank++) {
+      int gap = field.find(pattern, 0, false);
+      pattern[gap] = 1;
+      field.splat(gap, 1.0f);
+      ranks[gap] = rank;
+   }
+
+   // Phase 3: the unset pixels are the minority, rank the tightest clusters of them first
+   EnergyField unset(size);
+   for (int i = 0; i < n; i++) {
+      if (!pattern[i])
+         unset.splat(i, 1.0f);
+   }
+   for (; rank < n; rank++) {
+      int cluster = unset.find(pattern, 0, true);
+      pattern[cluster] = 1;
+      unset.splat(cluster, -1.0f);
+      ranks[cluster] = rank;
+   }
+
+   std::vector<float> mask(n);
+   for (int i = 0; i < n; i++)
+      mask[i] = (static_cast<float>(ranks[i]) + 0.5f) / static_cast<float>(n);
+   return mask;
+}
+
+const std::vector<float>& blueNoiseMask() {
+   static const std::vector<float> mask = generateBlueNoise(BLUE_NOISE_SIZE);
+   return mask;
+}
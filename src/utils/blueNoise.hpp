@@ -0,0 +1,18 @@
+#pragma once
+
+#ifndef BLUENOISE_HPP
+#define BLUENOISE_HPP
+
+#include <vector>
+
+// Tileable blue noise mask: every value of [0, 1) once per size x size tile, neighbours far
+// apart in value. Built with void and cluster (Ulichney 1993).
+// Row major, values (rank + 0.5) / size^2.
+std::vector<float> generateBlueNoise(int size, unsigned int seed = 1);
+
+// The BLUE_NOISE_SIZE mask of the blue noise sampler (see random.glsl), generated on first use
+const std::vector<float>& blueNoiseMask();
+
+constexpr int BLUE_NOISE_SIZE = 64;
+
+#endif //BLUENOISE_HPP
@@ -0,0 +1,23 @@
+#include "frameStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void FrameStats::push(float ms) {
+   times[next] = ms;
+   next = (next + 1) % CAPACITY;
+   count = std::min(count + 1, CAPACITY);
+}
+
+float FrameStats::percentile(float p) const {
+   if (count == 0)
+      return 0.0f;
+
+   std::array<float, CAPACITY> sorted;
+   std::copy(times.begin(), times.begin() + count, sorted.begin());
+   // Nearest rank
+   size_t rank = static_cast<size_t>(std::ceil(p * static_cast<float>(count)));
+   rank = std::clamp<size_t>(rank, 1, count) - 1;
+   std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.begin() + count);
+   return sorted[rank];
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#ifndef FRAMESTATS_HPP
+#define FRAMESTATS_HPP
+
+#include <array>
+#include <cstddef>
+
+// Ring buffer of the last frame times, for percentiles and ImGui::PlotLines
+class FrameStats {
+public:
+   static constexpr size_t CAPACITY = 240;
+
+   void push(float ms);
+
+   // p in [0, 1], over the frames in the buffer
+   [[nodiscard]] float percentile(float p) const;
+
+   [[nodiscard]] const float* data() const { return times.data(); }
+   [[nodiscard]] size_t size() const { return count; }
+   // Index of the oldest value, the values_offset of PlotLines
+   [[nodiscard]] int offset() const { return static_cast<int>(count < CAPACITY ? 0 : next); }
+
+private:
+   std::array<float, CAPACITY> times{};
+   size_t next = 0;
+   size_t count = 0;
+};
+
+#endif //FRAMESTATS_HPP
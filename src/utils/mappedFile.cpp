@@ -0,0 +1,73 @@
+#include "mappedFile.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+MappedFile::~MappedFile() {
+   close();
+}
+
+bool MappedFile::open(const std::string& path) {
+   close();
+#ifdef HAS_MMAP
+   const int fd = ::open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+   struct stat info{};
+   if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+      ::close(fd);
+      return false;
+   }
+   length = static_cast<size_t>(info.st_size);
+   // mmap refuses empty ranges, an empty file is an empty view
+   if (length > 0) {
+#ifdef MAP_POPULATE
+      // Fault every page in at once instead of one by one on the first reads
+      void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+      void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+      if (address == MAP_FAILED) {
+         ::close(fd);
+         length = 0;
+         return false;
+      }
+      bytes = static_cast<const char*>(address);
+      mapped = true;
+   }
+   // The mapping stays valid without the descriptor
+   ::close(fd);
+   return true;
+#else
+   std::ifstream file(path, std::ios::binary | std::ios::ate);
+   if (!file)
+      return false;
+   buffer.resize(static_cast<size_t>(file.tellg()));
+   file.seekg(0);
+   if (!file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+      buffer.clear();
+      return false;
+   }
+   bytes = buffer.data();
+   length = buffer.size();
+   return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifdef HAS_MMAP
+   if (mapped)
+      munmap(const_cast<char*>(bytes), length);
+#endif
+   bytes = nullptr;
+   length = 0;
+   mapped = false;
+   buffer.clear();
+}
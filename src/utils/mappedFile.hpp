@@ -0,0 +1,35 @@
+#pragma once
+
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file: mapped with mmap where available, read into memory otherwise.
+// Pages are only loaded when touched, parsers and uploads read them in place.
+class MappedFile {
+public:
+   MappedFile() = default;
+   ~MappedFile();
+
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+
+   // False when the file can't be opened or mapped, nothing is printed
+   bool open(const std::string& path);
+   void close();
+
+   [[nodiscard]] const char* data() const { return bytes; }
+   [[nodiscard]] size_t size() const { return length; }
+
+private:
+   const char* bytes = nullptr;
+   size_t length = 0;
+   bool mapped = false;
+   // Contents when mmap is not available
+   std::vector<char> buffer;
+};
+
+#endif //MAPPEDFILE_HPP
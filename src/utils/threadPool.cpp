@@ -0,0 +1,108 @@
+#include "threadPool.hpp"
+
+// Set on workers and on a caller while it helps with its own job
+static thread_local bool insideJob = false;
+static thread_local unsigned int workerIndex = 0;
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+   for (unsigned int i = 0; i < threadCount; i++) {
+      workers.emplace_back(&ThreadPool::workerLoop, this, i + 1);
+   }
+}
+
+ThreadPool::~ThreadPool() {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   wakeUp.notify_all();
+   for (std::thread& worker : workers) {
+      worker.join();
+   }
+}
+
+unsigned int ThreadPool::defaultThreadCount() {
+   unsigned int cores = std::thread::hardware_concurrency();
+   return cores > 1 ? cores - 1 : 0;
+}
+
+unsigned int ThreadPool::threadIndex() {
+   return workerIndex;
+}
+
+ThreadPool& ThreadPool::global() {
+   static ThreadPool pool;
+   return pool;
+}
+
+void ThreadPool::runJob() {
+   size_t done = 0;
+   for (size_t i = nextIndex.fetch_add(1); i < jobCount; i = nextIndex.fetch_add(1)) {
+      (*job)(i);
+      done++;
+   }
+   if (done > 0 && finished.fetch_add(done) + done == jobCount) {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobDone.notify_all();
+   }
+}
+
+void ThreadPool::workerLoop(unsigned int index) {
+   insideJob = true;
+   workerIndex = index;
+   unsigned long seenGeneration = 0;
+   while (true) {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         wakeUp.wait(lock, [&] { return stopping || generation != seenGeneration; });
+         if (stopping)
+            return;
+         seenGeneration = generation;
+         // Woke up after the caller already collected the job
+         if (!job)
+            continue;
+         activeWorkers++;
+      }
+
+      runJob();
+
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         activeWorkers--;
+      }
+      jobDone.notify_all();
+   }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& func) {
+   if (count == 0)
+      return;
+
+   if (insideJob || workers.empty() || count == 1) {
+      for (size_t i = 0; i < count; i++) {
+         func(i);
+      }
+      return;
+   }
+
+   // Only one job at a time, other callers wait their turn
+   std::lock_guard<std::mutex> callerLock(callerMutex);
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &func;
+      jobCount = count;
+      nextIndex = 0;
+      finished = 0;
+      generation++;
+   }
+   wakeUp.notify_all();
+
+   insideJob = true;
+   runJob();
+   insideJob = false;
+
+   // Wait for the last index and for every worker to leave the job before it goes out of scope
+   std::unique_lock<std::mutex> lock(mutex);
+   jobDone.wait(lock, [&] { return finished == jobCount && activeWorkers == 0; });
+   job = nullptr;
+}
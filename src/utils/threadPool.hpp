@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running parallel loops.
+// The calling thread takes part in the work, so a pool of N threads uses N+1 cores at most.
+class ThreadPool {
+public:
+   explicit ThreadPool(unsigned int threadCount = defaultThreadCount());
+   ~ThreadPool();
+
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+
+   // Call func(i) for every i in [0, count) and wait for all of them.
+   // Nested calls from inside a job run serially on the calling thread.
+   void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+   // Number of threads taking part in a parallelFor (workers + caller)
+   [[nodiscard]] unsigned int concurrency() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+   static unsigned int defaultThreadCount();
+
+   // 1 to N on the workers of a pool, 0 on any other thread. The threads of a parallel job have
+   // distinct indices in [0, concurrency()), so jobs can use it to pick per-thread scratch.
+   // A nested (serial) call may run on a worker of another pool, with any index.
+   static unsigned int threadIndex();
+
+   // Pool shared by the CPU renderer and the scene builders
+   static ThreadPool& global();
+
+private:
+   void workerLoop(unsigned int index);
+   void runJob();
+
+   std::vector<std::thread> workers;
+   std::mutex mutex;
+   std::condition_variable wakeUp;
+   std::condition_variable jobDone;
+
+   // Current job
+   const std::function<void(size_t)>* job = nullptr;
+   size_t jobCount = 0;
+   std::atomic<size_t> nextIndex{0};
+   std::atomic<size_t> finished{0};
+   unsigned int activeWorkers = 0;
+   unsigned long generation = 0;
+   bool stopping = false;
+   std::mutex callerMutex;
+};
+
+#endif //THREADPOOL_HPP
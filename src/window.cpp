@@ -1,6 +1,12 @@
 #include "window.hpp"
 
 #include <cstdio>
+#include <cstring>
+
+#ifdef RAYTRACER_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include "rendering/gladManager.hpp"
 
@@ -115,11 +121,139 @@ Window* windowInit(const std::string& title,int width,int height) {
    return &window;
 }
 
+#ifdef RAYTRACER_HAS_EGL
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+
+static bool hasEGLExtension(const char* extensions, const char* name) {
+   return extensions && strstr(extensions, name) != nullptr;
+}
+
+// Surfaceless EGL context (Mesa llvmpipe, NVIDIA headless, ...) with no window system at all
+static bool eglContextInit() {
+   const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   if (hasEGLExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+      auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+      if (getPlatformDisplay)
+         eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+   }
+   if (eglDisplay == EGL_NO_DISPLAY)
+      eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+   if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, nullptr, nullptr))
+      return false;
+
+   if (!eglBindAPI(EGL_OPENGL_API))
+      return false;
+
+   const EGLint configAttribs[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+      EGL_NONE
+   };
+   EGLConfig config;
+   EGLint configCount = 0;
+   if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &configCount) || configCount == 0)
+      return false;
+
+   const EGLint contextAttribs[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE
+   };
+   eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+   if (eglContext == EGL_NO_CONTEXT)
+      return false;
+
+   // Everything is drawn into our own framebuffers, a surface is only needed when the driver insists
+   if (!hasEGLExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+      const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+      eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+      if (eglSurface == EGL_NO_SURFACE)
+         return false;
+   }
+
+   return eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext) == EGL_TRUE;
+}
+
+static void eglContextClose() {
+   if (eglDisplay == EGL_NO_DISPLAY)
+      return;
+   eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   if (eglSurface != EGL_NO_SURFACE)
+      eglDestroySurface(eglDisplay, eglSurface);
+   if (eglContext != EGL_NO_CONTEXT)
+      eglDestroyContext(eglDisplay, eglContext);
+   eglTerminate(eglDisplay);
+   eglDisplay = EGL_NO_DISPLAY;
+   eglContext = EGL_NO_CONTEXT;
+   eglSurface = EGL_NO_SURFACE;
+}
+#endif
+
+Window* windowInitHeadless(const std::string& title,int width,int height) {
+   if (windowInitialized) {
+      fprintf(stderr, "Window already initialized\n");
+      exit(EXIT_FAILURE);
+   }
+   windowInitialized = 1;
+
+   window.window = nullptr;
+   window.title = title;
+   window.height = height;
+   window.width = width;
+   window.headless = true;
+
+#ifdef RAYTRACER_HAS_EGL
+   if (eglContextInit()) {
+      gladManager::init(reinterpret_cast<GLADloadproc>(eglGetProcAddress));
+      return &window;
+   }
+   fprintf(stderr, "EGL surfaceless context unavailable, falling back to OSMesa\n");
+   eglContextClose();
+#endif
+
+   // GLFW null platform: no display server needed, the context comes from OSMesa (llvmpipe)
+   glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+   if (!glfwInit()) {
+      fprintf(stderr, "Erreur: Impossible d'initialiser GLFW\n");
+      exit(EXIT_FAILURE);
+   }
+
+   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+   glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+   glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+   GLFWwindow* glfw_window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+   if (!glfw_window) {
+      fprintf(stderr, "Erreur: Impossible de créer un contexte OpenGL headless\n");
+      glfwTerminate();
+      exit(EXIT_FAILURE);
+   }
+   glfwMakeContextCurrent(glfw_window);
+   gladManager::init(glfw_window);
+
+   window.window = glfw_window;
+   return &window;
+}
+
 int windowShouldClose() {
    return glfwWindowShouldClose(window.window);
 }
 
 void windowClose() {
+   // A new window or context may be created afterwards
+   windowInitialized = 0;
+#ifdef RAYTRACER_HAS_EGL
+   if (window.headless && !window.window) {
+      eglContextClose();
+      return;
+   }
+#endif
    glfwDestroyWindow(window.window);
    glfwTerminate();
 }
\ No newline at end of file
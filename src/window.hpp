@@ -13,10 +13,15 @@ struct Window {
    GLFWwindow* window;
    std::string title;
    int width, height;
+   // No visible surface: rendering only goes to the gladManager framebuffers
+   bool headless = false;
 };
 
 struct Window* windowInit(const std::string& title,int width,int height);
 
+// Create an OpenGL context without any display (EGL surfaceless, or GLFW's null platform with OSMesa)
+struct Window* windowInitHeadless(const std::string& title,int width,int height);
+
 int windowShouldClose();
 
 void windowClose();